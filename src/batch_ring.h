@@ -0,0 +1,42 @@
+#ifndef BATCH_RING_H
+#define BATCH_RING_H
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Single-producer/single-consumer ring of batch indices, the hand-off between
+ * the stages of the render pipeline (render_pipeline.h). Holds up to
+ * Size - 1 entries. The producer fills a slot before publishing it with a
+ * release store of head, and the consumer's acquire load of head makes the
+ * slot, and everything written to the batch before it was pushed, visible.
+ */
+template <uint8_t Size>
+struct BatchRing {
+    std::atomic<uint8_t> head;
+    std::atomic<uint8_t> tail;
+    uint8_t slots[Size];
+
+    void reset() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer only; the caller makes sure the ring is not full
+    void push(uint8_t batch) {
+        uint8_t h = head.load(std::memory_order_relaxed);
+        slots[h] = batch;
+        head.store((h + 1) % Size, std::memory_order_release);
+    }
+
+    // Consumer only; false when empty
+    bool pop(uint8_t &batch) {
+        uint8_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        batch = slots[t];
+        tail.store((t + 1) % Size, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif
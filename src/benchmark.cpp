@@ -0,0 +1,945 @@
+// benchmark.cpp
+#include "benchmark.h"
+#include "image_utils.h"
+#include "pixel_kernel.h"
+#include "plane_rle.h"
+#include "bmp_decoder.h"
+#include "block_writer.h"
+#include "filesystem.h"
+#include "display.h"
+#include "panel_spi.h"
+#include "config.h"
+#include "debug.h"
+#include "esp_task_wdt.h"
+#include "esp_rom_crc.h"
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+
+PipelineTiming lastRenderTiming = {};
+
+static const char *stageNames[STAGE_COUNT] = {"read", "convert", "write", "spi"};
+
+const char *stageName(RenderStage stage) {
+    return stage < STAGE_COUNT ? stageNames[stage] : "unknown";
+}
+
+void resetPipelineTiming(PipelineTiming &timing) {
+    memset(&timing, 0, sizeof(timing));
+}
+
+void addStageTime(PipelineTiming &timing, RenderStage stage, uint32_t startMicros, uint32_t bytes) {
+    timing.stages[stage].micros += micros() - startMicros;
+    timing.stages[stage].bytes += bytes;
+}
+
+float stageNsPerPixel(const PipelineTiming &timing, RenderStage stage) {
+    if (timing.pixels == 0) return 0;
+    return timing.stages[stage].micros * 1000.0f / timing.pixels;
+}
+
+float stageMBps(const PipelineTiming &timing, RenderStage stage) {
+    if (timing.stages[stage].micros == 0) return 0;
+    // bytes per microsecond == MB/s
+    return (float) timing.stages[stage].bytes / timing.stages[stage].micros;
+}
+
+void printPipelineTiming(const PipelineTiming &timing) {
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        RenderStage stage = (RenderStage) s;
+        if (timing.stages[s].micros == 0) continue;
+        LOG_I("[TIMING] %s: %.1f ms, %.1f ns/px, %.2f MB/s", stageName(stage), timing.stages[s].micros / 1000.0f,
+              stageNsPerPixel(timing, stage), stageMBps(timing, stage));
+    }
+}
+
+// Baselines are kept per dither mode, and under "rle" for run-length images:
+// {"none": {"read": ns, "convert": ns}, ...}
+static void loadBaseline(JsonDocument &baseline) {
+    File f = LittleFS.open(BENCH_BASELINE_PATH, "r");
+    if (!f) return;
+    DeserializationError err = deserializeJson(baseline, f);
+    f.close();
+    if (err) {
+        debug.println("[BENCH] Ignoring unreadable baseline: " + String(err.c_str()));
+        baseline.clear();
+    }
+}
+
+static void saveBaseline(JsonDocument &baseline, const char *key, const PipelineTiming &timing) {
+    JsonObject entry = baseline[key].to<JsonObject>();
+    for (int s = STAGE_READ; s <= STAGE_CONVERT; s++) {
+        entry[stageName((RenderStage) s)] = stageNsPerPixel(timing, (RenderStage) s);
+    }
+    File f = LittleFS.open(BENCH_BASELINE_PATH, "w");
+    if (!f) {
+        debug.println("[BENCH] Error: Failed to write baseline");
+        return;
+    }
+    serializeJson(baseline, f);
+    f.close();
+    debug.println("[BENCH] Baseline saved to " + String(BENCH_BASELINE_PATH));
+}
+
+// One full pass over the file. The reference conversion is timed separately
+// and, without dithering, its planes compared with the kernel output.
+// Returns false on read error.
+static bool benchmarkPass(File &file, PipelineTiming &timing, PipelineTiming &reference,
+                          bool &identical, uint8_t *readBuffer, uint8_t *planeBuffers,
+                          uint16_t width, uint16_t height, DitherMode dither) {
+    const size_t rowSize = width * sizeof(uint16_t);
+    const size_t planeSize = (width / 8) * RENDER_BATCH_ROWS;
+    uint8_t *monoBuffer = planeBuffers;
+    uint8_t *colorBuffer = planeBuffers + planeSize;
+    uint8_t *refMonoBuffer = planeBuffers + 2 * planeSize;
+    uint8_t *refColorBuffer = planeBuffers + 3 * planeSize;
+
+    file.seek(0);
+    resetPipelineTiming(timing);
+    resetPipelineTiming(reference);
+    timing.pixels = reference.pixels = (uint32_t) width * height;
+
+    Rgb565Converter converter;
+    if (!converter.begin(width, dither)) return false;
+
+    for (uint16_t y = 0; y < height; ) {
+        uint16_t batchH = min(RENDER_BATCH_ROWS, (uint16_t)(height - y));
+        size_t batchReadSize = rowSize * batchH;
+
+        uint32_t t0 = micros();
+        size_t bytesRead = file.read(readBuffer, batchReadSize);
+        addStageTime(timing, STAGE_READ, t0, bytesRead);
+        if (bytesRead != batchReadSize) return false;
+
+        t0 = micros();
+        converter.convertRows(readBuffer, monoBuffer, colorBuffer, batchH);
+        addStageTime(timing, STAGE_CONVERT, t0, batchReadSize);
+
+        t0 = micros();
+        convertRgb565RowsReference(readBuffer, refMonoBuffer, refColorBuffer, width, batchH);
+        addStageTime(reference, STAGE_CONVERT, t0, batchReadSize);
+
+        size_t batchPlaneSize = (width / 8) * batchH;
+        if (dither == DITHER_NONE &&
+            (memcmp(monoBuffer, refMonoBuffer, batchPlaneSize) != 0 ||
+             memcmp(colorBuffer, refColorBuffer, batchPlaneSize) != 0)) {
+            identical = false;
+        }
+
+        esp_task_wdt_reset();
+        y += batchH;
+    }
+    return true;
+}
+
+static String errorReport(const char *message) {
+    JsonDocument report;
+    report["error"] = message;
+    String out;
+    serializeJson(report, out);
+    return out;
+}
+
+// Adds the read and convert stages of `best` to the report, checked against `modeBaseline`
+static void reportStages(JsonDocument &report, JsonObject modeBaseline, const PipelineTiming &best, bool &passed) {
+    for (int s = STAGE_READ; s <= STAGE_CONVERT; s++) {
+        RenderStage stage = (RenderStage) s;
+        JsonObject entry = report["stages"][stageName(stage)].to<JsonObject>();
+        float nsPerPixel = stageNsPerPixel(best, stage);
+        entry["ms"] = best.stages[s].micros / 1000.0f;
+        entry["nsPerPixel"] = nsPerPixel;
+        entry["MBps"] = stageMBps(best, stage);
+
+        if (modeBaseline[stageName(stage)].is<float>()) {
+            float reference = modeBaseline[stageName(stage)];
+            float limit = reference * (100 + BENCH_REGRESSION_TOLERANCE_PCT) / 100.0f;
+            bool stagePassed = nsPerPixel <= limit;
+            entry["baselineNsPerPixel"] = reference;
+            entry["passed"] = stagePassed;
+            if (!stagePassed) {
+                passed = false;
+                debug.println("[BENCH] REGRESSION: " + String(stageName(stage)) + " " +
+                              String(nsPerPixel, 1) + " ns/px > " + String(limit, 1));
+            }
+        }
+    }
+}
+
+// One full decode of a run-length image, band by band as drawRlePanelImageFromSpiffs does
+static bool benchmarkRlePass(File &file, const PanelImageHeader &header, PipelineTiming &timing,
+                             uint8_t *planeBuffer) {
+    const size_t rowBytes = header.width / 8;
+
+    file.seek(PANEL_IMAGE_HEADER_SIZE);
+    resetPipelineTiming(timing);
+    timing.pixels = (uint32_t) header.width * header.height;
+
+    PlaneRleReader reader;
+    if (!reader.begin(file, header.dataSize)) return false;
+
+    for (uint16_t y = 0; y < header.height; ) {
+        uint16_t bandH = min(header.bandRows, (uint16_t)(header.height - y));
+        if (!reader.read(planeBuffer, rowBytes * bandH, timing) ||
+            !reader.read(planeBuffer + rowBytes * bandH, rowBytes * bandH, timing)) {
+            return false;
+        }
+        esp_task_wdt_reset();
+        y += bandH;
+    }
+    return reader.finished();
+}
+
+static String runRleBenchmark(File &file, const char *filename, uint8_t iterations, bool saveAsBaseline,
+                              bool &passed) {
+    uint8_t headerData[PANEL_IMAGE_HEADER_SIZE];
+    PanelImageHeader header;
+    file.read(headerData, sizeof(headerData));
+    parsePanelImageHeader(headerData, header);
+
+    if (header.bandRows > RENDER_BATCH_ROWS) {
+        return errorReport("Run-length bands larger than the render batch");
+    }
+
+    uint8_t *planeBuffer = (uint8_t *) malloc(2 * (header.width / 8) * header.bandRows);
+    if (!planeBuffer) {
+        return errorReport("Failed to allocate buffers");
+    }
+
+    PipelineTiming best = {};
+    bool ok = true;
+    for (uint8_t i = 0; i < iterations && ok; i++) {
+        PipelineTiming pass;
+        ok = benchmarkRlePass(file, header, pass, planeBuffer);
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            if (i == 0 || pass.stages[s].micros < best.stages[s].micros) {
+                best.stages[s] = pass.stages[s];
+            }
+        }
+        best.pixels = pass.pixels;
+    }
+    free(planeBuffer);
+
+    if (!ok) {
+        return errorReport("Corrupt run-length data or read error");
+    }
+
+    JsonDocument baseline;
+    loadBaseline(baseline);
+
+    JsonDocument report;
+    passed = true;
+    report["file"] = filename;
+    report["format"] = imageFormatName(IMAGE_FORMAT_PLANES_RLE);
+    report["pixels"] = best.pixels;
+    report["iterations"] = iterations;
+    reportStages(report, baseline["rle"], best, passed);
+
+    uint32_t planesSize = panelPlanesDataSize(header.width, header.height);
+    report["compression"]["bytes"] = header.dataSize;
+    report["compression"]["planeBytes"] = planesSize;
+    report["compression"]["rgb565Bytes"] = (uint32_t) header.width * header.height * sizeof(uint16_t);
+    report["compression"]["ratio"] = (float) planesSize / header.dataSize;
+
+    if (saveAsBaseline) {
+        saveBaseline(baseline, "rle", best);
+        report["baselineSaved"] = true;
+    }
+    report["passed"] = passed;
+
+    String out;
+    serializeJson(report, out);
+    return out;
+}
+
+// Rows of the synthetic BMPs, a quarter of the panel so the 32 bit one fits next to image.bin
+static const uint16_t bench_bmp_rows = 96;
+
+// One frame through BmpDecoder, timed per stage as drawBmpImageFromSpiffs does, and through
+// the original per-pixel decoder, timed as a whole. Their planes are compared batch by batch.
+static bool benchmarkBmpPass(File &file, uint16_t width, uint16_t height, PipelineTiming &timing,
+                             uint32_t &referenceMicros, bool &identical, uint8_t *input, uint8_t *planeBuffers) {
+    const size_t rowBytes = width / 8;
+    const size_t planeSize = rowBytes * RENDER_BATCH_ROWS;
+    uint8_t *monoBuffer = planeBuffers;
+    uint8_t *colorBuffer = planeBuffers + planeSize;
+    uint8_t *refMonoBuffer = planeBuffers + 2 * planeSize;
+    uint8_t *refColorBuffer = planeBuffers + 3 * planeSize;
+
+    resetPipelineTiming(timing);
+    timing.pixels = (uint32_t) width * height;
+    referenceMicros = 0;
+
+    BmpDecoder decoder;
+    BmpReferenceDecoder reference;
+    uint32_t t0 = micros();
+    bool ok = decoder.begin(file, width, height);
+    addStageTime(timing, STAGE_READ, t0, 0);
+    t0 = micros();
+    ok = ok && reference.begin(file, width, height);
+    referenceMicros += micros() - t0;
+    if (!ok) return false;
+
+    for (uint16_t y = 0; y < height; ) {
+        uint16_t batchH = min(RENDER_BATCH_ROWS, (uint16_t)(height - y));
+        size_t bytesRead;
+
+        t0 = micros();
+        ok = decoder.readRows(y, batchH, input, bytesRead);
+        addStageTime(timing, STAGE_READ, t0, bytesRead);
+        if (!ok) return false;
+
+        t0 = micros();
+        decoder.convertRows(input, y, batchH, monoBuffer, colorBuffer);
+        addStageTime(timing, STAGE_CONVERT, t0, bytesRead);
+
+        t0 = micros();
+        for (uint16_t i = 0; i < batchH && ok; i++) {
+            ok = reference.readRow(y + i, refMonoBuffer + i * rowBytes, refColorBuffer + i * rowBytes, rowBytes);
+        }
+        referenceMicros += micros() - t0;
+        if (!ok) return false;
+
+        size_t batchPlaneSize = rowBytes * batchH;
+        if (memcmp(monoBuffer, refMonoBuffer, batchPlaneSize) != 0 ||
+            memcmp(colorBuffer, refColorBuffer, batchPlaneSize) != 0) {
+            identical = false;
+        }
+
+        esp_task_wdt_reset();
+        y += batchH;
+    }
+    return true;
+}
+
+// Fastest of `iterations` passes over a BMP file; false on a read error or an unsupported file
+static bool benchmarkBmp(File &file, uint16_t width, uint16_t height, uint8_t iterations,
+                         PipelineTiming &best, uint32_t &bestReference, bool &identical) {
+    uint8_t head[BMP_HEADER_PARSE_SIZE];
+    file.seek(0);
+    size_t headLen = file.read(head, sizeof(head));
+    BmpInfo info;
+    if (!parseBmpHeader(head, headLen, file.size(), info)) return false;
+
+    uint8_t *input = (uint8_t *) malloc(info.rowSize * RENDER_BATCH_ROWS);
+    // Kernel mono/color followed by reference mono/color
+    uint8_t *planeBuffers = (uint8_t *) malloc(4 * (width / 8) * RENDER_BATCH_ROWS);
+    bool ok = input && planeBuffers;
+
+    identical = true;
+    for (uint8_t i = 0; i < iterations && ok; i++) {
+        PipelineTiming pass;
+        uint32_t referenceMicros;
+        ok = benchmarkBmpPass(file, width, height, pass, referenceMicros, identical, input, planeBuffers);
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            if (i == 0 || pass.stages[s].micros < best.stages[s].micros) {
+                best.stages[s] = pass.stages[s];
+            }
+        }
+        if (i == 0 || referenceMicros < bestReference) bestReference = referenceMicros;
+        best.pixels = pass.pixels;
+    }
+
+    if (input) free(input);
+    if (planeBuffers) free(planeBuffers);
+    return ok;
+}
+
+// Original per-pixel decoder against read + convert of the batched one
+static void reportBmpReference(JsonObject out, const PipelineTiming &best, uint32_t bestReference, bool identical) {
+    uint32_t micros = best.stages[STAGE_READ].micros + best.stages[STAGE_CONVERT].micros;
+    out["ms"] = micros / 1000.0f;
+    out["nsPerPixel"] = best.pixels ? micros * 1000.0f / best.pixels : 0;
+    out["reference"]["ms"] = bestReference / 1000.0f;
+    out["reference"]["nsPerPixel"] = best.pixels ? bestReference * 1000.0f / best.pixels : 0;
+    if (micros > 0) {
+        out["reference"]["speedup"] = (float) bestReference / micros;
+    }
+    out["reference"]["identical"] = identical;
+}
+
+static String runBmpFileBenchmark(File &file, const char *filename, uint16_t width, uint16_t height,
+                                  uint8_t iterations, bool saveAsBaseline, bool &passed) {
+    PipelineTiming best = {};
+    uint32_t bestReference = 0;
+    bool identical = true;
+    if (!benchmarkBmp(file, width, height, iterations, best, bestReference, identical)) {
+        return errorReport("Unsupported BMP, read error or out of memory");
+    }
+
+    JsonDocument baseline;
+    loadBaseline(baseline);
+
+    JsonDocument report;
+    passed = identical;
+    report["file"] = filename;
+    report["format"] = imageFormatName(IMAGE_FORMAT_BMP);
+    report["pixels"] = best.pixels;
+    report["iterations"] = iterations;
+    reportStages(report, baseline["bmp"], best, passed);
+    reportBmpReference(report["total"].to<JsonObject>(), best, bestReference, identical);
+    if (!identical) {
+        debug.println("[BENCH] ERROR: BMP row kernels differ from the reference decoder");
+    }
+
+    if (saveAsBaseline) {
+        saveBaseline(baseline, "bmp", best);
+        report["baselineSaved"] = true;
+    }
+    report["passed"] = passed;
+
+    String out;
+    serializeJson(report, out);
+    return out;
+}
+
+String runImageBenchmark(const char *filename, uint16_t width, uint16_t height, DitherMode dither,
+                         uint8_t iterations, bool saveAsBaseline, bool &passed) {
+    passed = false;
+
+    String filePath = String("/") + filename;
+    File file = LittleFS.open(filePath, "r");
+    if (!file) {
+        return errorReport("File not found");
+    }
+
+    if (iterations == 0) iterations = 1;
+
+    uint8_t head[IMAGE_DETECT_HEAD_SIZE];
+    size_t headLen = file.read(head, sizeof(head));
+    ImageFormat format = detectImageFormat(head, headLen, file.size(), width, height);
+    if (format == IMAGE_FORMAT_PLANES_RLE) {
+        file.seek(0);
+        String report = runRleBenchmark(file, filename, iterations, saveAsBaseline, passed);
+        file.close();
+        return report;
+    }
+    if (format == IMAGE_FORMAT_BMP) {
+        String report = runBmpFileBenchmark(file, filename, width, height, iterations, saveAsBaseline, passed);
+        file.close();
+        return report;
+    }
+
+    if (file.size() != (size_t) width * height * sizeof(uint16_t)) {
+        file.close();
+        return errorReport("File is not a raw RGB565 image of the panel size");
+    }
+
+    const size_t rowBytes = width / 8;
+    const size_t rowSize = width * sizeof(uint16_t);
+    uint8_t *readBuffer = (uint8_t *) malloc(rowSize * RENDER_BATCH_ROWS);
+    // Kernel mono/color followed by reference mono/color
+    uint8_t *planeBuffers = (uint8_t *) malloc(4 * rowBytes * RENDER_BATCH_ROWS);
+
+    if (!readBuffer || !planeBuffers) {
+        if (readBuffer) free(readBuffer);
+        if (planeBuffers) free(planeBuffers);
+        file.close();
+        return errorReport("Failed to allocate buffers");
+    }
+
+    // Keep the fastest pass of each stage to filter out WiFi/flash cache noise
+    PipelineTiming best = {};
+    PipelineTiming bestReference = {};
+    bool identical = true;
+    bool ok = true;
+    for (uint8_t i = 0; i < iterations && ok; i++) {
+        PipelineTiming pass;
+        PipelineTiming reference;
+        ok = benchmarkPass(file, pass, reference, identical, readBuffer, planeBuffers, width, height, dither);
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            if (i == 0 || pass.stages[s].micros < best.stages[s].micros) {
+                best.stages[s] = pass.stages[s];
+            }
+            if (i == 0 || reference.stages[s].micros < bestReference.stages[s].micros) {
+                bestReference.stages[s] = reference.stages[s];
+            }
+        }
+        best.pixels = bestReference.pixels = pass.pixels;
+    }
+
+    free(planeBuffers);
+    free(readBuffer);
+    file.close();
+
+    if (!ok) {
+        return errorReport("Read error or out of memory");
+    }
+
+    JsonDocument baseline;
+    loadBaseline(baseline);
+
+    JsonDocument report;
+    passed = true;
+    report["file"] = filename;
+    report["pixels"] = best.pixels;
+    report["iterations"] = iterations;
+    report["dither"] = ditherModeName(dither);
+    reportStages(report, baseline[ditherModeName(dither)], best, passed);
+
+    // Original per-pixel conversion, for the kernel speedup and correctness check
+    JsonObject referenceEntry = report["reference"]["convert"].to<JsonObject>();
+    referenceEntry["ms"] = bestReference.stages[STAGE_CONVERT].micros / 1000.0f;
+    referenceEntry["nsPerPixel"] = stageNsPerPixel(bestReference, STAGE_CONVERT);
+    referenceEntry["MBps"] = stageMBps(bestReference, STAGE_CONVERT);
+    if (best.stages[STAGE_CONVERT].micros > 0) {
+        report["reference"]["speedup"] = (float) bestReference.stages[STAGE_CONVERT].micros /
+                                         best.stages[STAGE_CONVERT].micros;
+    }
+    if (dither == DITHER_NONE) {
+        report["reference"]["identical"] = identical;
+    }
+    if (!identical) {
+        passed = false;
+        debug.println("[BENCH] ERROR: Conversion kernel output differs from reference");
+    }
+
+    if (saveAsBaseline) {
+        saveBaseline(baseline, ditherModeName(dither), best);
+        report["baselineSaved"] = true;
+    }
+    report["passed"] = passed;
+
+    String out;
+    serializeJson(report, out);
+    return out;
+}
+
+static void putLE16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void putLE32(uint8_t *p, uint32_t v) {
+    putLE16(p, v & 0xFFFF);
+    putLE16(p + 2, v >> 16);
+}
+
+// Test pattern: diagonal gradients covering white, black and red pixels
+static void benchPatternColor(uint16_t x, uint16_t y, uint8_t &r, uint8_t &g, uint8_t &b) {
+    r = (x + y) & 0xFF;
+    g = (x * 3) & 0xFF;
+    b = (y * 5 + x) & 0xFF;
+}
+
+// Writes a width x bench_bmp_rows BMP in `format`. 565 uses BI_BITFIELDS and
+// 32 bit rows are stored top-down, so both header variants are covered.
+static bool writeBenchBmp(BmpPixelFormat format, uint16_t width) {
+    static const uint8_t depths[BMP_FORMAT_COUNT] = {1, 2, 4, 8, 16, 16, 24, 32};
+    const uint8_t depth = depths[format];
+    const uint16_t colors = depth <= 8 ? (1 << depth) : 0;
+    const bool bitfields = format == BMP_RGB565;
+    const bool topDown = format == BMP_BGRX32;
+    const uint32_t rowSize = ((uint32_t) width * depth + 31) / 32 * 4;
+    const size_t headerSize = bitfields ? BMP_HEADER_PARSE_SIZE : 54;
+    const uint32_t dataOffset = headerSize + 4 * colors;
+
+    File f = LittleFS.open(BENCH_BMP_PATH, "w");
+    if (!f) return false;
+
+    uint8_t header[BMP_HEADER_PARSE_SIZE] = {'B', 'M'};
+    putLE32(header + 2, dataOffset + rowSize * bench_bmp_rows);
+    putLE32(header + 10, dataOffset);
+    putLE32(header + 14, 40);
+    putLE32(header + 18, width);
+    putLE32(header + 22, topDown ? -(int32_t) bench_bmp_rows : bench_bmp_rows);
+    putLE16(header + 26, 1);
+    putLE16(header + 28, depth);
+    putLE32(header + 30, bitfields ? 3 : 0);
+    putLE32(header + 34, rowSize * bench_bmp_rows);
+    if (bitfields) {
+        putLE32(header + 54, 0xF800);
+        putLE32(header + 58, 0x07E0);
+        putLE32(header + 62, 0x001F);
+    }
+    bool ok = f.write(header, headerSize) == headerSize;
+
+    // Gray ramp palette with every fourth entry red
+    for (uint16_t i = 0; i < colors && ok; i++) {
+        uint8_t level = colors > 1 ? (i * 255) / (colors - 1) : 0;
+        uint8_t entry[4] = {level, level, level, 0};
+        if (depth > 1 && i % 4 == 3) {
+            entry[0] = entry[1] = 0;
+            entry[2] = 0xFF;
+        }
+        ok = f.write(entry, sizeof(entry)) == sizeof(entry);
+    }
+
+    uint8_t *row = (uint8_t *) malloc(rowSize);
+    ok = ok && row;
+    for (uint16_t i = 0; i < bench_bmp_rows && ok; i++) {
+        uint16_t y = topDown ? i : bench_bmp_rows - 1 - i;
+        memset(row, 0, rowSize);
+        for (uint16_t x = 0; x < width; x++) {
+            if (depth <= 8) {
+                uint8_t index = ((x >> 2) + (y >> 1)) & (colors - 1);
+                row[x * depth / 8] |= index << (8 - depth - (x * depth) % 8);
+                continue;
+            }
+            uint8_t r, g, b;
+            benchPatternColor(x, y, r, g, b);
+            if (format == BMP_RGB555) {
+                putLE16(row + 2 * x, ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3));
+            } else if (format == BMP_RGB565) {
+                putLE16(row + 2 * x, ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+            } else {
+                uint8_t *p = row + x * (depth / 8);
+                p[0] = b;
+                p[1] = g;
+                p[2] = r;
+            }
+        }
+        ok = f.write(row, rowSize) == rowSize;
+        esp_task_wdt_reset();
+    }
+
+    if (row) free(row);
+    f.close();
+    return ok;
+}
+
+String runBmpBenchmark(uint16_t width, uint8_t iterations, bool &passed) {
+    if (iterations == 0) iterations = 1;
+
+    JsonDocument report;
+    passed = true;
+    report["width"] = width;
+    report["height"] = bench_bmp_rows;
+    report["iterations"] = iterations;
+    JsonArray results = report["formats"].to<JsonArray>();
+
+    for (int format = 0; format < BMP_FORMAT_COUNT; format++) {
+        JsonObject entry = results.add<JsonObject>();
+        entry["format"] = bmpPixelFormatName((BmpPixelFormat) format);
+
+        PipelineTiming best = {};
+        uint32_t bestReference = 0;
+        bool identical = true;
+        bool ok = writeBenchBmp((BmpPixelFormat) format, width);
+        File file = ok ? LittleFS.open(BENCH_BMP_PATH, "r") : File();
+        ok = ok && file;
+        if (ok) {
+            entry["bytes"] = file.size();
+            ok = benchmarkBmp(file, width, bench_bmp_rows, iterations, best, bestReference, identical);
+            file.close();
+        }
+        LittleFS.remove(BENCH_BMP_PATH);
+
+        if (!ok) {
+            entry["error"] = "Cannot write or decode the test image";
+            passed = false;
+            continue;
+        }
+
+        JsonObject stages = entry["stages"].to<JsonObject>();
+        for (int s = STAGE_READ; s <= STAGE_CONVERT; s++) {
+            stages[stageName((RenderStage) s)] = stageNsPerPixel(best, (RenderStage) s);
+        }
+        reportBmpReference(entry, best, bestReference, identical);
+        if (!identical) {
+            passed = false;
+            debug.println("[BENCH] ERROR: " + String(bmpPixelFormatName((BmpPixelFormat) format)) +
+                          " row kernel differs from the reference decoder");
+        }
+    }
+    report["passed"] = passed;
+
+    String out;
+    serializeJson(report, out);
+    return out;
+}
+
+// Largest chunk replayed; AsyncTCP chunks are at most a few TCP segments
+static const size_t bench_upload_chunk_max = 8192;
+
+// Chunk sizes as AsyncTCP delivers them: full segments, and a mix of odd sizes
+static const uint16_t bench_segment_chunks[] = {1436};
+static const uint16_t bench_mixed_chunks[] = {1436, 536, 2872, 1072, 5744, 733, 64, 2920};
+
+struct UploadPassResult {
+    uint32_t micros;
+    uint32_t writes;
+    uint32_t programmed;  // flashProgramBytes() of the writes
+    uint32_t crc;         // CRC-32 of the file read back
+};
+
+// Byte `offset` of the synthetic upload
+static inline uint8_t benchUploadByte(uint32_t offset) {
+    return (offset * 31 + (offset >> 8)) & 0xFF;
+}
+
+// Writes `bytes` bytes in chunks of `sizes` (repeated), one write per chunk or
+// through a BlockWriter, timing only the writes and the final flush and close
+static bool benchmarkUploadPass(const uint16_t *sizes, size_t count, uint32_t bytes, bool coalesce,
+                                uint8_t *chunk, UploadPassResult &result) {
+    static BlockWriter writer;
+    File f = LittleFS.open(BENCH_UPLOAD_PATH, "w");
+    if (!f) return false;
+    if (coalesce && !writer.begin(f)) {
+        f.close();
+        return false;
+    }
+
+    bool ok = true;
+    result.micros = 0;
+    result.writes = 0;
+    result.programmed = 0;
+    uint32_t offset = 0;
+    for (size_t i = 0; offset < bytes && ok; i++) {
+        size_t len = min((uint32_t) min((size_t) sizes[i % count], bench_upload_chunk_max), bytes - offset);
+        for (size_t j = 0; j < len; j++) {
+            chunk[j] = benchUploadByte(offset + j);
+        }
+
+        uint32_t t0 = micros();
+        if (coalesce) {
+            ok = writer.write(chunk, len);
+        } else {
+            ok = f.write(chunk, len) == len;
+            result.writes++;
+            result.programmed += flashProgramBytes(offset, len);
+        }
+        result.micros += micros() - t0;
+        offset += len;
+        if (i % 64 == 0) esp_task_wdt_reset();
+    }
+
+    uint32_t t0 = micros();
+    if (coalesce) {
+        ok = writer.flush() && ok;
+        result.writes = writer.writeCalls();
+        result.programmed = writer.programmedBytes();
+    }
+    f.close();
+    result.micros += micros() - t0;
+    if (!ok) return false;
+
+    f = LittleFS.open(BENCH_UPLOAD_PATH, "r");
+    if (!f) return false;
+    result.crc = 0;
+    size_t n;
+    while ((n = f.read(chunk, bench_upload_chunk_max)) > 0) {
+        result.crc = esp_rom_crc32_le(result.crc, chunk, n);
+    }
+    ok = f.size() == bytes;
+    f.close();
+    return ok;
+}
+
+static void reportUploadPass(JsonObject out, const UploadPassResult &result, uint32_t bytes) {
+    out["ms"] = result.micros / 1000.0f;
+    out["MBps"] = result.micros ? (float) bytes / result.micros : 0;
+    out["writes"] = result.writes;
+    // Estimated flash programmed per byte received
+    out["programmed"] = result.programmed;
+    out["amplification"] = bytes ? (float) result.programmed / bytes : 0;
+}
+
+String runUploadBenchmark(uint32_t bytes, uint8_t iterations, bool &passed) {
+    if (iterations == 0) iterations = 1;
+    passed = false;
+
+    size_t freeBytes = LittleFS.totalBytes() - LittleFS.usedBytes();
+    if (bytes == 0 || freeBytes < bytes + 8192) {
+        return errorReport("Not enough free space for the test file");
+    }
+
+    static uint16_t lastUpload[UPLOAD_CHUNK_TRACE_SIZE];
+    size_t lastUploadCount = getUploadChunkSizes(lastUpload, UPLOAD_CHUNK_TRACE_SIZE);
+    struct {
+        const char *name;
+        const uint16_t *sizes;
+        size_t count;
+    } traces[] = {
+        {"last_upload", lastUpload, lastUploadCount},
+        {"segments", bench_segment_chunks, sizeof(bench_segment_chunks) / sizeof(bench_segment_chunks[0])},
+        {"mixed", bench_mixed_chunks, sizeof(bench_mixed_chunks) / sizeof(bench_mixed_chunks[0])},
+    };
+
+    uint8_t *chunk = (uint8_t *) malloc(bench_upload_chunk_max);
+    if (!chunk) return errorReport("Failed to allocate buffers");
+
+    uint32_t expectedCrc = 0;
+    for (uint32_t offset = 0; offset < bytes; offset += bench_upload_chunk_max) {
+        size_t len = min(bench_upload_chunk_max, (size_t) (bytes - offset));
+        for (size_t j = 0; j < len; j++) {
+            chunk[j] = benchUploadByte(offset + j);
+        }
+        expectedCrc = esp_rom_crc32_le(expectedCrc, chunk, len);
+    }
+
+    JsonDocument report;
+    passed = true;
+    report["bytes"] = bytes;
+    report["blockSize"] = UPLOAD_WRITE_BLOCK_SIZE;
+    report["programSize"] = FLASH_PROGRAM_SIZE;
+    report["iterations"] = iterations;
+    JsonArray results = report["traces"].to<JsonArray>();
+
+    for (auto &trace : traces) {
+        if (trace.count == 0) continue;
+        JsonObject entry = results.add<JsonObject>();
+        entry["trace"] = trace.name;
+        entry["chunks"] = trace.count;
+
+        // Best of `iterations` for both write paths, interleaved so flash wear state is shared
+        UploadPassResult best[2] = {};
+        bool ok = true;
+        bool identical = true;
+        for (uint8_t i = 0; i < iterations && ok; i++) {
+            for (int coalesce = 0; coalesce < 2 && ok; coalesce++) {
+                UploadPassResult result;
+                ok = benchmarkUploadPass(trace.sizes, trace.count, bytes, coalesce, chunk, result);
+                if (!ok) break;
+                identical = identical && result.crc == expectedCrc;
+                if (i == 0 || result.micros < best[coalesce].micros) best[coalesce] = result;
+            }
+        }
+        LittleFS.remove(BENCH_UPLOAD_PATH);
+
+        if (!ok) {
+            entry["error"] = "Cannot write the test file";
+            passed = false;
+            continue;
+        }
+        reportUploadPass(entry["direct"].to<JsonObject>(), best[0], bytes);
+        reportUploadPass(entry["coalesced"].to<JsonObject>(), best[1], bytes);
+        if (best[1].micros > 0) {
+            entry["speedup"] = (float) best[0].micros / best[1].micros;
+        }
+        entry["identical"] = identical;
+        if (!identical) {
+            passed = false;
+            debug.println("[BENCH] ERROR: " + String(trace.name) + " upload file differs from the data written");
+        }
+    }
+    free(chunk);
+    report["passed"] = passed;
+
+    String out;
+    serializeJson(report, out);
+    return out;
+}
+
+// Clocks the ESP32 SPI peripheral can derive from 80 MHz that are worth trying
+static const uint32_t bench_spi_clocks[] = {4000000, 8000000, 10000000, 16000000, 20000000, 26666666, 40000000};
+
+String runPanelSpiBenchmark(uint8_t iterations, bool &passed) {
+    if (iterations == 0) iterations = 1;
+    passed = false;
+    if (!lockDisplay(1000)) {
+        return errorReport("Display busy");
+    }
+
+    const uint32_t frameBytes = (uint32_t) PanelDriver::WIDTH * PanelDriver::HEIGHT / 2;
+    JsonDocument report;
+    report["clockHz"] = panelSpiClock();
+    report["maxHz"] = PANEL_SPI_MAX_HZ;
+    report["frameBytes"] = frameBytes;
+    JsonArray list = report["clocks"].to<JsonArray>();
+
+    bool measured = false;
+    for (uint32_t hz : bench_spi_clocks) {
+        if (hz > PANEL_SPI_MAX_HZ) break;
+
+        uint32_t best = UINT32_MAX;
+        for (uint8_t i = 0; i < iterations; i++) {
+            uint32_t elapsed = timePanelSpiFrame(hz);
+            esp_task_wdt_reset();
+            if (elapsed == 0) break;
+            if (elapsed < best) best = elapsed;
+        }
+        if (best == UINT32_MAX) break;
+
+        measured = true;
+        JsonObject entry = list.add<JsonObject>();
+        entry["hz"] = hz;
+        entry["ms"] = best / 1000.0f;
+        entry["MBps"] = frameBytes / (float) best;
+        // Share of the time spent clocking data; the rest is band commands and FIFO refills
+        entry["busyPct"] = 100.0f * (frameBytes * 8.0f * 1000000.0f / hz) / best;
+    }
+
+    // Controller RAM now holds the white test frame
+    invalidatePanelCache();
+    unlockDisplay();
+
+    if (!measured) {
+        return errorReport("Bulk SPI writes not available");
+    }
+    passed = true;
+    String out;
+    serializeJson(report, out);
+    return out;
+}
+
+static const uint32_t bench_task_stack = 8192;
+
+// The report is written by the benchmark task while the state is
+// BENCH_RUNNING and read by the AsyncTCP task once it is BENCH_DONE
+static BenchmarkRequest benchRequest;
+static BenchmarkState benchState = BENCH_NONE;
+static uint32_t benchId = 0;
+static String benchReport;
+static bool benchPassed = false;
+static portMUX_TYPE benchLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void benchmarkTask(void *parameter) {
+    bool passed = false;
+    String report;
+    switch (benchRequest.kind) {
+        case BENCH_BMP:
+            report = runBmpBenchmark(DISPLAY_WIDTH, benchRequest.iterations, passed);
+            break;
+        case BENCH_UPLOAD:
+            report = runUploadBenchmark(benchRequest.bytes, benchRequest.iterations, passed);
+            break;
+        case BENCH_SPI:
+            report = runPanelSpiBenchmark(benchRequest.iterations, passed);
+            break;
+        default:
+            report = runImageBenchmark(benchRequest.file, DISPLAY_WIDTH, DISPLAY_HEIGHT, benchRequest.dither,
+                                       benchRequest.iterations, benchRequest.save, passed);
+            break;
+    }
+    LOG_I("[BENCH] Benchmark %u %s", (unsigned) benchId, passed ? "passed" : "failed");
+
+    benchReport = report;
+    benchPassed = passed;
+    portENTER_CRITICAL(&benchLock);
+    benchState = BENCH_DONE;
+    portEXIT_CRITICAL(&benchLock);
+    vTaskDelete(NULL);
+}
+
+uint32_t startBenchmark(const BenchmarkRequest &request) {
+    portENTER_CRITICAL(&benchLock);
+    bool running = benchState == BENCH_RUNNING;
+    if (!running) benchState = BENCH_RUNNING;
+    portEXIT_CRITICAL(&benchLock);
+    if (running) return 0;
+
+    benchRequest = request;
+    benchReport = String();
+    benchPassed = false;
+    benchId++;
+    // Same core and priority as the render task, well below AsyncTCP, which keeps serving requests
+    if (xTaskCreatePinnedToCore(benchmarkTask, "bench", bench_task_stack, NULL, 1, NULL, 1) != pdPASS) {
+        LOG_E("[BENCH] Failed to start the benchmark task");
+        portENTER_CRITICAL(&benchLock);
+        benchState = BENCH_NONE;
+        portEXIT_CRITICAL(&benchLock);
+        return 0;
+    }
+    return benchId;
+}
+
+BenchmarkState benchmarkResult(uint32_t &id, String &report, bool &passed) {
+    portENTER_CRITICAL(&benchLock);
+    BenchmarkState state = benchState;
+    portEXIT_CRITICAL(&benchLock);
+    id = benchId;
+    if (state == BENCH_DONE) {
+        report = benchReport;
+        passed = benchPassed;
+    }
+    return state;
+}
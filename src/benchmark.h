@@ -0,0 +1,118 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <Arduino.h>
+#include "dither.h"
+
+// Stages of the raw image pipeline, timed separately
+enum RenderStage {
+    STAGE_READ,
+    STAGE_CONVERT,
+    STAGE_WRITE,
+    STAGE_SPI,      // bands on the wire, overlapping the other stages
+    STAGE_COUNT
+};
+
+struct StageTiming {
+    uint32_t micros;
+    uint32_t bytes;
+};
+
+struct PipelineTiming {
+    StageTiming stages[STAGE_COUNT];
+    uint32_t pixels;
+};
+
+// Timing of the last image render
+extern PipelineTiming lastRenderTiming;
+
+const char *stageName(RenderStage stage);
+
+void resetPipelineTiming(PipelineTiming &timing);
+void addStageTime(PipelineTiming &timing, RenderStage stage, uint32_t startMicros, uint32_t bytes);
+
+float stageNsPerPixel(const PipelineTiming &timing, RenderStage stage);
+float stageMBps(const PipelineTiming &timing, RenderStage stage);
+
+void printPipelineTiming(const PipelineTiming &timing);
+
+/**
+ * Runs the read and convert stages of the raw RGB565 pipeline against a file
+ * on LittleFS without touching the display, and compares each stage against
+ * the baseline stored in BENCH_BASELINE_PATH for the same dither mode.
+ * Run-length panel images are decoded instead (the convert stage is the
+ * decode) and the report adds their compression ratio. BMP files are decoded
+ * with the batched row kernels and with the original per-pixel decoder, and
+ * the report adds the speedup and whether both produced identical planes.
+ * Returns a JSON report; `passed` is false when a stage regressed past
+ * BENCH_REGRESSION_TOLERANCE_PCT.
+ */
+String runImageBenchmark(const char *filename, uint16_t width, uint16_t height, DitherMode dither,
+                         uint8_t iterations, bool saveBaseline, bool &passed);
+
+/**
+ * Writes a synthetic BMP of each supported depth and format (1/2/4/8 bit
+ * palette, 555, 565, 24 and 32 bit) to BENCH_BMP_PATH in turn, and compares
+ * the batched decoder with the original per-pixel decoder on each.
+ * `passed` is false when any of them differs from the reference.
+ */
+String runBmpBenchmark(uint16_t width, uint8_t iterations, bool &passed);
+
+/**
+ * Replays upload chunk-size traces against BENCH_UPLOAD_PATH: the chunk sizes
+ * of the last upload (if any), full TCP segments, and a mix of odd sizes.
+ * Each trace writes `bytes` bytes with one write per chunk, as AsyncTCP
+ * delivers them, and through a BlockWriter, and reports MB/s and the number
+ * of writes handed to LittleFS for both. `passed` is false when a write fails
+ * or a file read back differs from the data written.
+ */
+String runUploadBenchmark(uint32_t bytes, uint8_t iterations, bool &passed);
+
+/**
+ * Times a full frame of bulk panel writes at each SPI clock up to
+ * PANEL_SPI_MAX_HZ and reports MB/s and how much of the time the bus was
+ * clocking data. The controller cannot be read back, so whether a clock is
+ * stable has to be checked on the glass with a render at that clock.
+ * Overwrites controller RAM without a refresh. `passed` is false when the
+ * display is busy or the bulk path is not available.
+ */
+String runPanelSpiBenchmark(uint8_t iterations, bool &passed);
+
+enum BenchmarkKind : uint8_t {
+    BENCH_IMAGE,   // runImageBenchmark
+    BENCH_BMP,     // runBmpBenchmark
+    BENCH_UPLOAD,  // runUploadBenchmark
+    BENCH_SPI      // runPanelSpiBenchmark
+};
+
+struct BenchmarkRequest {
+    BenchmarkKind kind;
+    char file[64];        // BENCH_IMAGE
+    DitherMode dither;    // BENCH_IMAGE
+    bool save;            // BENCH_IMAGE
+    uint32_t bytes;       // BENCH_UPLOAD
+    uint8_t iterations;
+};
+
+enum BenchmarkState : uint8_t {
+    BENCH_NONE,     // nothing run since boot
+    BENCH_RUNNING,
+    BENCH_DONE
+};
+
+/**
+ * Runs a benchmark in a task of its own, since some of them take seconds or
+ * wait for the display, and returns its ID. Returns 0 when a benchmark is
+ * already running or the task could not be started.
+ * Call from the AsyncTCP task only, like benchmarkResult(): the report of the
+ * previous run is dropped here.
+ */
+uint32_t startBenchmark(const BenchmarkRequest &request);
+
+/**
+ * State and ID of the last benchmark started. When it is done, `report` and
+ * `passed` are set to what the run*Benchmark() function returned.
+ */
+BenchmarkState benchmarkResult(uint32_t &id, String &report, bool &passed);
+
+#endif
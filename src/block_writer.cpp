@@ -0,0 +1,71 @@
+#include "block_writer.h"
+#include "esp_rom_crc.h"
+#include "trace.h"
+
+BlockWriter::BlockWriter()
+    : file(nullptr), buffer(nullptr), blockSize(0), fill(0), written(0), programmed(0), crc(0), writes(0), failed(false) {}
+
+BlockWriter::~BlockWriter() {
+    free(buffer);
+}
+
+bool BlockWriter::begin(fs::File &f, size_t size) {
+    if (buffer && blockSize != size) {
+        free(buffer);
+        buffer = nullptr;
+    }
+    if (!buffer) {
+        buffer = (uint8_t *) malloc(size);
+    }
+    file = &f;
+    blockSize = size;
+    fill = 0;
+    written = 0;
+    programmed = 0;
+    crc = 0;
+    writes = 0;
+    failed = !buffer;
+    return buffer != nullptr;
+}
+
+bool BlockWriter::commit(const uint8_t *data, size_t len) {
+    TraceScope trace(SPAN_FS_WRITE, len);
+    size_t n = file->write(data, len);
+    crc = esp_rom_crc32_le(crc, data, n);
+    programmed += flashProgramBytes(written, n);
+    written += n;
+    writes++;
+    if (n != len) failed = true;
+    return !failed;
+}
+
+bool BlockWriter::write(const uint8_t *data, size_t len) {
+    while (len > 0 && !failed) {
+        if (fill == 0 && len >= blockSize) {
+            size_t n = len - len % blockSize;
+            commit(data, n);
+            data += n;
+            len -= n;
+            continue;
+        }
+
+        size_t n = min(len, blockSize - fill);
+        memcpy(buffer + fill, data, n);
+        fill += n;
+        data += n;
+        len -= n;
+        if (fill == blockSize) {
+            commit(buffer, blockSize);
+            fill = 0;
+        }
+    }
+    return !failed;
+}
+
+bool BlockWriter::flush() {
+    if (fill > 0 && !failed) {
+        commit(buffer, fill);
+        fill = 0;
+    }
+    return !failed;
+}
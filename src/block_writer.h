@@ -0,0 +1,70 @@
+#ifndef BLOCK_WRITER_H
+#define BLOCK_WRITER_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Upload writes are gathered into blocks of this size, the LittleFS block size
+#ifndef UPLOAD_WRITE_BLOCK_SIZE
+#define UPLOAD_WRITE_BLOCK_SIZE 4096
+#endif
+
+// Smallest unit the flash is programmed in, the page of the ESP32 SPI flash
+#ifndef FLASH_PROGRAM_SIZE
+#define FLASH_PROGRAM_SIZE 256
+#endif
+
+/**
+ * Estimate of the flash programmed by a write of `len` bytes at file offset
+ * `offset`: every program unit the write touches counts in full, so a unit
+ * split between two writes is programmed twice. Compare with the bytes
+ * received for the write amplification of an upload.
+ */
+static inline uint32_t flashProgramBytes(uint32_t offset, size_t len) {
+    if (len == 0) return 0;
+    uint32_t first = offset / FLASH_PROGRAM_SIZE;
+    uint32_t last = (offset + len - 1) / FLASH_PROGRAM_SIZE;
+    return (last - first + 1) * FLASH_PROGRAM_SIZE;
+}
+
+/**
+ * Gathers writes of any size into whole blocks, so LittleFS sees block-aligned
+ * writes instead of the odd chunk sizes AsyncTCP delivers. Chunks that start on
+ * a block boundary and span whole blocks are written straight from the caller's
+ * data; the rest is copied into the block buffer. A CRC-32 of the bytes the
+ * file accepted is kept as they are written, to verify the upload without
+ * reading it back. Offsets are counted from where the file was at begin().
+ */
+class BlockWriter {
+private:
+    fs::File *file;
+    uint8_t *buffer;
+    size_t blockSize;
+    size_t fill;
+    size_t written;
+    uint32_t programmed;
+    uint32_t crc;
+    uint32_t writes;
+    bool failed;
+
+    bool commit(const uint8_t *data, size_t len);
+
+public:
+    BlockWriter();
+    ~BlockWriter();
+
+    // The block buffer is allocated once and kept for later files of the same block size
+    bool begin(fs::File &file, size_t blockSize = UPLOAD_WRITE_BLOCK_SIZE);
+    bool write(const uint8_t *data, size_t len);
+    // Writes the last partial block; call before closing the file
+    bool flush();
+
+    bool ok() const { return !failed; }
+    size_t bytesWritten() const { return written; }
+    uint32_t writtenCrc() const { return crc; }
+    uint32_t writeCalls() const { return writes; }
+    // flashProgramBytes() summed over the writes
+    uint32_t programmedBytes() const { return programmed; }
+};
+
+#endif
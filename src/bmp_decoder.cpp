@@ -0,0 +1,509 @@
+// bmp_decoder.cpp
+#include "bmp_decoder.h"
+#include "pixel_kernel.h"
+
+static const uint32_t bmp_compression_rgb = 0;
+static const uint32_t bmp_compression_bitfields = 3;
+static const uint16_t bmp_max_palette_colors = 256;
+// File header, the largest info header (BITMAPV5HEADER) and a full palette
+static const size_t bmp_header_read_size = 14 + 124 + 4 * bmp_max_palette_colors;
+
+static uint16_t getLE16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t getLE32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+const char *bmpPixelFormatName(BmpPixelFormat format) {
+    switch (format) {
+        case BMP_INDEXED_1:
+            return "1bpp";
+        case BMP_INDEXED_2:
+            return "2bpp";
+        case BMP_INDEXED_4:
+            return "4bpp";
+        case BMP_INDEXED_8:
+            return "8bpp";
+        case BMP_RGB555:
+            return "rgb555";
+        case BMP_RGB565:
+            return "rgb565";
+        case BMP_BGR24:
+            return "bgr24";
+        case BMP_BGRX32:
+            return "bgrx32";
+        default:
+            return "unknown";
+    }
+}
+
+bool parseBmpHeader(const uint8_t *head, size_t headLen, size_t fileSize, BmpInfo &info) {
+    if (headLen < 54 || head[0] != 'B' || head[1] != 'M') return false;
+
+    uint32_t dataOffset = getLE32(head + 10);
+    uint32_t headerSize = getLE32(head + 14);
+    int32_t width = (int32_t) getLE32(head + 18);
+    int32_t height = (int32_t) getLE32(head + 22);
+    uint16_t planes = getLE16(head + 26);
+    uint16_t depth = getLE16(head + 28);
+    uint32_t compression = getLE32(head + 30);
+    uint32_t colorsUsed = getLE32(head + 46);
+
+    if (headerSize < 40 || planes != 1) return false;
+    if (width <= 0 || width > 0xFFFF || height == 0 || height > 0xFFFF || height < -0xFFFF) return false;
+
+    switch (depth) {
+        case 1:
+            info.format = BMP_INDEXED_1;
+            break;
+        case 2:
+            info.format = BMP_INDEXED_2;
+            break;
+        case 4:
+            info.format = BMP_INDEXED_4;
+            break;
+        case 8:
+            info.format = BMP_INDEXED_8;
+            break;
+        case 16:
+            info.format = BMP_RGB555;
+            break;
+        case 24:
+            info.format = BMP_BGR24;
+            break;
+        case 32:
+            info.format = BMP_BGRX32;
+            break;
+        default:
+            return false;
+    }
+
+    if (compression == bmp_compression_bitfields) {
+        // Masks follow a BITMAPINFOHEADER, or are part of the V4/V5 headers, at the same offset
+        if (headLen < BMP_HEADER_PARSE_SIZE) return false;
+        uint32_t redMask = getLE32(head + 54);
+        uint32_t greenMask = getLE32(head + 58);
+        uint32_t blueMask = getLE32(head + 62);
+        if (depth == 16 && redMask == 0x7C00 && greenMask == 0x03E0 && blueMask == 0x001F) {
+            info.format = BMP_RGB555;
+        } else if (depth == 16 && redMask == 0xF800 && greenMask == 0x07E0 && blueMask == 0x001F) {
+            info.format = BMP_RGB565;
+        } else if (!(depth == 32 && redMask == 0xFF0000 && greenMask == 0xFF00 && blueMask == 0xFF)) {
+            return false;
+        }
+    } else if (compression != bmp_compression_rgb) {
+        return false;
+    }
+
+    info.dataOffset = dataOffset;
+    info.width = width;
+    info.height = height < 0 ? -height : height;
+    info.bottomUp = height > 0;
+    info.depth = depth;
+    info.rowSize = ((uint32_t) width * depth + 31) / 32 * 4;
+    info.paletteOffset = 14 + headerSize;
+    info.paletteColors = 0;
+
+    if (depth <= 8) {
+        uint32_t colors = colorsUsed ? colorsUsed : (1UL << depth);
+        if (colors > (1UL << depth) || info.paletteOffset + 4 * colors > dataOffset) return false;
+        info.paletteColors = colors;
+    }
+
+    return (uint64_t) dataOffset + (uint64_t) info.rowSize * info.height <= fileSize;
+}
+
+// Same thresholds as the original decoder drawing with color
+static inline uint8_t classifyBmpRgb(uint8_t r, uint8_t g, uint8_t b) {
+    if (r > 0x80 && g > 0x80 && b > 0x80) return PIXEL_WHITE;
+    if (r > 0xF0 || (g > 0xF0 && b > 0xF0)) return PIXEL_COLOR;
+    return PIXEL_BLACK;
+}
+
+template <uint8_t Depth>
+static inline uint8_t indexedPixelClass(const uint8_t *row, uint16_t x, const uint8_t *classes) {
+    const uint8_t perByte = 8 / Depth;
+    const uint8_t shift = 8 - Depth - (x % perByte) * Depth;
+    return classes[(row[x / perByte] >> shift) & ((1 << Depth) - 1)];
+}
+
+template <BmpPixelFormat Format>
+static inline uint8_t bmpPixelClass(const uint8_t *row, uint16_t x, const uint8_t *classes) {
+    if constexpr (Format == BMP_INDEXED_1) {
+        return indexedPixelClass<1>(row, x, classes);
+    } else if constexpr (Format == BMP_INDEXED_2) {
+        return indexedPixelClass<2>(row, x, classes);
+    } else if constexpr (Format == BMP_INDEXED_4) {
+        return indexedPixelClass<4>(row, x, classes);
+    } else if constexpr (Format == BMP_INDEXED_8) {
+        return classes[row[x]];
+    } else if constexpr (Format == BMP_RGB555) {
+        uint8_t lsb = row[2 * x];
+        uint8_t msb = row[2 * x + 1];
+        return classifyBmpRgb((msb & 0x7C) << 1, ((msb & 0x03) << 6) | ((lsb & 0xE0) >> 2), (lsb & 0x1F) << 3);
+    } else if constexpr (Format == BMP_RGB565) {
+        uint8_t lsb = row[2 * x];
+        uint8_t msb = row[2 * x + 1];
+        return classifyBmpRgb(msb & 0xF8, ((msb & 0x07) << 5) | ((lsb & 0xE0) >> 3), (lsb & 0x1F) << 3);
+    } else if constexpr (Format == BMP_BGR24) {
+        const uint8_t *p = row + 3 * x;
+        return classifyBmpRgb(p[2], p[1], p[0]);
+    } else {
+        const uint8_t *p = row + 4 * x;
+        return classifyBmpRgb(p[2], p[1], p[0]);
+    }
+}
+
+// Whole output bytes of 8 pixels, then a partial byte padded with white
+template <BmpPixelFormat Format>
+static void convertBmpRow(const uint8_t *src, uint8_t *mono, uint8_t *color, uint16_t width,
+                          const uint8_t *classes) {
+    uint16_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint8_t black = 0;
+        uint8_t red = 0;
+        for (uint8_t i = 0; i < 8; i++) {
+            uint8_t c = bmpPixelClass<Format>(src, x + i, classes);
+            black = (black << 1) | (c & PIXEL_BLACK);
+            red = (red << 1) | ((c & PIXEL_COLOR) >> 1);
+        }
+        *mono++ = ~black;
+        *color++ = ~red;
+    }
+
+    if (x < width) {
+        uint8_t black = 0;
+        uint8_t red = 0;
+        for (uint8_t i = 0; i < 8; i++) {
+            uint8_t c = (x + i < width) ? bmpPixelClass<Format>(src, x + i, classes) : (uint8_t) PIXEL_WHITE;
+            black = (black << 1) | (c & PIXEL_BLACK);
+            red = (red << 1) | ((c & PIXEL_COLOR) >> 1);
+        }
+        *mono = ~black;
+        *color = ~red;
+    }
+}
+
+static const BmpRowKernel rowKernels[BMP_FORMAT_COUNT] = {
+    convertBmpRow<BMP_INDEXED_1>,
+    convertBmpRow<BMP_INDEXED_2>,
+    convertBmpRow<BMP_INDEXED_4>,
+    convertBmpRow<BMP_INDEXED_8>,
+    convertBmpRow<BMP_RGB555>,
+    convertBmpRow<BMP_RGB565>,
+    convertBmpRow<BMP_BGR24>,
+    convertBmpRow<BMP_BGRX32>
+};
+
+BmpRowKernel bmpRowKernel(BmpPixelFormat format) {
+    return format < BMP_FORMAT_COUNT ? rowKernels[format] : nullptr;
+}
+
+// Palette entries are BGRX quads. 1 bit images are drawn black and white only
+static void buildPaletteClasses(const uint8_t *palette, uint16_t colors, uint16_t depth, uint8_t *classes) {
+    memset(classes, PIXEL_BLACK, bmp_max_palette_colors);
+    for (uint16_t i = 0; i < colors; i++, palette += 4) {
+        uint8_t blue = palette[0];
+        uint8_t green = palette[1];
+        uint8_t red = palette[2];
+        if (depth == 1) {
+            classes[i] = (red + green + blue > 3 * 0x80) ? PIXEL_WHITE : PIXEL_BLACK;
+        } else {
+            classes[i] = classifyBmpRgb(red, green, blue);
+        }
+    }
+}
+
+BmpDecoder::BmpDecoder()
+    : file(nullptr), info(), kernel(nullptr), classes(nullptr), panelWidth(0),
+      visibleWidth(0), visibleHeight(0), ownsClasses(false) {
+}
+
+BmpDecoder::~BmpDecoder() {
+    end();
+}
+
+bool BmpDecoder::begin(fs::File &file, uint16_t panelWidth, uint16_t panelHeight, RenderArena *arena) {
+    end();
+    this->file = &file;
+    this->panelWidth = panelWidth;
+
+    ownsClasses = !arena;
+    classes = (uint8_t *) (arena ? arena->alloc(bmp_max_palette_colors) : malloc(bmp_max_palette_colors));
+    if (!classes) return false;
+
+    // Headers and palette in one read; the buffer is only needed until the palette is classified
+    size_t bufferMark = arena ? arena->mark() : 0;
+    uint8_t *buffer = (uint8_t *) (arena ? arena->alloc(bmp_header_read_size) : malloc(bmp_header_read_size));
+    bool ok = buffer != nullptr;
+
+    if (ok) {
+        file.seek(0);
+        size_t headLen = file.read(buffer, bmp_header_read_size);
+        ok = parseBmpHeader(buffer, headLen, file.size(), info);
+
+        if (ok && info.paletteColors) {
+            size_t paletteSize = 4 * info.paletteColors;
+            const uint8_t *palette = buffer + info.paletteOffset;
+            if (info.paletteOffset + paletteSize > headLen) {
+                // Palette past a header larger than BITMAPV5HEADER
+                ok = file.seek(info.paletteOffset) && file.read(buffer, paletteSize) == paletteSize;
+                palette = buffer;
+            }
+            if (ok) buildPaletteClasses(palette, info.paletteColors, info.depth, classes);
+        }
+    }
+
+    if (arena) {
+        arena->release(bufferMark);
+    } else if (buffer) {
+        free(buffer);
+    }
+    if (!ok) {
+        end();
+        return false;
+    }
+
+    kernel = bmpRowKernel(info.format);
+    visibleWidth = min(info.width, panelWidth);
+    visibleHeight = min(info.height, panelHeight);
+    return true;
+}
+
+void BmpDecoder::end() {
+    if (classes && ownsClasses) free(classes);
+    classes = nullptr;
+    kernel = nullptr;
+}
+
+// Rows of the image among panel rows [y, y + rows)
+uint16_t BmpDecoder::imageRowsIn(uint16_t y, uint16_t rows) const {
+    return y < visibleHeight ? min(rows, (uint16_t)(visibleHeight - y)) : 0;
+}
+
+bool BmpDecoder::readRows(uint16_t y, uint16_t rows, uint8_t *input, size_t &bytesRead) {
+    bytesRead = 0;
+    uint16_t n = imageRowsIn(y, rows);
+    if (n == 0) return true;
+
+    // Bottom-up files store these rows contiguously too, last one first
+    uint32_t first = info.bottomUp ? info.height - y - n : y;
+    size_t size = (size_t) n * info.rowSize;
+    if (!file->seek(info.dataOffset + first * info.rowSize)) return false;
+    bytesRead = file->read(input, size);
+    return bytesRead == size;
+}
+
+void BmpDecoder::convertRows(const uint8_t *input, uint16_t y, uint16_t rows, uint8_t *mono, uint8_t *color) {
+    const size_t rowBytes = panelWidth / 8;
+    const size_t imageBytes = (visibleWidth + 7) / 8;
+    uint16_t n = imageRowsIn(y, rows);
+
+    for (uint16_t i = 0; i < rows; i++) {
+        uint8_t *monoRow = mono + i * rowBytes;
+        uint8_t *colorRow = color + i * rowBytes;
+        if (i >= n) {
+            memset(monoRow, 0xFF, rowBytes);
+            memset(colorRow, 0xFF, rowBytes);
+            continue;
+        }
+
+        const uint8_t *src = input + (size_t)(info.bottomUp ? n - 1 - i : i) * info.rowSize;
+        kernel(src, monoRow, colorRow, visibleWidth, classes);
+        memset(monoRow + imageBytes, 0xFF, rowBytes - imageBytes);
+        memset(colorRow + imageBytes, 0xFF, rowBytes - imageBytes);
+    }
+}
+
+static uint16_t read16(fs::File &f) {
+    uint16_t result;
+    ((uint8_t *) &result)[0] = f.read();
+    ((uint8_t *) &result)[1] = f.read();
+    return result;
+}
+
+static uint32_t read32(fs::File &f) {
+    uint32_t result;
+    ((uint8_t *) &result)[0] = f.read();
+    ((uint8_t *) &result)[1] = f.read();
+    ((uint8_t *) &result)[2] = f.read();
+    ((uint8_t *) &result)[3] = f.read();
+    return result;
+}
+
+// Read buffer of the original decoder, 800 pixels of 24 bits
+static const size_t reference_input_size = 3 * 800;
+
+BmpReferenceDecoder::BmpReferenceDecoder() : file(nullptr), input(nullptr) {
+}
+
+BmpReferenceDecoder::~BmpReferenceDecoder() {
+    end();
+}
+
+void BmpReferenceDecoder::end() {
+    if (input) free(input);
+    input = nullptr;
+}
+
+bool BmpReferenceDecoder::begin(fs::File &f, uint16_t panelWidth, uint16_t panelHeight) {
+    end();
+    input = (uint8_t *) malloc(reference_input_size);
+    if (!input) return false;
+
+    file = &f;
+    f.seek(0);
+    if (read16(f) != 0x4D42) return false;
+
+    read32(f); // file size
+    read32(f); // creator bytes
+    imageOffset = read32(f);
+    read32(f); // header size
+    uint32_t width = read32(f);
+    height = (int32_t) read32(f);
+    uint16_t planes = read16(f);
+    depth = read16(f);
+    format = read32(f);
+
+    if (planes != 1 || (format != 0 && format != 3)) return false;
+
+    rowSize = (width * depth / 8 + 3) & ~3;
+    if (depth < 8)
+        rowSize = ((width * depth + 8 - depth) / 8 + 3) & ~3;
+    flip = true;
+    if (height < 0) {
+        height = -height;
+        flip = false;
+    }
+
+    w = width;
+    h = height;
+    if (w > panelWidth) w = panelWidth;
+    if (h > panelHeight) h = panelHeight;
+
+    bool with_color = depth != 1;
+    if (depth <= 8) {
+        file->seek(imageOffset - (4 << depth));
+        for (uint16_t pn = 0; pn < (1 << depth); pn++) {
+            uint16_t blue = f.read();
+            uint16_t green = f.read();
+            uint16_t red = f.read();
+            f.read(); // skip alpha
+
+            bool whitish = with_color
+                               ? ((red > 0x80) && (green > 0x80) && (blue > 0x80))
+                               : ((red + green + blue) > 3 * 0x80);
+            bool colored = with_color && ((red > 0xF0) || ((green > 0xF0) && (blue > 0xF0)));
+
+            if (0 == pn % 8) {
+                monoPalette[pn / 8] = 0;
+                colorPalette[pn / 8] = 0;
+            }
+            monoPalette[pn / 8] |= whitish << (pn % 8);
+            colorPalette[pn / 8] |= colored << (pn % 8);
+        }
+    }
+    return true;
+}
+
+bool BmpReferenceDecoder::readRow(uint16_t y, uint8_t *mono, uint8_t *color, size_t rowBytes) {
+    memset(mono, 0xFF, rowBytes);
+    memset(color, 0xFF, rowBytes);
+    if (y >= h) return true;
+
+    uint16_t row = flip ? h - 1 - y : y;
+    uint32_t rowPosition = (flip ? imageOffset + (height - h) * rowSize : imageOffset) + row * rowSize;
+
+    uint8_t bitmask = 0xFF;
+    uint8_t bitshift = 8 - depth;
+    if (depth < 8)
+        bitmask >>= depth;
+
+    uint32_t in_remain = rowSize;
+    uint32_t in_idx = 0;
+    uint32_t in_bytes = 0;
+    uint8_t in_byte = 0;
+    uint8_t in_bits = 0;
+    uint8_t out_byte = 0xFF;
+    uint8_t out_color_byte = 0xFF;
+    uint32_t out_idx = 0;
+    uint16_t red, green, blue;
+    bool whitish = false;
+    bool colored = false;
+
+    file->seek(rowPosition);
+
+    for (uint16_t col = 0; col < w; col++) {
+        if (in_idx >= in_bytes) {
+            in_bytes = file->read(input, (in_remain > reference_input_size) ? reference_input_size : in_remain);
+            in_remain -= in_bytes;
+            in_idx = 0;
+        }
+
+        switch (depth) {
+            case 32:
+                blue = input[in_idx++];
+                green = input[in_idx++];
+                red = input[in_idx++];
+                in_idx++;
+                whitish = (red > 0x80) && (green > 0x80) && (blue > 0x80);
+                colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
+                break;
+            case 24:
+                blue = input[in_idx++];
+                green = input[in_idx++];
+                red = input[in_idx++];
+                whitish = (red > 0x80) && (green > 0x80) && (blue > 0x80);
+                colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
+                break;
+            case 16: {
+                uint8_t lsb = input[in_idx++];
+                uint8_t msb = input[in_idx++];
+                if (format == 0) {
+                    blue = (lsb & 0x1F) << 3;
+                    green = ((msb & 0x03) << 6) | ((lsb & 0xE0) >> 2);
+                    red = (msb & 0x7C) << 1;
+                } else {
+                    blue = (lsb & 0x1F) << 3;
+                    green = ((msb & 0x07) << 5) | ((lsb & 0xE0) >> 3);
+                    red = (msb & 0xF8);
+                }
+                whitish = (red > 0x80) && (green > 0x80) && (blue > 0x80);
+                colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
+            }
+            break;
+            case 1:
+            case 2:
+            case 4:
+            case 8: {
+                if (0 == in_bits) {
+                    in_byte = input[in_idx++];
+                    in_bits = 8;
+                }
+                uint16_t pn = (in_byte >> bitshift) & bitmask;
+                whitish = monoPalette[pn / 8] & (0x1 << (pn % 8));
+                colored = colorPalette[pn / 8] & (0x1 << (pn % 8));
+                in_byte <<= depth;
+                in_bits -= depth;
+            }
+            break;
+        }
+
+        if (whitish) {
+        } else if (colored) {
+            out_color_byte &= ~(0x80 >> (col % 8));
+        } else {
+            out_byte &= ~(0x80 >> (col % 8));
+        }
+
+        if ((7 == col % 8) || (col == w - 1)) {
+            color[out_idx] = out_color_byte;
+            mono[out_idx++] = out_byte;
+            out_byte = 0xFF;
+            out_color_byte = 0xFF;
+        }
+    }
+    return true;
+}
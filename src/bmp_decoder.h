@@ -0,0 +1,126 @@
+#ifndef BMP_DECODER_H
+#define BMP_DECODER_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "render_arena.h"
+
+// File header, BITMAPINFOHEADER and the three BI_BITFIELDS masks that follow it
+#define BMP_HEADER_PARSE_SIZE 66
+
+enum BmpPixelFormat : uint8_t {
+    BMP_INDEXED_1,
+    BMP_INDEXED_2,
+    BMP_INDEXED_4,
+    BMP_INDEXED_8,
+    BMP_RGB555,
+    BMP_RGB565,
+    BMP_BGR24,
+    BMP_BGRX32,
+    BMP_FORMAT_COUNT
+};
+
+struct BmpInfo {
+    uint32_t dataOffset;
+    uint32_t rowSize;       // bytes per stored row, padded to 4
+    uint32_t paletteOffset;
+    uint16_t paletteColors;
+    uint16_t width;
+    uint16_t height;
+    uint16_t depth;
+    bool bottomUp;          // rows stored last row first (positive height)
+    BmpPixelFormat format;
+};
+
+const char *bmpPixelFormatName(BmpPixelFormat format);
+
+/**
+ * Parses and sanity-checks the BMP headers from the first
+ * BMP_HEADER_PARSE_SIZE bytes of a file (fewer only if the file is shorter).
+ * Accepts uncompressed (BI_RGB) 1/2/4/8 bit palette, 16 bit 555, 24 and 32
+ * bit images, and BI_BITFIELDS for 16 bit 555/565 and 32 bit BGRX.
+ */
+bool parseBmpHeader(const uint8_t *head, size_t headLen, size_t fileSize, BmpInfo &info);
+
+/**
+ * Converts one stored BMP row of `width` pixels into the panel planes
+ * (bit cleared = ink). `classes` holds the PixelClass of each palette entry
+ * for the indexed formats. Bits past `width` in the last byte are white.
+ */
+typedef void (*BmpRowKernel)(const uint8_t *src, uint8_t *mono, uint8_t *color, uint16_t width,
+                             const uint8_t *classes);
+
+// Row kernel specialized at compile time for each pixel format
+BmpRowKernel bmpRowKernel(BmpPixelFormat format);
+
+/**
+ * Batched BMP reader for the render pipeline. The headers and palette come
+ * from one buffered read; each batch of panel rows is then one seek and one
+ * read of the stored rows (in reverse for bottom-up files), converted with
+ * the row kernel of the file's format.
+ *
+ * The image is drawn at the top-left corner: pixels outside the panel are
+ * cropped and panel pixels outside the image are white.
+ */
+class BmpDecoder {
+private:
+    fs::File *file;
+    BmpInfo info;
+    BmpRowKernel kernel;
+    uint8_t *classes;     // PixelClass per palette entry
+    uint16_t panelWidth;
+    uint16_t visibleWidth;
+    uint16_t visibleHeight;
+    bool ownsClasses;
+
+    uint16_t imageRowsIn(uint16_t y, uint16_t rows) const;
+
+public:
+    BmpDecoder();
+    ~BmpDecoder();
+
+    // Palette classes come from `arena` if given (released with it), else from the heap
+    bool begin(fs::File &file, uint16_t panelWidth, uint16_t panelHeight, RenderArena *arena = nullptr);
+    void end();
+
+    const BmpInfo &header() const { return info; }
+
+    // Reads the stored rows shown on panel rows [y, y + rows) into `input`,
+    // which holds rows * header().rowSize bytes; false on a read error
+    bool readRows(uint16_t y, uint16_t rows, uint8_t *input, size_t &bytesRead);
+
+    // Converts rows read by readRows() into `rows` full panel rows
+    void convertRows(const uint8_t *input, uint16_t y, uint16_t rows, uint8_t *mono, uint8_t *color);
+};
+
+/**
+ * Original per-pixel decoder of drawBitmapFromSpiffs: single-byte header
+ * reads, a seek per row and a switch on the depth per pixel. Kept to verify
+ * and benchmark the row kernels; produces the same panel rows as BmpDecoder.
+ */
+class BmpReferenceDecoder {
+private:
+    fs::File *file;
+    uint32_t imageOffset;
+    uint32_t rowSize;
+    uint32_t format;
+    int32_t height;
+    uint16_t depth;
+    uint16_t w;
+    uint16_t h;
+    bool flip;
+    uint8_t *input;
+    uint8_t monoPalette[256 / 8];
+    uint8_t colorPalette[256 / 8];
+
+public:
+    BmpReferenceDecoder();
+    ~BmpReferenceDecoder();
+
+    bool begin(fs::File &file, uint16_t panelWidth, uint16_t panelHeight);
+    void end();
+    // Decodes panel row `y`; `rowBytes` is the panel row size
+    bool readRow(uint16_t y, uint8_t *mono, uint8_t *color, size_t rowBytes);
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "boot.h"
+#include "config.h"
+#include "debug.h"
+#include "esp_task_wdt.h"
+
+#include <Preferences.h>
+#include <WiFi.h>
+
+// A cached access point that has not answered by then is taken to be gone
+static const uint32_t wifi_cached_timeout_ms = 3000;
+static const uint32_t wifi_poll_interval_ms = 10;
+static const char *wifi_cache_namespace = "wifi";
+
+static const char *const stage_names[BOOT_STAGE_COUNT] = {
+    "serial", "oled", "renderArena", "wifiStart", "littlefs", "imageStore", "panel", "wifiConnect", "webserver"
+};
+
+static BootStageTiming stages[BOOT_STAGE_COUNT];
+static uint32_t completedAt = 0;
+
+static bool usedCachedAp = false;
+
+const char *bootStageName(BootStage stage) {
+    return stage < BOOT_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+void bootStageBegin(BootStage stage) {
+    stages[stage].startMs = millis();
+    stages[stage].done = false;
+}
+
+void bootStageEnd(BootStage stage) {
+    stages[stage].ms = millis() - stages[stage].startMs;
+    stages[stage].done = true;
+}
+
+const BootStageTiming &bootStageTiming(BootStage stage) {
+    return stages[stage];
+}
+
+void bootCompleted() {
+    completedAt = millis();
+    LOG_I("[BOOT] Ready after %u ms", (unsigned) completedAt);
+}
+
+uint32_t bootCompletedAt() {
+    return completedAt;
+}
+
+const char *resetReasonName() {
+    switch (esp_reset_reason()) {
+        case ESP_RST_POWERON:   return "power-on";
+        case ESP_RST_EXT:       return "external";
+        case ESP_RST_SW:        return "software";
+        case ESP_RST_PANIC:     return "panic";
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:       return "watchdog";
+        case ESP_RST_DEEPSLEEP: return "deep-sleep";
+        case ESP_RST_BROWNOUT:  return "brownout";
+        default:                return "unknown";
+    }
+}
+
+// The cache belongs to one SSID; a changed config.cpp must not reuse it
+static bool loadCachedAp(uint8_t *bssid, int32_t &channel) {
+    Preferences prefs;
+    if (!prefs.begin(wifi_cache_namespace, true)) return false;
+    bool ok = prefs.getString("ssid", "") == ssid &&
+              prefs.getBytes("bssid", bssid, 6) == 6;
+    channel = prefs.getUChar("channel", 0);
+    prefs.end();
+    return ok && channel > 0;
+}
+
+static void saveCachedAp() {
+    uint8_t bssid[6];
+    int32_t channel = 0;
+    bool cached = loadCachedAp(bssid, channel);
+    const uint8_t *current = WiFi.BSSID();
+    if (!current) return;
+    // NVS writes wear flash; only write when the access point changed
+    if (cached && channel == WiFi.channel() && memcmp(bssid, current, 6) == 0) return;
+
+    Preferences prefs;
+    if (!prefs.begin(wifi_cache_namespace, false)) return;
+    prefs.putString("ssid", ssid);
+    prefs.putBytes("bssid", current, 6);
+    prefs.putUChar("channel", (uint8_t) WiFi.channel());
+    prefs.end();
+    LOG_I("[WIFI] Cached access point %s on channel %d", WiFi.BSSIDstr().c_str(), (int) WiFi.channel());
+}
+
+static void clearCachedAp() {
+    Preferences prefs;
+    if (!prefs.begin(wifi_cache_namespace, false)) return;
+    prefs.clear();
+    prefs.end();
+}
+
+static void applyStaticIp() {
+    if (!staticIp[0]) return;
+
+    IPAddress ip, gateway, subnet, dns;
+    if (!ip.fromString(staticIp) || !gateway.fromString(staticGateway) || !subnet.fromString(staticSubnet)) {
+        LOG_W("[WIFI] Invalid static address config, using DHCP");
+        return;
+    }
+    if (!staticDns[0] || !dns.fromString(staticDns)) {
+        dns = gateway;
+    }
+    if (!WiFi.config(ip, gateway, subnet, dns)) {
+        LOG_W("[WIFI] Static address not applied, using DHCP");
+        return;
+    }
+    LOG_I("[WIFI] Static address %s", staticIp);
+}
+
+void beginWifi() {
+    applyStaticIp();
+
+    uint8_t bssid[6];
+    int32_t channel = 0;
+    usedCachedAp = loadCachedAp(bssid, channel);
+    if (usedCachedAp) {
+        LOG_I("[WIFI] Connecting to %s via cached access point, channel %d", ssid, (int) channel);
+        WiFi.begin(ssid, password, channel, bssid);
+    } else {
+        LOG_I("[WIFI] Connecting to %s", ssid);
+        WiFi.begin(ssid, password);
+    }
+}
+
+bool waitForWifi(uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (WiFi.status() != WL_CONNECTED) {
+        uint32_t elapsed = millis() - start;
+        if (elapsed >= timeoutMs) return false;
+
+        if (usedCachedAp && elapsed >= wifi_cached_timeout_ms) {
+            LOG_W("[WIFI] Cached access point not answering, scanning");
+            usedCachedAp = false;
+            clearCachedAp();
+            WiFi.disconnect();
+            WiFi.begin(ssid, password);
+        }
+
+        delay(wifi_poll_interval_ms);
+        esp_task_wdt_reset();
+    }
+
+    saveCachedAp();
+    return true;
+}
+
+bool wifiUsedCachedAp() {
+    return usedCachedAp;
+}
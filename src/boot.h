@@ -0,0 +1,69 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <Arduino.h>
+
+/**
+ * 1: WiFi starts first, from the access point of the last connection, while
+ * LittleFS is mounted on this core and the panel is initialized on the other;
+ * setup() waits on readiness instead of fixed delays. 0: the original
+ * sequence, which spaces the power peaks of WiFi and the panel apart for weak
+ * USB supplies.
+ */
+#ifndef FAST_BOOT
+#define FAST_BOOT 1
+#endif
+
+enum BootStage : uint8_t {
+    BOOT_SERIAL,
+    BOOT_OLED,
+    BOOT_RENDER_ARENA,
+    BOOT_WIFI_START,
+    BOOT_LITTLEFS,
+    BOOT_IMAGE_STORE,
+    BOOT_PANEL,
+    BOOT_WIFI_CONNECT,
+    BOOT_WEBSERVER,
+    BOOT_STAGE_COUNT
+};
+
+struct BootStageTiming {
+    uint32_t startMs;   // millis() when the stage started
+    uint32_t ms;        // duration
+    bool done;
+};
+
+const char *bootStageName(BootStage stage);
+
+// Stages may run on different tasks at the same time; each has its own entry
+void bootStageBegin(BootStage stage);
+void bootStageEnd(BootStage stage);
+const BootStageTiming &bootStageTiming(BootStage stage);
+
+// Marks the end of setup()
+void bootCompleted();
+// millis() when setup() finished, 0 while booting
+uint32_t bootCompletedAt();
+
+// Why the chip last reset, e.g. "power-on", "watchdog", "brownout"
+const char *resetReasonName();
+
+/**
+ * Starts connecting to the configured network, with the static address from
+ * config.h if one is set. When the BSSID and channel of the last connection
+ * are cached in NVS, they are passed along so the driver skips the scan.
+ */
+void beginWifi();
+
+/**
+ * Waits for the connection, feeding the watchdog. If the cached access point
+ * does not answer within a few seconds (it moved channel, or is gone), the
+ * cache is dropped and the connection retried with a full scan. On success
+ * the access point is cached for the next boot. False after `timeoutMs`.
+ */
+bool waitForWifi(uint32_t timeoutMs);
+
+// Whether the connection used the cached access point
+bool wifiUsedCachedAp();
+
+#endif
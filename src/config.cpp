@@ -7,6 +7,11 @@ const char *hostname = "esp32";
 const char *ssid = "EGOR";
 const char *password = "ohmyglob";
 
+const char *staticIp = "";
+const char *staticGateway = "";
+const char *staticSubnet = "255.255.255.0";
+const char *staticDns = "";
+
 int16_t DISPLAY_WIDTH = 640;
 int16_t DISPLAY_HEIGHT = 384;
 
@@ -14,6 +19,9 @@ const int WDT_TIMEOUT_SECONDS = 120;
 
 const int LED_PIN = 2;
 
+// Allowed slowdown of a benchmark stage against the stored baseline
+const int BENCH_REGRESSION_TOLERANCE_PCT = 20;
+
 void initConfig() {
     debug.println("[CONFIG] Starting configuration initialization...");
     debug.println("[CONFIG] Setting hostname: " + String(hostname));
@@ -8,17 +8,30 @@ extern const char *hostname;
 extern const char *ssid;
 extern const char *password;
 
+// Static IPv4 address instead of DHCP, which saves the DHCP round trips at
+// boot. Empty staticIp means DHCP; empty staticDns means the gateway.
+extern const char *staticIp;
+extern const char *staticGateway;
+extern const char *staticSubnet;
+extern const char *staticDns;
+
 extern int16_t DISPLAY_X;
 extern int16_t DISPLAY_Y;
 extern int16_t DISPLAY_WIDTH;
 extern int16_t DISPLAY_HEIGHT;
 
 #define SELECTED_IMAGE_BUFFER_PATH "image.bin"
+#define IMAGE_ETAG_PATH "/image.bin.etag"
+#define BENCH_BASELINE_PATH "/bench_baseline.json"
+#define BENCH_BMP_PATH "/bench.bmp"
+#define BENCH_UPLOAD_PATH "/bench_upload.bin"
 
 extern const int WDT_TIMEOUT_SECONDS;
 
 extern const int LED_PIN;
 
+extern const int BENCH_REGRESSION_TOLERANCE_PCT;
+
 void initConfig();
 
 #endif
@@ -1,18 +1,38 @@
 #include "debug.h"
+#include <stdarg.h>
 
 Debug debug;
 
-Debug::Debug() {
+// Slowest part of a message is the OLED redraw over I2C; coalesce bursts into one
+static const uint32_t oled_refresh_interval_ms = 500;
+// A flood of drops is summarized instead of adding to the flood
+static const uint32_t drop_report_interval_ms = 1000;
+static const uint32_t oled_probe_attempts = 10;
+static const uint32_t oled_probe_interval_ms = 10;
+static const uint32_t log_task_stack = 3072;
+static const UBaseType_t log_task_priority = 1;
+
+static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0, "LOG_QUEUE_SIZE must be a power of two");
+
+Debug::Debug() : enqueuePos(0), dequeuePos(0), dropped(0), written(0), displayReady(false), task(nullptr) {
     display = new Adafruit_SSD1306(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
-    currentMessage = "";
+    currentMessage[0] = '\0';
+    for (uint32_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
 }
 
 void Debug::begin() {
     Wire.begin(I2C_SDA, I2C_SCL, 100000);
-    delay(100);
 
-    Wire.beginTransmission(SCREEN_ADDRESS);
-    if (Wire.endTransmission() != 0) {
+    // Probe until the controller acks instead of waiting a fixed time after power-up
+    bool found = false;
+    for (uint32_t attempt = 0; attempt < oled_probe_attempts && !found; attempt++) {
+        if (attempt > 0) delay(oled_probe_interval_ms);
+        Wire.beginTransmission(SCREEN_ADDRESS);
+        found = Wire.endTransmission() == 0;
+    }
+    if (!found) {
         Serial.println(F("SSD1306 not found at 0x3C"));
         return;
     }
@@ -26,68 +46,189 @@ void Debug::begin() {
     display->setTextSize(1);
     display->setTextColor(SSD1306_WHITE);
     display->display();
+    displayReady = true;
+}
+
+void Debug::startTask() {
+    if (task) return;
+    if (xTaskCreate(drainTask, "log", log_task_stack, this, log_task_priority, &task) != pdPASS) {
+        task = nullptr;
+        Serial.println(F("[LOG] Failed to start log task, logging synchronously"));
+    }
 }
 
 void Debug::updateDisplay() {
     display->clearDisplay();
     display->setCursor(0, 0);
 
-    String message = currentMessage;
-    int charWidth = 6; // approximately
-    int charsPerLine = SCREEN_WIDTH / charWidth;
+    const int charWidth = 6; // approximately
+    const size_t charsPerLine = SCREEN_WIDTH / charWidth;
+
+    const char *p = currentMessage;
+    size_t remaining = strlen(currentMessage);
+    while (remaining > 0) {
+        size_t n = remaining > charsPerLine ? charsPerLine : remaining;
+        display->write((const uint8_t *) p, n);
+        display->println();
+        p += n;
+        remaining -= n;
+    }
+
+    display->display();
+}
 
-    while (message.length() > 0) {
-        String line;
-        if (message.length() > charsPerLine) {
-            line = message.substring(0, charsPerLine);
-            message = message.substring(charsPerLine);
+// Bounded MPMC queue with a sequence number per slot: a producer owns slot
+// `pos` once its sequence equals pos, and hands it over by setting pos + 1
+Debug::Slot *Debug::claim() {
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot &slot = slots[pos & (LOG_QUEUE_SIZE - 1)];
+        int32_t diff = (int32_t) (slot.sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return &slot;
+            }
+        } else if (diff < 0) {
+            // Drain task is a full queue behind
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
         } else {
-            line = message;
-            message = "";
+            pos = enqueuePos.load(std::memory_order_relaxed);
         }
-        display->println(line);
     }
+}
 
-    display->display();
+void Debug::publish(Slot *slot) {
+    uint32_t pos = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    xTaskNotifyGive(task);
 }
 
-void Debug::println(const String &message) {
-    static bool isProcessing = false;
+bool Debug::drainOne() {
+    uint32_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Slot &slot = slots[pos & (LOG_QUEUE_SIZE - 1)];
+    if ((int32_t) (slot.sequence.load(std::memory_order_acquire) - (pos + 1)) < 0) {
+        return false;
+    }
 
-    if (isProcessing) {
-        Serial.println(message);
+    Serial.println(slot.text);
+    if (slot.level <= LOG_LEVEL_INFO) {
+        memcpy(currentMessage, slot.text, sizeof(currentMessage));
+    }
+    written.fetch_add(1, std::memory_order_relaxed);
+
+    slot.sequence.store(pos + LOG_QUEUE_SIZE, std::memory_order_release);
+    dequeuePos.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+uint32_t Debug::queuedMessages() const {
+    return enqueuePos.load(std::memory_order_relaxed) - dequeuePos.load(std::memory_order_relaxed);
+}
+
+void Debug::drainTask(void *parameter) {
+    Debug *self = (Debug *) parameter;
+    uint32_t reportedDropped = 0;
+    uint32_t lastRefresh = 0;
+    uint32_t lastDropReport = 0;
+    bool refreshPending = false;
+
+    for (;;) {
+        while (self->drainOne()) {
+            refreshPending = true;
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        uint32_t droppedNow = self->droppedMessages();
+        if (droppedNow != reportedDropped) {
+            uint32_t since = millis() - lastDropReport;
+            if (since >= drop_report_interval_ms) {
+                Serial.printf("[LOG] %u messages dropped\n", (unsigned) (droppedNow - reportedDropped));
+                reportedDropped = droppedNow;
+                lastDropReport = millis();
+            } else {
+                wait = pdMS_TO_TICKS(drop_report_interval_ms - since);
+            }
+        }
+
+        if (refreshPending && self->displayReady) {
+            uint32_t since = millis() - lastRefresh;
+            if (since >= oled_refresh_interval_ms) {
+                self->updateDisplay();
+                lastRefresh = millis();
+                refreshPending = false;
+            } else if (pdMS_TO_TICKS(oled_refresh_interval_ms - since) < wait) {
+                wait = pdMS_TO_TICKS(oled_refresh_interval_ms - since);
+            }
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+void Debug::log(uint8_t level, const char *format, ...) {
+    if (level > LOG_LEVEL) return;
+
+    va_list args;
+    va_start(args, format);
+    if (!task) {
+        char text[LOG_MESSAGE_SIZE];
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        write(level, text);
         return;
     }
 
-    isProcessing = true;
+    Slot *slot = claim();
+    if (slot) {
+        vsnprintf(slot->text, sizeof(slot->text), format, args);
+        slot->level = level;
+        publish(slot);
+    }
+    va_end(args);
+}
 
-    Serial.println(message);
+void Debug::write(uint8_t level, const char *message) {
+    if (level > LOG_LEVEL) return;
+
+    if (!task) {
+        // Boot, before the drain task: write through as before
+        Serial.println(message);
+        if (displayReady && level <= LOG_LEVEL_INFO) {
+            strlcpy(currentMessage, message, sizeof(currentMessage));
+            updateDisplay();
+        }
+        return;
+    }
 
-    if (display != nullptr) {
-        currentMessage = message;
-        updateDisplay();
+    Slot *slot = claim();
+    if (slot) {
+        strlcpy(slot->text, message, sizeof(slot->text));
+        slot->level = level;
+        publish(slot);
     }
+}
 
-    isProcessing = false;
+void Debug::println(const String &message) {
+    write(LOG_LEVEL_INFO, message.c_str());
 }
 
 void Debug::println(const char* message) {
-    println(String(message));
+    write(LOG_LEVEL_INFO, message);
 }
 
 void Debug::println(char message) {
-    println(String(message));
+    char text[2] = {message, '\0'};
+    println(text);
 }
 
 void Debug::println(int message) {
-    println(String(message));
+    log(LOG_LEVEL_INFO, "%d", message);
 }
 
 void Debug::println(long message) {
-    println(String(message));
+    log(LOG_LEVEL_INFO, "%ld", message);
 }
 
 void Debug::println(double message, int precision) {
-    String str = String(message, precision);
-    println(str);
+    log(LOG_LEVEL_INFO, "%.*f", precision, message);
 }
@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include <Adafruit_SSD1306.h>
+#include <atomic>
 
 #define SCREEN_WIDTH 128
 #define SCREEN_HEIGHT 32
@@ -12,25 +13,106 @@
 #define I2C_SDA 21
 #define I2C_SCL 22
 
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Messages above this level are compiled out; set with -D LOG_LEVEL=...
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Queued messages; a power of two. Messages are dropped when it is full.
+#ifndef LOG_QUEUE_SIZE
+#define LOG_QUEUE_SIZE 32
+#endif
+
+// Longest message kept, including the terminator; longer ones are truncated
+#define LOG_MESSAGE_SIZE 120
+
+/**
+ * Serial and OLED log. Callers format into a slot of a lock-free
+ * multi-producer queue and return; a low-priority task writes the messages
+ * to Serial and shows the latest one on the OLED, redrawn at most every
+ * oled_refresh_interval_ms. Before startTask() messages go straight to Serial.
+ */
 class Debug {
 private:
-    String currentMessage;
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        uint8_t level;
+        char text[LOG_MESSAGE_SIZE];
+    };
+
+    Slot slots[LOG_QUEUE_SIZE];
+    std::atomic<uint32_t> enqueuePos;
+    std::atomic<uint32_t> dequeuePos;  // written by the drain task only
+    std::atomic<uint32_t> dropped;
+    std::atomic<uint32_t> written;
+
+    char currentMessage[LOG_MESSAGE_SIZE];
     Adafruit_SSD1306* display;
+    bool displayReady;
+    TaskHandle_t task;
 
-    void scrollLines();
+    Slot *claim();
+    void publish(Slot *slot);
+    bool drainOne();
     void updateDisplay();
+    static void drainTask(void *parameter);
 
 public:
     Debug();
     void begin();
+    // Starts the drain task; until then messages are written synchronously
+    void startTask();
+
+    // printf-style message; use the LOG_* macros so disabled levels compile out
+    void log(uint8_t level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    void write(uint8_t level, const char *message);
+
+    // Info level messages, kept for existing callers
     void println(const String &message);
     void println(const char* message);
     void println(char message);
     void println(int message);
     void println(long message);
     void println(double message, int precision = 2);
+
+    // Messages discarded because the queue was full
+    uint32_t droppedMessages() const { return dropped.load(std::memory_order_relaxed); }
+    // Messages written to Serial since boot
+    uint32_t writtenMessages() const { return written.load(std::memory_order_relaxed); }
+    // Messages waiting for the drain task
+    uint32_t queuedMessages() const;
 };
 
 extern Debug debug;
 
-#endif
\ No newline at end of file
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_E(...) debug.log(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_E(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_W(...) debug.log(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_W(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_I(...) debug.log(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_I(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_D(...) debug.log(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_D(...) do {} while (0)
+#endif
+
+#endif
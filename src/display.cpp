@@ -2,51 +2,260 @@
 #include "display.h"
 #include "image_utils.h"
 #include "filesystem.h"
+#include "image_store.h"
 #include "esp_task_wdt.h"
 #include "debug.h"
+#include "trace.h"
+#include "events.h"
 
 #include <Arduino.h>
+#include "esp_rom_crc.h"
 
-GxEPD2_3C<GxEPD2_750c, GxEPD2_750c::HEIGHT> display(GxEPD2_750c(/*CS=*/15, /*DC=*/27, /*RST=*/26, /*BUSY=*/25));
+#if PANEL_MOCK
+GxEPD2_3C<PanelDriver, PanelDriver::HEIGHT> display{MockPanel()};
+#else
+GxEPD2_3C<PanelDriver, PanelDriver::HEIGHT> display(BulkPanel(/*CS=*/15, /*DC=*/27, /*RST=*/26, /*BUSY=*/25));
+#endif
 SPIClass hspi(HSPI);
 
-bool isImageRefreshPending = false;
-bool isDisplayJobScheduled = false;
-unsigned long displayJobStart = 0;
+DitherMode renderDitherMode = DITHER_NONE;
+
+static SemaphoreHandle_t displayLock = nullptr;
+
+DitherMode requestDitherMode(AsyncWebServerRequest *request, DitherMode fallback) {
+    if (!request->hasParam("dither")) return fallback;
+    return parseDitherMode(request->getParam("dither")->value(), fallback);
+}
+
+void initPanel(uint32_t diagBitrate) {
+#if !PANEL_MOCK
+    hspi.begin(13, 12, 14, 15);
+    display.epd2.selectSPI(hspi, SPISettings(PANEL_SPI_HZ, MSBFIRST, SPI_MODE0));
+#endif
+    display.init(diagBitrate);
+    initPanelSpi();
+}
+
+void initDisplayLock() {
+    if (displayLock) return;
+    displayLock = xSemaphoreCreateBinary();
+    xSemaphoreGive(displayLock);
+}
+
+bool lockDisplay(uint32_t waitMs) {
+    return displayLock && xSemaphoreTake(displayLock, pdMS_TO_TICKS(waitMs)) == pdTRUE;
+}
+
+void unlockDisplay() {
+    xSemaphoreGive(displayLock);
+}
+
+static const uint16_t panel_band_count = (PanelDriver::HEIGHT + RENDER_BATCH_ROWS - 1) / RENDER_BATCH_ROWS;
+
+PanelFrameStats lastPanelFrame = {};
+uint32_t panelFrameCount = 0;
+
+static uint32_t panelBandHash[panel_band_count];
+static bool panelBandKnown[panel_band_count];
+static bool panelBandWritten[panel_band_count];
+static bool panelCacheValid = false;
+static PanelFrameStats panelFrame;
+// SPI totals when the frame began, for the frame's spi stage
+static PanelSpiStats panelSpiAtFrameStart;
+
+volatile PanelPhase panelPhase = PANEL_IDLE;
+static volatile bool panelCancelled = false;
+// Orders a cancel against the decision to refresh
+static portMUX_TYPE panelPhaseLock = portMUX_INITIALIZER_UNLOCKED;
+
+const char *panelPhaseName(PanelPhase phase) {
+    switch (phase) {
+        case PANEL_WRITING:
+            return "writing";
+        case PANEL_REFRESHING:
+            return "refreshing";
+        default:
+            return "idle";
+    }
+}
+
+void invalidatePanelCache() {
+    panelCacheValid = false;
+    memset(panelBandKnown, 0, sizeof(panelBandKnown));
+    setDisplayedImageEtag("");
+}
+
+uint16_t panelFrameBandsDone() {
+    return panelFrame.bandsWritten + panelFrame.bandsSkipped;
+}
+
+bool cancelPanelFrame() {
+    portENTER_CRITICAL(&panelPhaseLock);
+    bool cancelled = panelPhase == PANEL_WRITING;
+    if (cancelled) panelCancelled = true;
+    portEXIT_CRITICAL(&panelPhaseLock);
+    return cancelled;
+}
+
+bool panelFrameCancelled() {
+    return panelCancelled;
+}
+
+void beginPanelFrame() {
+    memset(&panelFrame, 0, sizeof(panelFrame));
+    flushPanelBands();
+    panelSpiAtFrameStart = panelSpiStats();
+    memset(panelBandWritten, 0, sizeof(panelBandWritten));
+
+    portENTER_CRITICAL(&panelPhaseLock);
+    panelCancelled = false;
+    panelPhase = PANEL_WRITING;
+    portEXIT_CRITICAL(&panelPhaseLock);
+    postEvent(EVENT_PANEL, "{\"phase\":\"writing\"}");
+
+    if (!panelCacheValid) {
+        // Controller RAM content unknown: start from white (no refresh)
+        unsigned long t0 = millis();
+        display.writeScreenBuffer();
+        LOG_I("[TIMING] writeScreenBuffer: %lu ms", millis() - t0);
+        memset(panelBandKnown, 0, sizeof(panelBandKnown));
+    }
+}
+
+// Queued for the SPI task when possible, else written here after the bands ahead of it
+static void writeBand(const uint8_t *mono, const uint8_t *color, uint16_t y, uint16_t rows) {
+    if (queuePanelBand(mono, color, y, rows)) return;
+    flushPanelBands();
+    display.writeImage(mono, color, 0, y, PanelDriver::WIDTH, rows);
+}
+
+void writePanelBand(const uint8_t *mono, const uint8_t *color, uint16_t y, uint16_t rows) {
+    const uint16_t width = PanelDriver::WIDTH;
+    const size_t planeBytes = (width / 8) * rows;
+    uint16_t band = y / RENDER_BATCH_ROWS;
+    bool aligned = (y % RENDER_BATCH_ROWS) == 0 &&
+                   (rows == RENDER_BATCH_ROWS || y + rows == PanelDriver::HEIGHT);
+
+    if (panelCancelled) return;
+
+    if (!aligned) {
+        // Not a cacheable band: write it and forget the bands it touches
+        uint32_t traceStart = traceNow();
+        writeBand(mono, color, y, rows);
+        traceEnd(SPAN_PANEL_WRITE, traceStart, 2 * planeBytes);
+        for (uint16_t b = band; b <= (y + rows - 1) / RENDER_BATCH_ROWS && b < panel_band_count; b++) {
+            panelBandKnown[b] = false;
+        }
+        panelFrame.bandsWritten++;
+        return;
+    }
+
+    uint32_t hash = esp_rom_crc32_le(0, mono, planeBytes);
+    hash = esp_rom_crc32_le(hash, color, planeBytes);
+    panelBandWritten[band] = true;
+
+    if (panelBandKnown[band] && panelBandHash[band] == hash) {
+        panelFrame.bandsSkipped++;
+        return;
+    }
+
+    uint32_t traceStart = traceNow();
+    writeBand(mono, color, y, rows);
+    traceEnd(SPAN_PANEL_WRITE, traceStart, 2 * planeBytes);
+    panelBandHash[band] = hash;
+    panelBandKnown[band] = true;
+    panelFrame.bandsWritten++;
+}
+
+void finishPanelWrites(PipelineTiming &timing) {
+    flushPanelBands();
+    PanelSpiStats now = panelSpiStats();
+    uint32_t bands = now.bands - panelSpiAtFrameStart.bands;
+    if (bands == 0) return;
+
+    uint32_t spiMicros = now.spiMicros - panelSpiAtFrameStart.spiMicros;
+    timing.stages[STAGE_SPI].micros += spiMicros;
+    timing.stages[STAGE_SPI].bytes += now.bytes - panelSpiAtFrameStart.bytes;
+    LOG_I("[TIMING] SPI: %u bands at %u MHz, %u us per band (max %u since boot), render waited %u us",
+          (unsigned) bands, (unsigned) (panelSpiClock() / 1000000), (unsigned) (spiMicros / bands),
+          (unsigned) now.maxBandMicros, (unsigned) (now.waitMicros - panelSpiAtFrameStart.waitMicros));
+}
+
+void endPanelFrame(bool complete) {
+    flushPanelBands();
+    for (uint16_t b = 0; b < panel_band_count; b++) {
+        complete = complete && panelBandWritten[b] && panelBandKnown[b];
+    }
+
+    portENTER_CRITICAL(&panelPhaseLock);
+    bool cancelled = panelCancelled;
+    panelPhase = cancelled ? PANEL_IDLE : PANEL_REFRESHING;
+    portEXIT_CRITICAL(&panelPhaseLock);
+
+    if (cancelled) {
+        // Controller RAM holds part of the cancelled frame; the glass is unchanged
+        LOG_I("[DISPLAY] Frame cancelled, skipping refresh");
+        panelFrame.refreshed = false;
+        panelFrame.cancelled = true;
+        complete = false;
+    } else if (panelFrame.bandsWritten == 0 && complete && panelCacheValid) {
+        LOG_I("[DISPLAY] Frame unchanged, skipping refresh");
+        panelFrame.refreshed = false;
+    } else {
+        unsigned long t0 = millis();
+        panelFrame.refreshStartedAt = t0;
+        postEvent(EVENT_PANEL, "{\"phase\":\"refreshing\",\"bandsWritten\":%u,\"bandsSkipped\":%u}",
+                  (unsigned) panelFrame.bandsWritten, (unsigned) panelFrame.bandsSkipped);
+        LOG_I("[TIMING] Starting display.refresh()...");
+        // Can outlast a wrap of the cycle counter, so the duration comes from micros()
+        uint32_t traceStart = traceNow();
+        uint32_t refreshStart = micros();
+        display.refresh();
+        traceRecord(SPAN_REFRESH, traceStart, micros() - refreshStart);
+        LOG_I("[TIMING] Display refresh: %lu ms", millis() - t0);
+        panelFrame.refreshed = true;
+    }
+
+    // Only a fully written frame makes controller RAM a trustworthy reference
+    panelCacheValid = complete;
+    if (!complete) memset(panelBandKnown, 0, sizeof(panelBandKnown));
+    panelPhase = PANEL_IDLE;
+
+    lastPanelFrame = panelFrame;
+    panelFrameCount++;
+    // Ready for the next frame
+    postEvent(EVENT_PANEL, "{\"phase\":\"idle\",\"refreshed\":%s,\"cancelled\":%s,\"refreshMs\":%u}",
+              panelFrame.refreshed ? "true" : "false", panelFrame.cancelled ? "true" : "false",
+              panelFrame.refreshed ? (unsigned) (millis() - panelFrame.refreshStartedAt) : 0u);
+    LOG_I("[DISPLAY] Bands written: %u, skipped: %u", (unsigned) panelFrame.bandsWritten,
+          (unsigned) panelFrame.bandsSkipped);
+}
 
 void clearDisplay() {
-    debug.println("[DISPLAY] Initiating display clear operation");
-    debug.println("[DISPLAY] Clearing Display...");
+    flushPanelBands();
+    LOG_I("[DISPLAY] Initiating display clear operation");
+    LOG_I("[DISPLAY] Clearing Display...");
     display.setFullWindow();
     display.firstPage();
     do {
         display.fillScreen(GxEPD_WHITE);
     } while (display.nextPage());
     // display.clearScreen();
-    debug.println("[DISPLAY] Display Cleared.");
-    debug.println("[DISPLAY] Display clear operation completed");
+    invalidatePanelCache();
+    LOG_I("[DISPLAY] Display Cleared.");
+    LOG_I("[DISPLAY] Display clear operation completed");
 }
 
-void showSelectedImage() {
+bool showSelectedImage(DitherMode dither) {
     unsigned long t0 = millis();
-    Serial.println("[DISPLAY] === Starting image rendering ===");
-    drawProgmemFileFromSpiffs(SELECTED_IMAGE_BUFFER_PATH, 640, 384);
-    Serial.println("[DISPLAY] === Rendering completed in " + String(millis() - t0) + " ms ===");
-}
-
-void handleDisplayJob() {
-    if (isImageRefreshPending) {
-        debug.println("[DISPLAY] Scheduling display refresh job");
-        debug.println("[DISPLAY] Image refresh pending. Scheduling display job...");
-        displayJobStart = millis();  // Save current time for delay countdown
-        isImageRefreshPending = false;
-        isDisplayJobScheduled = true;
-        debug.println("[DISPLAY] Job scheduled with 2000ms delay from: " + String(displayJobStart) + "ms");
-    }
-    if (isDisplayJobScheduled && (millis() - displayJobStart >= 100UL)) {
-        debug.println("[DISPLAY] Executing scheduled display job...");
-        isDisplayJobScheduled = false;
-        showSelectedImage();
-        debug.println("[DISPLAY] Display job completed.");
-    }
+    LOG_I("[DISPLAY] === Starting image rendering ===");
+    // Pinned so an upload cannot evict the image while it is drawn
+    String etag;
+    String path = pinSelectedImage(etag);
+    bool drawn = path.length() && drawImageFromSpiffs(path.c_str(), 640, 384, dither);
+    unpinImage();
+    if (!path.length()) LOG_W("[DISPLAY] No image selected");
+    setDisplayedImageEtag(drawn ? etag.c_str() : "");
+    LOG_I("[DISPLAY] === Rendering completed in %lu ms ===", millis() - t0);
+    return drawn;
 }
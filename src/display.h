@@ -5,18 +5,92 @@
 #include <GxEPD2_3C.h>
 #include <SPI.h>
 #include "config.h"
+#include "dither.h"
+#include "mock_panel.h"
+#include "panel_spi.h"
+#include "benchmark.h"
 
-extern GxEPD2_3C<GxEPD2_750c, GxEPD2_750c::HEIGHT> display;
+#if PANEL_MOCK
+typedef MockPanel PanelDriver;
+#else
+typedef BulkPanel PanelDriver;
+#endif
+
+extern GxEPD2_3C<PanelDriver, PanelDriver::HEIGHT> display;
 extern SPIClass hspi;
 
-extern bool isImageRefreshPending;
-extern bool isDisplayJobScheduled;
-extern unsigned long displayJobStart;
+// Dither mode of the last upload or draw of an RGB565 image
+extern DitherMode renderDitherMode;
 
-void clearDisplay();
+// Dither mode from the request's ?dither= parameter, or `fallback`
+DitherMode requestDitherMode(AsyncWebServerRequest *request, DitherMode fallback);
+
+/**
+ * Brings up the panel's SPI bus and controller. `diagBitrate` 0 keeps GxEPD2
+ * from (re)starting Serial for its diagnostics, which is what a caller running
+ * next to other tasks that log wants.
+ */
+void initPanel(uint32_t diagBitrate);
+
+// Serializes panel access between loop() and background render tasks.
+// A binary semaphore, so it may be released by a different task than took it.
+void initDisplayLock();
+bool lockDisplay(uint32_t waitMs);
+void unlockDisplay();
+
+struct PanelFrameStats {
+    uint16_t bandsWritten;
+    uint16_t bandsSkipped;
+    bool refreshed;
+    bool cancelled;
+    uint32_t refreshStartedAt;  // millis(), 0 without refresh
+};
+
+// Result of the last beginPanelFrame()/endPanelFrame() cycle
+extern PanelFrameStats lastPanelFrame;
+// Number of endPanelFrame() calls so far
+extern uint32_t panelFrameCount;
+
+enum PanelPhase : uint8_t {
+    PANEL_IDLE,
+    PANEL_WRITING,    // between beginPanelFrame() and the refresh
+    PANEL_REFRESHING
+};
 
-void showSelectedImage();
+extern volatile PanelPhase panelPhase;
+
+const char *panelPhaseName(PanelPhase phase);
+
+/**
+ * Full-width frame writes go through these. A CRC32 of every band of
+ * RENDER_BATCH_ROWS rows last written to controller RAM is kept, so bands
+ * that did not change are not sent again and an unchanged frame is not
+ * refreshed at all.
+ */
+void beginPanelFrame();
+void writePanelBand(const uint8_t *mono, const uint8_t *color, uint16_t y, uint16_t rows);
+// Waits for the frame's queued bands and adds their time on the wire to `timing`
+void finishPanelWrites(PipelineTiming &timing);
+// `complete` is false when the frame was cut short; the refresh still happens unless cancelled
+void endPanelFrame(bool complete);
+
+// Bands written or skipped so far in the current frame
+uint16_t panelFrameBandsDone();
+
+/**
+ * Stops the frame being written: further bands are dropped and endPanelFrame()
+ * skips the refresh. Safe from any task. Returns false if the refresh has
+ * already started (or no frame is being written).
+ */
+bool cancelPanelFrame();
+bool panelFrameCancelled();
+
+// Forget what controller RAM holds, e.g. after drawing outside the band writer
+void invalidatePanelCache();
+
+void clearDisplay();
 
-void handleDisplayJob();
+// Draws the stored image; true when the whole frame was drawn
+bool showSelectedImage(DitherMode dither);
 
 #endif
@@ -0,0 +1,196 @@
+// dither.cpp
+#include "dither.h"
+#include "pixel_kernel.h"
+
+// Left/right padding so diffusion never needs bounds checks
+static const uint8_t error_padding = 2;
+
+static const uint8_t bayer4[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5}
+};
+
+const char *ditherModeName(DitherMode mode) {
+    switch (mode) {
+        case DITHER_BAYER:
+            return "bayer";
+        case DITHER_FLOYD_STEINBERG:
+            return "floyd-steinberg";
+        case DITHER_ATKINSON:
+            return "atkinson";
+        default:
+            return "none";
+    }
+}
+
+DitherMode parseDitherMode(const String &name, DitherMode fallback) {
+    if (name == "none") return DITHER_NONE;
+    if (name == "bayer") return DITHER_BAYER;
+    if (name == "fs" || name == "floyd-steinberg") return DITHER_FLOYD_STEINBERG;
+    if (name == "atkinson") return DITHER_ATKINSON;
+    return fallback;
+}
+
+// Nearest of black, white and red by squared RGB distance, reduced to comparisons:
+// red beats black when r >= 128, then white beats red when g + b >= 255;
+// otherwise white beats black when r + g + b > 382.
+static inline uint8_t nearestPaletteColor(int16_t r, int16_t g, int16_t b) {
+    if (r >= 128) {
+        return (g + b >= 255) ? PIXEL_WHITE : PIXEL_COLOR;
+    }
+    return (r + g + b > 382) ? PIXEL_WHITE : PIXEL_BLACK;
+}
+
+static inline int16_t clampChannel(int16_t v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// RGB565 to full-range 8-bit channels
+static inline void expandRgb565(uint16_t p, int16_t &r, int16_t &g, int16_t &b) {
+    uint8_t r5 = p >> 11;
+    uint8_t g6 = (p >> 5) & 0x3F;
+    uint8_t b5 = p & 0x1F;
+    r = (r5 << 3) | (r5 >> 2);
+    g = (g6 << 2) | (g6 >> 4);
+    b = (b5 << 3) | (b5 >> 2);
+}
+
+Rgb565Converter::Rgb565Converter()
+    : mode(DITHER_NONE), width(0), row(0), errorRows(nullptr), errorRowCount(0), ownsErrorRows(false) {
+}
+
+Rgb565Converter::~Rgb565Converter() {
+    end();
+}
+
+bool Rgb565Converter::begin(uint16_t width, DitherMode mode, RenderArena *arena) {
+    end();
+    this->width = width;
+    this->mode = mode;
+    row = 0;
+
+    if (mode == DITHER_FLOYD_STEINBERG) errorRowCount = 2;
+    else if (mode == DITHER_ATKINSON) errorRowCount = 3;
+    else errorRowCount = 0;
+
+    if (errorRowCount) {
+        // 3 channels per pixel, errors in 1/16 units
+        size_t size = (size_t) errorRowCount * (width + 2 * error_padding) * 3 * sizeof(int16_t);
+        errorRows = (int16_t *) (arena ? arena->alloc(size) : malloc(size));
+        ownsErrorRows = !arena;
+        if (!errorRows) {
+            errorRowCount = 0;
+            return false;
+        }
+        memset(errorRows, 0, size);
+    }
+    return true;
+}
+
+void Rgb565Converter::end() {
+    if (errorRows && ownsErrorRows) free(errorRows);
+    errorRows = nullptr;
+    errorRowCount = 0;
+}
+
+// Error row for image row `row + ahead`, pointing at pixel 0
+int16_t *Rgb565Converter::errorRow(uint8_t ahead) {
+    size_t stride = (size_t)(width + 2 * error_padding) * 3;
+    return errorRows + ((row + ahead) % errorRowCount) * stride + error_padding * 3;
+}
+
+void Rgb565Converter::convertRowBayer(const uint8_t *src, uint8_t *mono, uint8_t *color) {
+    const uint8_t *thresholds = bayer4[row & 3];
+
+    for (uint16_t x = 0; x < width; x += 8) {
+        uint8_t black = 0;
+        uint8_t red = 0;
+        for (uint8_t i = 0; i < 8; i++, src += 2) {
+            int16_t r, g, b;
+            expandRgb565(src[0] | (src[1] << 8), r, g, b);
+            // Spread the threshold over the full channel range
+            int16_t offset = ((thresholds[(x + i) & 3] * 2 + 1) * 255) / 32 - 128;
+            uint8_t c = nearestPaletteColor(r + offset, g + offset, b + offset);
+            black = (black << 1) | (c & PIXEL_BLACK);
+            red = (red << 1) | ((c & PIXEL_COLOR) >> 1);
+        }
+        *mono++ = ~black;
+        *color++ = ~red;
+    }
+}
+
+void Rgb565Converter::convertRowDiffused(const uint8_t *src, uint8_t *mono, uint8_t *color) {
+    // The slot of the previous row becomes the farthest row ahead
+    size_t stride = (size_t)(width + 2 * error_padding) * 3;
+    memset(errorRow(errorRowCount - 1) - error_padding * 3, 0, stride * sizeof(int16_t));
+
+    int16_t *cur = errorRow(0);
+    int16_t *next = errorRow(1);
+    int16_t *next2 = errorRowCount > 2 ? errorRow(2) : nullptr;
+
+    for (uint16_t x = 0; x < width; x += 8) {
+        uint8_t black = 0;
+        uint8_t red = 0;
+        for (uint8_t i = 0; i < 8; i++, src += 2) {
+            int16_t *e = cur + (x + i) * 3;
+            int16_t *n = next + (x + i) * 3;
+            int16_t v[3];
+            expandRgb565(src[0] | (src[1] << 8), v[0], v[1], v[2]);
+            for (uint8_t ch = 0; ch < 3; ch++) {
+                v[ch] = clampChannel(v[ch] + ((e[ch] + 8) >> 4));
+            }
+
+            uint8_t c = nearestPaletteColor(v[0], v[1], v[2]);
+            black = (black << 1) | (c & PIXEL_BLACK);
+            red = (red << 1) | ((c & PIXEL_COLOR) >> 1);
+
+            int16_t target[3] = {
+                (int16_t)(c == PIXEL_BLACK ? 0 : 255),
+                (int16_t)(c == PIXEL_WHITE ? 255 : 0),
+                (int16_t)(c == PIXEL_WHITE ? 255 : 0)
+            };
+
+            for (uint8_t ch = 0; ch < 3; ch++) {
+                int16_t err = v[ch] - target[ch];
+                if (mode == DITHER_FLOYD_STEINBERG) {
+                    e[3 + ch] += err * 7;
+                    n[-3 + ch] += err * 3;
+                    n[ch] += err * 5;
+                    n[3 + ch] += err;
+                } else {
+                    // Atkinson: 1/8 of the error to each neighbour, the rest is dropped
+                    int16_t share = err * 2;
+                    e[3 + ch] += share;
+                    e[6 + ch] += share;
+                    n[-3 + ch] += share;
+                    n[ch] += share;
+                    n[3 + ch] += share;
+                    next2[(x + i) * 3 + ch] += share;
+                }
+            }
+        }
+        *mono++ = ~black;
+        *color++ = ~red;
+    }
+}
+
+void Rgb565Converter::convertRows(const uint8_t *src, uint8_t *mono, uint8_t *color, uint16_t rows) {
+    if (mode == DITHER_NONE || (mode != DITHER_BAYER && !errorRows)) {
+        convertRgb565Rows(src, mono, color, width, rows);
+        row += rows;
+        return;
+    }
+
+    const size_t rowBytes = width / 8;
+    const size_t rowSize = width * sizeof(uint16_t);
+    for (uint16_t i = 0; i < rows; i++, row++) {
+        const uint8_t *rowData = src + i * rowSize;
+        if (mode == DITHER_BAYER) {
+            convertRowBayer(rowData, mono + i * rowBytes, color + i * rowBytes);
+        } else {
+            convertRowDiffused(rowData, mono + i * rowBytes, color + i * rowBytes);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef DITHER_H
+#define DITHER_H
+
+#include <Arduino.h>
+#include "render_arena.h"
+
+enum DitherMode : uint8_t {
+    DITHER_NONE,            // hard thresholds, see pixel_kernel.h
+    DITHER_BAYER,           // ordered 4x4 Bayer matrix
+    DITHER_FLOYD_STEINBERG, // error diffusion to 4 neighbours
+    DITHER_ATKINSON         // error diffusion of 3/4 of the error to 6 neighbours
+};
+
+const char *ditherModeName(DitherMode mode);
+
+// Accepts "none", "bayer", "fs"/"floyd-steinberg" and "atkinson"; unknown names map to `fallback`
+DitherMode parseDitherMode(const String &name, DitherMode fallback = DITHER_NONE);
+
+/**
+ * Streaming RGB565 to panel plane converter for the black/white/red palette.
+ * Rows must be fed top to bottom; error diffusion state is kept in
+ * fixed-point error rows of the image width (2 rows for Floyd-Steinberg,
+ * 3 for Atkinson), so any batch size works without a frame buffer.
+ * DITHER_NONE uses the lookup-table kernel and keeps its exact output.
+ */
+class Rgb565Converter {
+private:
+    DitherMode mode;
+    uint16_t width;
+    uint16_t row;
+    int16_t *errorRows;
+    uint8_t errorRowCount;
+    bool ownsErrorRows;
+
+    int16_t *errorRow(uint8_t ahead);
+    void convertRowBayer(const uint8_t *src, uint8_t *mono, uint8_t *color);
+    void convertRowDiffused(const uint8_t *src, uint8_t *mono, uint8_t *color);
+
+public:
+    Rgb565Converter();
+    ~Rgb565Converter();
+
+    // Error rows come from `arena` if given (released with it), else from the heap
+    bool begin(uint16_t width, DitherMode mode, RenderArena *arena = nullptr);
+    void end();
+    void convertRows(const uint8_t *src, uint8_t *mono, uint8_t *color, uint16_t rows);
+
+    DitherMode ditherMode() const { return mode; }
+};
+
+#endif
@@ -0,0 +1,146 @@
+// events.cpp
+#include "events.h"
+#include "display.h"
+#include "filesystem.h"
+#include "image_store.h"
+#include "debug.h"
+#include <stdarg.h>
+
+struct DeviceEvent {
+    uint8_t type;
+    char data[EVENT_DATA_SIZE];
+};
+
+static AsyncEventSource eventSource("/api/events");
+static QueueHandle_t eventQueue = nullptr;
+
+// Clients are added and removed on the AsyncTCP task and sent to from loop();
+// recursive because close() can report the disconnect on the calling task
+static SemaphoreHandle_t clientLock = nullptr;
+static AsyncEventSourceClient *clients[EVENTS_MAX_CLIENTS];
+static volatile uint8_t clientCount = 0;
+
+static uint32_t nextEventId = 1;
+static EventStats stats;
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+const char *deviceEventName(DeviceEventType type) {
+    switch (type) {
+        case EVENT_UPLOAD:
+            return "upload";
+        case EVENT_JOB:
+            return "job";
+        case EVENT_PANEL:
+            return "panel";
+        default:
+            return "error";
+    }
+}
+
+String eventString(const String &value) {
+    String escaped = value;
+    escaped.replace("\\", "\\\\");
+    escaped.replace("\"", "\\\"");
+    return escaped;
+}
+
+// Called with clientLock held
+static bool removeClient(AsyncEventSourceClient *client) {
+    for (uint8_t i = 0; i < clientCount; i++) {
+        if (clients[i] != client) continue;
+        clients[i] = clients[--clientCount];
+        return true;
+    }
+    return false;
+}
+
+static void onConnect(AsyncEventSourceClient *client) {
+    xSemaphoreTakeRecursive(clientLock, portMAX_DELAY);
+    bool added = clientCount < EVENTS_MAX_CLIENTS;
+    if (added) clients[clientCount++] = client;
+    xSemaphoreGiveRecursive(clientLock);
+    if (!added) {
+        LOG_W("[EVENTS] Too many clients, refusing one");
+        client->close();
+        return;
+    }
+
+    // Where things stand, so a client does not have to poll /api/status first
+    char hello[EVENT_DATA_SIZE];
+    snprintf(hello, sizeof(hello),
+             "{\"phase\":\"%s\",\"slot\":\"%s\",\"displayedEtag\":\"%s\",\"frames\":%u,\"uptimeMs\":%u}",
+             panelPhaseName(panelPhase), selectedImageSlot().c_str(), eventString(displayedImageEtag()).c_str(),
+             (unsigned) panelFrameCount, (unsigned) millis());
+    // No id: it is not one of the numbered events; the retry asks browsers to reconnect after 5 s
+    client->send(hello, "hello", 0, 5000);
+    LOG_I("[EVENTS] Client connected, %u in total", (unsigned) clientCount);
+}
+
+static void onDisconnect(AsyncEventSourceClient *client) {
+    xSemaphoreTakeRecursive(clientLock, portMAX_DELAY);
+    removeClient(client);
+    xSemaphoreGiveRecursive(clientLock);
+}
+
+void initEvents(AsyncWebServer &server) {
+    if (!eventQueue) eventQueue = xQueueCreate(EVENTS_QUEUE_LENGTH, sizeof(DeviceEvent));
+    if (!clientLock) clientLock = xSemaphoreCreateRecursiveMutex();
+    eventSource.onConnect(onConnect);
+    eventSource.onDisconnect(onDisconnect);
+    server.addHandler(&eventSource);
+}
+
+void postEvent(DeviceEventType type, const char *format, ...) {
+    if (!eventQueue || clientCount == 0) return;
+
+    DeviceEvent event;
+    event.type = type;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(event.data, sizeof(event.data), format, args);
+    va_end(args);
+
+    bool queued = xQueueSend(eventQueue, &event, 0) == pdTRUE;
+    portENTER_CRITICAL(&statsLock);
+    if (queued) stats.posted++;
+    else stats.dropped++;
+    portEXIT_CRITICAL(&statsLock);
+}
+
+void drainEvents() {
+    if (!eventQueue) return;
+    static DeviceEvent event;
+    while (xQueueReceive(eventQueue, &event, 0) == pdTRUE) {
+        uint32_t id = nextEventId++;
+        uint32_t dropped = 0;
+
+        xSemaphoreTakeRecursive(clientLock, portMAX_DELAY);
+        for (uint8_t i = 0; i < clientCount;) {
+            AsyncEventSourceClient *client = clients[i];
+            if (client->packetsWaiting() >= EVENTS_CLIENT_MAX_QUEUED) {
+                // Too slow: its backlog would only grow, and costs heap for every event
+                removeClient(client);
+                client->close();
+                dropped++;
+                continue;
+            }
+            client->send(event.data, deviceEventName((DeviceEventType) event.type), id);
+            i++;
+        }
+        xSemaphoreGiveRecursive(clientLock);
+
+        if (dropped) LOG_W("[EVENTS] Dropped %u slow clients", (unsigned) dropped);
+        portENTER_CRITICAL(&statsLock);
+        stats.sent++;
+        stats.clientsDropped += dropped;
+        portEXIT_CRITICAL(&statsLock);
+    }
+}
+
+EventStats eventStats() {
+    portENTER_CRITICAL(&statsLock);
+    EventStats copy = stats;
+    portEXIT_CRITICAL(&statsLock);
+    copy.clients = clientCount;
+    return copy;
+}
@@ -0,0 +1,70 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Events waiting for loop() to send them; more are dropped and counted
+#ifndef EVENTS_QUEUE_LENGTH
+#define EVENTS_QUEUE_LENGTH 24
+#endif
+
+// Longest JSON payload of one event
+#ifndef EVENT_DATA_SIZE
+#define EVENT_DATA_SIZE 240
+#endif
+
+#ifndef EVENTS_MAX_CLIENTS
+#define EVENTS_MAX_CLIENTS 4
+#endif
+
+// Messages a client may have unsent before it is disconnected as too slow
+#ifndef EVENTS_CLIENT_MAX_QUEUED
+#define EVENTS_CLIENT_MAX_QUEUED 8
+#endif
+
+enum DeviceEventType : uint8_t {
+    EVENT_UPLOAD,   // upload progress and result
+    EVENT_JOB,      // render job queued, started, finished with its stage timings
+    EVENT_PANEL,    // panel writing, refreshing, idle (ready for the next frame)
+    EVENT_ERROR,
+    EVENT_TYPE_COUNT
+};
+
+const char *deviceEventName(DeviceEventType type);
+
+// `value` escaped for use inside a JSON string of an event, e.g. a quoted ETag
+String eventString(const String &value);
+
+struct EventStats {
+    uint32_t posted;
+    uint32_t dropped;         // queue full
+    uint32_t sent;            // events, counted once however many clients got them
+    uint32_t clientsDropped;  // disconnected for falling behind
+    uint8_t clients;
+};
+
+/**
+ * Adds the Server-Sent Events endpoint /api/events. A client gets a
+ * "hello" event with the current state on connect, then every event as it
+ * happens, each with an increasing id.
+ */
+void initEvents(AsyncWebServer &server);
+
+/**
+ * Queues an event with a JSON payload formatted like printf. Safe from any
+ * task and never blocks: when the queue is full the event is dropped. Does
+ * nothing while no client is connected.
+ */
+void postEvent(DeviceEventType type, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Sends the queued events to every client, in loop(). A client with more
+ * than EVENTS_CLIENT_MAX_QUEUED messages still unsent is disconnected
+ * rather than buffered for; it can reconnect and start from a new hello.
+ */
+void drainEvents();
+
+EventStats eventStats();
+
+#endif
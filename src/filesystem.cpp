@@ -3,12 +3,33 @@
 #include <LittleFS.h>
 #include "config.h"
 #include "display.h"
+#include "image_stream.h"
+#include "render_scheduler.h"
+#include "esp_rom_crc.h"
+#include "trace.h"
+#include "block_writer.h"
+#include "image_store.h"
+#include "bmp_decoder.h"
+#include "upload_inflate.h"
+#include "events.h"
 
 #include "debug.h"
 #include <Arduino.h>
 
 volatile bool uploadSuccess = false;
+bool uploadUnchanged = false;
 const char* uploadErrorMessage = nullptr;
+int uploadStatusCode = 500;
+ImageFormat uploadImageFormat = IMAGE_FORMAT_UNKNOWN;
+String uploadEtag;
+uint32_t uploadRenderJob = 0;
+
+static char displayedEtag[IMAGE_SLOT_ETAG_SIZE];
+static portMUX_TYPE displayedEtagLock = portMUX_INITIALIZER_UNLOCKED;
+UploadTransferStats lastUploadTransfer;
+
+// Upload progress is pushed to event clients every this many bytes received
+static const uint32_t upload_progress_event_bytes = 64 * 1024;
 
 void listDir(fs::FS &fs, const char *dirname, uint8_t levels)
 {
@@ -56,91 +77,433 @@ String listFiles()
     return ("Directory listing sent to Serial.");
 }
 
+void setDisplayedImageEtag(const char *etag)
+{
+    portENTER_CRITICAL(&displayedEtagLock);
+    strlcpy(displayedEtag, etag, sizeof(displayedEtag));
+    portEXIT_CRITICAL(&displayedEtagLock);
+}
+
+String displayedImageEtag()
+{
+    char etag[IMAGE_SLOT_ETAG_SIZE];
+    portENTER_CRITICAL(&displayedEtagLock);
+    memcpy(etag, displayedEtag, sizeof(etag));
+    portEXIT_CRITICAL(&displayedEtagLock);
+    return String(etag);
+}
+
+String makeImageEtag(uint32_t crc, bool converted, DitherMode dither)
+{
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08x", crc);
+    String etag = String("\"") + hex;
+    if (converted) etag += "-convert";
+    if (dither != DITHER_NONE) etag += String("-") + ditherModeName(dither);
+    etag += "\"";
+    return etag;
+}
+
+bool etagMatches(const String &header, const String &etag)
+{
+    if (etag.length() == 0) return false;
+    String list = header;
+    list.trim();
+    if (list == "*") return true;
+
+    int start = 0;
+    while (start < (int) list.length())
+    {
+        int comma = list.indexOf(',', start);
+        if (comma < 0) comma = list.length();
+        String candidate = list.substring(start, comma);
+        candidate.trim();
+        if (candidate.startsWith("W/")) candidate = candidate.substring(2);
+        if (candidate == etag) return true;
+        start = comma + 1;
+    }
+    return false;
+}
+
+static ImageStreamDecoder uploadDecoder;
+static BlockWriter uploadWriter;
+static UploadInflater uploadInflater;
+
+// State of the upload in progress, shared by handleFileUpload and the inflate sink
+static uint32_t totallength;
+static uint32_t crc;
+static uint8_t head[IMAGE_DETECT_HEAD_SIZE];
+static size_t headLen;
+static bool convertUpload;
+
+// Chunk sizes of the last upload, for replay by the upload benchmark
+static uint16_t uploadChunkSizes[UPLOAD_CHUNK_TRACE_SIZE];
+static size_t uploadChunkCount = 0;
+
+size_t getUploadChunkSizes(uint16_t *sizes, size_t max)
+{
+    size_t count = min(uploadChunkCount, max);
+    memcpy(sizes, uploadChunkSizes, count * sizeof(uint16_t));
+    return count;
+}
+
+// Closes and removes the partial upload file after an error
+static void discardUploadFile(File &f)
+{
+    f.close();
+    LittleFS.remove(IMAGE_STORE_UPLOAD_PATH);
+}
+
+// Appends a converted band to the upload file: mono rows, then color rows
+static bool writeBandToFile(const uint8_t *mono, const uint8_t *color, uint16_t y, uint16_t rows, void *context)
+{
+    BlockWriter *writer = (BlockWriter *) context;
+    size_t bandBytes = (DISPLAY_WIDTH / 8) * rows;
+    return writer->write(mono, bandBytes) && writer->write(color, bandBytes);
+}
+
+// Image bytes in upload order, straight from the request or out of the inflater
+static bool storeUploadBytes(const uint8_t *data, size_t len, void *context)
+{
+    crc = esp_rom_crc32_le(crc, data, len);
+    if (convertUpload)
+    {
+        if (!uploadDecoder.push(data, len))
+        {
+            LOG_E("[FILESYSTEM] Error: Conversion failed at row %u", uploadDecoder.rowsEmitted());
+            if (!uploadWriter.ok())
+            {
+                uploadStatusCode = 507;
+                uploadErrorMessage = "Failed to write file";
+            }
+            else
+            {
+                uploadErrorMessage = "Upload is not a raw RGB565 image of the panel size";
+            }
+            return false;
+        }
+    }
+    else
+    {
+        // Keep the first bytes to detect the image format
+        if (headLen < sizeof(head))
+        {
+            size_t n = min(len, sizeof(head) - headLen);
+            memcpy(head + headLen, data, n);
+            headLen += n;
+        }
+        if (!uploadWriter.write(data, len))
+        {
+            LOG_E("[FILESYSTEM] Error: Write failed after %u bytes", (unsigned) uploadWriter.bytesWritten());
+            uploadStatusCode = 507;
+            uploadErrorMessage = "Failed to write file";
+            return false;
+        }
+    }
+    totallength += len;
+    return true;
+}
+
 void handleFileUpload(AsyncWebServerRequest *request, String filename,
                       size_t index, uint8_t *data, size_t len, bool final, String folder)
 {
-    debug.println("[FILESYSTEM] handleFileUpload called - index: " + String(index) + ", len: " + String(len) + ", final: " + String(final));
+    LOG_D("[FILESYSTEM] handleFileUpload called - index: %u, len: %u, final: %d", (unsigned) index, (unsigned) len, final);
 
-    String path;
     static File f;
-    static uint32_t totallength;
+    static String slot;
+    static bool selectSlot;
     static size_t lastindex;
+    static bool discardUpload;
+    static DitherMode ditherMode;
+    static ContentEncoding encoding;
+    static uint32_t received;
+    static uint32_t startMs;
 
     if (index == 0)
     {
         uploadSuccess = false;
+        uploadUnchanged = false;
         uploadErrorMessage = nullptr;
-        path = folder + filename;
-        debug.println("[FILESYSTEM] Starting new file upload: " + String(path.c_str()));
-        LittleFS.remove(path);
-        f = LittleFS.open(path, "w");
+        uploadStatusCode = 500;
+        uploadImageFormat = IMAGE_FORMAT_UNKNOWN;
+        uploadEtag = "";
+        uploadRenderJob = 0;
+        discardUpload = false;
+        // An upload abandoned mid-stream never reached end()
+        uploadInflater.end();
+        ditherMode = requestDitherMode(request, DITHER_NONE);
+        convertUpload = request->hasParam("convert");
+        // Content-Encoding names the encoding of the file; the multipart framing around it is plain
+        encoding = request->hasHeader("Content-Encoding") ? parseContentEncoding(request->header("Content-Encoding"))
+                                                         : ENCODING_IDENTITY;
+        // ?slot=name stores into that slot of the image store; ?noselect stores without showing it
+        slot = request->hasParam("slot") ? request->getParam("slot")->value() : String(IMAGE_STORE_DEFAULT_SLOT);
+        selectSlot = !request->hasParam("noselect");
+        if (!isValidSlotName(slot))
+        {
+            uploadStatusCode = 400;
+            uploadErrorMessage = "Invalid slot name";
+            return;
+        }
+
+        // Conditional uploads against the ETag of the image stored in the slot
+        String slotEtag = imageSlotEtag(slot);
+        if (request->hasHeader("If-Match") && !etagMatches(request->header("If-Match"), slotEtag))
+        {
+            LOG_I("[FILESYSTEM] If-Match failed, current ETag: %s", slotEtag.c_str());
+            uploadStatusCode = 412;
+            uploadErrorMessage = "Stored image does not match If-Match";
+            return;
+        }
+        if (request->hasHeader("If-None-Match") && etagMatches(request->header("If-None-Match"), slotEtag))
+        {
+            LOG_I("[FILESYSTEM] If-None-Match hit, discarding upload body");
+            uploadStatusCode = 304;
+            uploadEtag = slotEtag;
+            discardUpload = true;
+            return;
+        }
+        if (encoding != ENCODING_IDENTITY && !uploadInflaterAvailable())
+        {
+            uploadStatusCode = 415;
+            uploadErrorMessage = "Compressed uploads are not available";
+            return;
+        }
+
+        // Written next to the stored images and moved into the store at the end. LittleFS cannot
+        // reserve space for a file, so the size to store (from Content-Length, which includes the
+        // multipart framing) is made free up front instead, evicting least recently shown slots
+        size_t storeBytes = convertUpload ? PANEL_IMAGE_HEADER_SIZE + panelPlanesDataSize(DISPLAY_WIDTH, DISPLAY_HEIGHT)
+                                          : request->contentLength();
+        if (encoding != ENCODING_IDENTITY && !convertUpload)
+        {
+            // The inflated size is only known at the end; assume a raw RGB565 frame
+            storeBytes = max(storeBytes, (size_t) DISPLAY_WIDTH * DISPLAY_HEIGHT * 2);
+        }
+        LittleFS.remove(IMAGE_STORE_UPLOAD_PATH);
+        if (!reserveImageSpace(storeBytes + 8192, slot))
+        {
+            LOG_E("[FILESYSTEM] Error: Upload of %u bytes does not fit in %u free bytes",
+                  (unsigned) storeBytes, (unsigned) (LittleFS.totalBytes() - LittleFS.usedBytes()));
+            uploadStatusCode = 507;
+            uploadErrorMessage = "Not enough space for the upload";
+            return;
+        }
+
+        LOG_I("[FILESYSTEM] Starting new file upload into slot %s", slot.c_str());
+        f = LittleFS.open(IMAGE_STORE_UPLOAD_PATH, "w");
         if (!f)
         {
-            debug.println("[FILESYSTEM] Error: Failed to create output file");
+            LOG_E("[FILESYSTEM] Error: Failed to create output file");
             uploadErrorMessage = "Failed to create output file";
             return;
         }
+        if (!uploadWriter.begin(f))
+        {
+            LOG_E("[FILESYSTEM] Error: Failed to allocate write buffer");
+            uploadErrorMessage = "Failed to allocate write buffer";
+            discardUploadFile(f);
+            return;
+        }
         totallength = 0;
         lastindex = 0;
+        headLen = 0;
+        crc = 0;
+        uploadChunkCount = 0;
+        received = 0;
+        startMs = millis();
+
+        // ?convert: transcode RGB565 to panel planes on the fly and store only the planes
+        if (convertUpload)
+        {
+            LOG_I("[FILESYSTEM] Converting RGB565 upload to panel planes");
+            PanelImageHeader header;
+            header.version = PANEL_IMAGE_VERSION;
+            header.encoding = PANEL_ENCODING_PLANES;
+            header.width = DISPLAY_WIDTH;
+            header.height = DISPLAY_HEIGHT;
+            header.bandRows = RENDER_BATCH_ROWS;
+            header.dataSize = panelPlanesDataSize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+            uint8_t headerData[PANEL_IMAGE_HEADER_SIZE];
+            writePanelImageHeader(headerData, header);
+            // Detect the format from what is stored, not what was received
+            memcpy(head, headerData, sizeof(headerData));
+            headLen = sizeof(headerData);
+
+            if (!uploadWriter.write(headerData, sizeof(headerData)) ||
+                !uploadDecoder.begin(DISPLAY_WIDTH, DISPLAY_HEIGHT, RENDER_BATCH_ROWS, writeBandToFile, &uploadWriter, ditherMode))
+            {
+                LOG_E("[FILESYSTEM] Error: Failed to start upload conversion");
+                uploadErrorMessage = "Failed to start conversion";
+                discardUploadFile(f);
+                return;
+            }
+        }
+
+        if (encoding != ENCODING_IDENTITY)
+        {
+            LOG_I("[FILESYSTEM] Inflating %s upload", contentEncodingName(encoding));
+            if (!uploadInflater.begin(encoding, storeUploadBytes, nullptr))
+            {
+                LOG_E("[FILESYSTEM] Error: Inflater busy");
+                uploadStatusCode = 503;
+                uploadErrorMessage = "Inflater busy";
+                if (convertUpload) uploadDecoder.end();
+                discardUploadFile(f);
+                return;
+            }
+        }
     }
 
-    if (uploadErrorMessage) return; // Skip if upload already failed
+    if (uploadErrorMessage || discardUpload) return; // Skip if upload already failed or is not needed
 
     if (len) // Something to write?
     {
-        debug.println("[FILESYSTEM] Writing chunk of " + String(len) + " bytes to " + String(filename.c_str()));
+        TraceScope chunkTrace(SPAN_UPLOAD_CHUNK, len);
+        LOG_D("[FILESYSTEM] Writing chunk of %u bytes to %s", (unsigned) len, filename.c_str());
         if ((index != lastindex) || (index == 0)) // New chunk?
         {
-            f.write(data, len);
-            totallength += len;
+            if (uploadChunkCount < UPLOAD_CHUNK_TRACE_SIZE)
+            {
+                uploadChunkSizes[uploadChunkCount++] = min(len, (size_t) UINT16_MAX);
+            }
+            received += len;
+            if (received / upload_progress_event_bytes != (received - len) / upload_progress_event_bytes)
+            {
+                postEvent(EVENT_UPLOAD, "{\"state\":\"receiving\",\"slot\":\"%s\",\"received\":%u,\"total\":%u}",
+                          slot.c_str(), (unsigned) received, (unsigned) request->contentLength());
+            }
+            bool stored = encoding == ENCODING_IDENTITY ? storeUploadBytes(data, len, nullptr)
+                                                        : uploadInflater.push(data, len);
+            if (!stored)
+            {
+                if (!uploadErrorMessage)
+                {
+                    uploadStatusCode = 400;
+                    uploadErrorMessage = "Compressed upload is corrupt";
+                }
+                if (convertUpload) uploadDecoder.end();
+                uploadInflater.end();
+                discardUploadFile(f);
+                return;
+            }
             lastindex = index;
-            debug.println("Written " + String(len) + " bytes to " + String(filename.c_str()));
+            LOG_D("Written %u bytes to %s", (unsigned) len, filename.c_str());
         }
     }
 
     if (final)
     {
-        if (uploadErrorMessage) return; // Upload already failed
+        if (encoding != ENCODING_IDENTITY)
+        {
+            bool inflated = uploadInflater.finish();
+            uploadInflater.end();
+            if (!inflated)
+            {
+                uploadStatusCode = 400;
+                uploadErrorMessage = "Compressed upload is truncated or corrupt";
+                if (convertUpload) uploadDecoder.end();
+                discardUploadFile(f);
+                return;
+            }
+        }
+        lastUploadTransfer.encoding = encoding;
+        lastUploadTransfer.receivedBytes = received;
+        lastUploadTransfer.inflatedBytes = encoding != ENCODING_IDENTITY ? uploadInflater.inflatedBytes() : 0;
+        lastUploadTransfer.inflateMicros = encoding != ENCODING_IDENTITY ? uploadInflater.inflateTime() : 0;
+        lastUploadTransfer.durationMs = millis() - startMs;
+        if (encoding != ENCODING_IDENTITY)
+        {
+            uint32_t us = max(lastUploadTransfer.inflateMicros, (uint32_t) 1);
+            LOG_I("[FILESYSTEM] Inflated %u to %u bytes (%u.%02ux) in %u us, %u KB/s; upload took %u ms",
+                  (unsigned) received, (unsigned) lastUploadTransfer.inflatedBytes,
+                  (unsigned) (lastUploadTransfer.inflatedBytes / max(received, (uint32_t) 1)),
+                  (unsigned) (lastUploadTransfer.inflatedBytes * 100ULL / max(received, (uint32_t) 1) % 100),
+                  (unsigned) us, (unsigned) (lastUploadTransfer.inflatedBytes * 1000ULL / us),
+                  (unsigned) lastUploadTransfer.durationMs);
+        }
 
-        f.close();
-        debug.println("[FILESYSTEM] Upload completed: " + String(filename.c_str()) + " (Total: " + String(totallength) + " bytes)");
+        if (convertUpload)
+        {
+            bool complete = uploadDecoder.finish();
+            uploadDecoder.end();
+            if (!complete)
+            {
+                LOG_E("[FILESYSTEM] ERROR: Upload ended after %u rows", uploadDecoder.rowsEmitted());
+                uploadErrorMessage = "Upload is not a raw RGB565 image of the panel size";
+                discardUploadFile(f);
+                return;
+            }
+        }
 
-        // Wait a moment for LittleFS to flush
-        delay(100);
+        // Verify from the byte count the file accepted as it was written, instead of reading it back.
+        // A short write or a failed flush shows there; the CRC of the accepted bytes would always
+        // match the upload's, since both are taken over the same buffers
+        bool written = uploadWriter.flush();
+        size_t fileSize = uploadWriter.bytesWritten();
+        f.close();
+        LOG_I("[FILESYSTEM] Upload completed: %s (Total: %u bytes, %u bytes in %u writes, %u programmed)",
+              filename.c_str(), (unsigned) totallength, (unsigned) fileSize, (unsigned) uploadWriter.writeCalls(),
+              (unsigned) uploadWriter.programmedBytes());
 
-        // Verify the file is readable and has correct size
-        debug.println("[FILESYSTEM] Verifying uploaded file...");
-        path = folder + filename;
-        File verifyFile = LittleFS.open(path, "r");
-        if (!verifyFile) {
-            debug.println("[FILESYSTEM] ERROR: Cannot open file for verification!");
+        size_t expectedSize = convertUpload ? PANEL_IMAGE_HEADER_SIZE + panelPlanesDataSize(DISPLAY_WIDTH, DISPLAY_HEIGHT)
+                                            : totallength;
+        if (!written || fileSize != expectedSize)
+        {
+            LOG_E("[FILESYSTEM] ERROR: Stored %u of %u bytes", (unsigned) fileSize, (unsigned) expectedSize);
+            uploadStatusCode = 507;
             uploadErrorMessage = "File verification failed";
+            LittleFS.remove(IMAGE_STORE_UPLOAD_PATH);
             return;
         }
 
-        size_t fileSize = verifyFile.size();
-        debug.println("[FILESYSTEM] Verified file size: " + String(fileSize) + " bytes");
-
-        // Try reading first few bytes to ensure file is readable
-        uint8_t testBuffer[128];
-        size_t testRead = verifyFile.read(testBuffer, sizeof(testBuffer));
-        verifyFile.close();
-
-        debug.println("[FILESYSTEM] Test read: " + String(testRead) + " bytes from start of file");
+        uploadImageFormat = detectImageFormat(head, headLen, fileSize, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+        LOG_I("[FILESYSTEM] Detected image format: %s", imageFormatName(uploadImageFormat));
+        if (uploadImageFormat == IMAGE_FORMAT_UNKNOWN) {
+            LOG_E("[FILESYSTEM] ERROR: Unsupported image format or size!");
+            uploadStatusCode = 415;
+            uploadErrorMessage = "Unsupported image format";
+            LittleFS.remove(IMAGE_STORE_UPLOAD_PATH);
+            return;
+        }
 
-        if (testRead == 0) {
-            debug.println("[FILESYSTEM] ERROR: File appears empty or unreadable!");
-            uploadErrorMessage = "File unreadable";
+        uploadEtag = makeImageEtag(crc, convertUpload, ditherMode);
+        if (uploadEtag == imageSlotEtag(slot) && (!selectSlot || slot == selectedImageSlot()) &&
+            slotHoldsContent(slot, IMAGE_STORE_UPLOAD_PATH, fileSize))
+        {
+            // Same bytes, same options: keep the stored image and skip the refresh. The bytes are
+            // compared, as a matching ETag is only a matching CRC; a collision is stored as usual
+            LOG_I("[FILESYSTEM] Upload identical to stored image (ETag %s)", uploadEtag.c_str());
+            LittleFS.remove(IMAGE_STORE_UPLOAD_PATH);
+            uploadStatusCode = 200;
+            uploadSuccess = true;
+            uploadUnchanged = true;
             return;
         }
 
-        debug.println("[FILESYSTEM] File verification successful");
-        debug.println("[FILESYSTEM] Setting image refresh flag...");
-        isImageRefreshPending = true;
+        uint16_t imageWidth = DISPLAY_WIDTH;
+        uint16_t imageHeight = DISPLAY_HEIGHT;
+        BmpInfo bmp;
+        if (uploadImageFormat == IMAGE_FORMAT_BMP && parseBmpHeader(head, headLen, fileSize, bmp))
+        {
+            imageWidth = bmp.width;
+            imageHeight = bmp.height;
+        }
+        if (!storeImage(slot, IMAGE_STORE_UPLOAD_PATH, uploadWriter.writtenCrc(), fileSize, uploadImageFormat,
+                        imageWidth, imageHeight, uploadEtag, selectSlot))
+        {
+            uploadErrorMessage = "Failed to store image";
+            return;
+        }
+        uploadStatusCode = 200;
         uploadSuccess = true;
-        debug.println("[FILESYSTEM] Image refresh flag set to TRUE");
+        if (!selectSlot) return;
+
+        renderDitherMode = ditherMode;
+        uploadRenderJob = requestRender(JOB_SOURCE_UPLOAD, ditherMode, false);
+        LOG_I("[FILESYSTEM] Render job %u queued", (unsigned) uploadRenderJob);
     }
-    debug.println("[FILESYSTEM] Upload progress: " + String(totallength) + " bytes written");
+    LOG_D("[FILESYSTEM] Upload progress: %u bytes written", (unsigned) totallength);
 }
 
 void handleImageFileUpload(AsyncWebServerRequest *request, String filename,
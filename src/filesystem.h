@@ -3,9 +3,50 @@
 
 #include <FS.h>
 #include <ESPAsyncWebServer.h>
+#include "panel_format.h"
+#include "dither.h"
+#include "upload_inflate.h"
+#include "image_store.h"
 
 extern volatile bool uploadSuccess;
+extern bool uploadUnchanged;          // upload matched the stored image, nothing was replaced
 extern const char* uploadErrorMessage;
+extern int uploadStatusCode;          // HTTP status for the upload response
+extern ImageFormat uploadImageFormat;
+extern String uploadEtag;
+extern uint32_t uploadRenderJob;      // render job queued by the upload, 0 if none
+
+// Transfer of the last completed upload, to weigh compression against raw transfer time
+struct UploadTransferStats {
+    ContentEncoding encoding;
+    uint32_t receivedBytes;   // file bytes as sent, compressed or not
+    uint32_t inflatedBytes;   // 0 for uncompressed uploads
+    uint32_t inflateMicros;   // time in the inflater, storing excluded
+    uint32_t durationMs;      // first chunk to last
+};
+extern UploadTransferStats lastUploadTransfer;
+
+/**
+ * ETag of the image last rendered to the panel, empty if unknown. Set by the
+ * render and stream tasks and read by the web server, so it is kept in a
+ * fixed buffer and copied in and out under a lock.
+ */
+void setDisplayedImageEtag(const char *etag);
+String displayedImageEtag();
+
+/**
+ * Strong ETag of an uploaded image: the CRC-32 of the uploaded bytes, plus
+ * the options that change what is stored or drawn, e.g. "1a2b3c4d-convert-fs"
+ */
+String makeImageEtag(uint32_t crc, bool converted, DitherMode dither);
+// Matches an If-Match / If-None-Match header value ("*", or a list of ETags)
+bool etagMatches(const String &header, const String &etag);
+
+// Chunk sizes kept from the last upload
+#define UPLOAD_CHUNK_TRACE_SIZE 256
+
+// Copies up to `max` chunk sizes of the last upload, in arrival order; returns the count
+size_t getUploadChunkSizes(uint16_t *sizes, size_t max);
 
 void listDir(fs::FS &fs, const char *dirname, uint8_t levels);
 String listFiles();
@@ -0,0 +1,453 @@
+// image_store.cpp
+#include "image_store.h"
+#include "config.h"
+#include "debug.h"
+#include "filesystem.h"
+#include "esp_rom_crc.h"
+#include "esp_task_wdt.h"
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+
+#define IMAGE_STORE_INDEX_TEMP_PATH "/store/index.tmp"
+// Blob names tried for one CRC-32: the CRC, then the next values for different content with the same CRC
+#define IMAGE_STORE_MAX_PROBES 4
+
+static ImageSlot slots[IMAGE_STORE_MAX_SLOTS];
+static uint8_t slotCount = 0;
+static int selected = -1;
+static uint32_t showCounter = 0;
+// Blob being drawn, not deleted until unpinned
+static uint32_t pinnedHash = 0;
+static bool pinned = false;
+// Index changes come from AsyncTCP, the stream render task and the render scheduler
+static SemaphoreHandle_t storeLock = nullptr;
+
+static void lockStore() {
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+}
+
+static void unlockStore() {
+    xSemaphoreGive(storeLock);
+}
+
+static String blobPath(uint32_t hash) {
+    char path[32];
+    snprintf(path, sizeof(path), IMAGE_STORE_DIR "/%08x.img", (unsigned) hash);
+    return String(path);
+}
+
+static size_t freeBytes() {
+    return LittleFS.totalBytes() - LittleFS.usedBytes();
+}
+
+static int findSlot(const String &name) {
+    for (uint8_t i = 0; i < slotCount; i++) {
+        if (name == slots[i].name) return i;
+    }
+    return -1;
+}
+
+static bool blobShared(uint32_t hash, int except) {
+    for (uint8_t i = 0; i < slotCount; i++) {
+        if (i != except && slots[i].hash == hash) return true;
+    }
+    return false;
+}
+
+// True if the blob at `path` holds the same `size` bytes as the file at `other`
+static bool sameContent(const String &path, const char *other, uint32_t size) {
+    File a = LittleFS.open(path, "r");
+    File b = LittleFS.open(other, "r");
+    bool same = a && b && a.size() == size && b.size() == size;
+    uint8_t bufferA[256];
+    uint8_t bufferB[256];
+    while (same) {
+        size_t n = a.read(bufferA, sizeof(bufferA));
+        if (n == 0) break;
+        same = b.read(bufferB, n) == n && memcmp(bufferA, bufferB, n) == 0;
+    }
+    if (a) a.close();
+    if (b) b.close();
+    return same;
+}
+
+static ImageFormat parseImageFormat(const char *name) {
+    for (int format = IMAGE_FORMAT_RGB565; format <= IMAGE_FORMAT_BMP; format++) {
+        if (name && strcmp(name, imageFormatName((ImageFormat) format)) == 0) return (ImageFormat) format;
+    }
+    return IMAGE_FORMAT_UNKNOWN;
+}
+
+// Written next to the index and swapped in, so a reset never leaves half an index
+static bool saveIndex() {
+    JsonDocument doc;
+    doc["selected"] = selected >= 0 ? slots[selected].name : "";
+    doc["shown"] = showCounter;
+    JsonArray list = doc["slots"].to<JsonArray>();
+    for (uint8_t i = 0; i < slotCount; i++) {
+        char hash[9];
+        snprintf(hash, sizeof(hash), "%08x", (unsigned) slots[i].hash);
+        JsonObject entry = list.add<JsonObject>();
+        entry["name"] = slots[i].name;
+        entry["hash"] = hash;
+        entry["format"] = imageFormatName(slots[i].format);
+        entry["width"] = slots[i].width;
+        entry["height"] = slots[i].height;
+        entry["size"] = slots[i].size;
+        entry["lastShown"] = slots[i].lastShown;
+        entry["etag"] = slots[i].etag;
+    }
+
+    File f = LittleFS.open(IMAGE_STORE_INDEX_TEMP_PATH, "w");
+    if (!f) {
+        LOG_E("[STORE] Error: Cannot write the slot index");
+        return false;
+    }
+    bool ok = serializeJson(doc, f) > 0;
+    f.close();
+    LittleFS.remove(IMAGE_STORE_INDEX_PATH);
+    ok = ok && LittleFS.rename(IMAGE_STORE_INDEX_TEMP_PATH, IMAGE_STORE_INDEX_PATH);
+    if (!ok) LOG_E("[STORE] Error: Cannot replace the slot index");
+    return ok;
+}
+
+static void loadIndex() {
+    File f = LittleFS.open(IMAGE_STORE_INDEX_PATH, "r");
+    if (!f) return;
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, f);
+    f.close();
+    if (err) {
+        LOG_E("[STORE] Error: Slot index unreadable (%s), starting empty", err.c_str());
+        return;
+    }
+
+    showCounter = doc["shown"] | 0;
+    const char *selectedName = doc["selected"] | "";
+    for (JsonObject entry : doc["slots"].as<JsonArray>()) {
+        if (slotCount == IMAGE_STORE_MAX_SLOTS) break;
+        ImageSlot &slot = slots[slotCount];
+        memset(&slot, 0, sizeof(slot));
+        strlcpy(slot.name, entry["name"] | "", sizeof(slot.name));
+        strlcpy(slot.etag, entry["etag"] | "", sizeof(slot.etag));
+        slot.hash = strtoul(entry["hash"] | "0", nullptr, 16);
+        slot.format = parseImageFormat(entry["format"].as<const char *>());
+        slot.width = entry["width"] | 0;
+        slot.height = entry["height"] | 0;
+        slot.size = entry["size"] | 0;
+        slot.lastShown = entry["lastShown"] | 0;
+
+        // A blob lost to a reset mid-write makes the slot useless
+        if (!isValidSlotName(slot.name) || !LittleFS.exists(blobPath(slot.hash))) {
+            LOG_W("[STORE] Dropping slot %s, its content is missing", slot.name);
+            continue;
+        }
+        if (strcmp(slot.name, selectedName) == 0) selected = slotCount;
+        slotCount++;
+    }
+}
+
+// Moves the single stored image from before the slot store into the default slot
+static void importLegacyImage() {
+    String legacyPath = String("/") + SELECTED_IMAGE_BUFFER_PATH;
+    File f = LittleFS.open(legacyPath, "r");
+    if (!f) return;
+
+    uint8_t buffer[1024];
+    uint8_t head[IMAGE_DETECT_HEAD_SIZE];
+    size_t headLen = 0;
+    uint32_t hash = 0;
+    size_t n;
+    while ((n = f.read(buffer, sizeof(buffer))) > 0) {
+        if (headLen < sizeof(head)) {
+            size_t k = min(n, sizeof(head) - headLen);
+            memcpy(head + headLen, buffer, k);
+            headLen += k;
+        }
+        hash = esp_rom_crc32_le(hash, buffer, n);
+        esp_task_wdt_reset();
+    }
+    uint32_t size = f.size();
+    f.close();
+
+    File etagFile = LittleFS.open(IMAGE_ETAG_PATH, "r");
+    String etag = etagFile ? etagFile.readString() : String();
+    if (etagFile) etagFile.close();
+    etag.trim();
+
+    ImageFormat format = detectImageFormat(head, headLen, size, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    String target = blobPath(hash);
+    if (format == IMAGE_FORMAT_UNKNOWN || findSlot(IMAGE_STORE_DEFAULT_SLOT) >= 0 ||
+        slotCount == IMAGE_STORE_MAX_SLOTS || !LittleFS.rename(legacyPath, target)) {
+        LOG_W("[STORE] Cannot import %s, leaving it in place", SELECTED_IMAGE_BUFFER_PATH);
+        return;
+    }
+    LittleFS.remove(IMAGE_ETAG_PATH);
+
+    ImageSlot &slot = slots[slotCount];
+    memset(&slot, 0, sizeof(slot));
+    strlcpy(slot.name, IMAGE_STORE_DEFAULT_SLOT, sizeof(slot.name));
+    strlcpy(slot.etag, etag.c_str(), sizeof(slot.etag));
+    slot.hash = hash;
+    slot.size = size;
+    slot.format = format;
+    slot.width = DISPLAY_WIDTH;
+    slot.height = DISPLAY_HEIGHT;
+    slot.lastShown = ++showCounter;
+    selected = slotCount++;
+    LOG_I("[STORE] Imported %s into slot " IMAGE_STORE_DEFAULT_SLOT, SELECTED_IMAGE_BUFFER_PATH);
+    saveIndex();
+}
+
+// Boot only: blobs of slots dropped while their content was pinned, and interrupted uploads
+static void removeOrphans() {
+    File dir = LittleFS.open(IMAGE_STORE_DIR);
+    if (!dir || !dir.isDirectory()) return;
+
+    String orphans[8];
+    int orphanCount = 0;
+    File file = dir.openNextFile();
+    while (file && orphanCount < 8) {
+        String path = String(IMAGE_STORE_DIR "/") + file.name();
+        bool keep = path == IMAGE_STORE_INDEX_PATH;
+        for (uint8_t i = 0; i < slotCount && !keep; i++) {
+            keep = path == blobPath(slots[i].hash);
+        }
+        if (!keep) orphans[orphanCount++] = path;
+        file = dir.openNextFile();
+    }
+    dir.close();
+
+    for (int i = 0; i < orphanCount; i++) {
+        LOG_I("[STORE] Removing orphan %s", orphans[i].c_str());
+        LittleFS.remove(orphans[i]);
+    }
+}
+
+void initImageStore() {
+    if (!storeLock) storeLock = xSemaphoreCreateMutex();
+    if (!LittleFS.exists(IMAGE_STORE_DIR)) LittleFS.mkdir(IMAGE_STORE_DIR);
+
+    loadIndex();
+    importLegacyImage();
+    removeOrphans();
+
+    LOG_I("[STORE] %u slots, selected: %s, ETag: %s", slotCount, selected >= 0 ? slots[selected].name : "none",
+          selected >= 0 && slots[selected].etag[0] ? slots[selected].etag : "none");
+}
+
+bool isValidSlotName(const String &name) {
+    if (name.length() == 0 || name.length() >= IMAGE_SLOT_NAME_SIZE) return false;
+    for (size_t i = 0; i < name.length(); i++) {
+        char c = name[i];
+        if (!isalnum((unsigned char) c) && c != '-' && c != '_') return false;
+    }
+    return true;
+}
+
+String selectedImageSlot() {
+    lockStore();
+    String name = selected >= 0 ? String(slots[selected].name) : String();
+    unlockStore();
+    return name;
+}
+
+String selectedImageEtag() {
+    lockStore();
+    String etag = selected >= 0 ? String(slots[selected].etag) : String();
+    unlockStore();
+    return etag;
+}
+
+String imageSlotEtag(const String &slot) {
+    lockStore();
+    int i = findSlot(slot);
+    String etag = i >= 0 ? String(slots[i].etag) : String();
+    unlockStore();
+    return etag;
+}
+
+bool slotHoldsContent(const String &slot, const char *path, uint32_t size) {
+    lockStore();
+    int i = findSlot(slot);
+    bool same = i >= 0 && slots[i].size == size && sameContent(blobPath(slots[i].hash), path, size);
+    unlockStore();
+    return same;
+}
+
+String selectedImagePath() {
+    lockStore();
+    String path = selected >= 0 ? blobPath(slots[selected].hash).substring(1) : String();
+    unlockStore();
+    return path;
+}
+
+String pinSelectedImage(String &etag) {
+    lockStore();
+    String path;
+    etag = String();
+    if (selected >= 0) {
+        pinned = true;
+        pinnedHash = slots[selected].hash;
+        path = blobPath(pinnedHash).substring(1);
+        etag = slots[selected].etag;
+    }
+    unlockStore();
+    return path;
+}
+
+void unpinImage() {
+    lockStore();
+    pinned = false;
+    unlockStore();
+}
+
+// Called with the store locked
+static void removeSlot(int i) {
+    uint32_t hash = slots[i].hash;
+    LOG_I("[STORE] Removing slot %s", slots[i].name);
+    if (!blobShared(hash, i) && !(pinned && pinnedHash == hash)) {
+        LittleFS.remove(blobPath(hash));
+    }
+
+    slotCount--;
+    if (i != slotCount) slots[i] = slots[slotCount];
+    if (selected == i) selected = -1;
+    else if (selected == slotCount) selected = i;
+}
+
+// Called with the store locked; the least recently shown slot that may go, or -1
+static int evictionCandidate(int keep) {
+    int victim = -1;
+    for (uint8_t i = 0; i < slotCount; i++) {
+        if (i == selected || i == keep) continue;
+        if (victim < 0 || slots[i].lastShown < slots[victim].lastShown) victim = i;
+    }
+    return victim;
+}
+
+bool reserveImageSpace(size_t bytes, const String &slot) {
+    lockStore();
+    bool evicted = false;
+    int target = findSlot(slot);
+    while (freeBytes() < bytes) {
+        int victim = evictionCandidate(target);
+        if (victim < 0) {
+            // Last resort: the slot being replaced, as a single image used to be
+            if (target < 0) break;
+            victim = target;
+        }
+        removeSlot(victim);
+        evicted = true;
+        target = findSlot(slot);
+    }
+    if (evicted) saveIndex();
+    bool ok = freeBytes() >= bytes;
+    unlockStore();
+    return ok;
+}
+
+bool storeImage(const String &slot, const char *tempPath, uint32_t hash, uint32_t size, ImageFormat format,
+                uint16_t width, uint16_t height, const String &etag, bool select) {
+    lockStore();
+    // A blob with the same CRC is the same content as a stored slot, or a blob
+    // still pinned from before, unless the bytes differ: then the next name is tried
+    bool ok = false;
+    uint32_t key = hash;
+    for (int probe = 0; probe < IMAGE_STORE_MAX_PROBES; probe++, key++) {
+        String target = blobPath(key);
+        if (!LittleFS.exists(target)) {
+            ok = LittleFS.rename(tempPath, target);
+            break;
+        }
+        if (sameContent(target, tempPath, size)) {
+            LittleFS.remove(tempPath);
+            LOG_I("[STORE] Content %08x already stored", (unsigned) key);
+            ok = true;
+            break;
+        }
+        LOG_W("[STORE] CRC collision: %08x holds different content", (unsigned) key);
+    }
+
+    int i = findSlot(slot);
+    if (ok && i < 0 && slotCount == IMAGE_STORE_MAX_SLOTS) {
+        int victim = evictionCandidate(-1);
+        if (victim >= 0) removeSlot(victim);
+    }
+    if (ok && i < 0 && slotCount == IMAGE_STORE_MAX_SLOTS) {
+        ok = false;
+    }
+    if (!ok) {
+        LOG_E("[STORE] Error: Cannot store slot %s", slot.c_str());
+        LittleFS.remove(tempPath);
+        unlockStore();
+        return false;
+    }
+
+    if (i < 0) {
+        i = slotCount++;
+        memset(&slots[i], 0, sizeof(slots[i]));
+        strlcpy(slots[i].name, slot.c_str(), sizeof(slots[i].name));
+    } else if (slots[i].hash != key && !blobShared(slots[i].hash, i) &&
+               !(pinned && pinnedHash == slots[i].hash)) {
+        LittleFS.remove(blobPath(slots[i].hash));
+    }
+    ImageSlot &entry = slots[i];
+    strlcpy(entry.etag, etag.c_str(), sizeof(entry.etag));
+    entry.hash = key;
+    entry.size = size;
+    entry.format = format;
+    entry.width = width;
+    entry.height = height;
+    if (select) {
+        selected = i;
+        entry.lastShown = ++showCounter;
+    }
+
+    ok = saveIndex();
+    unlockStore();
+    LOG_I("[STORE] Stored %s as %08x (%u bytes)", slot.c_str(), (unsigned) key, (unsigned) size);
+    return ok;
+}
+
+bool selectImageSlot(const String &slot) {
+    lockStore();
+    int i = findSlot(slot);
+    if (i >= 0) {
+        selected = i;
+        slots[i].lastShown = ++showCounter;
+        saveIndex();
+    }
+    unlockStore();
+    return i >= 0;
+}
+
+bool deleteImageSlot(const String &slot) {
+    lockStore();
+    int i = findSlot(slot);
+    if (i >= 0) {
+        removeSlot(i);
+        saveIndex();
+    }
+    unlockStore();
+    return i >= 0;
+}
+
+size_t getImageSlots(ImageSlot *out, size_t max) {
+    lockStore();
+    size_t n = min((size_t) slotCount, max);
+    memcpy(out, slots, n * sizeof(ImageSlot));
+    unlockStore();
+
+    // Insertion sort, most recently shown first; at most IMAGE_STORE_MAX_SLOTS entries
+    for (size_t i = 1; i < n; i++) {
+        ImageSlot slot = out[i];
+        size_t j = i;
+        while (j > 0 && out[j - 1].lastShown < slot.lastShown) {
+            out[j] = out[j - 1];
+            j--;
+        }
+        out[j] = slot;
+    }
+    return n;
+}
@@ -0,0 +1,88 @@
+#ifndef IMAGE_STORE_H
+#define IMAGE_STORE_H
+
+#include <Arduino.h>
+#include "panel_format.h"
+
+#define IMAGE_STORE_DIR "/store"
+#define IMAGE_STORE_INDEX_PATH "/store/index.json"
+#define IMAGE_STORE_UPLOAD_PATH "/store/upload.tmp"
+// Slot of uploads and streams without ?slot=
+#define IMAGE_STORE_DEFAULT_SLOT "default"
+
+#ifndef IMAGE_STORE_MAX_SLOTS
+#define IMAGE_STORE_MAX_SLOTS 16
+#endif
+
+#define IMAGE_SLOT_NAME_SIZE 32
+// Room for the longest ETag with its quotes, "1a2b3c4d-convert-floyd-steinberg"
+#define IMAGE_SLOT_ETAG_SIZE 40
+
+struct ImageSlot {
+    char name[IMAGE_SLOT_NAME_SIZE];
+    char etag[IMAGE_SLOT_ETAG_SIZE];  // ETag of the upload that filled the slot
+    uint32_t hash;        // CRC-32 of the stored bytes, or the next free value on a collision;
+                          // names the blob, shared by equal slots
+    uint32_t size;
+    uint32_t lastShown;   // show counter when last selected, for LRU eviction (there is no clock)
+    uint16_t width;
+    uint16_t height;
+    ImageFormat format;
+};
+
+/**
+ * Loads the slot index from LittleFS; call once at boot, after LittleFS is
+ * mounted. Moves a stored image from before the slot store into the default
+ * slot, and removes blobs no slot refers to. After this, slots are looked up
+ * in memory only.
+ */
+void initImageStore();
+
+// 1 to 31 letters, digits, '-' or '_'
+bool isValidSlotName(const String &name);
+
+// Name of the selected slot, empty if none
+String selectedImageSlot();
+// ETag of the selected slot, empty if none
+String selectedImageEtag();
+// ETag of `slot`, empty if there is no such slot
+String imageSlotEtag(const String &slot);
+// True if `slot` holds the same `size` bytes as the file at `path`
+bool slotHoldsContent(const String &slot, const char *path, uint32_t size);
+// Path of the selected image relative to the LittleFS root, empty if none
+String selectedImagePath();
+
+/**
+ * Like selectedImagePath(), but keeps the image from being evicted or deleted
+ * until unpinImage(). `etag` gets the ETag of the pinned image.
+ */
+String pinSelectedImage(String &etag);
+void unpinImage();
+
+/**
+ * Evicts least recently shown slots until `bytes` are free. The selected
+ * slot is kept, except when it is `slot` itself: its content is about to be
+ * replaced anyway. Returns false when that is still not enough.
+ */
+bool reserveImageSpace(size_t bytes, const String &slot);
+
+/**
+ * Stores the file at `tempPath` as the content of `slot`. Content that is
+ * already stored under `hash` is kept once and `tempPath` removed; the bytes
+ * are compared, and different content with the same CRC gets the next free
+ * blob name. Creates
+ * the slot if needed, evicting the least recently shown slot when all are
+ * used, and selects it if `select` is set.
+ */
+bool storeImage(const String &slot, const char *tempPath, uint32_t hash, uint32_t size, ImageFormat format,
+                uint16_t width, uint16_t height, const String &etag, bool select);
+
+// Makes `slot` the selected image; false if there is no such slot
+bool selectImageSlot(const String &slot);
+// Removes `slot` and, unless another slot shares it, its content
+bool deleteImageSlot(const String &slot);
+
+// Copies up to `max` slots, most recently shown first; returns the count
+size_t getImageSlots(ImageSlot *slots, size_t max);
+
+#endif
@@ -0,0 +1,106 @@
+// image_stream.cpp
+#include "image_stream.h"
+
+ImageStreamDecoder::ImageStreamDecoder()
+    : width(0), height(0), bandRows(0), sink(nullptr), sinkContext(nullptr),
+      rowBuffer(nullptr), monoBuffer(nullptr), colorBuffer(nullptr),
+      rowFill(0), bandFill(0), y(0), failed(false), ownsBuffers(false) {
+}
+
+ImageStreamDecoder::~ImageStreamDecoder() {
+    end();
+}
+
+bool ImageStreamDecoder::begin(uint16_t width, uint16_t height, uint16_t bandRows, BandSink sink, void *context,
+                               DitherMode dither, RenderArena *arena) {
+    end();
+
+    this->width = width;
+    this->height = height;
+    this->bandRows = bandRows;
+    this->sink = sink;
+    this->sinkContext = context;
+    rowFill = 0;
+    bandFill = 0;
+    y = 0;
+    failed = false;
+
+    const size_t rowBytes = width / 8;
+    ownsBuffers = !arena;
+    if (arena) {
+        rowBuffer = (uint8_t *) arena->alloc(width * sizeof(uint16_t));
+        monoBuffer = (uint8_t *) arena->alloc(rowBytes * bandRows);
+        colorBuffer = (uint8_t *) arena->alloc(rowBytes * bandRows);
+    } else {
+        rowBuffer = (uint8_t *) malloc(width * sizeof(uint16_t));
+        monoBuffer = (uint8_t *) malloc(rowBytes * bandRows);
+        colorBuffer = (uint8_t *) malloc(rowBytes * bandRows);
+    }
+    if (!rowBuffer || !monoBuffer || !colorBuffer || !converter.begin(width, dither, arena)) {
+        end();
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+void ImageStreamDecoder::end() {
+    if (ownsBuffers) {
+        if (rowBuffer) free(rowBuffer);
+        if (monoBuffer) free(monoBuffer);
+        if (colorBuffer) free(colorBuffer);
+    }
+    rowBuffer = nullptr;
+    monoBuffer = nullptr;
+    colorBuffer = nullptr;
+    converter.end();
+}
+
+bool ImageStreamDecoder::flushBand() {
+    if (bandFill == 0) return true;
+    if (!sink(monoBuffer, colorBuffer, y, bandFill, sinkContext)) {
+        failed = true;
+        return false;
+    }
+    y += bandFill;
+    bandFill = 0;
+    return true;
+}
+
+bool ImageStreamDecoder::push(const uint8_t *data, size_t len) {
+    if (failed || !rowBuffer) return false;
+
+    const size_t rowSize = width * sizeof(uint16_t);
+    const size_t rowBytes = width / 8;
+
+    while (len > 0) {
+        if (y + bandFill >= height) {
+            // More data than the image holds
+            failed = true;
+            return false;
+        }
+
+        size_t n = min(len, rowSize - rowFill);
+        memcpy(rowBuffer + rowFill, data, n);
+        rowFill += n;
+        data += n;
+        len -= n;
+
+        if (rowFill < rowSize) break;
+
+        converter.convertRows(rowBuffer, monoBuffer + bandFill * rowBytes,
+                              colorBuffer + bandFill * rowBytes, 1);
+        rowFill = 0;
+        bandFill++;
+
+        if (bandFill == bandRows || y + bandFill == height) {
+            if (!flushBand()) return false;
+        }
+    }
+    return true;
+}
+
+bool ImageStreamDecoder::finish() {
+    if (failed) return false;
+    return rowFill == 0 && bandFill == 0 && y == height;
+}
@@ -0,0 +1,55 @@
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include <Arduino.h>
+#include "dither.h"
+
+/**
+ * Receives a completed band of panel planes: `rows` rows of mono data followed
+ * (in a separate buffer) by the same rows of color data, starting at row `y`.
+ * Returns false to abort the stream.
+ */
+typedef bool (*BandSink)(const uint8_t *mono, const uint8_t *color, uint16_t y, uint16_t rows, void *context);
+
+/**
+ * Converts a raw RGB565 byte stream into panel planes as it arrives.
+ * Chunks may split pixels and rows anywhere; partial rows are carried over to
+ * the next push(), and dithering state carries across bands. Each band of
+ * `bandRows` rows is handed to the sink as soon as it is complete.
+ */
+class ImageStreamDecoder {
+private:
+    uint16_t width;
+    uint16_t height;
+    uint16_t bandRows;
+    BandSink sink;
+    void *sinkContext;
+
+    Rgb565Converter converter;
+    uint8_t *rowBuffer;   // one RGB565 row being assembled
+    uint8_t *monoBuffer;  // converted rows of the current band
+    uint8_t *colorBuffer;
+    size_t rowFill;
+    uint16_t bandFill;
+    uint16_t y;
+    bool failed;
+    bool ownsBuffers;
+
+    bool flushBand();
+
+public:
+    ImageStreamDecoder();
+    ~ImageStreamDecoder();
+
+    // Buffers come from `arena` if given (released with it), else from the heap
+    bool begin(uint16_t width, uint16_t height, uint16_t bandRows, BandSink sink, void *context,
+               DitherMode dither = DITHER_NONE, RenderArena *arena = nullptr);
+    bool push(const uint8_t *data, size_t len);
+    // True when exactly width * height pixels were received and emitted
+    bool finish();
+    void end();
+
+    uint16_t rowsEmitted() const { return y; }
+};
+
+#endif
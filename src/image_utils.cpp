@@ -6,424 +6,378 @@
 #include <LittleFS.h>
 #include <Arduino.h>
 #include "debug.h"
-
-// Buffer variables for image processing
-static const uint16_t input_buffer_pixels = 800;
-static const uint16_t max_row_width = 640;
-static const uint16_t max_palette_pixels = 256;
-
-uint8_t input_buffer[3 * input_buffer_pixels];
-uint8_t output_row_mono_buffer[max_row_width / 8];
-uint8_t output_row_color_buffer[max_row_width / 8];
-uint8_t mono_palette_buffer[max_palette_pixels / 8];
-uint8_t color_palette_buffer[max_palette_pixels / 8];
-uint16_t rgb_palette_buffer[max_palette_pixels];
-
-uint16_t read16(fs::File &f) {
-    uint16_t result;
-    ((uint8_t *) &result)[0] = f.read();
-    ((uint8_t *) &result)[1] = f.read();
-    return result;
+#include "benchmark.h"
+#include "panel_format.h"
+#include "plane_rle.h"
+#include "render_pipeline.h"
+#include "render_arena.h"
+#include "bmp_decoder.h"
+#include "trace.h"
+
+// Stages of the raw RGB565 render, run by runRenderPipeline
+struct RawRenderContext {
+    fs::File *file;
+    Rgb565Converter *converter;
+    size_t rowSize;
+};
+
+static bool readRawBatch(RenderBatch &batch, void *context) {
+    RawRenderContext *raw = (RawRenderContext *) context;
+    size_t size = raw->rowSize * batch.rows;
+    batch.inputBytes = raw->file->read(batch.input, size);
+    return batch.inputBytes == size;
 }
 
-uint32_t read32(fs::File &f) {
-    uint32_t result;
-    ((uint8_t *) &result)[0] = f.read();
-    ((uint8_t *) &result)[1] = f.read();
-    ((uint8_t *) &result)[2] = f.read();
-    ((uint8_t *) &result)[3] = f.read();
-    return result;
+static void convertRawBatch(RenderBatch &batch, void *context) {
+    RawRenderContext *raw = (RawRenderContext *) context;
+    raw->converter->convertRows(batch.input, batch.mono, batch.color, batch.rows);
 }
 
-void drawBitmapFromSpiffs(const char *filename, int16_t x, int16_t y, bool with_color) {
-    debug.println("[IMAGE_UTILS] Starting BMP image processing...");
-    fs::File file;
-    bool valid = false;
-    bool flip = true;
-    uint32_t startTime = millis();
-
-    if ((x >= display.epd2.WIDTH) || (y >= display.epd2.HEIGHT)) {
-        debug.println("[IMAGE_UTILS] Image position out of display bounds");
-        return;
-    }
+// Write batch to display controller in one call, unless unchanged. Stops the render once cancelled
+static bool writeRawBatch(RenderBatch &batch, void *context) {
+    writePanelBand(batch.mono, batch.color, batch.y, batch.rows);
+    return !panelFrameCancelled();
+}
 
-    debug.println("[IMAGE_UTILS] Opening file: " + String(filename));
-    // LittleFS is mounted at /data
-    file = LittleFS.open(String("/") + filename, "r");
-    if (!file) {
-        debug.println("[IMAGE_UTILS] Failed to open file at path: /data/" + String(filename));
-        return;
-    }
+// Stages of the BMP render: one read of the stored rows per batch, converted by the format's row kernel
+static bool readBmpBatch(RenderBatch &batch, void *context) {
+    return ((BmpDecoder *) context)->readRows(batch.y, batch.rows, batch.input, batch.inputBytes);
+}
 
-    // Parse BMP header
-    if (read16(file) == 0x4D42)
-    {
-        uint32_t fileSize = read32(file);
-        uint32_t creatorBytes = read32(file);
-        (void) creatorBytes;
-        uint32_t imageOffset = read32(file);
-        uint32_t headerSize = read32(file);
-        uint32_t width = read32(file);
-        int32_t height = (int32_t) read32(file);
-        uint16_t planes = read16(file);
-        uint16_t depth = read16(file);
-        uint32_t format = read32(file);
-
-        debug.println("[IMAGE_UTILS] BMP Header analysis:");
-        debug.println("[IMAGE_UTILS] File Size: " + String(fileSize) + " bytes");
-        debug.println("[IMAGE_UTILS] Image Offset: " + String(imageOffset) + " bytes");
-        debug.println("[IMAGE_UTILS] Header Size: " + String(headerSize) + " bytes");
-        debug.println("[IMAGE_UTILS] Image Dimensions: " + String(width) + "x" + String(height));
-        debug.println("[IMAGE_UTILS] Planes: " + String(planes));
-        debug.println("[IMAGE_UTILS] Bit Depth: " + String(depth));
-        debug.println("[IMAGE_UTILS] Format: " + String(format));
-
-        if ((planes == 1) && ((format == 0) || (format == 3)))
-        {
-
-            uint32_t rowSize = (width * depth / 8 + 3) & ~3;
-            if (depth < 8)
-                rowSize = ((width * depth + 8 - depth) / 8 + 3) & ~3;
-            if (height < 0) {
-                height = -height;
-                flip = false;
-            }
-
-            uint16_t w = width;
-            uint16_t h = height;
-
-            if ((x + w - 1) >= display.epd2.WIDTH)
-                w = display.epd2.WIDTH - x;
-            if ((y + h - 1) >= display.epd2.HEIGHT)
-                h = display.epd2.HEIGHT - y;
-
-            debug.println("[IMAGE_UTILS] Adjusted Image Size: " + String(w) + "x" + String(h));
-
-            if (w <= max_row_width)
-            {
-                debug.println("[IMAGE_UTILS] Image size within max_row_width. Proceeding with direct drawing.");
-
-
-                debug.println("[IMAGE_UTILS] Resetting Watchdog Timer before image processing.");
-                esp_task_wdt_reset();
-
-                valid = true;
-                uint8_t bitmask = 0xFF;
-                uint8_t bitshift = 8 - depth;
-                uint16_t red, green, blue;
-                bool whitish = false;
-                bool colored = false;
-
-                if (depth == 1)
-                    with_color = false;
-
-                if (depth <= 8) {
-                    if (depth < 8)
-                        bitmask >>= depth;
-                    file.seek(imageOffset - (4 << depth)); // 54 for regular, diff for colors important
-
-                    for (uint16_t pn = 0; pn < (1 << depth); pn++) {
-                        blue = file.read();
-                        green = file.read();
-                        red = file.read();
-                        file.read(); // skip alpha
-
-                        whitish = with_color
-                                      ? ((red > 0x80) && (green > 0x80) && (blue > 0x80))
-                                      : ((red + green + blue) > 3 * 0x80);
-                        colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
-
-                        if (0 == pn % 8)
-                            mono_palette_buffer[pn / 8] = 0;
-                        mono_palette_buffer[pn / 8] |= whitish << (pn % 8);
-
-                        if (0 == pn % 8)
-                            color_palette_buffer[pn / 8] = 0;
-                        color_palette_buffer[pn / 8] |= colored << (pn % 8);
-                    }
-
-                    debug.println("[IMAGE_UTILS] Palette buffers populated.");
-                }
-
-                display.clearScreen();
-
-                uint32_t rowPosition = flip ? imageOffset + (height - h) * rowSize : imageOffset;
-                debug.println("[IMAGE_UTILS] Starting to process " + String(h) + " rows...");
-
-                for (uint16_t row = 0; row < h; row++, rowPosition += rowSize)
-                {
-
-                    esp_task_wdt_reset();
-
-                    uint32_t in_remain = rowSize;
-                    uint32_t in_idx = 0;
-                    uint32_t in_bytes = 0;
-                    uint8_t in_byte = 0;
-                    uint8_t in_bits = 0;
-                    uint8_t out_byte = 0xFF;
-                    uint8_t out_color_byte = 0xFF;
-                    uint32_t out_idx = 0;
-
-                    file.seek(rowPosition);
-
-                    for (uint16_t col = 0; col < w; col++)
-                    {
-
-                        if (in_idx >= in_bytes)
-                        {
-                            in_bytes = file.read(input_buffer,
-                                                 (in_remain > sizeof(input_buffer)) ? sizeof(input_buffer) : in_remain);
-                            in_remain -= in_bytes;
-                            in_idx = 0;
-                        }
-
-                        switch (depth) {
-                            case 32:
-                                blue = input_buffer[in_idx++];
-                                green = input_buffer[in_idx++];
-                                red = input_buffer[in_idx++];
-                                in_idx++;
-                                whitish = with_color
-                                              ? ((red > 0x80) && (green > 0x80) && (blue > 0x80))
-                                              : ((red + green + blue) > 3 * 0x80);
-                                colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
-                                break;
-                            case 24:
-                                blue = input_buffer[in_idx++];
-                                green = input_buffer[in_idx++];
-                                red = input_buffer[in_idx++];
-                                whitish = with_color
-                                              ? ((red > 0x80) && (green > 0x80) && (blue > 0x80))
-                                              : ((red + green + blue) > 3 * 0x80);
-                                colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
-                                break;
-                            case 16: {
-                                uint8_t lsb = input_buffer[in_idx++];
-                                uint8_t msb = input_buffer[in_idx++];
-                                if (format == 0)
-                                {
-                                    blue = (lsb & 0x1F) << 3;
-                                    green = ((msb & 0x03) << 6) | ((lsb & 0xE0) >> 2);
-                                    red = (msb & 0x7C) << 1;
-                                } else
-                                {
-                                    blue = (lsb & 0x1F) << 3;
-                                    green = ((msb & 0x07) << 5) | ((lsb & 0xE0) >> 3);
-                                    red = (msb & 0xF8);
-                                }
-                                whitish = with_color
-                                              ? ((red > 0x80) && (green > 0x80) && (blue > 0x80))
-                                              : ((red + green + blue) > 3 * 0x80);
-                                colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0));
-                            }
-                            break;
-                            case 1:
-                            case 2:
-                            case 4:
-                            case 8: {
-                                if (0 == in_bits) {
-                                    in_byte = input_buffer[in_idx++];
-                                    in_bits = 8;
-                                }
-                                uint16_t pn = (in_byte >> bitshift) & bitmask;
-                                whitish = mono_palette_buffer[pn / 8] & (0x1 << (pn % 8));
-                                colored = color_palette_buffer[pn / 8] & (0x1 << (pn % 8));
-                                in_byte <<= depth;
-                                in_bits -= depth;
-                            }
-                            break;
-                        }
-
-                        if (whitish) {
-
-                        } else if (colored && with_color) {
-                            out_color_byte &= ~(0x80 >> (col % 8));
-                        } else {
-                            out_byte &= ~(0x80 >> (col % 8));
-                        }
-
-                        if ((7 == col % 8) || (col == w - 1))
-                        {
-                            output_row_color_buffer[out_idx] = out_color_byte;
-                            output_row_mono_buffer[out_idx++] = out_byte;
-                            out_byte = 0xFF;
-                            out_color_byte = 0xFF;
-                        }
-                    }
-
-                    uint16_t yrow = y + (flip ? h - row - 1 : row);
-                    display.writeImage(output_row_mono_buffer, output_row_color_buffer, x, yrow, w, 1);
-
-
-                    esp_task_wdt_reset();
-                }
-
-                debug.println("[IMAGE_UTILS] Image loaded in " + String(millis() - startTime) + " ms");
-                display.refresh();
-                debug.println("[IMAGE_UTILS] Display refreshed.");
-            }
-        }
-    }
-    file.close();
+static void convertBmpBatch(RenderBatch &batch, void *context) {
+    ((BmpDecoder *) context)->convertRows(batch.input, batch.y, batch.rows, batch.mono, batch.color);
 }
 
-void drawProgmemFileFromSpiffs(const char *filename, uint16_t width, uint16_t height) {
-    Serial.println("[IMAGE_UTILS] >>> drawProgmemFileFromSpiffs START");
-    Serial.flush();
+bool drawProgmemFileFromSpiffs(const char *filename, uint16_t width, uint16_t height, DitherMode dither) {
+    LOG_I("[IMAGE_UTILS] >>> drawProgmemFileFromSpiffs START");
     unsigned long totalStart = millis();
 
-    bool with_color = true;
-
-    String filePath = String("/") + filename;
+    char filePath[IMAGE_PATH_SIZE];
+    snprintf(filePath, sizeof(filePath), "/%s", filename);
     fs::File file = LittleFS.open(filePath, "r");
     if (!file) {
-        debug.println("[IMAGE_UTILS] Error: File access failed at path: " + filePath);
-        return;
+        LOG_E("[IMAGE_UTILS] Error: File access failed at path: %s", filePath);
+        return false;
     }
 
     size_t fileSize = file.size();
     size_t expectedSize = width * height * sizeof(uint16_t);
-    Serial.println("[IMAGE_UTILS] File size: " + String(fileSize) + " expected: " + String(expectedSize));
-    Serial.flush();
+    LOG_I("[IMAGE_UTILS] File size: %u expected: %u", (unsigned) fileSize, (unsigned) expectedSize);
 
     if (fileSize != expectedSize) {
-        Serial.println("[IMAGE_UTILS] ERROR: File size mismatch!");
+        LOG_E("[IMAGE_UTILS] ERROR: File size mismatch: %u bytes, expected %u", (unsigned) fileSize,
+              (unsigned) expectedSize);
         file.close();
-        return;
+        return false;
     }
 
-    // Batch processing: BATCH_ROWS rows at a time to reduce SPI command overhead
-    const uint16_t BATCH_ROWS = 16;
+    // Batch processing: RENDER_BATCH_ROWS rows at a time to reduce SPI command overhead
     const size_t rowBytes = width / 8;  // 80 bytes per row for mono/color
     const size_t rowSize = width * sizeof(uint16_t);  // 1280 bytes per row RGB565
 
-    // Allocate batch buffers
-    uint8_t *readBuffer = (uint8_t *) malloc(rowSize * BATCH_ROWS);
-    uint8_t *monoBuffer = (uint8_t *) malloc(rowBytes * BATCH_ROWS);
-    uint8_t *colorBuffer = (uint8_t *) malloc(rowBytes * BATCH_ROWS);
-
-    if (!readBuffer || !monoBuffer || !colorBuffer) {
-        debug.println("[IMAGE_UTILS] Failed to allocate buffers");
-        if (readBuffer) free(readBuffer);
-        if (monoBuffer) free(monoBuffer);
-        if (colorBuffer) free(colorBuffer);
+    RenderArenaScope scope;
+    Rgb565Converter converter;
+    if (!converter.begin(width, dither, &renderArena)) {
+        LOG_E("[IMAGE_UTILS] Failed to allocate buffers");
         file.close();
-        return;
+        return false;
     }
 
-    Serial.println("[IMAGE_UTILS] Batch size: " + String(BATCH_ROWS) + " rows, buffer: " + String(rowSize * BATCH_ROWS) + " bytes");
+    LOG_I("[IMAGE_UTILS] Dither mode: %s", ditherModeName(dither));
+    LOG_I("[IMAGE_UTILS] Batch size: %u rows, buffer: %u bytes", (unsigned) RENDER_BATCH_ROWS,
+          (unsigned) (rowSize * RENDER_BATCH_ROWS));
+
+    // Initialize display controller and RAM if needed (no refresh). Only 289ms vs 32s for clearScreen().
+    beginPanelFrame();
 
-    // Initialize display controller and RAM (no refresh). Only 289ms vs 32s for clearScreen().
+    // Read, convert and write overlap across both cores (see render_pipeline.h)
+    PipelineTiming timing;
+    resetPipelineTiming(timing);
+    timing.pixels = (uint32_t) width * height;
     unsigned long t0 = millis();
-    display.writeScreenBuffer();
-    Serial.println("[TIMING] writeScreenBuffer: " + String(millis() - t0) + " ms");
+    uint16_t y = 0;
+
+    RawRenderContext context = {&file, &converter, rowSize};
+    RenderPipelineStages stages = {readRawBatch, convertRawBatch, writeRawBatch, &context};
+    if (!runRenderPipeline(height, RENDER_BATCH_ROWS, rowSize, rowBytes, stages, timing, y)) {
+        LOG_E("[IMAGE_UTILS] Failed to allocate buffers");
+    }
+
+    unsigned long processTime = millis() - t0;
+    LOG_I("[TIMING] Read + convert + write: %lu ms (%u rows)", processTime, (unsigned) y);
+    finishPanelWrites(timing);
+    printPipelineTiming(timing);
+    lastRenderTiming = timing;
+
+    // Single display refresh (hardware limit ~32s for 3-color e-paper), skipped if nothing changed
+    endPanelFrame(y == height);
+    LOG_I("[TIMING] Total pipeline: %lu ms", millis() - totalStart);
+
+    file.close();
+    return y == height;
+}
 
-    // Process image in batches
-    t0 = millis();
+// Opens an EPD3 file and checks its header; the file is left at the start of the data
+static bool openPanelImage(const char *filename, uint16_t width, uint16_t height, uint8_t encoding,
+                           fs::File &file, PanelImageHeader &header) {
+    char filePath[IMAGE_PATH_SIZE];
+    snprintf(filePath, sizeof(filePath), "/%s", filename);
+    file = LittleFS.open(filePath, "r");
+    if (!file) {
+        LOG_E("[IMAGE_UTILS] Error: File access failed at path: %s", filePath);
+        return false;
+    }
+
+    uint8_t headerData[PANEL_IMAGE_HEADER_SIZE];
+    if (file.read(headerData, sizeof(headerData)) != sizeof(headerData) ||
+        !parsePanelImageHeader(headerData, header) ||
+        header.encoding != encoding) {
+        LOG_E("[IMAGE_UTILS] ERROR: Invalid panel image header in %s", filePath);
+        file.close();
+        return false;
+    }
+
+    if (header.width != width || header.height != height ||
+        file.size() != PANEL_IMAGE_HEADER_SIZE + header.dataSize) {
+        LOG_E("[IMAGE_UTILS] ERROR: Panel image %s does not match display size", filePath);
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+bool drawPanelImageFromSpiffs(const char *filename, uint16_t width, uint16_t height) {
+    LOG_I("[IMAGE_UTILS] >>> drawPanelImageFromSpiffs START");
+    unsigned long totalStart = millis();
+
+    fs::File file;
+    PanelImageHeader header;
+    if (!openPanelImage(filename, width, height, PANEL_ENCODING_PLANES, file, header)) return false;
+
+    const size_t rowBytes = width / 8;
+    // Mono rows followed by color rows of one batch
+    RenderArenaScope scope;
+    uint8_t *planeBuffer = (uint8_t *) renderArena.alloc(2 * rowBytes * RENDER_BATCH_ROWS);
+    if (!planeBuffer) {
+        LOG_E("[IMAGE_UTILS] Failed to allocate buffers");
+        file.close();
+        return false;
+    }
+
+    beginPanelFrame();
+
+    PipelineTiming timing;
+    resetPipelineTiming(timing);
+    timing.pixels = (uint32_t) width * height;
+    unsigned long t0 = millis();
     uint16_t y = 0;
 
     while (y < height) {
-        uint16_t batchH = min((uint16_t)BATCH_ROWS, (uint16_t)(height - y));
-        size_t batchReadSize = rowSize * batchH;
-
-        // Read batch from LittleFS
-        size_t bytesRead = file.read(readBuffer, batchReadSize);
-        if (bytesRead != batchReadSize) {
-            debug.println("[IMAGE_UTILS] Read error at row " + String(y));
-            break;
+        uint16_t bandStart = y - y % header.bandRows;
+        uint16_t bandH = min(header.bandRows, (uint16_t)(height - bandStart));
+        // Batches never cross a band, so each plane is one contiguous read
+        uint16_t batchH = min(RENDER_BATCH_ROWS, (uint16_t)(bandStart + bandH - y));
+        size_t batchPlaneSize = rowBytes * batchH;
+
+        uint32_t bandOffset = PANEL_IMAGE_HEADER_SIZE + 2UL * rowBytes * bandStart;
+        uint32_t monoOffset = bandOffset + rowBytes * (y - bandStart);
+        uint32_t colorOffset = monoOffset + rowBytes * bandH;
+
+        uint8_t *monoBuffer = planeBuffer;
+        uint8_t *colorBuffer = planeBuffer + batchPlaneSize;
+
+        uint32_t stageStart = micros();
+        uint32_t traceStart = traceNow();
+        size_t bytesRead;
+        if (batchH == bandH) {
+            // Whole band: mono and color rows are adjacent in the file
+            file.seek(monoOffset);
+            bytesRead = file.read(planeBuffer, 2 * batchPlaneSize);
+        } else {
+            file.seek(monoOffset);
+            bytesRead = file.read(monoBuffer, batchPlaneSize);
+            file.seek(colorOffset);
+            bytesRead += file.read(colorBuffer, batchPlaneSize);
         }
-
-        // Initialize batch output buffers to white
-        memset(monoBuffer, 0xFF, rowBytes * batchH);
-        memset(colorBuffer, 0xFF, rowBytes * batchH);
-
-        // Convert RGB565 to 1bpp mono + color
-        for (uint16_t row = 0; row < batchH; row++) {
-            uint8_t *rowData = readBuffer + row * rowSize;
-            uint8_t *monoRow = monoBuffer + row * rowBytes;
-            uint8_t *colorRow = colorBuffer + row * rowBytes;
-
-            for (uint16_t col = 0; col < width; col++) {
-                uint16_t idx = col * 2;
-                uint16_t pixel565 = ((uint16_t)rowData[idx + 1] << 8) | rowData[idx];
-
-                uint8_t r = (pixel565 & 0xF800) >> 8;
-                uint8_t g = (pixel565 & 0x07E0) >> 3;
-                uint8_t b = (pixel565 & 0x001F) << 3;
-
-                bool whitish = ((uint16_t)r + g + b) > 384;
-
-                if (!whitish) {
-                    bool colored = (r > 0xF0) || ((g > 0xF0) && (b > 0xF0));
-                    uint8_t mask = 0x80 >> (col & 7);
-                    uint16_t byteIdx = col >> 3;
-
-                    if (with_color && colored) {
-                        colorRow[byteIdx] &= ~mask;
-                    } else {
-                        monoRow[byteIdx] &= ~mask;
-                    }
-                }
-            }
+        traceEnd(SPAN_BATCH_READ, traceStart, bytesRead);
+        addStageTime(timing, STAGE_READ, stageStart, bytesRead);
+        if (bytesRead != 2 * batchPlaneSize) {
+            LOG_E("[IMAGE_UTILS] Read error at row %u", (unsigned) y);
+            break;
         }
 
-        // Write batch to display controller in one call
-        display.writeImage(monoBuffer, colorBuffer, 0, y, width, batchH);
+        stageStart = micros();
+        writePanelBand(monoBuffer, colorBuffer, y, batchH);
+        addStageTime(timing, STAGE_WRITE, stageStart, 2 * batchPlaneSize);
+        if (panelFrameCancelled()) break;
 
         esp_task_wdt_reset();
         y += batchH;
+    }
+
+    LOG_I("[TIMING] Read + write: %lu ms (%u rows)", millis() - t0, (unsigned) y);
+    finishPanelWrites(timing);
+    printPipelineTiming(timing);
+    lastRenderTiming = timing;
 
-        if (y % 64 == 0 || y >= height) {
-            Serial.println("[TIMING] Processed " + String(y) + "/" + String(height) + " rows");
+    endPanelFrame(y == height);
+    LOG_I("[TIMING] Total pipeline: %lu ms", millis() - totalStart);
+
+    file.close();
+    return y == height;
+}
+
+bool drawRlePanelImageFromSpiffs(const char *filename, uint16_t width, uint16_t height) {
+    LOG_I("[IMAGE_UTILS] >>> drawRlePanelImageFromSpiffs START");
+    unsigned long totalStart = millis();
+
+    fs::File file;
+    PanelImageHeader header;
+    if (!openPanelImage(filename, width, height, PANEL_ENCODING_RLE, file, header)) return false;
+
+    const size_t rowBytes = width / 8;
+    RenderArenaScope scope;
+    uint8_t *monoBuffer = (uint8_t *) renderArena.alloc(rowBytes * RENDER_BATCH_ROWS);
+    uint8_t *colorBuffer = (uint8_t *) renderArena.alloc(rowBytes * RENDER_BATCH_ROWS);
+    PlaneRleReader reader;
+
+    if (!monoBuffer || !colorBuffer || !reader.begin(file, header.dataSize, &renderArena)) {
+        LOG_E("[IMAGE_UTILS] Failed to allocate buffers");
+        file.close();
+        return false;
+    }
+
+    LOG_I("[IMAGE_UTILS] Compressed size: %u of %u bytes", (unsigned) header.dataSize,
+          (unsigned) panelPlanesDataSize(width, height));
+
+    beginPanelFrame();
+
+    PipelineTiming timing;
+    resetPipelineTiming(timing);
+    timing.pixels = (uint32_t) width * height;
+    unsigned long t0 = millis();
+    uint16_t y = 0;
+
+    // One band per batch: the mono rows of a band are decoded before its color rows
+    while (y < height) {
+        uint16_t bandH = min(header.bandRows, (uint16_t)(height - y));
+        size_t bandPlaneSize = rowBytes * bandH;
+
+        // Reads of the compressed data are part of the decode span
+        uint32_t traceStart = traceNow();
+        bool decoded = reader.read(monoBuffer, bandPlaneSize, timing) &&
+                       reader.read(colorBuffer, bandPlaneSize, timing);
+        traceEnd(SPAN_CONVERT, traceStart, 2 * bandPlaneSize);
+        if (!decoded) {
+            LOG_E("[IMAGE_UTILS] Truncated run-length data at row %u", (unsigned) y);
+            break;
         }
+
+        uint32_t stageStart = micros();
+        writePanelBand(monoBuffer, colorBuffer, y, bandH);
+        addStageTime(timing, STAGE_WRITE, stageStart, 2 * bandPlaneSize);
+        if (panelFrameCancelled()) break;
+
+        esp_task_wdt_reset();
+        y += bandH;
     }
 
-    unsigned long processTime = millis() - t0;
-    Serial.println("[TIMING] Read + convert + write: " + String(processTime) + " ms (" + String(y) + " rows)");
-
-    // Single display refresh (hardware limit ~32s for 3-color e-paper)
-    t0 = millis();
-    Serial.println("[TIMING] Starting display.refresh()...");
-    display.refresh();
-    Serial.println("[TIMING] Display refresh: " + String(millis() - t0) + " ms");
-    Serial.println("[TIMING] Total pipeline: " + String(millis() - totalStart) + " ms");
-
-    free(colorBuffer);
-    free(monoBuffer);
-    free(readBuffer);
+    if (y == height && !reader.finished()) {
+        LOG_W("[IMAGE_UTILS] Warning: Trailing run-length data ignored");
+    }
+
+    LOG_I("[TIMING] Read + decode + write: %lu ms (%u rows)", millis() - t0, (unsigned) y);
+    finishPanelWrites(timing);
+    printPipelineTiming(timing);
+    lastRenderTiming = timing;
+
+    endPanelFrame(y == height);
+    LOG_I("[TIMING] Total pipeline: %lu ms", millis() - totalStart);
+
+    reader.end();
     file.close();
+    return y == height;
 }
 
-// Task implementation for image rendering
-void imageRenderTask(void *parameter) {
-    debug.println("[TASK] Image Render Task Started.");
+bool drawBmpImageFromSpiffs(const char *filename, uint16_t width, uint16_t height) {
+    LOG_I("[IMAGE_UTILS] >>> drawBmpImageFromSpiffs START");
+    unsigned long totalStart = millis();
 
-    // Initialize WDT for CPU 1
-    if (esp_task_wdt_init(WDT_TIMEOUT_SECONDS, true) != ESP_OK) {
-        debug.println("[TASK] Failed to initialize Watchdog Timer on CPU 1.");
-    } else {
-        debug.println("[TASK] Watchdog Timer initialized on CPU 1 with " + String(WDT_TIMEOUT_SECONDS) + " seconds timeout.");
+    char filePath[IMAGE_PATH_SIZE];
+    snprintf(filePath, sizeof(filePath), "/%s", filename);
+    fs::File file = LittleFS.open(filePath, "r");
+    if (!file) {
+        LOG_E("[IMAGE_UTILS] Error: File access failed at path: %s", filePath);
+        return false;
     }
 
-    // Add current task to WDT monitoring
-    if (esp_task_wdt_add(NULL) != ESP_OK) {
-        debug.println("[TASK] Failed to add Image Render Task to Watchdog Timer.");
-    } else {
-        debug.println("[TASK] Image Render Task added to Watchdog Timer.");
+    RenderArenaScope scope;
+    BmpDecoder decoder;
+    if (!decoder.begin(file, width, height, &renderArena)) {
+        LOG_E("[IMAGE_UTILS] ERROR: Unsupported or corrupt BMP file %s", filePath);
+        file.close();
+        return false;
     }
 
-    // Draw the image
-    drawProgmemFileFromSpiffs(SELECTED_IMAGE_BUFFER_PATH, 640, 384);
+    const BmpInfo &info = decoder.header();
+    LOG_I("[IMAGE_UTILS] BMP %ux%u %s, %s", (unsigned) info.width, (unsigned) info.height,
+          bmpPixelFormatName(info.format), info.bottomUp ? "bottom-up" : "top-down");
+
+    beginPanelFrame();
 
-    debug.println("[TASK] Image Render Task Completed.");
+    PipelineTiming timing;
+    resetPipelineTiming(timing);
+    timing.pixels = (uint32_t) width * height;
+    unsigned long t0 = millis();
+    uint16_t y = 0;
 
-    // Remove task from WDT monitoring
-    if (esp_task_wdt_delete(NULL) != ESP_OK) {
-        debug.println("[TASK] Failed to remove Image Render Task from Watchdog Timer.");
-    } else {
-        debug.println("[TASK] Image Render Task removed from Watchdog Timer.");
+    RenderPipelineStages stages = {readBmpBatch, convertBmpBatch, writeRawBatch, &decoder};
+    if (!runRenderPipeline(height, RENDER_BATCH_ROWS, info.rowSize, width / 8, stages, timing, y)) {
+        LOG_E("[IMAGE_UTILS] Failed to allocate buffers");
     }
 
-    // Task cleanup
-    vTaskDelete(NULL);
+    LOG_I("[TIMING] Read + convert + write: %lu ms (%u rows)", millis() - t0, (unsigned) y);
+    finishPanelWrites(timing);
+    printPipelineTiming(timing);
+    lastRenderTiming = timing;
+
+    endPanelFrame(y == height);
+    LOG_I("[TIMING] Total pipeline: %lu ms", millis() - totalStart);
+
+    decoder.end();
+    file.close();
+    return y == height;
+}
+
+ImageFormat detectImageFileFormat(const char *filename, uint16_t width, uint16_t height) {
+    char filePath[IMAGE_PATH_SIZE];
+    snprintf(filePath, sizeof(filePath), "/%s", filename);
+    fs::File file = LittleFS.open(filePath, "r");
+    if (!file) return IMAGE_FORMAT_UNKNOWN;
+
+    uint8_t head[IMAGE_DETECT_HEAD_SIZE];
+    size_t headLen = file.read(head, sizeof(head));
+    size_t fileSize = file.size();
+    file.close();
+
+    return detectImageFormat(head, headLen, fileSize, width, height);
+}
+
+bool drawImageFromSpiffs(const char *filename, uint16_t width, uint16_t height, DitherMode dither) {
+    ImageFormat format = detectImageFileFormat(filename, width, height);
+    LOG_I("[IMAGE_UTILS] Image format: %s", imageFormatName(format));
+
+    switch (format) {
+        case IMAGE_FORMAT_PLANES:
+            return drawPanelImageFromSpiffs(filename, width, height);
+        case IMAGE_FORMAT_PLANES_RLE:
+            return drawRlePanelImageFromSpiffs(filename, width, height);
+        case IMAGE_FORMAT_RGB565:
+            return drawProgmemFileFromSpiffs(filename, width, height, dither);
+        case IMAGE_FORMAT_BMP:
+            return drawBmpImageFromSpiffs(filename, width, height);
+        default:
+            LOG_E("[IMAGE_UTILS] Error: Unsupported image format in %s", filename);
+            return false;
+    }
 }
@@ -3,31 +3,56 @@
 
 #include <Arduino.h>
 #include "FS.h"
+#include "panel_format.h"
+#include "dither.h"
 
-uint16_t read16(fs::File &f);
-uint32_t read32(fs::File &f);
+// Rows converted and written to the panel per batch
+static const uint16_t RENDER_BATCH_ROWS = 16;
+
+// Stack buffer for the absolute path of an image file, so draws build no String
+#define IMAGE_PATH_SIZE 96
+
+/**
+ * Displays a raw binary image file from SPIFFS storage
+ * Expects RGB565 format (16 bits per pixel)
+ * File should contain raw pixel data without any header
+ * Image dimensions must match the provided width and height parameters
+ * Pixels are mapped to the panel palette with the given dither mode
+ * Returns true when the whole frame was drawn
+ */
+bool drawProgmemFileFromSpiffs(const char *filename, uint16_t width, uint16_t height,
+                               DitherMode dither = DITHER_NONE);
+
+/**
+ * Displays an image in the packed native panel format (see panel_format.h)
+ * Planes are streamed to the controller without any conversion
+ */
+bool drawPanelImageFromSpiffs(const char *filename, uint16_t width, uint16_t height);
 
 /**
- * Displays a BMP image from SPIFFS storage
+ * Displays a run-length compressed panel image (see plane_rle.h)
+ * Each band is decoded straight into the plane buffers sent to the controller
+ */
+bool drawRlePanelImageFromSpiffs(const char *filename, uint16_t width, uint16_t height);
+
+/**
+ * Displays a BMP image (see bmp_decoder.h) at the top-left corner of the panel
  * Supported color depths:
  * - 1 bit per pixel (monochrome)
  * - 2, 4, or 8 bits per pixel (palette colors)
- * - 16 bits per pixel (RGB565 or RGB555)
+ * - 16 bits per pixel (RGB555, or RGB565 with BI_BITFIELDS)
  * - 24 bits per pixel (RGB)
  * - 32 bits per pixel (RGBA). Alpha channel is ignored during processing.
- * 
- * Only uncompressed BMP files (BI_RGB) or BI_BITFIELDS (used only for 16-bit images) are supported.
+ * Larger images are cropped, smaller ones padded with white
  */
-void drawBitmapFromSpiffs(const char *filename, int16_t x, int16_t y, bool with_color);
+bool drawBmpImageFromSpiffs(const char *filename, uint16_t width, uint16_t height);
+
+ImageFormat detectImageFileFormat(const char *filename, uint16_t width, uint16_t height);
 
 /**
- * Displays a raw binary image file from SPIFFS storage
- * Expects RGB565 format (16 bits per pixel)
- * File should contain raw pixel data without any header
- * Image dimensions must match the provided width and height parameters
+ * Displays an image file in any supported format, detected from its header and size
  */
-void drawProgmemFileFromSpiffs(const char *filename, uint16_t width, uint16_t height);
-
-void imageRenderTask(void *parameter);
+bool drawImageFromSpiffs(const char *filename, uint16_t width, uint16_t height,
+                         DitherMode dither = DITHER_NONE);
 
 #endif
@@ -0,0 +1,496 @@
+#include "layout.h"
+#include "display.h"
+#include "filesystem.h"
+#include "image_utils.h"
+#include "panel_format.h"
+#include "render_arena.h"
+#include "debug.h"
+#include "esp_task_wdt.h"
+#include "esp_rom_crc.h"
+
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <Adafruit_GFX.h>
+#include <Fonts/FreeSans9pt7b.h>
+#include <Fonts/FreeSans12pt7b.h>
+#include <Fonts/FreeSans18pt7b.h>
+#include <Fonts/FreeSans24pt7b.h>
+#include <Fonts/FreeSansBold9pt7b.h>
+#include <Fonts/FreeSansBold12pt7b.h>
+#include <Fonts/FreeSansBold18pt7b.h>
+#include <Fonts/FreeSansBold24pt7b.h>
+#include <Fonts/FreeMono9pt7b.h>
+#include <Fonts/FreeMonoBold12pt7b.h>
+
+struct LayoutFont {
+    const char *name;
+    const GFXfont *font;  // nullptr: the built-in 6x8 font
+};
+
+static const LayoutFont fonts[] = {
+    {"default", nullptr},
+    {"sans9", &FreeSans9pt7b},
+    {"sans12", &FreeSans12pt7b},
+    {"sans18", &FreeSans18pt7b},
+    {"sans24", &FreeSans24pt7b},
+    {"sansBold9", &FreeSansBold9pt7b},
+    {"sansBold12", &FreeSansBold12pt7b},
+    {"sansBold18", &FreeSansBold18pt7b},
+    {"sansBold24", &FreeSansBold24pt7b},
+    {"mono9", &FreeMono9pt7b},
+    {"monoBold12", &FreeMonoBold12pt7b},
+};
+static const size_t font_count = sizeof(fonts) / sizeof(fonts[0]);
+
+enum LayoutElementType : uint8_t {
+    LAYOUT_TEXT,
+    LAYOUT_RECT,
+    LAYOUT_LINE,
+    LAYOUT_ICON
+};
+
+enum LayoutAlign : uint8_t {
+    LAYOUT_ALIGN_LEFT,
+    LAYOUT_ALIGN_CENTER,
+    LAYOUT_ALIGN_RIGHT
+};
+
+struct LayoutElement {
+    uint8_t type;
+    uint8_t font;
+    uint8_t size;       // text magnification
+    uint8_t align;
+    bool fill;
+    uint16_t color;     // GxEPD_BLACK, GxEPD_WHITE or GxEPD_RED
+    int16_t x, y;       // line: first end
+    int16_t w, h;       // line: second end
+    uint16_t text;      // text run or icon path, offset into the text pool
+};
+
+struct LayoutScene {
+    uint16_t background;
+    uint16_t count;
+    uint16_t textUsed;
+    LayoutElement elements[LAYOUT_MAX_ELEMENTS];
+    char textPool[LAYOUT_TEXT_POOL_SIZE];
+};
+
+// Parsed by the web handler, copied by the render task when it starts
+static LayoutScene parsedScene;
+static LayoutScene pendingScene;
+static LayoutScene renderScene;
+static bool pendingValid = false;
+static uint32_t pendingCrc = 0;
+static uint32_t pendingParseMicros = 0;
+static uint32_t pendingBodyBytes = 0;
+static portMUX_TYPE layoutLock = portMUX_INITIALIZER_UNLOCKED;
+
+static LayoutStats stats;
+
+// Rows [top, bottom) an element reaches, and where its text starts after alignment
+static int16_t elementTop[LAYOUT_MAX_ELEMENTS];
+static int16_t elementBottom[LAYOUT_MAX_ELEMENTS];
+static int16_t elementX[LAYOUT_MAX_ELEMENTS];
+
+struct LayoutIcon {
+    uint16_t width;
+    uint16_t height;
+    uint8_t *mono;
+    uint8_t *color;
+};
+
+static LayoutIcon icons[LAYOUT_MAX_ELEMENTS];
+
+/**
+ * Adafruit GFX target of RENDER_BATCH_ROWS rows of the panel planes. It
+ * covers the whole panel, so elements are drawn at their panel coordinates;
+ * whatever falls outside the current band is dropped.
+ */
+class BandCanvas : public Adafruit_GFX {
+private:
+    uint8_t *mono;
+    uint8_t *color;
+    int16_t top;
+    int16_t rows;
+
+    static void setBits(uint8_t *row, int16_t x0, int16_t x1, bool set) {
+        int16_t b0 = x0 >> 3;
+        int16_t b1 = (x1 - 1) >> 3;
+        uint8_t first = 0xFF >> (x0 & 7);
+        uint8_t last = 0xFF << (7 - ((x1 - 1) & 7));
+        if (b0 == b1) {
+            first &= last;
+            row[b0] = set ? row[b0] | first : row[b0] & ~first;
+            return;
+        }
+        row[b0] = set ? row[b0] | first : row[b0] & ~first;
+        if (b1 > b0 + 1) memset(row + b0 + 1, set ? 0xFF : 0x00, b1 - b0 - 1);
+        row[b1] = set ? row[b1] | last : row[b1] & ~last;
+    }
+
+    // Pixels [x0, x1) of panel row y, already clipped to the band
+    void fillSpan(int16_t x0, int16_t x1, int16_t y, uint16_t c) {
+        size_t offset = (size_t) (y - top) * (_width / 8);
+        bool red = c == GxEPD_RED;
+        setBits(mono + offset, x0, x1, c != GxEPD_BLACK);
+        setBits(color + offset, x0, x1, !red);
+    }
+
+public:
+    BandCanvas() : Adafruit_GFX(PanelDriver::WIDTH, PanelDriver::HEIGHT), mono(nullptr), color(nullptr), top(0), rows(0) {}
+
+    void begin(uint8_t *monoPlane, uint8_t *colorPlane, int16_t y, int16_t bandRows, uint16_t background) {
+        mono = monoPlane;
+        color = colorPlane;
+        top = y;
+        rows = bandRows;
+        fillRect(0, top, _width, rows, background);
+    }
+
+    void drawPixel(int16_t x, int16_t y, uint16_t c) override {
+        if (x < 0 || x >= _width || y < top || y >= top + rows) return;
+        fillSpan(x, x + 1, y, c);
+    }
+
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t c) override {
+        int16_t x0 = max<int16_t>(x, 0);
+        int16_t x1 = min<int16_t>(x + w, _width);
+        int16_t y0 = max<int16_t>(y, top);
+        int16_t y1 = min<int16_t>(y + h, top + rows);
+        for (int16_t row = y0; row < y1 && x0 < x1; row++) {
+            fillSpan(x0, x1, row, c);
+        }
+    }
+
+    void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t c) override {
+        fillRect(x, y, w, 1, c);
+    }
+
+    void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t c) override {
+        fillRect(x, y, 1, h, c);
+    }
+
+    void fillScreen(uint16_t c) override {
+        fillRect(0, top, _width, rows, c);
+    }
+};
+
+static BandCanvas canvas;
+
+size_t layoutFontCount() {
+    return font_count;
+}
+
+const char *layoutFontName(size_t index) {
+    return index < font_count ? fonts[index].name : "";
+}
+
+static bool parseColor(const char *name, uint16_t &color) {
+    if (!strcmp(name, "black")) color = GxEPD_BLACK;
+    else if (!strcmp(name, "white")) color = GxEPD_WHITE;
+    else if (!strcmp(name, "red")) color = GxEPD_RED;
+    else return false;
+    return true;
+}
+
+static bool addText(LayoutScene &scene, const char *text, uint16_t &offset) {
+    size_t len = strlen(text) + 1;
+    if (scene.textUsed + len > LAYOUT_TEXT_POOL_SIZE) return false;
+    memcpy(scene.textPool + scene.textUsed, text, len);
+    offset = scene.textUsed;
+    scene.textUsed += len;
+    return true;
+}
+
+static String parseElement(JsonObject e, LayoutScene &scene, LayoutElement &el) {
+    const char *type = e["type"] | "";
+    if (!parseColor(e["color"] | "black", el.color)) return "Unknown color";
+    el.x = e["x"] | 0;
+    el.y = e["y"] | 0;
+
+    if (!strcmp(type, "text")) {
+        el.type = LAYOUT_TEXT;
+        const char *font = e["font"] | "default";
+        for (el.font = 0; el.font < font_count && strcmp(fonts[el.font].name, font); el.font++) {}
+        if (el.font == font_count) return String("Unknown font: ") + font;
+        el.size = constrain((int) (e["size"] | 1), 1, 8);
+        const char *align = e["align"] | "left";
+        el.align = !strcmp(align, "center") ? LAYOUT_ALIGN_CENTER :
+                   !strcmp(align, "right") ? LAYOUT_ALIGN_RIGHT : LAYOUT_ALIGN_LEFT;
+        if (!addText(scene, e["text"] | "", el.text)) return "Too much text";
+    } else if (!strcmp(type, "rect")) {
+        el.type = LAYOUT_RECT;
+        el.w = e["w"] | 0;
+        el.h = e["h"] | 0;
+        el.fill = e["fill"] | false;
+        if (el.w <= 0 || el.h <= 0) return "Rectangle without size";
+    } else if (!strcmp(type, "line")) {
+        el.type = LAYOUT_LINE;
+        el.x = e["x0"] | 0;
+        el.y = e["y0"] | 0;
+        el.w = e["x1"] | 0;
+        el.h = e["y1"] | 0;
+    } else if (!strcmp(type, "icon")) {
+        el.type = LAYOUT_ICON;
+        const char *path = e["path"] | "";
+        if (!path[0]) return "Icon without path";
+        if (!addText(scene, path, el.text)) return "Too much text";
+    } else {
+        return String("Unknown element type: ") + type;
+    }
+    return String();
+}
+
+static String parseLayout(const uint8_t *body, size_t len, LayoutScene &scene) {
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, body, len);
+    if (err) return String("Invalid JSON: ") + err.c_str();
+
+    scene.count = 0;
+    scene.textUsed = 0;
+    if (!parseColor(doc["background"] | "white", scene.background)) return "Unknown background color";
+
+    JsonArray elements = doc["elements"];
+    if (elements.isNull()) return "Missing elements";
+    if (elements.size() > LAYOUT_MAX_ELEMENTS) return "More than " + String(LAYOUT_MAX_ELEMENTS) + " elements";
+
+    for (JsonObject e : elements) {
+        LayoutElement &el = scene.elements[scene.count];
+        memset(&el, 0, sizeof(el));
+        String error = parseElement(e, scene, el);
+        if (error.length()) return "Element " + String(scene.count) + ": " + error;
+        scene.count++;
+    }
+    return String();
+}
+
+String layoutEtag(const uint8_t *body, size_t len) {
+    char etag[20];
+    snprintf(etag, sizeof(etag), "\"%08x-layout\"", (unsigned) esp_rom_crc32_le(0, body, len));
+    return String(etag);
+}
+
+// Called from the web server task only, so parsedScene needs no lock
+String setPendingLayout(const uint8_t *body, size_t len) {
+    uint32_t t0 = micros();
+    String error = parseLayout(body, len, parsedScene);
+    uint32_t parseMicros = micros() - t0;
+    if (error.length()) return error;
+
+    uint32_t crc = esp_rom_crc32_le(0, body, len);
+    portENTER_CRITICAL(&layoutLock);
+    memcpy(&pendingScene, &parsedScene, sizeof(pendingScene));
+    pendingValid = true;
+    pendingCrc = crc;
+    pendingParseMicros = parseMicros;
+    pendingBodyBytes = len;
+    portEXIT_CRITICAL(&layoutLock);
+
+    LOG_I("[LAYOUT] Scene of %u elements, %u bytes, parsed in %u us",
+          (unsigned) parsedScene.count, (unsigned) len, (unsigned) parseMicros);
+    return String();
+}
+
+// Uncompressed EPD3 images, read into the render arena
+static bool loadIcon(const char *path, LayoutIcon &icon) {
+    char fullPath[IMAGE_PATH_SIZE];
+    snprintf(fullPath, sizeof(fullPath), "%s%s", path[0] == '/' ? "" : "/", path);
+    File file = LittleFS.open(fullPath, "r");
+    if (!file) return false;
+
+    uint8_t head[PANEL_IMAGE_HEADER_SIZE];
+    PanelImageHeader header;
+    if (file.read(head, sizeof(head)) != sizeof(head) || !parsePanelImageHeader(head, header) ||
+        header.encoding != PANEL_ENCODING_PLANES) {
+        file.close();
+        return false;
+    }
+
+    const size_t rowBytes = header.width / 8;
+    const size_t planeBytes = rowBytes * header.height;
+    icon.mono = (uint8_t *) renderArena.alloc(planeBytes);
+    icon.color = (uint8_t *) renderArena.alloc(planeBytes);
+    if (!icon.mono || !icon.color) {
+        file.close();
+        return false;
+    }
+
+    // Band by band: mono rows of the band, then its color rows
+    uint16_t bandRows = header.bandRows ? header.bandRows : header.height;
+    bool ok = true;
+    for (uint16_t y = 0; y < header.height && ok; y += bandRows) {
+        size_t bytes = rowBytes * min<uint16_t>(bandRows, header.height - y);
+        ok = file.read(icon.mono + y * rowBytes, bytes) == bytes &&
+             file.read(icon.color + y * rowBytes, bytes) == bytes;
+    }
+    file.close();
+    icon.width = header.width;
+    icon.height = header.height;
+    return ok;
+}
+
+// White icon pixels are transparent
+static void drawIcon(const LayoutIcon &icon, int16_t x, int16_t y, int16_t bandTop, int16_t bandBottom) {
+    const size_t rowBytes = icon.width / 8;
+    int16_t first = max<int16_t>(0, bandTop - y);
+    int16_t last = min<int16_t>(icon.height, bandBottom - y);
+    for (int16_t row = first; row < last; row++) {
+        const uint8_t *mono = icon.mono + row * rowBytes;
+        const uint8_t *color = icon.color + row * rowBytes;
+        for (int16_t col = 0; col < icon.width; col++) {
+            uint8_t bit = 0x80 >> (col & 7);
+            if (!(color[col >> 3] & bit)) canvas.drawPixel(x + col, y + row, GxEPD_RED);
+            else if (!(mono[col >> 3] & bit)) canvas.drawPixel(x + col, y + row, GxEPD_BLACK);
+        }
+    }
+}
+
+// Loads icons and measures every element once, so each band only draws what reaches into it
+static void prepareScene(const LayoutScene &scene) {
+    for (uint16_t i = 0; i < scene.count; i++) {
+        const LayoutElement &el = scene.elements[i];
+        const char *text = scene.textPool + el.text;
+        elementX[i] = el.x;
+        switch (el.type) {
+            case LAYOUT_TEXT: {
+                int16_t x1, y1;
+                uint16_t w, h;
+                canvas.setFont(fonts[el.font].font);
+                canvas.setTextSize(el.size);
+                canvas.getTextBounds(text, el.x, el.y, &x1, &y1, &w, &h);
+                if (el.align == LAYOUT_ALIGN_CENTER) elementX[i] -= w / 2;
+                else if (el.align == LAYOUT_ALIGN_RIGHT) elementX[i] -= w;
+                elementTop[i] = y1;
+                elementBottom[i] = y1 + h;
+                break;
+            }
+            case LAYOUT_RECT:
+                elementTop[i] = el.y;
+                elementBottom[i] = el.y + el.h;
+                break;
+            case LAYOUT_LINE:
+                elementTop[i] = min(el.y, el.h);
+                elementBottom[i] = max(el.y, el.h) + 1;
+                break;
+            case LAYOUT_ICON:
+                if (!loadIcon(text, icons[i])) {
+                    LOG_W("[LAYOUT] Cannot load icon %s", text);
+                    icons[i].height = 0;
+                }
+                elementTop[i] = el.y;
+                elementBottom[i] = el.y + icons[i].height;
+                break;
+        }
+    }
+}
+
+static void drawElement(const LayoutScene &scene, uint16_t i, int16_t bandTop, int16_t bandBottom) {
+    const LayoutElement &el = scene.elements[i];
+    switch (el.type) {
+        case LAYOUT_TEXT:
+            canvas.setFont(fonts[el.font].font);
+            canvas.setTextSize(el.size);
+            canvas.setTextColor(el.color);
+            canvas.setCursor(elementX[i], el.y);
+            canvas.print(scene.textPool + el.text);
+            break;
+        case LAYOUT_RECT:
+            if (el.fill) canvas.fillRect(el.x, el.y, el.w, el.h, el.color);
+            else canvas.drawRect(el.x, el.y, el.w, el.h, el.color);
+            break;
+        case LAYOUT_LINE:
+            canvas.drawLine(el.x, el.y, el.w, el.h, el.color);
+            break;
+        case LAYOUT_ICON:
+            drawIcon(icons[i], el.x, el.y, bandTop, bandBottom);
+            break;
+    }
+}
+
+bool renderPendingLayout() {
+    portENTER_CRITICAL(&layoutLock);
+    bool valid = pendingValid;
+    if (valid) memcpy(&renderScene, &pendingScene, sizeof(renderScene));
+    uint32_t crc = pendingCrc;
+    LayoutStats run = {};
+    run.parseMicros = pendingParseMicros;
+    run.bodyBytes = pendingBodyBytes;
+    portEXIT_CRITICAL(&layoutLock);
+
+    if (!valid) {
+        LOG_W("[LAYOUT] No scene to draw");
+        return false;
+    }
+
+    LOG_I("[LAYOUT] >>> renderPendingLayout START");
+    unsigned long totalStart = millis();
+    const uint16_t width = PanelDriver::WIDTH;
+    const uint16_t height = PanelDriver::HEIGHT;
+    const size_t rowBytes = width / 8;
+
+    RenderArenaScope scope;
+    uint8_t *mono = (uint8_t *) renderArena.alloc(rowBytes * RENDER_BATCH_ROWS);
+    uint8_t *color = (uint8_t *) renderArena.alloc(rowBytes * RENDER_BATCH_ROWS);
+    if (!mono || !color) {
+        LOG_E("[LAYOUT] Failed to allocate buffers");
+        return false;
+    }
+
+    PipelineTiming timing;
+    resetPipelineTiming(timing);
+    timing.pixels = (uint32_t) width * height;
+
+    uint32_t t0 = micros();
+    canvas.setTextWrap(false);
+    prepareScene(renderScene);
+    run.prepareMicros = micros() - t0;
+    addStageTime(timing, STAGE_READ, t0, 0);
+    run.elements = renderScene.count;
+
+    beginPanelFrame();
+
+    uint16_t y = 0;
+    while (y < height) {
+        uint16_t rows = min<uint16_t>(RENDER_BATCH_ROWS, height - y);
+        size_t planeBytes = rowBytes * rows;
+
+        uint32_t stageStart = micros();
+        canvas.begin(mono, color, y, rows, renderScene.background);
+        bool touched = false;
+        for (uint16_t i = 0; i < renderScene.count; i++) {
+            if (elementBottom[i] <= y || elementTop[i] >= y + rows) continue;
+            drawElement(renderScene, i, y, y + rows);
+            touched = true;
+        }
+        if (touched) run.bands++;
+        addStageTime(timing, STAGE_CONVERT, stageStart, 2 * planeBytes);
+
+        stageStart = micros();
+        writePanelBand(mono, color, y, rows);
+        addStageTime(timing, STAGE_WRITE, stageStart, 2 * planeBytes);
+        if (panelFrameCancelled()) break;
+
+        esp_task_wdt_reset();
+        y += rows;
+    }
+    run.rasterMicros = timing.stages[STAGE_CONVERT].micros;
+
+    LOG_I("[TIMING] Layout parse: %u us, prepare: %u us, raster: %u us (%u elements)", (unsigned) run.parseMicros,
+          (unsigned) run.prepareMicros, (unsigned) run.rasterMicros, (unsigned) run.elements);
+    finishPanelWrites(timing);
+    printPipelineTiming(timing);
+    lastRenderTiming = timing;
+    stats = run;
+
+    endPanelFrame(y == height);
+    LOG_I("[TIMING] Total layout: %lu ms", millis() - totalStart);
+
+    char etag[20];
+    snprintf(etag, sizeof(etag), "\"%08x-layout\"", (unsigned) crc);
+    setDisplayedImageEtag(y == height ? etag : "");
+    return y == height;
+}
+
+LayoutStats lastLayoutStats() {
+    return stats;
+}
@@ -0,0 +1,65 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <Arduino.h>
+
+// Largest scene body /api/layout accepts
+#ifndef LAYOUT_MAX_BODY
+#define LAYOUT_MAX_BODY 4096
+#endif
+
+#ifndef LAYOUT_MAX_ELEMENTS
+#define LAYOUT_MAX_ELEMENTS 64
+#endif
+
+// Text runs and icon paths of a scene, NUL-terminated one after another
+#ifndef LAYOUT_TEXT_POOL_SIZE
+#define LAYOUT_TEXT_POOL_SIZE 1024
+#endif
+
+struct LayoutStats {
+    uint32_t parseMicros;   // JSON to scene, in the request handler
+    uint32_t prepareMicros; // icons loaded and element bounds measured
+    uint32_t rasterMicros;  // drawing the bands, panel writes excluded
+    uint16_t elements;
+    uint16_t bands;         // bands at least one element was drawn in
+    uint32_t bodyBytes;
+};
+
+/**
+ * Parses a scene and makes it the one the next JOB_SOURCE_LAYOUT render
+ * draws:
+ *
+ *   {"background": "white",
+ *    "elements": [
+ *      {"type": "rect", "x": 0, "y": 0, "w": 640, "h": 40, "color": "black", "fill": true},
+ *      {"type": "text", "x": 320, "y": 30, "text": "21.5 C", "font": "sansBold18",
+ *       "color": "white", "align": "center"},
+ *      {"type": "line", "x0": 0, "y0": 41, "x1": 639, "y1": 41, "color": "red"},
+ *      {"type": "icon", "x": 16, "y": 60, "path": "/icons/sun.epd3"}]}
+ *
+ * Colors are black, white and red. Icons are uncompressed EPD3 images on
+ * LittleFS, drawn with white as transparent. Text is placed by its baseline
+ * (by its top-left corner with the built-in "default" font). Returns an error
+ * message, or an empty string when the scene was accepted.
+ */
+String setPendingLayout(const uint8_t *body, size_t len);
+
+// ETag of the frame a scene body draws
+String layoutEtag(const uint8_t *body, size_t len);
+
+/**
+ * Draws the pending scene band by band into the panel, with no framebuffer:
+ * each band is cleared, every element that reaches into it is drawn with
+ * Adafruit GFX, and the band goes to writePanelBand, which skips it when it
+ * did not change. Call from the render task with the display lock held.
+ */
+bool renderPendingLayout();
+
+LayoutStats lastLayoutStats();
+
+// Names of the fonts a text element can use
+size_t layoutFontCount();
+const char *layoutFontName(size_t index);
+
+#endif
@@ -3,6 +3,13 @@
 #include "display.h"
 #include "filesystem.h"
 #include "webserver.h"
+#include "render_arena.h"
+#include "render_scheduler.h"
+#include "image_store.h"
+#include "upload_session.h"
+#include "upload_inflate.h"
+#include "events.h"
+#include "boot.h"
 #include <WiFi.h>
 #include <LittleFS.h>
 #include "esp_task_wdt.h"
@@ -22,39 +29,21 @@ const long statusUpdateInterval = 5000;  // Update status message every 5 second
 
 String data;
 
-void setup() {
-    // CRITICAL: Disable brownout detector first
-    // This prevents reboot on voltage drops from USB cable
-    WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0);
+static const uint32_t wifi_connect_timeout_ms = 20000;
+static const uint32_t panel_init_timeout_ms = 10000;
+static const uint32_t panel_init_stack = 4096;
 
-    Serial.begin(115200);
-    delay(2000);
-
-    Serial.println("\n\n=== ESP32 WEATHER STATION ===");
-    Serial.println("Starting initialization...");
-    Serial.println("Brownout detector DISABLED for USB power");
-
-    // Early WiFi mode initialization for stability
-    WiFi.mode(WIFI_STA);
-    delay(100);
-
-    // I2C-OLED display
-    Serial.println("Initializing OLED debug...");
-    debug.begin();
-    delay(200); // Increased delay for I2C stabilization
-    Serial.println("OLED initialized");
-    debug.println("[SYSTEM] Starting system initialization...");
-
-    while (!Serial) {
+static void haltOnFilesystemError() {
+    while(1) {
+        digitalWrite(LED_PIN, HIGH);
+        delay(100);
+        digitalWrite(LED_PIN, LOW);
         delay(100);
     }
-    debug.println("[SYSTEM] Serial communication established");
-
-    pinMode(LED_PIN, OUTPUT);
-    digitalWrite(LED_PIN, LOW);
-    debug.println("[SYSTEM] LED pin initialized");
-    delay(200); // Delay before next module
+}
 
+static void mountFilesystem() {
+    bootStageBegin(BOOT_LITTLEFS);
     Serial.println("Initializing LittleFS...");
     debug.println("[FILESYSTEM] Initializing LittleFS...");
 
@@ -64,22 +53,32 @@ void setup() {
         debug.println("[FILESYSTEM] ERROR: LittleFS mount failed, formatting...");
 
         LittleFS.format();
-        delay(1000);
 
         if (!LittleFS.begin(true, "/data")) {
             Serial.println("LittleFS format failed! System halted.");
             debug.println("[FILESYSTEM] CRITICAL: Cannot initialize LittleFS!");
-            while(1) {
-                digitalWrite(LED_PIN, HIGH);
-                delay(100);
-                digitalWrite(LED_PIN, LOW);
-                delay(100);
-            }
+            haltOnFilesystemError();
         }
     }
     Serial.println("LittleFS mounted successfully");
     debug.println("[FILESYSTEM] LittleFS mounted successfully");
+    bootStageEnd(BOOT_LITTLEFS);
+
+    bootStageBegin(BOOT_IMAGE_STORE);
+    initImageStore();
+    initUploadSessions();
+    bootStageEnd(BOOT_IMAGE_STORE);
+}
+
+// Large buffers go first, before the heap fragments
+static void reserveRenderArena() {
+    bootStageBegin(BOOT_RENDER_ARENA);
+    initRenderArena();
+    initUploadInflater();
+    bootStageEnd(BOOT_RENDER_ARENA);
+}
 
+static void readIntro() {
     File file = LittleFS.open("/intro.txt");
     if (!file) {
         debug.println("Failed to open /data/intro.txt");
@@ -89,51 +88,166 @@ void setup() {
         debug.println("Content of /data/intro.txt:");
         debug.println(data);
     }
+}
 
+static void initWatchdog() {
     if (esp_task_wdt_init(WDT_TIMEOUT_SECONDS, true) != ESP_OK) {
         debug.println("[WDT] ERROR: Watchdog initialization failed");
     }
     debug.println("[WDT] Watchdog timer initialized");
-    delay(200); // Delay after WDT
-
-    // WiFi connection BEFORE display initialization (to spread power consumption peaks)
-    debug.println("[WIFI] Initiating connection...");
+}
 
-    // Increased delay before WiFi for power stabilization
-    delay(1000); // Was 500ms, increased to 1000ms
+static void connectWifiOrRestart() {
+    bootStageBegin(BOOT_WIFI_CONNECT);
+    if (!waitForWifi(wifi_connect_timeout_ms)) {
+        debug.println("[WIFI] ERROR: Failed to connect after 20 seconds");
+        debug.println("[WIFI] Restarting ESP32...");
+        delay(1000);
+        ESP.restart();
+    }
+    bootStageEnd(BOOT_WIFI_CONNECT);
 
-    String wifiMsg = "[WIFI] Connecting to SSID: ";
-    wifiMsg += ssid;
-    debug.println(wifiMsg);
+    debug.println("[WIFI] Connection established");
+    String ipMsg = "[WIFI] IP address: ";
+    ipMsg += WiFi.localIP().toString();
+    debug.println(ipMsg);
+}
 
+static void startWifi() {
+    bootStageBegin(BOOT_WIFI_START);
+    WiFi.mode(WIFI_STA);
     // Set minimum transmitter power to reduce consumption
     WiFi.setTxPower(WIFI_POWER_8_5dBm);  // Minimum power for USB
-    debug.println("[WIFI] TX power set to 8.5dBm (minimum for USB)");
-
     // Disable WiFi sleep mode for stability
     WiFi.setSleep(false);
+    beginWifi();
+    bootStageEnd(BOOT_WIFI_START);
+}
+
+static void initPanelStage(uint32_t diagBitrate) {
+    bootStageBegin(BOOT_PANEL);
+    initPanel(diagBitrate);
+    bootStageEnd(BOOT_PANEL);
+}
+
+static void panelInitTask(void *parameter) {
+    // No GxEPD2 diagnostics: they would restart Serial under the log task
+    initPanelStage(0);
+    xTaskNotifyGive((TaskHandle_t) parameter);
+    vTaskDelete(NULL);
+}
+
+#if FAST_BOOT
+
+void setup() {
+    WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0);
+
+    bootStageBegin(BOOT_SERIAL);
+    Serial.begin(115200);
+    pinMode(LED_PIN, OUTPUT);
+    digitalWrite(LED_PIN, LOW);
+    bootStageEnd(BOOT_SERIAL);
+
+    // Before WiFi allocates its buffers, as in the standard sequence
+    reserveRenderArena();
 
-    WiFi.begin(ssid, password);
+    // The association runs in the WiFi task while the rest comes up
+    startWifi();
 
-    int wifiAttempts = 0;
-    while (WiFi.status() != WL_CONNECTED && wifiAttempts < 40) {
-        delay(500);
-        Serial.print(".");
-        esp_task_wdt_reset();
-        wifiAttempts++;
+    bootStageBegin(BOOT_OLED);
+    debug.begin();
+    debug.startTask();
+    bootStageEnd(BOOT_OLED);
+    LOG_I("[SYSTEM] Fast boot, reset reason: %s", resetReasonName());
+
+    // Panel reset and SPI setup on the other core while LittleFS mounts here
+    TaskHandle_t panelTask = nullptr;
+    if (xTaskCreatePinnedToCore(panelInitTask, "panelInit", panel_init_stack, xTaskGetCurrentTaskHandle(),
+                                1, &panelTask, 0) != pdPASS) {
+        panelTask = nullptr;
     }
 
-    if (WiFi.status() != WL_CONNECTED) {
-        debug.println("\n[WIFI] ERROR: Failed to connect after 20 seconds");
-        debug.println("[WIFI] Restarting ESP32...");
-        delay(1000);
-        ESP.restart();
+    mountFilesystem();
+    readIntro();
+    initWatchdog();
+
+    if (!panelTask) {
+        initPanelStage(0);
+    } else if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(panel_init_timeout_ms)) == 0) {
+        LOG_E("[DISPLAY] Panel initialization timed out");
     }
+    initDisplayLock();
+    startRenderScheduler();
+    debug.println("[DISPLAY] Display hardware initialized successfully");
 
-    debug.println("\n[WIFI] Connection established");
-    String ipMsg = "[WIFI] IP address: ";
-    ipMsg += WiFi.localIP().toString();
-    debug.println(ipMsg);
+    connectWifiOrRestart();
+
+    bootStageBegin(BOOT_WEBSERVER);
+    startWebserver();
+    bootStageEnd(BOOT_WEBSERVER);
+
+    bootCompleted();
+    debug.println("[SYSTEM] System initialization complete");
+}
+
+#else
+
+void setup() {
+    // CRITICAL: Disable brownout detector first
+    // This prevents reboot on voltage drops from USB cable
+    WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0);
+
+    bootStageBegin(BOOT_SERIAL);
+    Serial.begin(115200);
+    delay(2000);
+
+    Serial.println("\n\n=== ESP32 WEATHER STATION ===");
+    Serial.println("Starting initialization...");
+    Serial.println("Brownout detector DISABLED for USB power");
+    bootStageEnd(BOOT_SERIAL);
+
+    // Early WiFi mode initialization for stability
+    WiFi.mode(WIFI_STA);
+    delay(100);
+
+    // I2C-OLED display
+    bootStageBegin(BOOT_OLED);
+    Serial.println("Initializing OLED debug...");
+    debug.begin();
+    debug.startTask();
+    delay(200); // Increased delay for I2C stabilization
+    Serial.println("OLED initialized");
+    debug.println("[SYSTEM] Starting system initialization...");
+    bootStageEnd(BOOT_OLED);
+
+    while (!Serial) {
+        delay(100);
+    }
+    debug.println("[SYSTEM] Serial communication established");
+
+    pinMode(LED_PIN, OUTPUT);
+    digitalWrite(LED_PIN, LOW);
+    debug.println("[SYSTEM] LED pin initialized");
+    delay(200); // Delay before next module
+
+    mountFilesystem();
+
+    // Reserve render buffers before WiFi and the web server start fragmenting the heap
+    reserveRenderArena();
+
+    readIntro();
+    initWatchdog();
+    delay(200); // Delay after WDT
+
+    // WiFi connection BEFORE display initialization (to spread power consumption peaks)
+    debug.println("[WIFI] Initiating connection...");
+
+    // Increased delay before WiFi for power stabilization
+    delay(1000); // Was 500ms, increased to 1000ms
+
+    startWifi();
+    debug.println("[WIFI] TX power set to 8.5dBm (minimum for USB)");
+    connectWifiOrRestart();
 
     // Delay after WiFi before display initialization
     debug.println("[SYSTEM] Waiting before display init...");
@@ -141,17 +255,22 @@ void setup() {
 
     // E-Paper display (after WiFi)
     debug.println("[DISPLAY] Initializing display hardware...");
-    hspi.begin(13, 12, 14, 15);
-    display.epd2.selectSPI(hspi, SPISettings(10000000, MSBFIRST, SPI_MODE0));
-    display.init(115200);
+    initPanelStage(115200);
+    initDisplayLock();
+    startRenderScheduler();
     debug.println("[DISPLAY] Display hardware initialized successfully");
 
+    bootStageBegin(BOOT_WEBSERVER);
     startWebserver();
+    bootStageEnd(BOOT_WEBSERVER);
     listFiles();
+    bootCompleted();
     debug.println("[SYSTEM] System initialization complete");
     debug.println("[SYSTEM] Running on USB power");
 }
 
+#endif
+
 void loop() {
     unsigned long currentMillis = millis();
 
@@ -162,9 +281,6 @@ void loop() {
         digitalWrite(LED_PIN, ledState ? HIGH : LOW);
     }
 
-    // Handle display updates when triggered by server
-    handleDisplayJob();
-
     // Update status message every 5 seconds
     if (currentMillis - previousStatusUpdate >= statusUpdateInterval) {
         previousStatusUpdate = currentMillis;
@@ -173,5 +289,8 @@ void loop() {
         debug.println(statusMsg);
     }
 
+    // Events posted by the render task and the web server go out from here
+    drainEvents();
+
     esp_task_wdt_reset();
 }
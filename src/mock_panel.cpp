@@ -0,0 +1,199 @@
+#include "mock_panel.h"
+
+static const char *const op_names[MOCK_OP_COUNT] = {
+    "init", "fill", "write", "refresh", "powerOff", "hibernate"
+};
+
+const char *mockPanelOpName(MockPanelOp op) {
+    return op < MOCK_OP_COUNT ? op_names[op] : "unknown";
+}
+
+// The real controller takes 4 bits per pixel: both planes are merged on the wire
+static uint32_t wireBytes(int16_t w, int16_t h) {
+    return (uint32_t) w * h / 2;
+}
+
+MockPanel::MockPanel()
+    : GxEPD2_EPD(-1, -1, -1, -1, LOW, 0, WIDTH, HEIGHT, panel, hasColor, hasPartialUpdate, hasFastPartialUpdate),
+      mono(nullptr), color(nullptr), callCount(0) {
+    counterLock = portMUX_INITIALIZER_UNLOCKED;
+    memset(opCalls, 0, sizeof(opCalls));
+    memset(opBytes, 0, sizeof(opBytes));
+}
+
+void MockPanel::init(uint32_t serial_diag_bitrate) {
+    init(serial_diag_bitrate, true);
+}
+
+void MockPanel::init(uint32_t serial_diag_bitrate, bool initial, uint16_t reset_duration, bool pulldown_rst_mode) {
+    if (!mono) mono = (uint8_t *) malloc(PLANE_SIZE);
+    if (!color) color = (uint8_t *) malloc(PLANE_SIZE);
+    if (!mono || !color) {
+        Serial.println("[MOCK] No memory for panel RAM, counting calls only");
+    }
+    record(MOCK_OP_INIT, 0, 0, WIDTH, HEIGHT, 0);
+}
+
+void MockPanel::record(MockPanelOp op, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t bytes) {
+    portENTER_CRITICAL(&counterLock);
+    opCalls[op]++;
+    opBytes[op] += bytes;
+    MockPanelCall &call = callLog[callCount % MOCK_PANEL_LOG_SIZE];
+    call.op = op;
+    call.x = x;
+    call.y = y;
+    call.w = w;
+    call.h = h;
+    call.bytes = bytes;
+    callCount++;
+    portEXIT_CRITICAL(&counterLock);
+}
+
+size_t MockPanel::lastCalls(MockPanelCall *out, size_t max) const {
+    portENTER_CRITICAL((portMUX_TYPE *) &counterLock);
+    size_t count = callCount < MOCK_PANEL_LOG_SIZE ? callCount : MOCK_PANEL_LOG_SIZE;
+    if (count > max) count = max;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = callLog[(callCount - count + i) % MOCK_PANEL_LOG_SIZE];
+    }
+    portEXIT_CRITICAL((portMUX_TYPE *) &counterLock);
+    return count;
+}
+
+void MockPanel::resetCounters() {
+    portENTER_CRITICAL(&counterLock);
+    memset(opCalls, 0, sizeof(opCalls));
+    memset(opBytes, 0, sizeof(opBytes));
+    callCount = 0;
+    portEXIT_CRITICAL(&counterLock);
+}
+
+void MockPanel::clearScreen(uint8_t value) {
+    clearScreen(value, 0xFF);
+}
+
+void MockPanel::clearScreen(uint8_t black_value, uint8_t color_value) {
+    writeScreenBuffer(black_value, color_value);
+    refresh(false);
+}
+
+void MockPanel::writeScreenBuffer(uint8_t value) {
+    writeScreenBuffer(value, 0xFF);
+}
+
+void MockPanel::writeScreenBuffer(uint8_t black_value, uint8_t color_value) {
+    if (mono) memset(mono, black_value, PLANE_SIZE);
+    if (color) memset(color, color_value, PLANE_SIZE);
+    record(MOCK_OP_FILL, 0, 0, WIDTH, HEIGHT, wireBytes(WIDTH, HEIGHT));
+}
+
+// Same rounding and clipping as the GxEPD2 drivers: x and w to whole bytes,
+// rows mirrored over the whole bitmap height. A null bitmap writes white.
+void MockPanel::copyPlane(uint8_t *plane, const uint8_t *bitmap, int16_t x_part, int16_t y_part, int16_t w_bitmap,
+                          int16_t h_bitmap, int16_t x, int16_t y, int16_t w, int16_t h, bool invert, bool mirror_y) {
+    if (!plane) return;
+    int16_t wb = (w_bitmap + 7) / 8;
+    int16_t x1 = x < 0 ? 0 : x;
+    int16_t y1 = y < 0 ? 0 : y;
+    int16_t x2 = x + w > WIDTH ? WIDTH : x + w;
+    int16_t y2 = y + h > HEIGHT ? HEIGHT : y + h;
+    if (x1 >= x2 || y1 >= y2) return;
+
+    int16_t dx = x1 - x;
+    int16_t dy = y1 - y;
+    int16_t rowBytes = (x2 - x1) / 8;
+    for (int16_t i = 0; i < y2 - y1; i++) {
+        uint8_t *out = plane + (size_t) (y1 + i) * (WIDTH / 8) + x1 / 8;
+        if (!bitmap) {
+            memset(out, 0xFF, rowBytes);
+            continue;
+        }
+        int32_t row = y_part + dy + i;
+        if (mirror_y) row = h_bitmap - 1 - row;
+        const uint8_t *in = bitmap + row * wb + (x_part + dx) / 8;
+        for (int16_t j = 0; j < rowBytes; j++) {
+            out[j] = invert ? ~in[j] : in[j];
+        }
+    }
+}
+
+void MockPanel::writeImage(const uint8_t bitmap[], int16_t x, int16_t y, int16_t w, int16_t h,
+                           bool invert, bool mirror_y, bool pgm) {
+    writeImage(bitmap, nullptr, x, y, w, h, invert, mirror_y, pgm);
+}
+
+void MockPanel::writeImagePart(const uint8_t bitmap[], int16_t x_part, int16_t y_part, int16_t w_bitmap, int16_t h_bitmap,
+                               int16_t x, int16_t y, int16_t w, int16_t h, bool invert, bool mirror_y, bool pgm) {
+    writeImagePart(bitmap, nullptr, x_part, y_part, w_bitmap, h_bitmap, x, y, w, h, invert, mirror_y, pgm);
+}
+
+void MockPanel::writeImage(const uint8_t *black, const uint8_t *color_bitmap, int16_t x, int16_t y, int16_t w, int16_t h,
+                           bool invert, bool mirror_y, bool pgm) {
+    writeImagePart(black, color_bitmap, 0, 0, w, h, x, y, w, h, invert, mirror_y, pgm);
+}
+
+void MockPanel::writeImagePart(const uint8_t *black, const uint8_t *color_bitmap, int16_t x_part, int16_t y_part,
+                               int16_t w_bitmap, int16_t h_bitmap, int16_t x, int16_t y, int16_t w, int16_t h,
+                               bool invert, bool mirror_y, bool pgm) {
+    x -= x % 8;
+    w = 8 * ((w + 7) / 8);
+    x_part -= x_part % 8;
+    copyPlane(mono, black, x_part, y_part, w_bitmap, h_bitmap, x, y, w, h, invert, mirror_y);
+    copyPlane(color, color_bitmap, x_part, y_part, w_bitmap, h_bitmap, x, y, w, h, invert, mirror_y);
+
+    int16_t cw = min<int16_t>(x + w, WIDTH) - max<int16_t>(x, 0);
+    int16_t ch = min<int16_t>(y + h, HEIGHT) - max<int16_t>(y, 0);
+    record(MOCK_OP_WRITE, x, y, w, h, cw > 0 && ch > 0 ? wireBytes(cw, ch) : 0);
+}
+
+void MockPanel::writeNative(const uint8_t *data1, const uint8_t *data2, int16_t x, int16_t y, int16_t w, int16_t h,
+                            bool invert, bool mirror_y, bool pgm) {
+    writeImage(data1, data2, x, y, w, h, invert, mirror_y, pgm);
+}
+
+void MockPanel::drawImage(const uint8_t bitmap[], int16_t x, int16_t y, int16_t w, int16_t h,
+                          bool invert, bool mirror_y, bool pgm) {
+    writeImage(bitmap, x, y, w, h, invert, mirror_y, pgm);
+    refresh(x, y, w, h);
+}
+
+void MockPanel::drawImagePart(const uint8_t bitmap[], int16_t x_part, int16_t y_part, int16_t w_bitmap, int16_t h_bitmap,
+                              int16_t x, int16_t y, int16_t w, int16_t h, bool invert, bool mirror_y, bool pgm) {
+    writeImagePart(bitmap, x_part, y_part, w_bitmap, h_bitmap, x, y, w, h, invert, mirror_y, pgm);
+    refresh(x, y, w, h);
+}
+
+void MockPanel::drawImage(const uint8_t *black, const uint8_t *color_bitmap, int16_t x, int16_t y, int16_t w, int16_t h,
+                          bool invert, bool mirror_y, bool pgm) {
+    writeImage(black, color_bitmap, x, y, w, h, invert, mirror_y, pgm);
+    refresh(x, y, w, h);
+}
+
+void MockPanel::drawImagePart(const uint8_t *black, const uint8_t *color_bitmap, int16_t x_part, int16_t y_part,
+                              int16_t w_bitmap, int16_t h_bitmap, int16_t x, int16_t y, int16_t w, int16_t h,
+                              bool invert, bool mirror_y, bool pgm) {
+    writeImagePart(black, color_bitmap, x_part, y_part, w_bitmap, h_bitmap, x, y, w, h, invert, mirror_y, pgm);
+    refresh(x, y, w, h);
+}
+
+void MockPanel::drawNative(const uint8_t *data1, const uint8_t *data2, int16_t x, int16_t y, int16_t w, int16_t h,
+                           bool invert, bool mirror_y, bool pgm) {
+    writeNative(data1, data2, x, y, w, h, invert, mirror_y, pgm);
+    refresh(x, y, w, h);
+}
+
+void MockPanel::refresh(bool partial_update_mode) {
+    record(MOCK_OP_REFRESH, 0, 0, WIDTH, HEIGHT, 0);
+}
+
+void MockPanel::refresh(int16_t x, int16_t y, int16_t w, int16_t h) {
+    record(MOCK_OP_REFRESH, x, y, w, h, 0);
+}
+
+void MockPanel::powerOff() {
+    record(MOCK_OP_POWER_OFF, 0, 0, 0, 0, 0);
+}
+
+void MockPanel::hibernate() {
+    record(MOCK_OP_HIBERNATE, 0, 0, 0, 0, 0);
+}
@@ -0,0 +1,125 @@
+#ifndef MOCK_PANEL_H
+#define MOCK_PANEL_H
+
+#include <Arduino.h>
+#include <GxEPD2_EPD.h>
+
+// 1: build against MockPanel instead of the GDEW075Z09 on HSPI
+#ifndef PANEL_MOCK
+#define PANEL_MOCK 0
+#endif
+
+// Last panel calls kept for /api/panel
+#ifndef MOCK_PANEL_LOG_SIZE
+#define MOCK_PANEL_LOG_SIZE 64
+#endif
+
+enum MockPanelOp : uint8_t {
+    MOCK_OP_INIT,
+    MOCK_OP_FILL,       // writeScreenBuffer
+    MOCK_OP_WRITE,      // writeImage, writeImagePart, writeNative
+    MOCK_OP_REFRESH,
+    MOCK_OP_POWER_OFF,
+    MOCK_OP_HIBERNATE,
+    MOCK_OP_COUNT
+};
+
+// One call to the panel; with the real driver each is one SPI transaction per plane
+struct MockPanelCall {
+    uint8_t op;
+    int16_t x;
+    int16_t y;
+    int16_t w;
+    int16_t h;
+    uint32_t bytes;     // bytes the real driver would clock out
+};
+
+const char *mockPanelOpName(MockPanelOp op);
+
+/**
+ * Stand-in for GxEPD2_750c with the same interface, for GxEPD2_3C and the
+ * band writer in display.cpp. Instead of clocking data out on SPI it keeps
+ * controller RAM (a mono and a color plane, bit cleared = ink, as the real
+ * controller) in memory and counts calls and bytes, so render paths can be
+ * checked bit for bit and timed without the 16 s refresh. The planes are
+ * allocated in init(); when the heap is short only the counters work.
+ */
+class MockPanel : public GxEPD2_EPD {
+public:
+    static const uint16_t WIDTH = 640;
+    static const uint16_t WIDTH_VISIBLE = WIDTH;
+    static const uint16_t HEIGHT = 384;
+    static const GxEPD2::Panel panel = GxEPD2::GDEW075Z09;
+    static const bool hasColor = true;
+    static const bool hasPartialUpdate = true;
+    static const bool usePartialUpdateWindow = false;
+    static const bool hasFastPartialUpdate = false;
+    static const uint16_t power_on_time = 0;
+    static const uint16_t power_off_time = 0;
+    static const uint16_t full_refresh_time = 0;
+    static const uint16_t partial_refresh_time = 0;
+
+    static const size_t PLANE_SIZE = (size_t) WIDTH / 8 * HEIGHT;
+
+    MockPanel();
+
+    void init(uint32_t serial_diag_bitrate = 0);
+    void init(uint32_t serial_diag_bitrate, bool initial, uint16_t reset_duration = 10, bool pulldown_rst_mode = false);
+
+    void clearScreen(uint8_t value = 0xFF);
+    void clearScreen(uint8_t black_value, uint8_t color_value);
+    void writeScreenBuffer(uint8_t value = 0xFF);
+    void writeScreenBuffer(uint8_t black_value, uint8_t color_value);
+    void writeImage(const uint8_t bitmap[], int16_t x, int16_t y, int16_t w, int16_t h,
+                    bool invert = false, bool mirror_y = false, bool pgm = false);
+    void writeImagePart(const uint8_t bitmap[], int16_t x_part, int16_t y_part, int16_t w_bitmap, int16_t h_bitmap,
+                        int16_t x, int16_t y, int16_t w, int16_t h, bool invert = false, bool mirror_y = false, bool pgm = false);
+    void writeImage(const uint8_t *black, const uint8_t *color, int16_t x, int16_t y, int16_t w, int16_t h,
+                    bool invert = false, bool mirror_y = false, bool pgm = false);
+    void writeImagePart(const uint8_t *black, const uint8_t *color, int16_t x_part, int16_t y_part,
+                        int16_t w_bitmap, int16_t h_bitmap, int16_t x, int16_t y, int16_t w, int16_t h,
+                        bool invert = false, bool mirror_y = false, bool pgm = false);
+    // The controller's native format is the two planes here
+    void writeNative(const uint8_t *data1, const uint8_t *data2, int16_t x, int16_t y, int16_t w, int16_t h,
+                     bool invert = false, bool mirror_y = false, bool pgm = false);
+    void drawImage(const uint8_t bitmap[], int16_t x, int16_t y, int16_t w, int16_t h,
+                   bool invert = false, bool mirror_y = false, bool pgm = false);
+    void drawImagePart(const uint8_t bitmap[], int16_t x_part, int16_t y_part, int16_t w_bitmap, int16_t h_bitmap,
+                       int16_t x, int16_t y, int16_t w, int16_t h, bool invert = false, bool mirror_y = false, bool pgm = false);
+    void drawImage(const uint8_t *black, const uint8_t *color, int16_t x, int16_t y, int16_t w, int16_t h,
+                   bool invert = false, bool mirror_y = false, bool pgm = false);
+    void drawImagePart(const uint8_t *black, const uint8_t *color, int16_t x_part, int16_t y_part,
+                       int16_t w_bitmap, int16_t h_bitmap, int16_t x, int16_t y, int16_t w, int16_t h,
+                       bool invert = false, bool mirror_y = false, bool pgm = false);
+    void drawNative(const uint8_t *data1, const uint8_t *data2, int16_t x, int16_t y, int16_t w, int16_t h,
+                    bool invert = false, bool mirror_y = false, bool pgm = false);
+    void refresh(bool partial_update_mode = false);
+    void refresh(int16_t x, int16_t y, int16_t w, int16_t h);
+    void powerOff();
+    void hibernate();
+
+    // Controller RAM, nullptr before init() or if it could not be allocated
+    const uint8_t *monoPlane() const { return mono; }
+    const uint8_t *colorPlane() const { return color; }
+
+    uint32_t calls(MockPanelOp op) const { return opCalls[op]; }
+    uint32_t bytes(MockPanelOp op) const { return opBytes[op]; }
+    // Copies up to `max` of the last calls, oldest first; returns the count
+    size_t lastCalls(MockPanelCall *out, size_t max) const;
+    void resetCounters();
+
+private:
+    uint8_t *mono;
+    uint8_t *color;
+    uint32_t opCalls[MOCK_OP_COUNT];
+    uint32_t opBytes[MOCK_OP_COUNT];
+    MockPanelCall callLog[MOCK_PANEL_LOG_SIZE];
+    uint32_t callCount;
+    portMUX_TYPE counterLock;
+
+    void record(MockPanelOp op, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t bytes);
+    void copyPlane(uint8_t *plane, const uint8_t *bitmap, int16_t x_part, int16_t y_part, int16_t w_bitmap,
+                   int16_t h_bitmap, int16_t x, int16_t y, int16_t w, int16_t h, bool invert, bool mirror_y);
+};
+
+#endif
@@ -0,0 +1,101 @@
+// panel_format.cpp
+#include "panel_format.h"
+#include "image_utils.h"
+
+static uint16_t getLE16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t getLE32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void putLE16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void putLE32(uint8_t *p, uint32_t v) {
+    putLE16(p, v & 0xFFFF);
+    putLE16(p + 2, v >> 16);
+}
+
+const char *imageFormatName(ImageFormat format) {
+    switch (format) {
+        case IMAGE_FORMAT_RGB565:
+            return "rgb565";
+        case IMAGE_FORMAT_PLANES:
+            return "planes";
+        case IMAGE_FORMAT_PLANES_RLE:
+            return "planes-rle";
+        case IMAGE_FORMAT_BMP:
+            return "bmp";
+        default:
+            return "unknown";
+    }
+}
+
+bool parsePanelImageHeader(const uint8_t *data, PanelImageHeader &header) {
+    if (memcmp(data, PANEL_IMAGE_MAGIC, 4) != 0) return false;
+
+    header.version = data[4];
+    header.encoding = data[5];
+    header.width = getLE16(data + 6);
+    header.height = getLE16(data + 8);
+    header.bandRows = getLE16(data + 10);
+    header.dataSize = getLE32(data + 12);
+
+    if (header.version != PANEL_IMAGE_VERSION) return false;
+    if (header.width == 0 || header.height == 0 || (header.width % 8) != 0) return false;
+    if (header.bandRows == 0 || header.bandRows > header.height) header.bandRows = header.height;
+
+    if (header.encoding == PANEL_ENCODING_PLANES) {
+        return header.dataSize == panelPlanesDataSize(header.width, header.height);
+    }
+    if (header.encoding == PANEL_ENCODING_RLE) {
+        // Decoded one band at a time into a render batch
+        if (header.bandRows > RENDER_BATCH_ROWS) return false;
+        // PackBits never grows data by more than one byte per 128
+        uint32_t planesSize = panelPlanesDataSize(header.width, header.height);
+        return header.dataSize > 0 && header.dataSize <= planesSize + planesSize / 128 + 1;
+    }
+    return false;
+}
+
+void writePanelImageHeader(uint8_t *data, const PanelImageHeader &header) {
+    memcpy(data, PANEL_IMAGE_MAGIC, 4);
+    data[4] = header.version;
+    data[5] = header.encoding;
+    putLE16(data + 6, header.width);
+    putLE16(data + 8, header.height);
+    putLE16(data + 10, header.bandRows);
+    putLE32(data + 12, header.dataSize);
+}
+
+uint32_t panelPlanesDataSize(uint16_t width, uint16_t height) {
+    return 2UL * (width / 8) * height;
+}
+
+ImageFormat detectImageFormat(const uint8_t *head, size_t headLen, size_t totalSize,
+                              uint16_t width, uint16_t height) {
+    if (headLen >= PANEL_IMAGE_HEADER_SIZE) {
+        PanelImageHeader header;
+        if (parsePanelImageHeader(head, header)) {
+            if (header.width == width && header.height == height &&
+                totalSize == PANEL_IMAGE_HEADER_SIZE + header.dataSize) {
+                return header.encoding == PANEL_ENCODING_RLE ? IMAGE_FORMAT_PLANES_RLE : IMAGE_FORMAT_PLANES;
+            }
+        }
+    }
+
+    BmpInfo bmp;
+    if (headLen >= 2 && head[0] == 'B' && head[1] == 'M' &&
+        parseBmpHeader(head, headLen, totalSize, bmp) && bmp.rowSize <= (uint32_t) width * 4) {
+        return IMAGE_FORMAT_BMP;
+    }
+
+    if (totalSize == (size_t) width * height * sizeof(uint16_t)) {
+        return IMAGE_FORMAT_RGB565;
+    }
+    return IMAGE_FORMAT_UNKNOWN;
+}
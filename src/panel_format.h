@@ -0,0 +1,78 @@
+#ifndef PANEL_FORMAT_H
+#define PANEL_FORMAT_H
+
+#include <Arduino.h>
+#include "bmp_decoder.h"
+
+/**
+ * Packed native panel format ("EPD3")
+ *
+ * A 16-byte little-endian header followed by the mono and color planes in the
+ * layout display.writeImage takes: 1 bit per pixel, MSB first, rows of
+ * width / 8 bytes, bit cleared = ink (black in the mono plane, red in the
+ * color plane). Planes are stored band by band: for each band of `bandRows`
+ * rows, the mono rows of that band followed by its color rows. bandRows equal
+ * to the image height (or 0) means one mono plane followed by one color plane.
+ *
+ *   offset  size  field
+ *   0       4     magic "EPD3"
+ *   4       1     version (1)
+ *   5       1     encoding (0 = uncompressed planes, 1 = run-length, see plane_rle.h)
+ *   6       2     width in pixels, multiple of 8
+ *   8       2     height in pixels
+ *   10      2     bandRows
+ *   12      4     dataSize, bytes following the header
+ *
+ * Run-length images are rendered one band at a time, so their bandRows must
+ * not exceed RENDER_BATCH_ROWS; parsePanelImageHeader rejects them otherwise.
+ */
+
+#define PANEL_IMAGE_MAGIC "EPD3"
+#define PANEL_IMAGE_VERSION 1
+#define PANEL_IMAGE_HEADER_SIZE 16
+
+// Bytes detectImageFormat needs from the start of a file: the EPD3 header or the BMP headers
+#define IMAGE_DETECT_HEAD_SIZE BMP_HEADER_PARSE_SIZE
+
+enum PanelEncoding : uint8_t {
+    PANEL_ENCODING_PLANES = 0,
+    PANEL_ENCODING_RLE = 1
+};
+
+struct PanelImageHeader {
+    uint8_t version;
+    uint8_t encoding;
+    uint16_t width;
+    uint16_t height;
+    uint16_t bandRows;
+    uint32_t dataSize;
+};
+
+enum ImageFormat {
+    IMAGE_FORMAT_UNKNOWN,
+    IMAGE_FORMAT_RGB565,
+    IMAGE_FORMAT_PLANES,
+    IMAGE_FORMAT_PLANES_RLE,
+    IMAGE_FORMAT_BMP
+};
+
+const char *imageFormatName(ImageFormat format);
+
+// Parses and sanity-checks a header; `data` must hold PANEL_IMAGE_HEADER_SIZE bytes
+bool parsePanelImageHeader(const uint8_t *data, PanelImageHeader &header);
+
+void writePanelImageHeader(uint8_t *data, const PanelImageHeader &header);
+
+// Expected dataSize for an uncompressed image with the given dimensions
+uint32_t panelPlanesDataSize(uint16_t width, uint16_t height);
+
+/**
+ * Detects the image format from the first bytes of a file and its total size.
+ * `head` must hold at least IMAGE_DETECT_HEAD_SIZE bytes (or the whole file
+ * if shorter). BMP files are recognized by their "BM" magic at any size, as
+ * long as a row is no larger than the panel width at 32 bits per pixel.
+ */
+ImageFormat detectImageFormat(const uint8_t *head, size_t headLen, size_t totalSize,
+                              uint16_t width, uint16_t height);
+
+#endif
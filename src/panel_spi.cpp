@@ -0,0 +1,214 @@
+#include "panel_spi.h"
+#include "display.h"
+#include "render_arena.h"
+#include "image_utils.h"
+#include "debug.h"
+#include "trace.h"
+
+static const uint16_t band_native_size = GxEPD2_750c::WIDTH / 2 * RENDER_BATCH_ROWS;
+static const uint32_t spi_task_stack = 2048;
+static const UBaseType_t spi_task_priority = 2;
+
+// Controller pixel values
+static const uint8_t native_black = 0x0;
+static const uint8_t native_white = 0x3;
+static const uint8_t native_red = 0x4;
+
+BulkPanel::BulkPanel(int16_t cs, int16_t dc, int16_t rst, int16_t busy)
+    : GxEPD2_750c(cs, dc, rst, busy), clockHz(PANEL_SPI_HZ) {}
+
+// Same command sequence as GxEPD2_750c::writeImage over the full width
+void BulkPanel::writeNativeBand(const uint8_t *native, uint16_t y, uint16_t rows) {
+    const uint16_t xe = WIDTH - 1;
+    const uint16_t ye = y + rows - 1;
+    const uint8_t window[] = {0, 0, (uint8_t) (xe >> 8), (uint8_t) xe, (uint8_t) (y >> 8), (uint8_t) y,
+                              (uint8_t) (ye >> 8), (uint8_t) ye, 0x01};
+
+    // Powers the controller up again after a refresh or hibernate, as writeImage does
+    if (!_using_partial_mode) _Init_Part();
+    _writeCommand(0x91);  // partial in
+    _writeCommand(0x90);  // partial window
+    for (uint8_t b : window) _writeData(b);
+    _writeCommand(0x10);
+    _startTransfer();
+    _pSPIx->writeBytes(native, (uint32_t) rows * WIDTH / 2);
+    _endTransfer();
+    _writeCommand(0x92);  // partial out
+}
+
+void BulkPanel::setSpiClock(uint32_t hz) {
+    clockHz = hz;
+    _spi_settings = SPISettings(hz, MSBFIRST, SPI_MODE0);
+}
+
+struct QueuedBand {
+    uint8_t buffer;
+    uint16_t y;
+    uint16_t rows;
+};
+
+// Four pixels of the mono and color planes (a nibble of each) to two bytes
+// of controller pixels, two per byte. A cleared mono bit is black whatever
+// the color plane says; red takes a set mono bit and a cleared color bit.
+static uint8_t nativeQuad[256][2];
+
+static uint8_t *buffers[2];
+static uint8_t nextBuffer = 0;
+static QueueHandle_t bandQueue = nullptr;
+static SemaphoreHandle_t freeBuffers = nullptr;
+static TaskHandle_t spiTask = nullptr;
+
+static PanelSpiStats stats;
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t nativePixel(bool white, bool noColor) {
+    if (!white) return native_black;
+    return noColor ? native_white : native_red;
+}
+
+static void buildNativeTable() {
+    for (uint16_t i = 0; i < 256; i++) {
+        uint8_t mono = i >> 4;
+        uint8_t color = i & 0x0F;
+        for (uint8_t pair = 0; pair < 2; pair++) {
+            uint8_t shift = 3 - 2 * pair;
+            uint8_t first = nativePixel(mono >> shift & 1, color >> shift & 1);
+            uint8_t second = nativePixel(mono >> (shift - 1) & 1, color >> (shift - 1) & 1);
+            nativeQuad[i][pair] = first << 4 | second;
+        }
+    }
+}
+
+static void encodeBand(const uint8_t *mono, const uint8_t *color, uint8_t *out, size_t planeBytes) {
+    for (size_t i = 0; i < planeBytes; i++) {
+        const uint8_t *high = nativeQuad[(mono[i] & 0xF0) | (color[i] >> 4)];
+        const uint8_t *low = nativeQuad[(mono[i] << 4 & 0xF0) | (color[i] & 0x0F)];
+        out[0] = high[0];
+        out[1] = high[1];
+        out[2] = low[0];
+        out[3] = low[1];
+        out += 4;
+    }
+}
+
+static void panelSpiTask(void *parameter) {
+    QueuedBand band;
+    for (;;) {
+        if (xQueueReceive(bandQueue, &band, portMAX_DELAY) != pdTRUE) continue;
+
+        uint32_t bytes = (uint32_t) band.rows * GxEPD2_750c::WIDTH / 2;
+        uint32_t traceStart = traceNow();
+        uint32_t t0 = micros();
+#if !PANEL_MOCK
+        display.epd2.writeNativeBand(buffers[band.buffer], band.y, band.rows);
+#endif
+        uint32_t elapsed = micros() - t0;
+        traceEnd(SPAN_PANEL_SPI, traceStart, bytes);
+
+        portENTER_CRITICAL(&statsLock);
+        stats.bands++;
+        stats.bytes += bytes;
+        stats.spiMicros += elapsed;
+        if (elapsed > stats.maxBandMicros) stats.maxBandMicros = elapsed;
+        portEXIT_CRITICAL(&statsLock);
+
+        xSemaphoreGive(freeBuffers);
+    }
+}
+
+bool initPanelSpi() {
+#if PANEL_MOCK || !PANEL_SPI_BULK
+    return false;
+#else
+    if (spiTask) return true;
+
+    buildNativeTable();
+    for (uint8_t i = 0; i < 2; i++) {
+        buffers[i] = (uint8_t *) heap_caps_malloc(band_native_size, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    }
+    bandQueue = xQueueCreate(2, sizeof(QueuedBand));
+    freeBuffers = xSemaphoreCreateCounting(2, 2);
+    if (!buffers[0] || !buffers[1] || !bandQueue || !freeBuffers ||
+        xTaskCreatePinnedToCore(panelSpiTask, "panelSpi", spi_task_stack, NULL, spi_task_priority, &spiTask, 0) != pdPASS) {
+        LOG_E("[DISPLAY] Bulk SPI writes unavailable, using writeImage");
+        spiTask = nullptr;
+        return false;
+    }
+    LOG_I("[DISPLAY] Bulk SPI writes at %u Hz", (unsigned) display.epd2.spiClock());
+    return true;
+#endif
+}
+
+bool queuePanelBand(const uint8_t *mono, const uint8_t *color, uint16_t y, uint16_t rows) {
+#if PANEL_MOCK
+    return false;
+#else
+    if (!spiTask || rows > RENDER_BATCH_ROWS || !display.epd2.bulkReady()) return false;
+
+    uint32_t t0 = micros();
+    xSemaphoreTake(freeBuffers, portMAX_DELAY);
+    uint32_t waited = micros() - t0;
+
+    // Bands are sent in order, so the buffers free up in the order they were queued
+    QueuedBand band = {nextBuffer, y, rows};
+    nextBuffer ^= 1;
+    encodeBand(mono, color, buffers[band.buffer], (size_t) GxEPD2_750c::WIDTH / 8 * rows);
+    xQueueSend(bandQueue, &band, portMAX_DELAY);
+
+    portENTER_CRITICAL(&statsLock);
+    stats.waitMicros += waited;
+    portEXIT_CRITICAL(&statsLock);
+    return true;
+#endif
+}
+
+void flushPanelBands() {
+    if (!spiTask) return;
+    xSemaphoreTake(freeBuffers, portMAX_DELAY);
+    xSemaphoreTake(freeBuffers, portMAX_DELAY);
+    xSemaphoreGive(freeBuffers);
+    xSemaphoreGive(freeBuffers);
+}
+
+PanelSpiStats panelSpiStats() {
+    portENTER_CRITICAL(&statsLock);
+    PanelSpiStats copy = stats;
+    portEXIT_CRITICAL(&statsLock);
+    return copy;
+}
+
+uint32_t panelSpiClock() {
+#if PANEL_MOCK
+    return 0;
+#else
+    return display.epd2.spiClock();
+#endif
+}
+
+uint32_t timePanelSpiFrame(uint32_t hz) {
+#if PANEL_MOCK
+    return 0;
+#else
+    if (!spiTask) return 0;
+    if (!display.epd2.bulkReady()) display.writeScreenBuffer();
+
+    RenderArenaScope scope;
+    const size_t planeBytes = (size_t) GxEPD2_750c::WIDTH / 8 * RENDER_BATCH_ROWS;
+    uint8_t *white = (uint8_t *) renderArena.alloc(planeBytes);
+    if (!white) return 0;
+    memset(white, 0xFF, planeBytes);
+
+    flushPanelBands();
+    uint32_t previous = display.epd2.spiClock();
+    display.epd2.setSpiClock(hz);
+    uint32_t t0 = micros();
+    for (uint16_t y = 0; y < GxEPD2_750c::HEIGHT; y += RENDER_BATCH_ROWS) {
+        uint16_t rows = min<uint16_t>(RENDER_BATCH_ROWS, GxEPD2_750c::HEIGHT - y);
+        queuePanelBand(white, white, y, rows);
+    }
+    flushPanelBands();
+    uint32_t elapsed = micros() - t0;
+    display.epd2.setSpiClock(previous);
+    return elapsed;
+#endif
+}
@@ -0,0 +1,80 @@
+#ifndef PANEL_SPI_H
+#define PANEL_SPI_H
+
+#include <Arduino.h>
+#include <GxEPD2_3C.h>
+
+// SPI clock of the panel; raise it as far as renders still come out right
+#ifndef PANEL_SPI_HZ
+#define PANEL_SPI_HZ 10000000
+#endif
+
+// Highest clock /api/bench?spi tries
+#ifndef PANEL_SPI_MAX_HZ
+#define PANEL_SPI_MAX_HZ 20000000
+#endif
+
+// 0: bands go through GxEPD2's writeImage byte by byte on the render task, as before
+#ifndef PANEL_SPI_BULK
+#define PANEL_SPI_BULK 1
+#endif
+
+/**
+ * GxEPD2_750c that can also take a band already in the controller's 4-bit
+ * pixel format and clock it out in one bulk write, instead of encoding and
+ * sending it a byte at a time.
+ */
+class BulkPanel : public GxEPD2_750c {
+public:
+    BulkPanel(int16_t cs, int16_t dc, int16_t rst, int16_t busy);
+
+    // Bulk writes skip the first full write that writeImage does
+    bool bulkReady() const { return _init_display_done && !_initial_write; }
+    // `native` holds rows * WIDTH / 2 bytes, two pixels per byte
+    void writeNativeBand(const uint8_t *native, uint16_t y, uint16_t rows);
+
+    void setSpiClock(uint32_t hz);
+    uint32_t spiClock() const { return clockHz; }
+
+private:
+    uint32_t clockHz;
+};
+
+struct PanelSpiStats {
+    uint32_t bands;
+    uint32_t bytes;
+    uint32_t spiMicros;     // time on the wire, summed over bands
+    uint32_t maxBandMicros;
+    uint32_t waitMicros;    // time the render task waited for a free buffer
+};
+
+/**
+ * Allocates the two band buffers and starts the SPI task on core 0. Without
+ * them bands are written with writeImage on the render task.
+ */
+bool initPanelSpi();
+
+/**
+ * Encodes a full-width band into whichever of the two buffers is free and
+ * hands it to the SPI task, so the caller converts the next band while this
+ * one is on the wire. Waits only while both buffers are in flight. False when
+ * the bulk path is not available; the caller then uses writeImage.
+ */
+bool queuePanelBand(const uint8_t *mono, const uint8_t *color, uint16_t y, uint16_t rows);
+
+// Waits until the queued bands are written; every other panel command must come after this
+void flushPanelBands();
+
+// Totals since boot; bands still queued are not counted yet
+PanelSpiStats panelSpiStats();
+uint32_t panelSpiClock();
+
+/**
+ * Writes a white frame through the bulk path at `hz` and returns the time it
+ * took in microseconds, 0 if the bulk path is not available. Controller RAM
+ * is overwritten (the glass is not refreshed); the caller holds the display
+ * lock and invalidates the band cache. The clock is restored afterwards.
+ */
+uint32_t timePanelSpiFrame(uint32_t hz);
+
+#endif
@@ -0,0 +1,97 @@
+// pixel_kernel.cpp
+#include "pixel_kernel.h"
+
+// Lives in internal RAM so lookups never miss the flash cache
+static const DRAM_ATTR Rgb565ClassTable<RGB565_WHITE_SUM, RGB565_COLOR_LEVEL> classTable;
+
+static inline uint8_t pixelClass(uint16_t pixel565) {
+    return (classTable.packed[pixel565 >> 2] >> ((pixel565 & 3) << 1)) & 0x03;
+}
+
+// Shifts one classified pixel into the ink accumulators (bit set = ink)
+#define PUSH_PIXEL(p)                                  \
+    do {                                               \
+        uint8_t c = pixelClass(p);                     \
+        black = (black << 1) | (c & PIXEL_BLACK);      \
+        red = (red << 1) | ((c & PIXEL_COLOR) >> 1);   \
+    } while (0)
+
+void convertRgb565Rows(const uint8_t *src, uint8_t *mono, uint8_t *color, uint16_t width, uint16_t rows) {
+    const size_t rowBytes = width / 8;
+    const size_t rowSize = width * sizeof(uint16_t);
+    // Word loads need 4-byte aligned rows; batch buffers from malloc always are
+    const bool aligned = (((uintptr_t) src | rowSize) & 3) == 0;
+
+    for (uint16_t row = 0; row < rows; row++) {
+        const uint8_t *rowData = src + row * rowSize;
+        uint8_t *monoRow = mono + row * rowBytes;
+        uint8_t *colorRow = color + row * rowBytes;
+
+        if (aligned) {
+            const uint32_t *words = (const uint32_t *) rowData;
+            for (size_t out = 0; out < rowBytes; out++, words += 4) {
+                uint8_t black = 0;
+                uint8_t red = 0;
+                for (uint8_t i = 0; i < 4; i++) {
+                    uint32_t w = words[i];
+                    PUSH_PIXEL(w & 0xFFFF);
+                    PUSH_PIXEL(w >> 16);
+                }
+                monoRow[out] = ~black;
+                colorRow[out] = ~red;
+            }
+        } else {
+            const uint8_t *p = rowData;
+            for (size_t out = 0; out < rowBytes; out++) {
+                uint8_t black = 0;
+                uint8_t red = 0;
+                for (uint8_t i = 0; i < 8; i++, p += 2) {
+                    PUSH_PIXEL(p[0] | (p[1] << 8));
+                }
+                monoRow[out] = ~black;
+                colorRow[out] = ~red;
+            }
+        }
+    }
+}
+
+#undef PUSH_PIXEL
+
+void convertRgb565RowsReference(const uint8_t *src, uint8_t *mono, uint8_t *color, uint16_t width, uint16_t rows) {
+    const bool with_color = true;
+    const size_t rowBytes = width / 8;
+    const size_t rowSize = width * sizeof(uint16_t);
+
+    // Initialize output to white
+    memset(mono, 0xFF, rowBytes * rows);
+    memset(color, 0xFF, rowBytes * rows);
+
+    for (uint16_t row = 0; row < rows; row++) {
+        const uint8_t *rowData = src + row * rowSize;
+        uint8_t *monoRow = mono + row * rowBytes;
+        uint8_t *colorRow = color + row * rowBytes;
+
+        for (uint16_t col = 0; col < width; col++) {
+            uint16_t idx = col * 2;
+            uint16_t pixel565 = ((uint16_t)rowData[idx + 1] << 8) | rowData[idx];
+
+            uint8_t r = (pixel565 & 0xF800) >> 8;
+            uint8_t g = (pixel565 & 0x07E0) >> 3;
+            uint8_t b = (pixel565 & 0x001F) << 3;
+
+            bool whitish = ((uint16_t)r + g + b) > RGB565_WHITE_SUM;
+
+            if (!whitish) {
+                bool colored = (r > RGB565_COLOR_LEVEL) || ((g > RGB565_COLOR_LEVEL) && (b > RGB565_COLOR_LEVEL));
+                uint8_t mask = 0x80 >> (col & 7);
+                uint16_t byteIdx = col >> 3;
+
+                if (with_color && colored) {
+                    colorRow[byteIdx] &= ~mask;
+                } else {
+                    monoRow[byteIdx] &= ~mask;
+                }
+            }
+        }
+    }
+}
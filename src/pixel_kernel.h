@@ -0,0 +1,55 @@
+#ifndef PIXEL_KERNEL_H
+#define PIXEL_KERNEL_H
+
+#include <Arduino.h>
+
+// Classification thresholds for RGB565 pixels (channels expanded to 8 bits).
+// Override with build flags to retune the palette; the lookup table is
+// regenerated at compile time and the kernel stays unchanged.
+#ifndef RGB565_WHITE_SUM
+#define RGB565_WHITE_SUM 384    // r + g + b above this is white
+#endif
+#ifndef RGB565_COLOR_LEVEL
+#define RGB565_COLOR_LEVEL 0xF0 // red, or green + blue, above this is colored
+#endif
+
+enum PixelClass : uint8_t {
+    PIXEL_WHITE = 0,
+    PIXEL_BLACK = 1,
+    PIXEL_COLOR = 2
+};
+
+constexpr uint8_t classifyRgb565(uint16_t pixel565, uint16_t whiteSum, uint8_t colorLevel) {
+    // Same channel expansion as the original per-pixel loop
+    return ((uint16_t)((pixel565 & 0xF800) >> 8) + ((pixel565 & 0x07E0) >> 3) + ((pixel565 & 0x001F) << 3)) > whiteSum
+               ? PIXEL_WHITE
+           : (((pixel565 & 0xF800) >> 8) > colorLevel ||
+              ((((pixel565 & 0x07E0) >> 3) > colorLevel) && (((pixel565 & 0x001F) << 3) > colorLevel)))
+               ? PIXEL_COLOR
+               : PIXEL_BLACK;
+}
+
+// 2 bits per RGB565 value, 4 values per byte: 16 KB for the whole color space
+template <uint16_t WhiteSum, uint8_t ColorLevel>
+struct Rgb565ClassTable {
+    uint8_t packed[65536 / 4];
+
+    constexpr Rgb565ClassTable() : packed() {
+        for (uint32_t p = 0; p < 65536; p++) {
+            packed[p >> 2] |= classifyRgb565(p, WhiteSum, ColorLevel) << ((p & 3) << 1);
+        }
+    }
+};
+
+/**
+ * Converts `rows` rows of little-endian RGB565 pixels into the 1bpp mono and
+ * color planes expected by display.writeImage (bit cleared = ink).
+ * Looks every pixel up in the compile-time class table and emits a whole
+ * output byte per 8 pixels.
+ */
+void convertRgb565Rows(const uint8_t *src, uint8_t *mono, uint8_t *color, uint16_t width, uint16_t rows);
+
+// Original per-pixel branchy conversion, kept to verify the table kernel
+void convertRgb565RowsReference(const uint8_t *src, uint8_t *mono, uint8_t *color, uint16_t width, uint16_t rows);
+
+#endif
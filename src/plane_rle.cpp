@@ -0,0 +1,98 @@
+// plane_rle.cpp
+#include "plane_rle.h"
+
+static const size_t rle_input_buffer_size = 1024;
+
+PlaneRleReader::PlaneRleReader()
+    : file(nullptr), remaining(0), inBuffer(nullptr), in(nullptr), inEnd(nullptr),
+      literal(0), run(0), runValue(0), readMicros(0), ownsBuffer(false) {
+}
+
+PlaneRleReader::~PlaneRleReader() {
+    end();
+}
+
+bool PlaneRleReader::begin(fs::File &file, uint32_t dataSize, RenderArena *arena) {
+    end();
+    this->file = &file;
+    remaining = dataSize;
+    literal = 0;
+    run = 0;
+    inBuffer = (uint8_t *) (arena ? arena->alloc(rle_input_buffer_size) : malloc(rle_input_buffer_size));
+    ownsBuffer = !arena;
+    in = inEnd = inBuffer;
+    return inBuffer != nullptr;
+}
+
+void PlaneRleReader::end() {
+    if (inBuffer && ownsBuffer) free(inBuffer);
+    inBuffer = nullptr;
+    in = inEnd = nullptr;
+    file = nullptr;
+}
+
+bool PlaneRleReader::refill() {
+    if (remaining == 0 || !file) return false;
+    uint32_t t0 = micros();
+    size_t n = file->read(inBuffer, min((size_t) remaining, rle_input_buffer_size));
+    readMicros += micros() - t0;
+    if (n == 0) return false;
+    remaining -= n;
+    in = inBuffer;
+    inEnd = inBuffer + n;
+    return true;
+}
+
+bool PlaneRleReader::read(uint8_t *out, size_t len, PipelineTiming &timing) {
+    if (!inBuffer) return false;
+
+    uint32_t t0 = micros();
+    readMicros = 0;
+    uint32_t bytesBefore = remaining;
+    size_t produced = 0;
+    bool ok = true;
+
+    while (produced < len) {
+        if (run) {
+            size_t n = min((size_t) run, len - produced);
+            memset(out + produced, runValue, n);
+            run -= n;
+            produced += n;
+            continue;
+        }
+        if (in == inEnd && !refill()) {
+            ok = false;
+            break;
+        }
+        if (literal) {
+            size_t n = min(min((size_t) literal, len - produced), (size_t)(inEnd - in));
+            memcpy(out + produced, in, n);
+            in += n;
+            literal -= n;
+            produced += n;
+            continue;
+        }
+
+        int8_t control = (int8_t) *in++;
+        if (control >= 0) {
+            literal = control + 1;
+        } else if (control != -128) {
+            if (in == inEnd && !refill()) {
+                ok = false;
+                break;
+            }
+            run = 1 - control;
+            runValue = *in++;
+        }
+    }
+
+    timing.stages[STAGE_READ].micros += readMicros;
+    timing.stages[STAGE_READ].bytes += bytesBefore - remaining;
+    timing.stages[STAGE_CONVERT].micros += (micros() - t0) - readMicros;
+    timing.stages[STAGE_CONVERT].bytes += produced;
+    return ok;
+}
+
+bool PlaneRleReader::finished() const {
+    return remaining == 0 && in == inEnd && literal == 0 && run == 0;
+}
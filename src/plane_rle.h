@@ -0,0 +1,55 @@
+#ifndef PLANE_RLE_H
+#define PLANE_RLE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "benchmark.h"
+#include "render_arena.h"
+
+/**
+ * Streaming decoder for run-length compressed panel planes (EPD3 encoding 1).
+ *
+ * The compressed data is PackBits over the uncompressed EPD3 data, so it
+ * decodes band by band to mono rows followed by color rows. Each control
+ * byte n is followed by:
+ *   0..127     n + 1 literal bytes
+ *   -127..-1   one byte repeated 1 - n times
+ *   -128       nothing (no-op)
+ * Runs may span rows, planes and bands. tools/epd3_encode.py writes this format.
+ */
+class PlaneRleReader {
+private:
+    fs::File *file;
+    uint32_t remaining;   // compressed bytes not yet read from the file
+    uint8_t *inBuffer;
+    const uint8_t *in;
+    const uint8_t *inEnd;
+    uint8_t literal;      // literal bytes left in the current packet
+    uint8_t run;          // repeats left in the current packet
+    uint8_t runValue;
+    uint32_t readMicros;
+    bool ownsBuffer;
+
+    bool refill();
+
+public:
+    PlaneRleReader();
+    ~PlaneRleReader();
+
+    // `file` must be positioned at the start of the compressed data. The input
+    // buffer comes from `arena` if given (released with it), else from the heap
+    bool begin(fs::File &file, uint32_t dataSize, RenderArena *arena = nullptr);
+    void end();
+
+    /**
+     * Decodes exactly `len` bytes into `out`. File reads are added to the
+     * read stage of `timing`, decoding to the convert stage.
+     * Returns false on a read error or truncated data.
+     */
+    bool read(uint8_t *out, size_t len, PipelineTiming &timing);
+
+    // True when every compressed byte was consumed and no packet is pending
+    bool finished() const;
+};
+
+#endif
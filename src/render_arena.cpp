@@ -0,0 +1,61 @@
+// render_arena.cpp
+#include "render_arena.h"
+#include "render_pipeline.h"
+#include "image_utils.h"
+#include "config.h"
+#include "debug.h"
+
+RenderArena renderArena;
+
+RenderArena::RenderArena()
+    : base(nullptr), capacity(0), used(0), highWater(0), failures(0) {
+}
+
+bool RenderArena::begin(size_t capacity) {
+    if (base) return true;
+    base = (uint8_t *) malloc(capacity);
+    this->capacity = base ? capacity : 0;
+    used = 0;
+    highWater = 0;
+    return base != nullptr;
+}
+
+void *RenderArena::alloc(size_t size) {
+    size = (size + 3) & ~(size_t) 3;
+    if (!base || size > capacity - used) {
+        failures++;
+        LOG_W("[ARENA] Out of render memory: %u bytes requested, %u free", (unsigned) size,
+              (unsigned) (capacity - used));
+        return nullptr;
+    }
+    void *block = base + used;
+    used += size;
+    if (used > highWater) highWater = used;
+    return block;
+}
+
+void RenderArena::release(size_t mark) {
+    if (mark <= used) used = mark;
+}
+
+// Largest single render: the RGB565 pipeline with Atkinson error rows
+static size_t renderArenaSize() {
+    const size_t rowSize = DISPLAY_WIDTH * sizeof(uint16_t);
+    const size_t rowBytes = DISPLAY_WIDTH / 8;
+    const size_t batch = (rowSize + 2 * rowBytes) * RENDER_BATCH_ROWS;
+    const size_t batches = RENDER_PIPELINE_DEPTH > 1 ? RENDER_PIPELINE_DEPTH : 1;
+    // Rgb565Converter: 3 error rows of 3 channels, padded by 2 pixels per side
+    const size_t errorRows = 3 * (DISPLAY_WIDTH + 4) * 3 * sizeof(int16_t);
+    // Alignment slack for each block
+    return batches * batch + errorRows + 64;
+}
+
+bool initRenderArena() {
+    size_t size = renderArenaSize();
+    if (!renderArena.begin(size)) {
+        LOG_E("[ARENA] ERROR: Cannot reserve %u bytes for rendering", (unsigned) size);
+        return false;
+    }
+    LOG_I("[ARENA] Reserved %u bytes for rendering", (unsigned) size);
+    return true;
+}
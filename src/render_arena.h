@@ -0,0 +1,58 @@
+#ifndef RENDER_ARENA_H
+#define RENDER_ARENA_H
+
+#include <Arduino.h>
+
+/**
+ * Fixed block reserved once at boot for every buffer a render needs, so render
+ * buffers never come from the general heap and cannot fail after days of heap
+ * fragmentation. Draw paths log with the LOG_* macros, which format into the
+ * log queue's fixed slots. What a draw still takes from the heap is small and
+ * short-lived: the LittleFS file handle, and the path and ETag Strings of the
+ * image being drawn. Buffers are bump-allocated and released all at once by
+ * resetting to a mark (see RenderArenaScope).
+ *
+ * Not thread-safe: only the holder of the display lock allocates from it.
+ */
+class RenderArena {
+private:
+    uint8_t *base;
+    size_t capacity;
+    size_t used;
+    size_t highWater;
+    uint32_t failures;
+
+public:
+    RenderArena();
+
+    bool begin(size_t capacity);
+
+    // 4-byte aligned block, or nullptr when the arena is exhausted
+    void *alloc(size_t size);
+
+    size_t mark() const { return used; }
+    void release(size_t mark);
+
+    size_t size() const { return capacity; }
+    size_t bytesUsed() const { return used; }
+    size_t bytesFree() const { return capacity - used; }
+    size_t highWaterMark() const { return highWater; }
+    uint32_t allocationFailures() const { return failures; }
+};
+
+extern RenderArena renderArena;
+
+// Releases everything allocated from the render arena during its lifetime
+class RenderArenaScope {
+private:
+    size_t start;
+
+public:
+    RenderArenaScope() : start(renderArena.mark()) {}
+    ~RenderArenaScope() { renderArena.release(start); }
+};
+
+// Reserves the arena, sized for the largest render of the panel
+bool initRenderArena();
+
+#endif
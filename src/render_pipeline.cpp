@@ -0,0 +1,265 @@
+// render_pipeline.cpp
+#include "render_pipeline.h"
+#include "batch_ring.h"
+#include "esp_task_wdt.h"
+#include "render_arena.h"
+#include "debug.h"
+#include "trace.h"
+#include <atomic>
+
+// Never fills up: only RENDER_PIPELINE_DEPTH batches exist
+typedef BatchRing<RENDER_PIPELINE_DEPTH + 1> PipelineRing;
+
+// One render at a time (the display lock is held), so the state is static and
+// outlives the worker tasks
+struct PipelineState {
+    RenderBatch batches[RENDER_PIPELINE_DEPTH];
+    PipelineRing freeRing;      // writer -> reader
+    PipelineRing readRing;      // reader -> converter
+    PipelineRing convertedRing; // converter -> writer
+    TaskHandle_t readerTask;
+    TaskHandle_t converterTask;
+    TaskHandle_t writerTask;
+    SemaphoreHandle_t finished;
+    const RenderPipelineStages *stages;
+    PipelineTiming *timing;
+    uint16_t height;
+    uint16_t batchRows;
+    std::atomic<bool> aborted;
+};
+
+static PipelineState pipeline;
+
+// Worker stacks and control blocks are static too, so starting the pipeline
+// never allocates from the heap
+static const uint32_t worker_stack_size = 4096;
+static StackType_t readerStack[worker_stack_size];
+static StackType_t converterStack[worker_stack_size];
+static StaticTask_t readerTaskBuffer;
+static StaticTask_t converterTaskBuffer;
+static StaticSemaphore_t finishedBuffer;
+
+// Stage calls, timed into their stage of `timing` and traced as spans
+static bool readStage(const RenderPipelineStages &stages, RenderBatch &batch, PipelineTiming &timing) {
+    uint32_t t0 = micros();
+    uint32_t traceStart = traceNow();
+    bool ok = stages.read(batch, stages.context);
+    traceEnd(SPAN_BATCH_READ, traceStart, ok ? batch.inputBytes : 0);
+    addStageTime(timing, STAGE_READ, t0, ok ? batch.inputBytes : 0);
+    return ok;
+}
+
+static void convertStage(const RenderPipelineStages &stages, RenderBatch &batch, PipelineTiming &timing) {
+    uint32_t t0 = micros();
+    uint32_t traceStart = traceNow();
+    stages.convert(batch, stages.context);
+    traceEnd(SPAN_CONVERT, traceStart, batch.inputBytes);
+    addStageTime(timing, STAGE_CONVERT, t0, batch.inputBytes);
+}
+
+static uint8_t takeBatch(PipelineRing &ring) {
+    uint8_t batch;
+    while (!ring.pop(batch)) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+    return batch;
+}
+
+// Workers park instead of deleting themselves: the other stages may still
+// notify them until the writer has drained the pipeline
+static void finishWorker() {
+    xSemaphoreGive(pipeline.finished);
+    vTaskSuspend(NULL);
+}
+
+// Deletes a worker once it has parked, so its static stack is free for the next render
+static void deleteWorker(TaskHandle_t task) {
+    while (eTaskGetState(task) != eSuspended) {
+        vTaskDelay(1);
+    }
+    vTaskDelete(task);
+}
+
+static void pipelineReaderTask(void *parameter) {
+    uint16_t y = 0;
+    while (true) {
+        uint8_t i = takeBatch(pipeline.freeRing);
+        RenderBatch &batch = pipeline.batches[i];
+        batch.y = y;
+        batch.rows = pipeline.aborted ? 0 : min(pipeline.batchRows, (uint16_t)(pipeline.height - y));
+
+        if (batch.rows) {
+            if (!readStage(*pipeline.stages, batch, *pipeline.timing)) {
+                LOG_E("[PIPELINE] Read error at row %u", (unsigned) y);
+                batch.rows = 0;
+            }
+        }
+
+        y += batch.rows;
+        pipeline.readRing.push(i);
+        xTaskNotifyGive(pipeline.converterTask);
+        if (batch.rows == 0) break;
+        if (y == pipeline.height) {
+            // End marker in the next free batch
+            uint8_t end = takeBatch(pipeline.freeRing);
+            pipeline.batches[end].rows = 0;
+            pipeline.readRing.push(end);
+            xTaskNotifyGive(pipeline.converterTask);
+            break;
+        }
+    }
+    finishWorker();
+}
+
+static void pipelineConverterTask(void *parameter) {
+    while (true) {
+        uint8_t i = takeBatch(pipeline.readRing);
+        RenderBatch &batch = pipeline.batches[i];
+        if (batch.rows && !pipeline.aborted) {
+            convertStage(*pipeline.stages, batch, *pipeline.timing);
+        }
+        bool end = batch.rows == 0;
+        pipeline.convertedRing.push(i);
+        xTaskNotifyGive(pipeline.writerTask);
+        if (end) break;
+    }
+    finishWorker();
+}
+
+// Batch buffers come from the render arena, released by the caller's scope
+static bool allocBatch(RenderBatch &batch, uint16_t batchRows, size_t inputRowBytes, size_t planeRowBytes) {
+    batch.input = (uint8_t *) renderArena.alloc(inputRowBytes * batchRows);
+    batch.mono = (uint8_t *) renderArena.alloc(planeRowBytes * batchRows);
+    batch.color = (uint8_t *) renderArena.alloc(planeRowBytes * batchRows);
+    return batch.input && batch.mono && batch.color;
+}
+
+// All three stages on the calling task with a single batch
+static bool runSequential(uint16_t height, uint16_t batchRows, size_t inputRowBytes, size_t planeRowBytes,
+                          const RenderPipelineStages &stages, PipelineTiming &timing, uint16_t &rowsDone) {
+    RenderArenaScope scope;
+    RenderBatch batch;
+    bool allocated = allocBatch(batch, batchRows, inputRowBytes, planeRowBytes);
+
+    while (allocated && rowsDone < height) {
+        batch.y = rowsDone;
+        batch.rows = min(batchRows, (uint16_t)(height - rowsDone));
+
+        if (!readStage(stages, batch, timing)) {
+            LOG_E("[PIPELINE] Read error at row %u", (unsigned) rowsDone);
+            break;
+        }
+
+        convertStage(stages, batch, timing);
+
+        uint32_t t0 = micros();
+        bool ok = stages.write(batch, stages.context);
+        addStageTime(timing, STAGE_WRITE, t0, 2 * planeRowBytes * batch.rows);
+        if (!ok) break;
+
+        esp_task_wdt_reset();
+        rowsDone += batch.rows;
+    }
+    return allocated;
+}
+
+// Reader, converter and writer overlapped; false if it could not be started
+static bool runPipelined(uint16_t height, uint16_t batchRows, size_t inputRowBytes, size_t planeRowBytes,
+                         const RenderPipelineStages &stages, PipelineTiming &timing, uint16_t &rowsDone) {
+    if (RENDER_PIPELINE_DEPTH < 2) return false;
+
+    if (!pipeline.finished) {
+        pipeline.finished = xSemaphoreCreateCountingStatic(2, 0, &finishedBuffer);
+    }
+
+    // Wide rows (24 and 32 bit BMP) do not fit RENDER_PIPELINE_DEPTH batches; run those in turn
+    const size_t inputSize = (inputRowBytes * batchRows + 3) & ~(size_t) 3;
+    const size_t planeSize = (planeRowBytes * batchRows + 3) & ~(size_t) 3;
+    if (RENDER_PIPELINE_DEPTH * (inputSize + 2 * planeSize) > renderArena.bytesFree()) {
+        LOG_W("[PIPELINE] Not enough render memory for %u batches", (unsigned) RENDER_PIPELINE_DEPTH);
+        return false;
+    }
+
+    RenderArenaScope scope;
+    for (uint8_t i = 0; i < RENDER_PIPELINE_DEPTH; i++) {
+        if (!allocBatch(pipeline.batches[i], batchRows, inputRowBytes, planeRowBytes)) {
+            LOG_W("[PIPELINE] Not enough render memory for %u batches", (unsigned) RENDER_PIPELINE_DEPTH);
+            return false;
+        }
+    }
+
+    pipeline.freeRing.reset();
+    pipeline.readRing.reset();
+    pipeline.convertedRing.reset();
+    for (uint8_t i = 0; i < RENDER_PIPELINE_DEPTH; i++) {
+        pipeline.freeRing.push(i);
+    }
+    pipeline.stages = &stages;
+    pipeline.timing = &timing;
+    pipeline.height = height;
+    pipeline.batchRows = batchRows;
+    pipeline.aborted = false;
+    pipeline.writerTask = xTaskGetCurrentTaskHandle();
+    // Drop notifications left over from before
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    // Converter first: the reader notifies it as soon as a batch is read.
+    // It runs above loop() priority on the writer's core, so it takes the CPU
+    // in short bursts while the writer is busy clocking out SPI.
+    pipeline.converterTask = xTaskCreateStaticPinnedToCore(pipelineConverterTask, "renderConvert", worker_stack_size,
+                                                           NULL, 3, converterStack, &converterTaskBuffer, 1);
+    if (!pipeline.converterTask) {
+        return false;
+    }
+    pipeline.readerTask = xTaskCreateStaticPinnedToCore(pipelineReaderTask, "renderRead", worker_stack_size,
+                                                        NULL, 2, readerStack, &readerTaskBuffer, 0);
+    if (!pipeline.readerTask) {
+        // Let the converter see an end marker and exit
+        uint8_t end = takeBatch(pipeline.freeRing);
+        pipeline.batches[end].rows = 0;
+        pipeline.readRing.push(end);
+        xTaskNotifyGive(pipeline.converterTask);
+        xSemaphoreTake(pipeline.finished, portMAX_DELAY);
+        deleteWorker(pipeline.converterTask);
+        return false;
+    }
+
+    // Writer: the calling task owns the display
+    while (true) {
+        uint8_t i = takeBatch(pipeline.convertedRing);
+        RenderBatch &batch = pipeline.batches[i];
+        if (batch.rows == 0) break;
+
+        if (!pipeline.aborted) {
+            uint32_t t0 = micros();
+            if (stages.write(batch, stages.context)) {
+                rowsDone += batch.rows;
+            } else {
+                pipeline.aborted = true;
+            }
+            addStageTime(timing, STAGE_WRITE, t0, 2 * planeRowBytes * batch.rows);
+        }
+        esp_task_wdt_reset();
+
+        pipeline.freeRing.push(i);
+        xTaskNotifyGive(pipeline.readerTask);
+    }
+
+    // Both workers are past their last access to the batches once they signal
+    xSemaphoreTake(pipeline.finished, portMAX_DELAY);
+    xSemaphoreTake(pipeline.finished, portMAX_DELAY);
+    deleteWorker(pipeline.readerTask);
+    deleteWorker(pipeline.converterTask);
+    return true;
+}
+
+bool runRenderPipeline(uint16_t height, uint16_t batchRows, size_t inputRowBytes, size_t planeRowBytes,
+                       const RenderPipelineStages &stages, PipelineTiming &timing, uint16_t &rowsDone) {
+    rowsDone = 0;
+    if (runPipelined(height, batchRows, inputRowBytes, planeRowBytes, stages, timing, rowsDone)) {
+        LOG_I("[PIPELINE] Pipelined render, %u batches in flight", (unsigned) RENDER_PIPELINE_DEPTH);
+        return true;
+    }
+    LOG_I("[PIPELINE] Sequential render");
+    return runSequential(height, batchRows, inputRowBytes, planeRowBytes, stages, timing, rowsDone);
+}
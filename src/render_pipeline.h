@@ -0,0 +1,54 @@
+#ifndef RENDER_PIPELINE_H
+#define RENDER_PIPELINE_H
+
+#include <Arduino.h>
+#include "benchmark.h"
+
+// Batches in flight between the stages; 0 renders sequentially on the calling task
+#ifndef RENDER_PIPELINE_DEPTH
+#define RENDER_PIPELINE_DEPTH 3
+#endif
+
+struct RenderBatch {
+    uint8_t *input;   // raw rows read from flash
+    uint8_t *mono;    // converted planes
+    uint8_t *color;
+    uint16_t y;
+    uint16_t rows;    // 0 marks the end of the image
+    size_t inputBytes;
+};
+
+// Fills batch.input for rows [batch.y, batch.y + batch.rows); false on read error
+typedef bool (*BatchReadFn)(RenderBatch &batch, void *context);
+// Converts batch.input into batch.mono / batch.color
+typedef void (*BatchConvertFn)(RenderBatch &batch, void *context);
+// Sends the planes to the panel; false aborts the render
+typedef bool (*BatchWriteFn)(RenderBatch &batch, void *context);
+
+struct RenderPipelineStages {
+    BatchReadFn read;
+    BatchConvertFn convert;
+    BatchWriteFn write;
+    void *context;
+};
+
+/**
+ * Renders `height` rows in batches of `batchRows` with the read, convert and
+ * write stages overlapped: a reader task on core 0, a converter task on core 1
+ * and the calling task as the SPI writer. RENDER_PIPELINE_DEPTH batch buffers
+ * circulate between them through single-producer/single-consumer rings, so
+ * ownership moves without locks; task notifications only wake an idle stage.
+ * Batches reach the converter and the writer in order.
+ *
+ * Each stage's time is added to its stage in `timing`; the stages run
+ * concurrently, so their sum exceeds the wall time.
+ * Batch buffers come from the render arena. Falls back to running the
+ * stages in turn on the calling task with one batch when the pipeline cannot
+ * be started (RENDER_PIPELINE_DEPTH < 2, or no room for the batches or tasks).
+ * Returns false only if not even one batch could be allocated. `rowsDone`
+ * is the number of rows written.
+ */
+bool runRenderPipeline(uint16_t height, uint16_t batchRows, size_t inputRowBytes, size_t planeRowBytes,
+                       const RenderPipelineStages &stages, PipelineTiming &timing, uint16_t &rowsDone);
+
+#endif
@@ -0,0 +1,224 @@
+// render_scheduler.cpp
+#include "render_scheduler.h"
+#include "display.h"
+#include "debug.h"
+#include "layout.h"
+#include "esp_task_wdt.h"
+#include "trace.h"
+#include "events.h"
+
+static const uint8_t job_history_size = 8;
+
+// Ring of recent jobs; the newest is at jobHead - 1
+static RenderJob jobs[job_history_size];
+static uint8_t jobHead = 0;
+static uint8_t jobCount = 0;
+static uint32_t nextJobId = 1;
+static RenderJob *queuedJob = nullptr;
+static RenderJob *runningJob = nullptr;
+static portMUX_TYPE jobLock = portMUX_INITIALIZER_UNLOCKED;
+// Finished jobs per final state, for /api/metrics
+static uint32_t jobTotals[JOB_FAILED + 1];
+
+static TaskHandle_t schedulerTask = nullptr;
+
+const char *renderJobStateName(RenderJobState state) {
+    switch (state) {
+        case JOB_QUEUED:
+            return "queued";
+        case JOB_CONVERTING:
+            return "converting";
+        case JOB_WRITING:
+            return "writing";
+        case JOB_REFRESHING:
+            return "refreshing";
+        case JOB_DONE:
+            return "done";
+        case JOB_CANCELLED:
+            return "cancelled";
+        default:
+            return "failed";
+    }
+}
+
+const char *renderJobSourceName(RenderJobSource source) {
+    switch (source) {
+        case JOB_SOURCE_UPLOAD:
+            return "upload";
+        case JOB_SOURCE_SELECT:
+            return "select";
+        case JOB_SOURCE_LAYOUT:
+            return "layout";
+        default:
+            return "draw";
+    }
+}
+
+// Called with jobLock held. Never reuses the slot of the queued or running job.
+static RenderJob *newJob(RenderJobSource source, DitherMode dither, bool force) {
+    RenderJob *job = &jobs[jobHead];
+    while (job == queuedJob || job == runningJob) {
+        jobHead = (jobHead + 1) % job_history_size;
+        job = &jobs[jobHead];
+    }
+    jobHead = (jobHead + 1) % job_history_size;
+    if (jobCount < job_history_size) jobCount++;
+
+    memset(job, 0, sizeof(*job));
+    job->id = nextJobId++;
+    job->state = JOB_QUEUED;
+    job->source = source;
+    job->dither = dither;
+    job->force = force;
+    job->queuedAt = millis();
+    return job;
+}
+
+uint32_t requestRender(RenderJobSource source, DitherMode dither, bool force) {
+    uint32_t id;
+    bool cancelled = false;
+
+    portENTER_CRITICAL(&jobLock);
+    if (queuedJob) {
+        // Not started yet: the newest settings win
+        queuedJob->dither = dither;
+        queuedJob->force = queuedJob->force || force;
+        queuedJob->source = source;
+        queuedJob->merged++;
+        id = queuedJob->id;
+    } else if (runningJob && source == JOB_SOURCE_DRAW && runningJob->source != JOB_SOURCE_LAYOUT && !force &&
+               runningJob->dither == dither && panelPhase == PANEL_WRITING) {
+        // Already drawing the same image the same way; a layout is not the stored image
+        runningJob->merged++;
+        id = runningJob->id;
+    } else {
+        queuedJob = newJob(source, dither, force);
+        id = queuedJob->id;
+        // A draw only leaves a running job alone when that job draws the stored image too
+        cancelled = runningJob && (source != JOB_SOURCE_DRAW || runningJob->source == JOB_SOURCE_LAYOUT);
+    }
+    portEXIT_CRITICAL(&jobLock);
+
+    postEvent(EVENT_JOB, "{\"id\":%u,\"state\":\"queued\",\"source\":\"%s\"}", (unsigned) id,
+              renderJobSourceName(source));
+
+    // A newer image makes the running job pointless, unless its refresh already started
+    if (cancelled && cancelPanelFrame()) {
+        LOG_I("[SCHEDULER] Cancelling the running job for job %u", (unsigned) id);
+    }
+
+    if (schedulerTask) xTaskNotifyGive(schedulerTask);
+    return id;
+}
+
+uint8_t getRenderJobs(RenderJob *out, uint8_t max) {
+    uint8_t n = 0;
+    portENTER_CRITICAL(&jobLock);
+    if (runningJob) {
+        // Live state of the job on the panel
+        if (panelPhase == PANEL_REFRESHING) runningJob->state = JOB_REFRESHING;
+        else if (panelPhase == PANEL_WRITING && panelFrameBandsDone() > 0) runningJob->state = JOB_WRITING;
+    }
+    for (uint8_t i = 0; i < jobCount && n < max; i++) {
+        out[n++] = jobs[(jobHead + job_history_size - 1 - i) % job_history_size];
+    }
+    portEXIT_CRITICAL(&jobLock);
+    return n;
+}
+
+uint32_t renderJobsFinished(RenderJobState state) {
+    return state <= JOB_FAILED ? jobTotals[state] : 0;
+}
+
+static void runJob(RenderJob *job) {
+    uint32_t traceStart = traceNow();
+    uint32_t startMicros = micros();
+    traceRecord(SPAN_RENDER_WAIT, traceStart, (job->startedAt - job->queuedAt) * 1000);
+
+    LOG_I("[SCHEDULER] Running job %u (%s, dither %s)", (unsigned) job->id, renderJobSourceName(job->source),
+          ditherModeName(job->dither));
+    postEvent(EVENT_JOB, "{\"id\":%u,\"state\":\"converting\",\"source\":\"%s\",\"waitMs\":%u}",
+              (unsigned) job->id, renderJobSourceName(job->source), (unsigned) (job->startedAt - job->queuedAt));
+    if (job->force) {
+        invalidatePanelCache();
+    }
+
+    uint32_t framesBefore = panelFrameCount;
+    bool drawn = job->source == JOB_SOURCE_LAYOUT ? renderPendingLayout() : showSelectedImage(job->dither);
+    // No frame at all when the image could not be opened
+    bool framed = panelFrameCount != framesBefore;
+    bool cancelled = framed && lastPanelFrame.cancelled;
+
+    portENTER_CRITICAL(&jobLock);
+    if (framed) {
+        job->timing = lastRenderTiming;
+        job->bandsWritten = lastPanelFrame.bandsWritten;
+        job->bandsSkipped = lastPanelFrame.bandsSkipped;
+        job->refreshed = lastPanelFrame.refreshed;
+        job->refreshAt = lastPanelFrame.refreshStartedAt;
+    }
+    job->finishedAt = millis();
+    job->state = cancelled ? JOB_CANCELLED : (drawn ? JOB_DONE : JOB_FAILED);
+    jobTotals[job->state]++;
+    runningJob = nullptr;
+    // The slot may be reused by a new job from here on
+    RenderJob result = *job;
+    portEXIT_CRITICAL(&jobLock);
+
+    // Includes the refresh, so it can outlast a wrap of the cycle counter
+    traceRecord(SPAN_RENDER_JOB, traceStart, micros() - startMicros);
+
+    LOG_I("[SCHEDULER] Job %u %s in %u ms", (unsigned) result.id, renderJobStateName(result.state),
+          (unsigned) (result.finishedAt - result.startedAt));
+
+    const StageTiming *stages = result.timing.stages;
+    postEvent(EVENT_JOB,
+              "{\"id\":%u,\"state\":\"%s\",\"source\":\"%s\",\"readMs\":%u,\"convertMs\":%u,"
+              "\"writeMs\":%u,\"spiMs\":%u,\"bandsWritten\":%u,\"bandsSkipped\":%u,\"refreshed\":%s,"
+              "\"totalMs\":%u}",
+              (unsigned) result.id, renderJobStateName(result.state), renderJobSourceName(result.source),
+              (unsigned) (stages[STAGE_READ].micros / 1000), (unsigned) (stages[STAGE_CONVERT].micros / 1000),
+              (unsigned) (stages[STAGE_WRITE].micros / 1000), (unsigned) (stages[STAGE_SPI].micros / 1000),
+              (unsigned) result.bandsWritten, (unsigned) result.bandsSkipped, result.refreshed ? "true" : "false",
+              (unsigned) (result.finishedAt - result.startedAt));
+    if (result.state == JOB_FAILED) {
+        postEvent(EVENT_ERROR, "{\"source\":\"job\",\"id\":%u,\"message\":\"Render failed\"}",
+                  (unsigned) result.id);
+    }
+}
+
+static void renderSchedulerTask(void *parameter) {
+    esp_task_wdt_add(NULL);
+
+    while (true) {
+        // Woken by requestRender(); the timeout only feeds the watchdog
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10000));
+        esp_task_wdt_reset();
+
+        while (queuedJob) {
+            // A stream render may hold the panel
+            if (!lockDisplay(1000)) {
+                esp_task_wdt_reset();
+                continue;
+            }
+
+            portENTER_CRITICAL(&jobLock);
+            RenderJob *job = queuedJob;
+            queuedJob = nullptr;
+            runningJob = job;
+            job->state = JOB_CONVERTING;
+            job->startedAt = millis();
+            portEXIT_CRITICAL(&jobLock);
+
+            runJob(job);
+            unlockDisplay();
+            esp_task_wdt_reset();
+        }
+    }
+}
+
+void startRenderScheduler() {
+    if (schedulerTask) return;
+    // Core 1 like loop(); the 32 s refresh no longer blocks loop()
+    xTaskCreatePinnedToCore(renderSchedulerTask, "renderJobs", 8192, NULL, 1, &schedulerTask, 1);
+}
@@ -0,0 +1,63 @@
+#ifndef RENDER_SCHEDULER_H
+#define RENDER_SCHEDULER_H
+
+#include <Arduino.h>
+#include "benchmark.h"
+#include "dither.h"
+
+enum RenderJobState : uint8_t {
+    JOB_QUEUED,
+    JOB_CONVERTING,  // started, no band written yet
+    JOB_WRITING,
+    JOB_REFRESHING,
+    JOB_DONE,
+    JOB_CANCELLED,
+    JOB_FAILED
+};
+
+enum RenderJobSource : uint8_t {
+    JOB_SOURCE_DRAW,
+    JOB_SOURCE_UPLOAD,
+    JOB_SOURCE_SELECT, // another stored image was selected
+    JOB_SOURCE_LAYOUT  // a scene posted to /api/layout, see layout.h
+};
+
+struct RenderJob {
+    uint32_t id;
+    RenderJobState state;
+    RenderJobSource source;
+    DitherMode dither;
+    bool force;           // rewrite every band, see invalidatePanelCache()
+    uint16_t merged;      // requests folded into this job
+    uint32_t queuedAt;    // millis() timestamps, 0 = not reached
+    uint32_t startedAt;
+    uint32_t refreshAt;
+    uint32_t finishedAt;
+    PipelineTiming timing;
+    uint16_t bandsWritten;
+    uint16_t bandsSkipped;
+    bool refreshed;
+};
+
+const char *renderJobStateName(RenderJobState state);
+const char *renderJobSourceName(RenderJobSource source);
+
+// Starts the render task; call once after the display and its lock are initialized
+void startRenderScheduler();
+
+/**
+ * Queues a render of the stored image and returns its job ID.
+ * A request while another job is still queued is merged into it. A draw
+ * while a job with the same settings is converting or writing is merged into
+ * that job. An upload or a slot selection cancels a job that has not
+ * started its refresh yet, since it would show the old image.
+ */
+uint32_t requestRender(RenderJobSource source, DitherMode dither, bool force);
+
+// Copies up to `max` most recent jobs, newest first; returns the count
+uint8_t getRenderJobs(RenderJob *jobs, uint8_t max);
+
+// Jobs that ended in `state` (done, cancelled or failed) since boot
+uint32_t renderJobsFinished(RenderJobState state);
+
+#endif
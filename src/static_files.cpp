@@ -0,0 +1,199 @@
+// static_files.cpp
+#include "static_files.h"
+#include "filesystem.h"
+#include "image_store.h"
+#include "debug.h"
+#include "esp_rom_crc.h"
+#include <LittleFS.h>
+
+struct EtagEntry {
+    String path;
+    uint32_t size;
+    time_t modified;
+    uint32_t crc;
+    uint32_t used;
+};
+
+// Only touched from the AsyncTCP task
+static EtagEntry etagCache[FS_ETAG_CACHE_SIZE];
+static uint32_t etagUse = 0;
+static StaticFileStats stats;
+
+static const char *contentType(const String &path) {
+    if (path.endsWith(".html") || path.endsWith(".htm")) return "text/html";
+    if (path.endsWith(".css")) return "text/css";
+    if (path.endsWith(".js")) return "application/javascript";
+    if (path.endsWith(".json")) return "application/json";
+    if (path.endsWith(".txt")) return "text/plain";
+    if (path.endsWith(".png")) return "image/png";
+    if (path.endsWith(".jpg") || path.endsWith(".jpeg")) return "image/jpeg";
+    if (path.endsWith(".gif")) return "image/gif";
+    if (path.endsWith(".svg")) return "image/svg+xml";
+    if (path.endsWith(".ico")) return "image/x-icon";
+    if (path.endsWith(".bmp")) return "image/bmp";
+    if (path.endsWith(".gz")) return "application/gzip";
+    return "application/octet-stream";
+}
+
+// Image store blobs are named by the CRC-32 of their content
+static bool blobCrc(const String &path, uint32_t &crc) {
+    const String dir = IMAGE_STORE_DIR "/";
+    if (!path.startsWith(dir) || !path.endsWith(".img") || path.length() != dir.length() + 12) return false;
+    char *end = nullptr;
+    crc = strtoul(path.c_str() + dir.length(), &end, 16);
+    return end == path.c_str() + dir.length() + 8;
+}
+
+static uint32_t hashFile(File &file) {
+    uint8_t buffer[512];
+    uint32_t crc = 0;
+    size_t n;
+    while ((n = file.read(buffer, sizeof(buffer))) > 0) {
+        crc = esp_rom_crc32_le(crc, buffer, n);
+    }
+    file.seek(0, SeekSet);
+    stats.hashReads++;
+    return crc;
+}
+
+static String fileEtag(File &file, const String &path) {
+    uint32_t size = file.size();
+    time_t modified = file.getLastWrite();
+    int hit = -1;
+    int victim = 0;
+    for (int i = 0; i < FS_ETAG_CACHE_SIZE && hit < 0; i++) {
+        const EtagEntry &entry = etagCache[i];
+        if (entry.path == path && entry.size == size && entry.modified == modified) hit = i;
+        else if (entry.used < etagCache[victim].used) victim = i;
+    }
+
+    uint32_t crc;
+    if (hit >= 0) {
+        crc = etagCache[hit].crc;
+        etagCache[hit].used = ++etagUse;
+    } else {
+        if (!blobCrc(path, crc)) crc = hashFile(file);
+        EtagEntry &entry = etagCache[victim];
+        entry.path = path;
+        entry.size = size;
+        entry.modified = modified;
+        entry.crc = crc;
+        entry.used = ++etagUse;
+    }
+
+    char etag[12];
+    snprintf(etag, sizeof(etag), "\"%08x\"", (unsigned) crc);
+    return String(etag);
+}
+
+/**
+ * Parses a single "bytes=first-last", "bytes=first-" or "bytes=-suffix"
+ * range into [start, end). False when the range cannot be satisfied; a
+ * header that is not a single byte range leaves the whole file.
+ */
+static bool parseRange(const String &header, uint32_t size, uint32_t &start, uint32_t &end) {
+    start = 0;
+    end = size;
+    if (!header.startsWith("bytes=") || header.indexOf(',') >= 0) return true;
+    int dash = header.indexOf('-');
+    if (dash < 0) return true;
+
+    String first = header.substring(6, dash);
+    String last = header.substring(dash + 1);
+    first.trim();
+    last.trim();
+    if (first.length() == 0) {
+        // The last `suffix` bytes
+        uint32_t suffix = strtoul(last.c_str(), nullptr, 10);
+        if (suffix == 0 || size == 0) return false;
+        start = suffix < size ? size - suffix : 0;
+        return true;
+    }
+    start = strtoul(first.c_str(), nullptr, 10);
+    if (last.length()) end = min<uint32_t>(strtoul(last.c_str(), nullptr, 10) + 1, size);
+    return start < size && start < end;
+}
+
+void handleStaticFile(AsyncWebServerRequest *request) {
+    stats.requests++;
+    String path = request->url().substring(strlen(FS_URL_PREFIX));
+    if (path.length() == 0) path = "/";
+    if (path.endsWith("/")) path += "index.htm";
+    if (path.indexOf("..") >= 0) {
+        request->send(400, "text/plain", "Invalid path");
+        return;
+    }
+
+    // A .gz sibling stands in for the file, unless a range of the file itself was asked for
+    bool ranged = request->hasHeader("Range");
+    bool acceptsGzip = request->hasHeader("Accept-Encoding") && request->header("Accept-Encoding").indexOf("gzip") >= 0;
+    String gzipPath = path + ".gz";
+    bool hasGzip = !path.endsWith(".gz") && LittleFS.exists(gzipPath);
+    bool hasPlain = LittleFS.exists(path);
+    bool gzip = hasGzip && acceptsGzip && (!ranged || !hasPlain);
+    if (!hasPlain && !gzip) {
+        request->send(404, "text/plain", "Not found");
+        return;
+    }
+
+    File file = LittleFS.open(gzip ? gzipPath : path, "r");
+    if (!file || file.isDirectory()) {
+        request->send(404, "text/plain", "Not found");
+        return;
+    }
+
+    String etag = fileEtag(file, gzip ? gzipPath : path);
+    if (request->hasHeader("If-None-Match") && etagMatches(request->header("If-None-Match"), etag)) {
+        stats.notModified++;
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", etag);
+        response->addHeader("Cache-Control", FS_CACHE_CONTROL);
+        if (hasGzip) response->addHeader("Vary", "Accept-Encoding");
+        request->send(response);
+        return;
+    }
+
+    // If-Range: a range of an older version is no use, send the whole current file
+    uint32_t size = file.size();
+    uint32_t start = 0;
+    uint32_t end = size;
+    bool partial = false;
+    if (ranged && (!request->hasHeader("If-Range") || request->header("If-Range") == etag)) {
+        if (!parseRange(request->header("Range"), size, start, end)) {
+            AsyncWebServerResponse *response = request->beginResponse(416);
+            response->addHeader("Content-Range", "bytes */" + String(size));
+            request->send(response);
+            return;
+        }
+        partial = start != 0 || end != size;
+    }
+
+    uint32_t length = end - start;
+    AsyncWebServerResponse *response = request->beginResponse(contentType(path), length,
+        [file, start, length](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+            if (index >= length) return 0;
+            size_t n = min<size_t>(maxLen, length - index);
+            if (!file.seek(start + index, SeekSet)) return 0;
+            n = file.read(buffer, n);
+            stats.bytesSent += n;
+            return n;
+        });
+    if (partial) {
+        stats.partial++;
+        response->setCode(206);
+        response->addHeader("Content-Range", "bytes " + String(start) + "-" + String(end - 1) + "/" + String(size));
+    }
+    if (gzip) {
+        stats.gzip++;
+        response->addHeader("Content-Encoding", "gzip");
+    }
+    if (hasGzip) response->addHeader("Vary", "Accept-Encoding");
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", FS_CACHE_CONTROL);
+    response->addHeader("Accept-Ranges", "bytes");
+    request->send(response);
+}
+
+StaticFileStats staticFileStats() {
+    return stats;
+}
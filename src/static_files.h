@@ -0,0 +1,42 @@
+#ifndef STATIC_FILES_H
+#define STATIC_FILES_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// URL prefix LittleFS is served under
+#define FS_URL_PREFIX "/fs"
+
+// Clients may keep a copy but must revalidate it, which costs a 304 at most
+#ifndef FS_CACHE_CONTROL
+#define FS_CACHE_CONTROL "no-cache"
+#endif
+
+// Files whose content hash is remembered, so revalidation reads no flash
+#ifndef FS_ETAG_CACHE_SIZE
+#define FS_ETAG_CACHE_SIZE 16
+#endif
+
+struct StaticFileStats {
+    uint32_t requests;
+    uint32_t notModified;   // answered with 304, no file data read
+    uint32_t partial;       // Range requests answered with 206
+    uint32_t gzip;          // served from a .gz sibling
+    uint32_t hashReads;     // files read to hash them, on an ETag cache miss
+    uint32_t bytesSent;     // file bytes, headers excluded
+};
+
+/**
+ * Serves LittleFS under FS_URL_PREFIX with strong ETags, If-None-Match,
+ * single-range Range requests and precompressed siblings: a client that
+ * accepts gzip gets `file.gz` in place of `file` when it exists.
+ *
+ * ETags are the CRC-32 of the file sent. Image store blobs are named by
+ * their CRC, so theirs are free; other files are read once and the hash is
+ * kept while their size and modification time stay the same.
+ */
+void handleStaticFile(AsyncWebServerRequest *request);
+
+StaticFileStats staticFileStats();
+
+#endif
@@ -0,0 +1,275 @@
+// stream_render.cpp
+#include "stream_render.h"
+#include "image_stream.h"
+#include "image_utils.h"
+#include "panel_format.h"
+#include "benchmark.h"
+#include "display.h"
+#include "render_arena.h"
+#include "config.h"
+#include "debug.h"
+#include "filesystem.h"
+#include "esp_rom_crc.h"
+#include "trace.h"
+#include "block_writer.h"
+#include "image_store.h"
+#include <LittleFS.h>
+#include "freertos/stream_buffer.h"
+
+#define STREAM_TEMP_PATH IMAGE_STORE_DIR "/stream.tmp"
+
+// Ring buffer between the AsyncTCP upload callback and the render task
+static const size_t stream_buffer_size = 16 * 1024;
+static const size_t stream_read_chunk = 2048;
+// Give up when no data arrives, or the ring buffer does not drain, for this long
+static const uint32_t stream_idle_timeout_ms = 10000;
+
+volatile StreamRenderState streamRenderState = STREAM_IDLE;
+const char *streamRenderError = nullptr;
+
+static StreamBufferHandle_t streamBuffer = nullptr;
+static AsyncWebServerRequest *streamOwner = nullptr;
+static volatile bool streamInputDone = false;
+static volatile bool streamAborted = false;
+static bool streamSave = false;
+static String streamSlot;
+static DitherMode streamDither = DITHER_NONE;
+static File streamFile;
+static BlockWriter streamWriter;
+static uint32_t streamCrc = 0;
+static unsigned long streamStart = 0;
+static PipelineTiming streamTiming;
+
+const char *streamRenderStateName(StreamRenderState state) {
+    switch (state) {
+        case STREAM_IDLE:
+            return "idle";
+        case STREAM_RECEIVING:
+            return "receiving";
+        case STREAM_REFRESHING:
+            return "refreshing";
+        case STREAM_DONE:
+            return "done";
+        default:
+            return "failed";
+    }
+}
+
+static void failStream(const char *message) {
+    if (!streamRenderError) streamRenderError = message;
+    streamAborted = true;
+    LOG_E("[STREAM] Error: %s", message);
+}
+
+static bool writeBandToPanel(const uint8_t *mono, const uint8_t *color, uint16_t y, uint16_t rows, void *context) {
+    size_t bandBytes = (DISPLAY_WIDTH / 8) * rows;
+
+    uint32_t t0 = micros();
+    writePanelBand(mono, color, y, rows);
+    addStageTime(streamTiming, STAGE_WRITE, t0, 2 * bandBytes);
+
+    if (streamSave && streamFile) {
+        if (!streamWriter.write(mono, bandBytes) || !streamWriter.write(color, bandBytes)) {
+            // The panel still gets the image, only the copy on flash is dropped
+            debug.println("[STREAM] Error: Failed to save planes, continuing without saving");
+            streamFile.close();
+            LittleFS.remove(STREAM_TEMP_PATH);
+        }
+    }
+    return !streamAborted;
+}
+
+static bool openStreamFile() {
+    LittleFS.remove(STREAM_TEMP_PATH);
+    streamFile = LittleFS.open(STREAM_TEMP_PATH, "w");
+    if (!streamFile || !streamWriter.begin(streamFile)) return false;
+
+    PanelImageHeader header;
+    header.version = PANEL_IMAGE_VERSION;
+    header.encoding = PANEL_ENCODING_PLANES;
+    header.width = DISPLAY_WIDTH;
+    header.height = DISPLAY_HEIGHT;
+    header.bandRows = RENDER_BATCH_ROWS;
+    header.dataSize = panelPlanesDataSize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    uint8_t headerData[PANEL_IMAGE_HEADER_SIZE];
+    writePanelImageHeader(headerData, header);
+    return streamWriter.write(headerData, sizeof(headerData));
+}
+
+static void finishStreamFile(bool ok, const String &etag) {
+    if (!streamSave) return;
+    bool saved = ok && streamFile && streamWriter.flush();
+    if (streamFile) streamFile.close();
+
+    if (saved) {
+        saved = storeImage(streamSlot, STREAM_TEMP_PATH, streamWriter.writtenCrc(), streamWriter.bytesWritten(),
+                           IMAGE_FORMAT_PLANES, DISPLAY_WIDTH, DISPLAY_HEIGHT, etag, true);
+    } else {
+        LittleFS.remove(STREAM_TEMP_PATH);
+    }
+    LOG_I("[STREAM] %s slot %s", saved ? "Planes saved to" : "Image not saved to", streamSlot.c_str());
+}
+
+static void streamRenderTask(void *parameter) {
+    // Render buffers come from the arena, released before the display lock
+    size_t arenaMark = renderArena.mark();
+    uint8_t *chunk = (uint8_t *) renderArena.alloc(stream_read_chunk);
+    ImageStreamDecoder decoder;
+
+    resetPipelineTiming(streamTiming);
+    streamTiming.pixels = (uint32_t) DISPLAY_WIDTH * DISPLAY_HEIGHT;
+
+    bool framed = false;
+    if (!chunk || !decoder.begin(DISPLAY_WIDTH, DISPLAY_HEIGHT, RENDER_BATCH_ROWS, writeBandToPanel, nullptr, streamDither, &renderArena)) {
+        failStream("Failed to allocate buffers");
+    } else {
+        beginPanelFrame();
+        framed = true;
+    }
+
+    unsigned long lastData = millis();
+    while (!streamAborted) {
+        size_t n = xStreamBufferReceive(streamBuffer, chunk, stream_read_chunk, pdMS_TO_TICKS(50));
+        if (n > 0) {
+            lastData = millis();
+            if (!decoder.push(chunk, n)) {
+                failStream("Stream is not a raw RGB565 image of the panel size");
+            }
+            continue;
+        }
+        if (streamInputDone && xStreamBufferIsEmpty(streamBuffer)) break;
+        if (millis() - lastData > stream_idle_timeout_ms) {
+            failStream("Stream stalled");
+        }
+    }
+
+    bool ok = !streamAborted && decoder.finish();
+    if (!streamAborted && !ok) {
+        failStream("Stream ended before the image was complete");
+    }
+    decoder.end();
+    renderArena.release(arenaMark);
+
+    if (ok) {
+        streamRenderState = STREAM_REFRESHING;
+        LOG_I("[TIMING] Stream start to refresh: %lu ms", millis() - streamStart);
+        finishPanelWrites(streamTiming);
+        printPipelineTiming(streamTiming);
+        lastRenderTiming = streamTiming;
+        endPanelFrame(true);
+    } else if (framed) {
+        // Rows already written leave controller RAM out of step with the glass. Ending the
+        // frame cancelled skips the refresh, forgets the bands and puts the panel back to idle.
+        cancelPanelFrame();
+        endPanelFrame(false);
+    }
+
+    // Same ETag as an upload of these bytes with ?convert
+    String etag = makeImageEtag(streamCrc, true, streamDither);
+    setDisplayedImageEtag(ok ? etag.c_str() : "");
+    finishStreamFile(ok, etag);
+
+    streamRenderState = ok ? STREAM_DONE : STREAM_FAILED;
+    LOG_I("[STREAM] Stream render %s in %lu ms", streamRenderStateName(streamRenderState), millis() - streamStart);
+    unlockDisplay();
+    vTaskDelete(NULL);
+}
+
+static bool beginStream(AsyncWebServerRequest *request) {
+    if (streamRenderState == STREAM_RECEIVING || streamRenderState == STREAM_REFRESHING) {
+        debug.println("[STREAM] Rejecting stream, another one is in progress");
+        return false;
+    }
+    if (!lockDisplay(0)) {
+        debug.println("[STREAM] Rejecting stream, display is busy");
+        return false;
+    }
+
+    streamOwner = request;
+    streamRenderError = nullptr;
+    streamInputDone = false;
+    streamAborted = false;
+    streamCrc = 0;
+    streamStart = millis();
+
+    // Allocated once and reused, so repeated streams do not fragment the heap
+    if (!streamBuffer) {
+        streamBuffer = xStreamBufferCreate(stream_buffer_size, 1);
+    }
+    if (!streamBuffer) {
+        failStream("Failed to allocate stream buffer");
+        streamRenderState = STREAM_FAILED;
+        unlockDisplay();
+        return true;
+    }
+    xStreamBufferReset(streamBuffer);
+
+    streamSave = request->hasParam("save");
+    streamSlot = request->hasParam("slot") ? request->getParam("slot")->value() : String(IMAGE_STORE_DEFAULT_SLOT);
+    streamDither = requestDitherMode(request, DITHER_NONE);
+    if (streamSave && !isValidSlotName(streamSlot)) {
+        LOG_E("[STREAM] Error: Invalid slot name, image will not be saved");
+        streamSave = false;
+    }
+    size_t planesBytes = PANEL_IMAGE_HEADER_SIZE + panelPlanesDataSize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    if (streamSave && (!reserveImageSpace(planesBytes + 8192, streamSlot) || !openStreamFile())) {
+        LOG_E("[STREAM] Error: Cannot create " STREAM_TEMP_PATH ", image will not be saved");
+        if (streamFile) streamFile.close();
+    }
+
+    streamRenderState = STREAM_RECEIVING;
+    // Core 0: AsyncTCP and loop() run on core 1
+    if (xTaskCreatePinnedToCore(streamRenderTask, "streamRender", 8192, NULL, 2, NULL, 0) != pdPASS) {
+        failStream("Failed to start render task");
+        finishStreamFile(false, String());
+        streamRenderState = STREAM_FAILED;
+        unlockDisplay();
+    }
+    debug.println("[STREAM] Stream render started");
+    return true;
+}
+
+// Blocks until the render task has room, which holds back AsyncTCP and the sender
+static void sendToRenderTask(const uint8_t *data, size_t len) {
+    unsigned long waitStart = millis();
+    while (len > 0 && !streamAborted) {
+        size_t sent = xStreamBufferSend(streamBuffer, data, len, pdMS_TO_TICKS(100));
+        data += sent;
+        len -= sent;
+        if (sent > 0) {
+            waitStart = millis();
+        } else if (millis() - waitStart > stream_idle_timeout_ms) {
+            failStream("Render task stopped reading");
+        }
+    }
+}
+
+void handleStreamUpload(AsyncWebServerRequest *request, String filename,
+                        size_t index, uint8_t *data, size_t len, bool final) {
+    if (index == 0 && !beginStream(request)) return;
+    if (request != streamOwner || streamRenderState != STREAM_RECEIVING) return;
+
+    if (len) {
+        TraceScope trace(SPAN_UPLOAD_CHUNK, len);
+        streamCrc = esp_rom_crc32_le(streamCrc, data, len);
+        sendToRenderTask(data, len);
+    }
+    if (final) {
+        streamInputDone = true;
+        LOG_I("[STREAM] Upload received in %lu ms", millis() - streamStart);
+    }
+}
+
+void handleStreamResponse(AsyncWebServerRequest *request) {
+    if (request != streamOwner) {
+        request->send(409, "text/plain", "Display busy");
+        return;
+    }
+    streamOwner = nullptr;
+
+    if (streamRenderError) {
+        request->send(500, "text/plain", streamRenderError);
+    } else {
+        request->send(200, "text/plain", "Streaming render in progress");
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef STREAM_RENDER_H
+#define STREAM_RENDER_H
+
+#include <ESPAsyncWebServer.h>
+
+enum StreamRenderState {
+    STREAM_IDLE,
+    STREAM_RECEIVING,
+    STREAM_REFRESHING,
+    STREAM_DONE,
+    STREAM_FAILED
+};
+
+extern volatile StreamRenderState streamRenderState;
+extern const char *streamRenderError;
+
+const char *streamRenderStateName(StreamRenderState state);
+
+/**
+ * Upload handler for /api/image/stream
+ * Raw RGB565 chunks go through a bounded ring buffer to a render task that
+ * converts and writes rows to the panel while the body is still arriving.
+ * When the ring buffer is full the handler blocks, which stalls AsyncTCP and
+ * throttles the sender. With ?save the planes are also stored as image.bin.
+ */
+void handleStreamUpload(AsyncWebServerRequest *request, String filename,
+                        size_t index, uint8_t *data, size_t len, bool final);
+
+// Request handler for /api/image/stream, called once the body has been received
+void handleStreamResponse(AsyncWebServerRequest *request);
+
+#endif
@@ -0,0 +1,99 @@
+// trace.cpp
+#include "trace.h"
+
+// Upper bounds of the duration histogram buckets in microseconds; +Inf is implicit
+static const uint32_t bucket_bounds_us[] = {
+    10, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000,
+    1000000, 5000000, 10000000, 30000000, 60000000
+};
+static const uint8_t bucket_count = sizeof(bucket_bounds_us) / sizeof(bucket_bounds_us[0]);
+
+struct SpanStats {
+    uint32_t buckets[bucket_count];  // per bucket, made cumulative on export
+    uint32_t count;
+    uint64_t sumMicros;
+    uint64_t bytes;
+};
+
+static const char *spanNames[SPAN_COUNT] = {
+    "http_request", "upload_chunk", "fs_write", "batch_read", "convert",
+    "panel_write", "panel_spi", "refresh", "render_wait", "render_job"
+};
+
+static TraceEvent ring[TRACE_RING_SIZE];
+// Spans ever recorded; the newest is at (ringTotal - 1) % TRACE_RING_SIZE
+static uint32_t ringTotal = 0;
+static SpanStats stats[SPAN_COUNT];
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t cpuMhz = 0;
+
+const char *traceSpanName(TraceSpan span) {
+    return span < SPAN_COUNT ? spanNames[span] : "unknown";
+}
+
+void traceEnd(TraceSpan span, uint32_t startCycles, uint32_t bytes) {
+    uint32_t cycles = traceNow() - startCycles;
+    if (cpuMhz == 0) cpuMhz = getCpuFrequencyMhz();
+    traceRecord(span, startCycles, cycles / cpuMhz, bytes);
+}
+
+void traceRecord(TraceSpan span, uint32_t startCycles, uint32_t micros, uint32_t bytes) {
+    if (span >= SPAN_COUNT) return;
+
+    uint8_t bucket = 0;
+    while (bucket < bucket_count && micros > bucket_bounds_us[bucket]) bucket++;
+
+    portENTER_CRITICAL(&traceLock);
+    TraceEvent &event = ring[ringTotal % TRACE_RING_SIZE];
+    event.startCycles = startCycles;
+    event.micros = micros;
+    event.bytes = bytes;
+    event.span = span;
+    event.core = xPortGetCoreID();
+    ringTotal++;
+
+    SpanStats &s = stats[span];
+    if (bucket < bucket_count) s.buckets[bucket]++;
+    s.count++;
+    s.sumMicros += micros;
+    s.bytes += bytes;
+    portEXIT_CRITICAL(&traceLock);
+}
+
+size_t getTraceEvents(TraceEvent *events, size_t max) {
+    portENTER_CRITICAL(&traceLock);
+    size_t n = min((size_t) min(ringTotal, (uint32_t) TRACE_RING_SIZE), max);
+    for (size_t i = 0; i < n; i++) {
+        events[i] = ring[(ringTotal - n + i) % TRACE_RING_SIZE];
+    }
+    portEXIT_CRITICAL(&traceLock);
+    return n;
+}
+
+void appendTraceMetrics(String &out) {
+    SpanStats snapshot[SPAN_COUNT];
+    portENTER_CRITICAL(&traceLock);
+    memcpy(snapshot, stats, sizeof(snapshot));
+    portEXIT_CRITICAL(&traceLock);
+
+    out += "# HELP epd_span_duration_seconds Duration of traced spans\n";
+    out += "# TYPE epd_span_duration_seconds histogram\n";
+    for (int s = 0; s < SPAN_COUNT; s++) {
+        String label = String("span=\"") + spanNames[s] + "\"";
+        uint32_t cumulative = 0;
+        for (uint8_t b = 0; b < bucket_count; b++) {
+            cumulative += snapshot[s].buckets[b];
+            out += "epd_span_duration_seconds_bucket{" + label + ",le=\"" +
+                   String(bucket_bounds_us[b] / 1000000.0, 6) + "\"} " + String(cumulative) + "\n";
+        }
+        out += "epd_span_duration_seconds_bucket{" + label + ",le=\"+Inf\"} " + String(snapshot[s].count) + "\n";
+        out += "epd_span_duration_seconds_sum{" + label + "} " + String(snapshot[s].sumMicros / 1000000.0, 6) + "\n";
+        out += "epd_span_duration_seconds_count{" + label + "} " + String(snapshot[s].count) + "\n";
+    }
+
+    out += "# HELP epd_span_bytes_total Bytes handled by traced spans\n";
+    out += "# TYPE epd_span_bytes_total counter\n";
+    for (int s = 0; s < SPAN_COUNT; s++) {
+        out += String("epd_span_bytes_total{span=\"") + spanNames[s] + "\"} " + String(snapshot[s].bytes) + "\n";
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+
+// Completed spans kept for /api/trace; older ones are overwritten
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 128
+#endif
+
+enum TraceSpan : uint8_t {
+    SPAN_HTTP_REQUEST,  // web handler, from request dispatch to return
+    SPAN_UPLOAD_CHUNK,  // one upload body chunk, including its flash write or conversion
+    SPAN_FS_WRITE,      // LittleFS write of an upload chunk
+    SPAN_BATCH_READ,    // image rows read from LittleFS for one batch
+    SPAN_CONVERT,       // one batch converted or decoded to planes
+    SPAN_PANEL_WRITE,   // one band handed to the panel: encoded and queued, or display.writeImage
+    SPAN_PANEL_SPI,     // one queued band clocked out by the SPI task
+    SPAN_REFRESH,       // display.refresh, mostly the BUSY wait
+    SPAN_RENDER_WAIT,   // render job queued until started
+    SPAN_RENDER_JOB,    // render job started until finished, refresh included
+    SPAN_COUNT
+};
+
+struct TraceEvent {
+    uint32_t startCycles;  // CPU cycle counter of `core` when the span started
+    uint32_t micros;       // duration
+    uint32_t bytes;
+    uint8_t span;
+    uint8_t core;
+};
+
+const char *traceSpanName(TraceSpan span);
+
+// Timestamp for traceEnd(): the cycle counter of the calling core
+static inline uint32_t traceNow() {
+    return ESP.getCycleCount();
+}
+
+/**
+ * Records a span that started at traceNow() `startCycles` on this core.
+ * The cycle counter wraps after ~17 s at 240 MHz, so longer spans must use
+ * traceRecord() with a duration measured otherwise.
+ */
+void traceEnd(TraceSpan span, uint32_t startCycles, uint32_t bytes = 0);
+
+// Records a span with a known duration in microseconds
+void traceRecord(TraceSpan span, uint32_t startCycles, uint32_t micros, uint32_t bytes = 0);
+
+// Copies up to `max` most recent spans, oldest first; returns the count
+size_t getTraceEvents(TraceEvent *events, size_t max);
+
+/**
+ * Appends the span metrics in Prometheus text format: a duration histogram,
+ * a byte counter and a span counter per span.
+ */
+void appendTraceMetrics(String &out);
+
+// Traces the enclosing scope
+class TraceScope {
+private:
+    uint32_t start;
+    uint32_t bytes;
+    TraceSpan span;
+
+public:
+    explicit TraceScope(TraceSpan span, uint32_t bytes = 0) : start(traceNow()), bytes(bytes), span(span) {}
+    ~TraceScope() { traceEnd(span, start, bytes); }
+
+    void setBytes(uint32_t n) { bytes = n; }
+};
+
+#endif
@@ -0,0 +1,252 @@
+// upload_inflate.cpp
+#include "upload_inflate.h"
+#include "debug.h"
+#include "esp_rom_crc.h"
+#include "esp32/rom/miniz.h"
+
+// gzip header fields (RFC 1952), in the order they follow the fixed 10 bytes
+enum GzipHeaderState : uint8_t {
+    GZIP_FIXED,
+    GZIP_EXTRA_LENGTH,
+    GZIP_EXTRA,
+    GZIP_NAME,
+    GZIP_COMMENT,
+    GZIP_HEADER_CRC,
+    GZIP_BODY
+};
+
+static const uint8_t gzip_flag_hcrc = 0x02;
+static const uint8_t gzip_flag_extra = 0x04;
+static const uint8_t gzip_flag_name = 0x08;
+static const uint8_t gzip_flag_comment = 0x10;
+
+// ROM inflater state and its dictionary, which doubles as the output window
+static tinfl_decompressor *decompressor = nullptr;
+static uint8_t *window = nullptr;
+static bool inUse = false;
+
+const char *contentEncodingName(ContentEncoding encoding) {
+    switch (encoding) {
+        case ENCODING_GZIP:
+            return "gzip";
+        case ENCODING_DEFLATE:
+            return "deflate";
+        default:
+            return "identity";
+    }
+}
+
+ContentEncoding parseContentEncoding(const String &name) {
+    String value = name;
+    value.trim();
+    value.toLowerCase();
+    if (value == "gzip" || value == "x-gzip") return ENCODING_GZIP;
+    if (value == "deflate") return ENCODING_DEFLATE;
+    return ENCODING_IDENTITY;
+}
+
+bool initUploadInflater() {
+#if UPLOAD_INFLATE
+    if (window) return true;
+    decompressor = (tinfl_decompressor *) malloc(sizeof(tinfl_decompressor));
+    window = (uint8_t *) malloc(TINFL_LZ_DICT_SIZE);
+    if (!decompressor || !window) {
+        LOG_E("[INFLATE] Error: Cannot reserve %u bytes, compressed uploads disabled",
+              (unsigned) (sizeof(tinfl_decompressor) + TINFL_LZ_DICT_SIZE));
+        free(decompressor);
+        free(window);
+        decompressor = nullptr;
+        window = nullptr;
+        return false;
+    }
+    LOG_I("[INFLATE] Reserved %u bytes for compressed uploads",
+          (unsigned) (sizeof(tinfl_decompressor) + TINFL_LZ_DICT_SIZE));
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool uploadInflaterAvailable() {
+    return window != nullptr;
+}
+
+UploadInflater::UploadInflater()
+    : encoding(ENCODING_IDENTITY), sink(nullptr), sinkContext(nullptr), flags(0), windowOffset(0),
+      headerState(GZIP_FIXED), headerFlags(0), skip(0), trailerFill(0), crc(0), compressed(0), inflated(0),
+      inflateMicros(0), done(false), failed(false), active(false) {}
+
+bool UploadInflater::begin(ContentEncoding contentEncoding, InflateSink bytesSink, void *context) {
+    if (!window || inUse || contentEncoding == ENCODING_IDENTITY) return false;
+    inUse = true;
+    active = true;
+
+    encoding = contentEncoding;
+    sink = bytesSink;
+    sinkContext = context;
+    flags = 0;
+    windowOffset = 0;
+    headerState = encoding == ENCODING_GZIP ? GZIP_FIXED : GZIP_BODY;
+    headerFlags = 0;
+    skip = 0;
+    trailerFill = 0;
+    crc = 0;
+    compressed = 0;
+    inflated = 0;
+    inflateMicros = 0;
+    done = false;
+    failed = false;
+    tinfl_init(decompressor);
+    return true;
+}
+
+// Moves past header fields the flags say are absent
+static uint8_t nextGzipField(uint8_t state, uint8_t headerFlags) {
+    for (;;) {
+        state++;
+        if (state == GZIP_EXTRA_LENGTH && !(headerFlags & gzip_flag_extra)) continue;
+        if (state == GZIP_EXTRA && !(headerFlags & gzip_flag_extra)) continue;
+        if (state == GZIP_NAME && !(headerFlags & gzip_flag_name)) continue;
+        if (state == GZIP_COMMENT && !(headerFlags & gzip_flag_comment)) continue;
+        if (state == GZIP_HEADER_CRC && !(headerFlags & gzip_flag_hcrc)) continue;
+        return state;
+    }
+}
+
+// Consumes header bytes, which may be split across chunks; returns how many
+size_t UploadInflater::parseGzipHeader(const uint8_t *data, size_t len) {
+    size_t i = 0;
+    while (i < len && headerState != GZIP_BODY && !failed) {
+        uint8_t b = data[i++];
+        switch (headerState) {
+            case GZIP_FIXED:
+                // Magic and the deflate method, then flags; time, extra flags and OS are skipped
+                if ((skip == 0 && b != 0x1F) || (skip == 1 && b != 0x8B) || (skip == 2 && b != 8)) {
+                    LOG_E("[INFLATE] Error: Not a gzip stream");
+                    failed = true;
+                } else if (skip == 3) {
+                    headerFlags = b;
+                }
+                if (++skip == 10) {
+                    skip = 0;
+                    headerState = nextGzipField(headerState, headerFlags);
+                }
+                break;
+            case GZIP_EXTRA_LENGTH:
+                // Little endian; the high byte is added in the second round
+                if (trailerFill++ == 0) {
+                    skip = b;
+                } else {
+                    skip |= b << 8;
+                    trailerFill = 0;
+                    headerState = GZIP_EXTRA;
+                    if (skip == 0) headerState = nextGzipField(headerState, headerFlags);
+                }
+                break;
+            case GZIP_EXTRA:
+                if (--skip == 0) headerState = nextGzipField(headerState, headerFlags);
+                break;
+            case GZIP_NAME:
+            case GZIP_COMMENT:
+                if (b == 0) headerState = nextGzipField(headerState, headerFlags);
+                break;
+            case GZIP_HEADER_CRC:
+                if (++skip == 2) {
+                    skip = 0;
+                    headerState = nextGzipField(headerState, headerFlags);
+                }
+                break;
+        }
+    }
+    return i;
+}
+
+bool UploadInflater::inflate(const uint8_t *data, size_t len, size_t &used) {
+    used = 0;
+    for (;;) {
+        size_t inSize = len - used;
+        size_t outSize = TINFL_LZ_DICT_SIZE - windowOffset;
+        uint32_t t0 = micros();
+        tinfl_status status = tinfl_decompress(decompressor, data + used, &inSize, window, window + windowOffset,
+                                               &outSize, flags | TINFL_FLAG_HAS_MORE_INPUT);
+        inflateMicros += micros() - t0;
+        used += inSize;
+
+        if (outSize) {
+            if (encoding == ENCODING_GZIP) crc = esp_rom_crc32_le(crc, window + windowOffset, outSize);
+            inflated += outSize;
+            if (!sink(window + windowOffset, outSize, sinkContext)) return false;
+            windowOffset = (windowOffset + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+        if (status == TINFL_STATUS_DONE) {
+            done = true;
+            return true;
+        }
+        if (status < TINFL_STATUS_DONE) {
+            LOG_E("[INFLATE] Error: Inflate failed (%d) after %u bytes in", (int) status, (unsigned) compressed);
+            return false;
+        }
+        // Otherwise the window is full (go round) or the chunk is used up
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT) return true;
+    }
+}
+
+bool UploadInflater::push(const uint8_t *data, size_t len) {
+    if (!active || failed) return false;
+    compressed += len;
+
+    if (headerState != GZIP_BODY) {
+        size_t n = parseGzipHeader(data, len);
+        data += n;
+        len -= n;
+        if (failed) return false;
+    }
+
+    if (!done && len) {
+        // HTTP deflate is zlib-wrapped, but some clients send it raw; the zlib header tells them apart
+        if (encoding == ENCODING_DEFLATE && inflated == 0 && flags == 0 && decompressor->m_state == 0) {
+            bool zlib = (data[0] & 0x0F) == 8 && (data[0] >> 4) <= 7 &&
+                        (len < 2 || ((data[0] << 8) | data[1]) % 31 == 0);
+            if (zlib) flags = TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32;
+        }
+        size_t used = 0;
+        if (!inflate(data, len, used)) {
+            failed = true;
+            return false;
+        }
+        data += used;
+        len -= used;
+    }
+
+    // What follows the last block: the gzip trailer
+    if (done && encoding == ENCODING_GZIP) {
+        size_t n = min(len, sizeof(trailer) - trailerFill);
+        memcpy(trailer + trailerFill, data, n);
+        trailerFill += n;
+    }
+    return true;
+}
+
+bool UploadInflater::finish() {
+    if (!active || failed) return false;
+    if (!done) {
+        LOG_E("[INFLATE] Error: Stream ended before its last block (%u bytes in)", (unsigned) compressed);
+        return false;
+    }
+    if (encoding != ENCODING_GZIP) return true;
+
+    uint32_t trailerCrc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t) trailer[3] << 24;
+    uint32_t trailerSize = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (uint32_t) trailer[7] << 24;
+    if (trailerFill < sizeof(trailer) || trailerCrc != crc || trailerSize != inflated) {
+        LOG_E("[INFLATE] Error: gzip trailer mismatch (CRC %08x, %u bytes; inflated %08x, %u bytes)",
+              (unsigned) trailerCrc, (unsigned) trailerSize, (unsigned) crc, (unsigned) inflated);
+        return false;
+    }
+    return true;
+}
+
+void UploadInflater::end() {
+    if (!active) return;
+    active = false;
+    inUse = false;
+}
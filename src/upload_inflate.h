@@ -0,0 +1,76 @@
+#ifndef UPLOAD_INFLATE_H
+#define UPLOAD_INFLATE_H
+
+#include <Arduino.h>
+
+// 0: no compressed uploads, and no 43 KB of inflater state reserved at boot
+#ifndef UPLOAD_INFLATE
+#define UPLOAD_INFLATE 1
+#endif
+
+enum ContentEncoding : uint8_t {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_DEFLATE    // zlib-wrapped as HTTP specifies, or raw deflate
+};
+
+const char *contentEncodingName(ContentEncoding encoding);
+// "gzip", "x-gzip" or "deflate"; anything else is identity
+ContentEncoding parseContentEncoding(const String &name);
+
+// Receives inflated bytes; returns false to abort
+typedef bool (*InflateSink)(const uint8_t *data, size_t len, void *context);
+
+/**
+ * Allocates the inflater state and its 32 KB window once, at boot, so
+ * compressed uploads never allocate. Without it only identity uploads work.
+ */
+bool initUploadInflater();
+bool uploadInflaterAvailable();
+
+/**
+ * Inflates a gzip or deflate stream with the ROM inflater as it arrives,
+ * in chunks split anywhere, handing the output to the sink a window at a
+ * time. The gzip trailer (CRC-32 and length of the inflated data) is
+ * checked in finish(). There is one window, so one stream at a time.
+ */
+class UploadInflater {
+private:
+    ContentEncoding encoding;
+    InflateSink sink;
+    void *sinkContext;
+    uint32_t flags;
+    size_t windowOffset;
+    uint8_t headerState;
+    uint8_t headerFlags;
+    uint16_t skip;
+    uint8_t trailer[8];
+    uint8_t trailerFill;
+    uint32_t crc;
+    uint32_t compressed;
+    uint32_t inflated;
+    uint32_t inflateMicros;
+    bool done;
+    bool failed;
+    bool active;
+
+    size_t parseGzipHeader(const uint8_t *data, size_t len);
+    bool inflate(const uint8_t *data, size_t len, size_t &used);
+
+public:
+    UploadInflater();
+
+    // False if the inflater is not available or already in use
+    bool begin(ContentEncoding encoding, InflateSink sink, void *context);
+    bool push(const uint8_t *data, size_t len);
+    // True when the stream ended where it should and its checks passed
+    bool finish();
+    void end();
+
+    uint32_t compressedBytes() const { return compressed; }
+    uint32_t inflatedBytes() const { return inflated; }
+    // Time spent in the inflater itself, sink excluded
+    uint32_t inflateTime() const { return inflateMicros; }
+};
+
+#endif
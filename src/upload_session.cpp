@@ -0,0 +1,396 @@
+// upload_session.cpp
+#include "upload_session.h"
+#include "filesystem.h"
+#include "display.h"
+#include "config.h"
+#include "bmp_decoder.h"
+#include "render_scheduler.h"
+#include "debug.h"
+#include "trace.h"
+#include "esp_rom_crc.h"
+#include "esp_task_wdt.h"
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+
+static UploadSession sessions[UPLOAD_SESSION_MAX];
+static uint8_t sessionCount = 0;
+static uint32_t useCounter = 0;
+
+static String sessionPath(const char *id, const char *extension) {
+    return String(UPLOAD_SESSION_DIR "/") + id + extension;
+}
+
+static String dataPath(const UploadSession &session) {
+    return sessionPath(session.id, ".part");
+}
+
+static uint16_t chunkCount(uint32_t size) {
+    return (size + UPLOAD_SESSION_CHUNK_SIZE - 1) / UPLOAD_SESSION_CHUNK_SIZE;
+}
+
+static bool chunkCommitted(const UploadSession &session, uint16_t chunk) {
+    return session.committed[chunk >> 3] & (1 << (chunk & 7));
+}
+
+static bool uploadComplete(const UploadSession &session) {
+    for (uint16_t chunk = 0; chunk < chunkCount(session.size); chunk++) {
+        if (!chunkCommitted(session, chunk)) return false;
+    }
+    return true;
+}
+
+static int findSession(const String &id) {
+    for (uint8_t i = 0; i < sessionCount; i++) {
+        if (id == sessions[i].id) return i;
+    }
+    return -1;
+}
+
+// Same swap as the slot index: a reset leaves the old metadata or the new one
+static bool saveSession(const UploadSession &session) {
+    char hex[2 * sizeof(session.committed) + 1];
+    for (size_t i = 0; i < sizeof(session.committed); i++) {
+        snprintf(hex + 2 * i, 3, "%02x", session.committed[i]);
+    }
+    char crc[9];
+    snprintf(crc, sizeof(crc), "%08x", (unsigned) session.crc);
+
+    JsonDocument doc;
+    doc["slot"] = session.slot;
+    doc["size"] = session.size;
+    doc["crc"] = crc;
+    doc["dither"] = ditherModeName(session.dither);
+    doc["select"] = session.select;
+    doc["touched"] = session.touched;
+    doc["committed"] = hex;
+
+    String path = sessionPath(session.id, ".json");
+    String tempPath = sessionPath(session.id, ".tmp");
+    File f = LittleFS.open(tempPath, "w");
+    if (!f) {
+        LOG_E("[UPLOAD] Error: Cannot write session %s", session.id);
+        return false;
+    }
+    bool ok = serializeJson(doc, f) > 0;
+    f.close();
+    LittleFS.remove(path);
+    ok = ok && LittleFS.rename(tempPath, path);
+    if (!ok) LOG_E("[UPLOAD] Error: Cannot replace session %s", session.id);
+    return ok;
+}
+
+static bool loadSession(const String &id, UploadSession &session) {
+    File f = LittleFS.open(sessionPath(id.c_str(), ".json"), "r");
+    if (!f) return false;
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, f);
+    f.close();
+    if (err) return false;
+
+    memset(&session, 0, sizeof(session));
+    strlcpy(session.id, id.c_str(), sizeof(session.id));
+    strlcpy(session.slot, doc["slot"] | "", sizeof(session.slot));
+    session.size = doc["size"] | 0;
+    session.crc = strtoul(doc["crc"] | "0", nullptr, 16);
+    session.dither = parseDitherMode(doc["dither"] | "none");
+    session.select = doc["select"] | true;
+    session.touched = doc["touched"] | 0;
+    const char *hex = doc["committed"] | "";
+    for (size_t i = 0; i < sizeof(session.committed) && hex[2 * i] && hex[2 * i + 1]; i++) {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], 0};
+        session.committed[i] = strtoul(byte, nullptr, 16);
+    }
+    // A data file lost to a reset takes its chunks with it
+    if (!LittleFS.exists(dataPath(session))) memset(session.committed, 0, sizeof(session.committed));
+    return isValidSlotName(session.slot) && session.size > 0 &&
+           chunkCount(session.size) <= UPLOAD_SESSION_MAX_CHUNKS;
+}
+
+static void removeSession(int i) {
+    LittleFS.remove(dataPath(sessions[i]));
+    LittleFS.remove(sessionPath(sessions[i].id, ".json"));
+    sessions[i] = sessions[--sessionCount];
+}
+
+void initUploadSessions() {
+    if (!LittleFS.exists(UPLOAD_SESSION_DIR)) LittleFS.mkdir(UPLOAD_SESSION_DIR);
+    File dir = LittleFS.open(UPLOAD_SESSION_DIR);
+    if (!dir || !dir.isDirectory()) return;
+
+    String strays[8];
+    int strayCount = 0;
+    File file = dir.openNextFile();
+    while (file) {
+        String name = file.name();
+        String id = name.substring(0, name.indexOf('.'));
+        file = dir.openNextFile();
+
+        if (name.endsWith(".json") && findSession(id) < 0 && sessionCount < UPLOAD_SESSION_MAX &&
+            loadSession(id, sessions[sessionCount])) {
+            useCounter = max(useCounter, sessions[sessionCount].touched);
+            sessionCount++;
+        }
+    }
+    dir.close();
+
+    // Data without metadata, metadata that did not load, and half-written metadata
+    dir = LittleFS.open(UPLOAD_SESSION_DIR);
+    file = dir.openNextFile();
+    while (file && strayCount < 8) {
+        String name = file.name();
+        if (findSession(name.substring(0, name.indexOf('.'))) < 0 || name.endsWith(".tmp")) {
+            strays[strayCount++] = String(UPLOAD_SESSION_DIR "/") + name;
+        }
+        file = dir.openNextFile();
+    }
+    dir.close();
+    for (int i = 0; i < strayCount; i++) {
+        LOG_I("[UPLOAD] Removing stray %s", strays[i].c_str());
+        LittleFS.remove(strays[i]);
+    }
+
+    for (uint8_t i = 0; i < sessionCount; i++) {
+        uint16_t chunks = chunkCount(sessions[i].size);
+        uint16_t done = 0;
+        for (uint16_t chunk = 0; chunk < chunks; chunk++) done += chunkCommitted(sessions[i], chunk);
+        LOG_I("[UPLOAD] Resumable session %s: %u bytes into slot %s, %u of %u chunks", sessions[i].id,
+              (unsigned) sessions[i].size, sessions[i].slot, (unsigned) done, (unsigned) chunks);
+    }
+}
+
+int openUploadSession(const String &slot, uint32_t size, uint32_t crc, DitherMode dither, bool select,
+                      String &id, String &message) {
+    if (!isValidSlotName(slot)) {
+        message = "Invalid slot name";
+        return 400;
+    }
+    if (size == 0 || chunkCount(size) > UPLOAD_SESSION_MAX_CHUNKS) {
+        message = "Size must be 1 to " + String((uint32_t) UPLOAD_SESSION_MAX_CHUNKS * UPLOAD_SESSION_CHUNK_SIZE) + " bytes";
+        return size == 0 ? 400 : 413;
+    }
+
+    char key[64];
+    snprintf(key, sizeof(key), "%s/%u/%08x/%s", slot.c_str(), (unsigned) size, (unsigned) crc, ditherModeName(dither));
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08x", (unsigned) esp_rom_crc32_le(0, (const uint8_t *) key, strlen(key)));
+    id = hex;
+
+    int i = findSession(id);
+    if (i >= 0) {
+        sessions[i].touched = ++useCounter;
+        sessions[i].select = select;
+        saveSession(sessions[i]);
+        LOG_I("[UPLOAD] Resuming session %s", hex);
+        return 200;
+    }
+
+    if (sessionCount == UPLOAD_SESSION_MAX) {
+        int oldest = 0;
+        for (uint8_t j = 1; j < sessionCount; j++) {
+            if (sessions[j].touched < sessions[oldest].touched) oldest = j;
+        }
+        LOG_I("[UPLOAD] Dropping session %s for %s", sessions[oldest].id, hex);
+        removeSession(oldest);
+    }
+
+    // As for a single upload, the space is made free before the first byte is written
+    if (!reserveImageSpace(size + 8192, slot)) {
+        message = "Not enough space for the upload";
+        return 507;
+    }
+
+    UploadSession &session = sessions[sessionCount];
+    memset(&session, 0, sizeof(session));
+    strlcpy(session.id, hex, sizeof(session.id));
+    strlcpy(session.slot, slot.c_str(), sizeof(session.slot));
+    session.size = size;
+    session.crc = crc;
+    session.dither = dither;
+    session.select = select;
+    session.touched = ++useCounter;
+
+    File f = LittleFS.open(dataPath(session), "w");
+    bool ok = (bool) f;
+    if (f) f.close();
+    if (!ok || !saveSession(session)) {
+        LittleFS.remove(dataPath(session));
+        message = "Failed to create session";
+        return 500;
+    }
+    sessionCount++;
+    LOG_I("[UPLOAD] Session %s: %u bytes into slot %s", hex, (unsigned) size, slot.c_str());
+    return 201;
+}
+
+const UploadSession *findUploadSession(const String &id) {
+    int i = findSession(id);
+    return i >= 0 ? &sessions[i] : nullptr;
+}
+
+int writeUploadChunk(const String &id, uint32_t offset, const uint8_t *data, size_t len, uint32_t chunkCrc,
+                     String &message) {
+    int i = findSession(id);
+    if (i < 0) {
+        message = "No such session";
+        return 404;
+    }
+    UploadSession &session = sessions[i];
+    uint16_t chunk = offset / UPLOAD_SESSION_CHUNK_SIZE;
+    size_t expected = min<uint32_t>(UPLOAD_SESSION_CHUNK_SIZE, session.size - min(offset, session.size));
+    if (offset % UPLOAD_SESSION_CHUNK_SIZE || offset >= session.size || len != expected) {
+        message = "Chunks are " + String(UPLOAD_SESSION_CHUNK_SIZE) + " bytes at multiples of that, shorter only at the end";
+        return 416;
+    }
+
+    TraceScope trace(SPAN_UPLOAD_CHUNK, len);
+    uint32_t crc = esp_rom_crc32_le(0, data, len);
+    if (crc != chunkCrc) {
+        LOG_W("[UPLOAD] Chunk at %u of session %s has CRC %08x, expected %08x", (unsigned) offset,
+              session.id, (unsigned) crc, (unsigned) chunkCrc);
+        message = "Chunk CRC mismatch";
+        return 422;
+    }
+
+    // Seeking past the end lets chunks arrive in any order; the gap reads as zeros until filled
+    File f = LittleFS.open(dataPath(session), "r+");
+    bool ok = f && f.seek(offset, SeekSet) && f.write(data, len) == len;
+    if (f) f.close();
+    if (!ok) {
+        LOG_E("[UPLOAD] Error: Cannot write chunk at %u of session %s", (unsigned) offset, session.id);
+        message = "Failed to write chunk";
+        return 507;
+    }
+
+    // Only marked once the chunk is on flash: after a reset it is either there or re-sent
+    session.committed[chunk >> 3] |= 1 << (chunk & 7);
+    session.touched = ++useCounter;
+    if (!saveSession(session)) {
+        message = "Failed to save session";
+        return 500;
+    }
+    LOG_D("[UPLOAD] Session %s: chunk %u committed", session.id, (unsigned) chunk);
+    return 200;
+}
+
+// Reads the data back once: the chunks came in any order, so there is no running CRC to trust
+static bool verifyUpload(const UploadSession &session, uint8_t *head, size_t &headLen) {
+    File f = LittleFS.open(dataPath(session), "r");
+    if (!f || f.size() != session.size) {
+        if (f) f.close();
+        return false;
+    }
+    uint8_t *buffer = (uint8_t *) malloc(UPLOAD_WRITE_BLOCK_SIZE);
+    if (!buffer) {
+        f.close();
+        return false;
+    }
+
+    uint32_t crc = 0;
+    size_t total = 0;
+    headLen = 0;
+    while (total < session.size) {
+        size_t n = f.read(buffer, UPLOAD_WRITE_BLOCK_SIZE);
+        if (n == 0) break;
+        if (headLen < IMAGE_DETECT_HEAD_SIZE) {
+            size_t copy = min(n, (size_t) IMAGE_DETECT_HEAD_SIZE - headLen);
+            memcpy(head + headLen, buffer, copy);
+            headLen += copy;
+        }
+        crc = esp_rom_crc32_le(crc, buffer, n);
+        total += n;
+        esp_task_wdt_reset();
+    }
+    free(buffer);
+    f.close();
+    if (crc != session.crc) {
+        LOG_E("[UPLOAD] Session %s has CRC %08x, expected %08x", session.id, (unsigned) crc, (unsigned) session.crc);
+    }
+    return total == session.size && crc == session.crc;
+}
+
+int finalizeUploadSession(const String &id, String &etag, uint32_t &job, String &message) {
+    job = 0;
+    int i = findSession(id);
+    if (i < 0) {
+        message = "No such session";
+        return 404;
+    }
+    UploadSession &session = sessions[i];
+    if (!uploadComplete(session)) {
+        message = "Upload incomplete";
+        return 409;
+    }
+
+    uint8_t head[IMAGE_DETECT_HEAD_SIZE];
+    size_t headLen = 0;
+    if (!verifyUpload(session, head, headLen)) {
+        // Nothing to resume from: the committed chunks do not add up to the upload
+        removeSession(i);
+        message = "Upload does not match its CRC";
+        return 422;
+    }
+
+    ImageFormat format = detectImageFormat(head, headLen, session.size, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    if (format == IMAGE_FORMAT_UNKNOWN) {
+        removeSession(i);
+        message = "Unsupported image format";
+        return 415;
+    }
+    uint16_t width = DISPLAY_WIDTH;
+    uint16_t height = DISPLAY_HEIGHT;
+    BmpInfo bmp;
+    if (format == IMAGE_FORMAT_BMP && parseBmpHeader(head, headLen, session.size, bmp)) {
+        width = bmp.width;
+        height = bmp.height;
+    }
+
+    // storeImage renames the data file into the store, so the slot changes in one step
+    etag = makeImageEtag(session.crc, false, session.dither);
+    String slot = session.slot;
+    bool select = session.select;
+    DitherMode dither = session.dither;
+    bool stored = storeImage(slot, dataPath(session).c_str(), session.crc, session.size, format, width, height,
+                             etag, select);
+    removeSession(i);
+    if (!stored) {
+        message = "Failed to store image";
+        return 500;
+    }
+    LOG_I("[UPLOAD] Session %s stored in slot %s (%s)", id.c_str(), slot.c_str(), imageFormatName(format));
+
+    if (select) {
+        renderDitherMode = dither;
+        job = requestRender(JOB_SOURCE_UPLOAD, dither, false);
+    }
+    return 200;
+}
+
+bool abortUploadSession(const String &id) {
+    int i = findSession(id);
+    if (i < 0) return false;
+    LOG_I("[UPLOAD] Session %s aborted", sessions[i].id);
+    removeSession(i);
+    return true;
+}
+
+size_t uploadSessionRanges(const UploadSession &session, bool committed, uint32_t ranges[][2], size_t max) {
+    size_t count = 0;
+    uint16_t chunks = chunkCount(session.size);
+    for (uint16_t chunk = 0; chunk < chunks && count < max; chunk++) {
+        if (chunkCommitted(session, chunk) != committed) continue;
+        uint32_t start = (uint32_t) chunk * UPLOAD_SESSION_CHUNK_SIZE;
+        uint32_t end = min<uint32_t>(start + UPLOAD_SESSION_CHUNK_SIZE, session.size);
+        if (count && ranges[count - 1][1] == start) {
+            ranges[count - 1][1] = end;
+        } else {
+            ranges[count][0] = start;
+            ranges[count][1] = end;
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t uploadSessionCount() {
+    return sessionCount;
+}
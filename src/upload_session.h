@@ -0,0 +1,86 @@
+#ifndef UPLOAD_SESSION_H
+#define UPLOAD_SESSION_H
+
+#include <Arduino.h>
+#include "dither.h"
+#include "image_store.h"
+
+// Sessions live outside IMAGE_STORE_DIR, whose strays are removed at boot
+#define UPLOAD_SESSION_DIR "/uploads"
+
+// Chunks are written at multiples of this; two LittleFS blocks
+#ifndef UPLOAD_SESSION_CHUNK_SIZE
+#define UPLOAD_SESSION_CHUNK_SIZE 8192
+#endif
+
+// Largest upload is UPLOAD_SESSION_MAX_CHUNKS * UPLOAD_SESSION_CHUNK_SIZE (1 MB)
+#ifndef UPLOAD_SESSION_MAX_CHUNKS
+#define UPLOAD_SESSION_MAX_CHUNKS 128
+#endif
+
+// Open sessions; opening one more drops the least recently used
+#ifndef UPLOAD_SESSION_MAX
+#define UPLOAD_SESSION_MAX 2
+#endif
+
+struct UploadSession {
+    char id[9];           // hex, derived from slot, size and hash, so reopening finds it again
+    char slot[IMAGE_SLOT_NAME_SIZE];
+    uint32_t size;
+    uint32_t crc;         // CRC-32 of the whole upload, checked when it is finalized
+    DitherMode dither;
+    bool select;
+    uint32_t touched;     // use counter, for dropping the least recently used session
+    uint8_t committed[UPLOAD_SESSION_MAX_CHUNKS / 8];  // bit per chunk on flash
+};
+
+/**
+ * Loads the sessions left on LittleFS by an earlier boot, after the image
+ * store is initialized. Data files without metadata are removed.
+ */
+void initUploadSessions();
+
+/**
+ * Opens a session for an upload of `size` bytes with CRC-32 `crc` into
+ * `slot`, or returns the one already open for the same upload, with the
+ * chunks it already has. Space for the image is made free up front. Returns
+ * an HTTP status: 201 (new), 200 (resumed), or an error with `message` set.
+ *
+ * Sessions are only touched from the AsyncTCP task, so there is no lock.
+ */
+int openUploadSession(const String &slot, uint32_t size, uint32_t crc, DitherMode dither, bool select,
+                      String &id, String &message);
+
+// nullptr if there is no such session
+const UploadSession *findUploadSession(const String &id);
+
+/**
+ * Writes the chunk at `offset`, which must be a multiple of
+ * UPLOAD_SESSION_CHUNK_SIZE, and marks it committed once it is on flash.
+ * The chunk is a full chunk except at the end of the upload, and is
+ * rejected unless its CRC-32 is `chunkCrc`. Writing a committed chunk
+ * again replaces it. Returns an HTTP status, with `message` set on errors.
+ */
+int writeUploadChunk(const String &id, uint32_t offset, const uint8_t *data, size_t len, uint32_t chunkCrc,
+                     String &message);
+
+/**
+ * Checks that every chunk is committed and the file has the session's CRC,
+ * then moves it into the slot in one rename, as a single upload would, and
+ * queues a render when the session selects the slot. Returns an HTTP
+ * status; `etag` is the image's ETag and `job` the render job, 0 if none.
+ */
+int finalizeUploadSession(const String &id, String &etag, uint32_t &job, String &message);
+
+// Removes a session and its data; false if there is no such session
+bool abortUploadSession(const String &id);
+
+/**
+ * Byte ranges [start, end) that are committed, or with `committed` false
+ * still missing. Returns the number of ranges, up to `max`.
+ */
+size_t uploadSessionRanges(const UploadSession &session, bool committed, uint32_t ranges[][2], size_t max);
+
+size_t uploadSessionCount();
+
+#endif
@@ -10,6 +10,18 @@
 
 #include "filesystem.h"
 #include "config.h"
+#include "benchmark.h"
+#include "stream_render.h"
+#include "render_arena.h"
+#include "render_scheduler.h"
+#include "trace.h"
+#include "image_store.h"
+#include "boot.h"
+#include "esp_rom_crc.h"
+#include "layout.h"
+#include "upload_session.h"
+#include "static_files.h"
+#include "events.h"
 
 AsyncWebServer webServer(80);
 
@@ -27,31 +39,194 @@ String getFullMemoryUsage() {
     return usage;
 }
 
+static void appendMetric(String &out, const char *name, const char *type, const char *help, double value) {
+    out += String("# HELP ") + name + " " + help + "\n";
+    out += String("# TYPE ") + name + " " + type + "\n";
+    out += String(name) + " " + String(value, 0) + "\n";
+}
+
+// Prometheus text exposition of the span histograms, render jobs and memory
+static String getPrometheusMetrics() {
+    String out;
+    out.reserve(12 * 1024);
+    appendTraceMetrics(out);
+
+    out += "# HELP epd_render_jobs_total Render jobs finished, by final state\n";
+    out += "# TYPE epd_render_jobs_total counter\n";
+    for (int state = JOB_DONE; state <= JOB_FAILED; state++) {
+        out += String("epd_render_jobs_total{state=\"") + renderJobStateName((RenderJobState) state) + "\"} " +
+               String(renderJobsFinished((RenderJobState) state)) + "\n";
+    }
+
+    appendMetric(out, "epd_panel_frames_total", "counter", "Panel frames written, refreshed or not", panelFrameCount);
+    appendMetric(out, "epd_heap_free_bytes", "gauge", "Free heap", ESP.getFreeHeap());
+    appendMetric(out, "epd_heap_min_free_bytes", "gauge", "Lowest free heap since boot", ESP.getMinFreeHeap());
+    appendMetric(out, "epd_heap_max_alloc_bytes", "gauge", "Largest allocatable heap block", ESP.getMaxAllocHeap());
+    appendMetric(out, "epd_render_arena_high_water_bytes", "gauge", "Peak render arena use", renderArena.highWaterMark());
+    appendMetric(out, "epd_render_arena_failures_total", "counter", "Failed render arena allocations",
+                 renderArena.allocationFailures());
+    appendMetric(out, "epd_log_messages_total", "counter", "Log messages written to Serial", debug.writtenMessages());
+    appendMetric(out, "epd_log_dropped_total", "counter", "Log messages dropped on a full queue", debug.droppedMessages());
+    appendMetric(out, "epd_uptime_seconds", "gauge", "Time since boot", millis() / 1000);
+    return out;
+}
+
 void notFoundResponse(AsyncWebServerRequest *request) {
-    debug.println("[WEBSERVER] Error 404: Resource not found at " + String(request->url().c_str()));
+    LOG_I("[WEBSERVER] Error 404: Resource not found at %s", request->url().c_str());
     request->send(404, "text/plain", "Not found");
 }
 
+// Collects the scene body in request->_tempObject, which the request frees
+static void handleLayoutBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (total > LAYOUT_MAX_BODY) return;
+    if (index == 0) {
+        free(request->_tempObject);
+        request->_tempObject = malloc(total);
+    }
+    if (request->_tempObject && index + len <= total) {
+        memcpy((uint8_t *) request->_tempObject + index, data, len);
+    }
+}
+
+static void handleLayoutRequest(AsyncWebServerRequest *request) {
+    LOG_D("[WEBSERVER] Received POST request on '/api/layout'");
+    size_t len = request->contentLength();
+    if (len > LAYOUT_MAX_BODY) {
+        request->send(413, "text/plain", "Layout larger than " + String(LAYOUT_MAX_BODY) + " bytes");
+        return;
+    }
+    const uint8_t *body = (const uint8_t *) request->_tempObject;
+    if (!body || len == 0) {
+        request->send(400, "text/plain", "Missing layout body");
+        return;
+    }
+
+    // The same scene is the same frame, so If-None-Match works as for stored images
+    String etag = layoutEtag(body, len);
+    if (!request->hasParam("force") && request->hasHeader("If-None-Match") &&
+        etag == displayedImageEtag() && etagMatches(request->header("If-None-Match"), etag)) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", etag);
+        request->send(response);
+        return;
+    }
+
+    String error = setPendingLayout(body, len);
+    if (error.length()) {
+        request->send(400, "text/plain", error);
+        return;
+    }
+    uint32_t job = requestRender(JOB_SOURCE_LAYOUT, DITHER_NONE, request->hasParam("force"));
+
+    JsonDocument doc;
+    doc["job"] = job;
+    doc["etag"] = etag;
+    String response;
+    serializeJson(doc, response);
+    AsyncWebServerResponse *reply = request->beginResponse(202, "application/json", response);
+    reply->addHeader("ETag", etag);
+    reply->addHeader("X-Render-Job", String(job));
+    request->send(reply);
+}
+
+static void sendUploadSession(AsyncWebServerRequest *request, int status, const UploadSession &session) {
+    static uint32_t ranges[UPLOAD_SESSION_MAX_CHUNKS][2];
+    char crc[9];
+    snprintf(crc, sizeof(crc), "%08x", (unsigned) session.crc);
+
+    JsonDocument doc;
+    doc["id"] = session.id;
+    doc["slot"] = session.slot;
+    doc["size"] = session.size;
+    doc["crc"] = crc;
+    doc["chunkSize"] = UPLOAD_SESSION_CHUNK_SIZE;
+    for (int committed = 1; committed >= 0; committed--) {
+        size_t count = uploadSessionRanges(session, committed, ranges, UPLOAD_SESSION_MAX_CHUNKS);
+        JsonArray list = doc[committed ? "committed" : "missing"].to<JsonArray>();
+        for (size_t i = 0; i < count; i++) {
+            JsonArray range = list.add<JsonArray>();
+            range.add(ranges[i][0]);
+            range.add(ranges[i][1]);
+        }
+        if (!committed) doc["complete"] = count == 0;
+    }
+
+    String response;
+    serializeJson(doc, response);
+    request->send(status, "application/json", response);
+}
+
+static String sessionId(AsyncWebServerRequest *request) {
+    return request->hasParam("id") ? request->getParam("id")->value() : String();
+}
+
+// A chunk is collected in request->_tempObject like a layout, then written in one go
+static void handleUploadChunkBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (total > UPLOAD_SESSION_CHUNK_SIZE) return;
+    if (index == 0) {
+        free(request->_tempObject);
+        request->_tempObject = malloc(total);
+    }
+    if (request->_tempObject && index + len <= total) {
+        memcpy((uint8_t *) request->_tempObject + index, data, len);
+    }
+}
+
+static void handleUploadChunk(AsyncWebServerRequest *request) {
+    LOG_D("[WEBSERVER] Received PUT request on '/api/upload/chunk'");
+    size_t len = request->contentLength();
+    if (len > UPLOAD_SESSION_CHUNK_SIZE) {
+        request->send(413, "text/plain", "Chunks are at most " + String(UPLOAD_SESSION_CHUNK_SIZE) + " bytes");
+        return;
+    }
+    if (!request->hasParam("offset") || !request->hasHeader("X-Chunk-CRC32")) {
+        request->send(400, "text/plain", "Missing offset or X-Chunk-CRC32");
+        return;
+    }
+    if (!request->_tempObject || len == 0) {
+        request->send(400, "text/plain", "Missing chunk body");
+        return;
+    }
+
+    String id = sessionId(request);
+    uint32_t offset = strtoul(request->getParam("offset")->value().c_str(), nullptr, 10);
+    uint32_t crc = strtoul(request->header("X-Chunk-CRC32").c_str(), nullptr, 16);
+    String message;
+    int status = writeUploadChunk(id, offset, (const uint8_t *) request->_tempObject, len, crc, message);
+    const UploadSession *session = findUploadSession(id);
+    if (status != 200 || !session) {
+        request->send(status, "text/plain", message);
+        return;
+    }
+    sendUploadSession(request, status, *session);
+}
+
 void startWebserver() {
     debug.println("[WEBSERVER] Initializing web server");
 
+    // Handler time of every request, for /api/metrics. Upload bodies are traced per chunk instead
+    webServer.addMiddleware([](AsyncWebServerRequest *request, ArMiddlewareNext next) {
+        TraceScope trace(SPAN_HTTP_REQUEST);
+        next();
+    });
+
     webServer.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-        debug.println("[WEBSERVER] Processing root path request");
+        LOG_D("[WEBSERVER] Processing root path request");
         request->send(200, "text/plain", "Hello, world");
     });
 
     webServer.on("/api/system/memory", HTTP_GET, [](AsyncWebServerRequest *request) {
-        debug.println("[WEBSERVER] Received GET request on '/api/system/memory'");
+        LOG_D("[WEBSERVER] Received GET request on '/api/system/memory'");
         request->send(200, "text/plain", getFullMemoryUsage());
     });
 
     webServer.on("/api/system/list", HTTP_GET, [](AsyncWebServerRequest *request) {
-        debug.println("[WEBSERVER] Received GET request on '/api/system/list'");
+        LOG_D("[WEBSERVER] Received GET request on '/api/system/list'");
         request->send(200, "text/plain", listFiles());
     });
 
     webServer.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request) {
-        Serial.println("[WEBSERVER] Received GET request on '/api/status'");
+        LOG_D("[WEBSERVER] Received GET request on '/api/status'");
 
         // Create JSON response
         JsonDocument doc;
@@ -60,11 +235,81 @@ void startWebserver() {
         doc["system"]["freeHeap"] = ESP.getFreeHeap();
         doc["system"]["uptime"] = millis();
 
+        // Add boot stage timings, in millis() since reset
+        doc["boot"]["fast"] = FAST_BOOT != 0;
+        doc["boot"]["resetReason"] = resetReasonName();
+        doc["boot"]["readyMs"] = bootCompletedAt();
+        doc["boot"]["wifiCachedAp"] = wifiUsedCachedAp();
+        for (uint8_t i = 0; i < BOOT_STAGE_COUNT; i++) {
+            const BootStageTiming &stage = bootStageTiming((BootStage) i);
+            if (!stage.done) continue;
+            JsonObject entry = doc["boot"]["stages"][bootStageName((BootStage) i)].to<JsonObject>();
+            entry["startMs"] = stage.startMs;
+            entry["ms"] = stage.ms;
+        }
+
         // Add WiFi information
         doc["wifi"]["ssid"] = WiFi.SSID();
         doc["wifi"]["rssi"] = WiFi.RSSI();
         doc["wifi"]["ip"] = WiFi.localIP().toString();
 
+        // Add render information
+        doc["render"]["stream"] = streamRenderStateName(streamRenderState);
+        doc["render"]["bandsWritten"] = lastPanelFrame.bandsWritten;
+        doc["render"]["bandsSkipped"] = lastPanelFrame.bandsSkipped;
+        doc["render"]["refreshed"] = lastPanelFrame.refreshed;
+        PanelSpiStats spi = panelSpiStats();
+        doc["render"]["spi"]["hz"] = panelSpiClock();
+        doc["render"]["spi"]["bands"] = spi.bands;
+        doc["render"]["spi"]["bytes"] = spi.bytes;
+        doc["render"]["spi"]["bandUs"] = spi.bands ? spi.spiMicros / spi.bands : 0;
+        doc["render"]["spi"]["maxBandUs"] = spi.maxBandMicros;
+        doc["render"]["spi"]["waitUs"] = spi.waitMicros;
+        doc["render"]["arena"]["size"] = renderArena.size();
+        doc["render"]["arena"]["used"] = renderArena.bytesUsed();
+        doc["render"]["arena"]["highWater"] = renderArena.highWaterMark();
+        doc["render"]["arena"]["failures"] = renderArena.allocationFailures();
+        LayoutStats layout = lastLayoutStats();
+        doc["render"]["layout"]["elements"] = layout.elements;
+        doc["render"]["layout"]["bodyBytes"] = layout.bodyBytes;
+        doc["render"]["layout"]["parseUs"] = layout.parseMicros;
+        doc["render"]["layout"]["prepareUs"] = layout.prepareMicros;
+        doc["render"]["layout"]["rasterUs"] = layout.rasterMicros;
+        doc["render"]["layout"]["bands"] = layout.bands;
+
+        // Add the last upload's transfer, compressed or not
+        doc["upload"]["encoding"] = contentEncodingName(lastUploadTransfer.encoding);
+        doc["upload"]["receivedBytes"] = lastUploadTransfer.receivedBytes;
+        doc["upload"]["inflatedBytes"] = lastUploadTransfer.inflatedBytes;
+        doc["upload"]["inflateUs"] = lastUploadTransfer.inflateMicros;
+        doc["upload"]["ms"] = lastUploadTransfer.durationMs;
+
+        // Add static file counters
+        StaticFileStats files = staticFileStats();
+        doc["fs"]["requests"] = files.requests;
+        doc["fs"]["notModified"] = files.notModified;
+        doc["fs"]["partial"] = files.partial;
+        doc["fs"]["gzip"] = files.gzip;
+        doc["fs"]["hashReads"] = files.hashReads;
+        doc["fs"]["bytesSent"] = files.bytesSent;
+
+        EventStats events = eventStats();
+        doc["events"]["clients"] = events.clients;
+        doc["events"]["posted"] = events.posted;
+        doc["events"]["dropped"] = events.dropped;
+        doc["events"]["sent"] = events.sent;
+        doc["events"]["clientsDropped"] = events.clientsDropped;
+
+        // Add log queue counters
+        doc["log"]["written"] = debug.writtenMessages();
+        doc["log"]["queued"] = debug.queuedMessages();
+        doc["log"]["dropped"] = debug.droppedMessages();
+
+        // Add image ETags
+        doc["image"]["slot"] = selectedImageSlot();
+        doc["image"]["etag"] = selectedImageEtag();
+        doc["image"]["displayedEtag"] = displayedImageEtag();
+
         // Add power source
         doc["power"]["source"] = "USB";
 
@@ -78,27 +323,385 @@ void startWebserver() {
     });
 
     webServer.on("/api/image/draw", HTTP_GET, [](AsyncWebServerRequest *request) {
-        debug.println("[WEBSERVER] Received GET request on '/api/image/draw'");
-        request->send(200, "text/plain", "Drawing saved image");
-        isImageRefreshPending = true;
+        LOG_D("[WEBSERVER] Received GET request on '/api/image/draw'");
+        // If-Match: only draw the image the client expects to be stored
+        if (request->hasHeader("If-Match") && !etagMatches(request->header("If-Match"), selectedImageEtag())) {
+            request->send(412, "text/plain", "Stored image does not match If-Match");
+            return;
+        }
+        // If-None-Match: nothing to do if the panel already shows that image
+        String displayedEtag = displayedImageEtag();
+        if (!request->hasParam("force") && request->hasHeader("If-None-Match") &&
+            etagMatches(request->header("If-None-Match"), displayedEtag)) {
+            AsyncWebServerResponse *response = request->beginResponse(304);
+            response->addHeader("ETag", displayedEtag);
+            request->send(response);
+            return;
+        }
+        renderDitherMode = requestDitherMode(request, renderDitherMode);
+        // ?force: rewrite and refresh every band even if the panel already shows the image
+        uint32_t job = requestRender(JOB_SOURCE_DRAW, renderDitherMode, request->hasParam("force"));
+        AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", "Drawing saved image, job " + String(job));
+        response->addHeader("X-Render-Job", String(job));
+        request->send(response);
+    });
+
+    webServer.on("/api/image/select", HTTP_GET, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received GET request on '/api/image/select'");
+        String slot = request->hasParam("slot") ? request->getParam("slot")->value() : String();
+        if (!isValidSlotName(slot)) {
+            request->send(400, "text/plain", "Missing or invalid slot");
+            return;
+        }
+        if (!selectImageSlot(slot)) {
+            request->send(404, "text/plain", "No such slot");
+            return;
+        }
+        renderDitherMode = requestDitherMode(request, renderDitherMode);
+        uint32_t job = requestRender(JOB_SOURCE_SELECT, renderDitherMode, request->hasParam("force"));
+        AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", "Drawing slot " + slot + ", job " + String(job));
+        String etag = imageSlotEtag(slot);
+        if (etag.length()) response->addHeader("ETag", etag);
+        response->addHeader("X-Render-Job", String(job));
+        request->send(response);
+    });
+
+    webServer.on("/api/image/slots", HTTP_DELETE, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received DELETE request on '/api/image/slots'");
+        String slot = request->hasParam("slot") ? request->getParam("slot")->value() : String();
+        if (slot.length() && slot == selectedImageSlot()) {
+            request->send(409, "text/plain", "Cannot delete the selected slot");
+        } else if (!isValidSlotName(slot) || !deleteImageSlot(slot)) {
+            request->send(404, "text/plain", "No such slot");
+        } else {
+            request->send(200, "text/plain", "Deleted slot " + slot);
+        }
+    });
+
+    webServer.on("/api/image/slots", HTTP_GET, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received GET request on '/api/image/slots'");
+        static ImageSlot slots[IMAGE_STORE_MAX_SLOTS];
+        size_t count = getImageSlots(slots, IMAGE_STORE_MAX_SLOTS);
+
+        JsonDocument doc;
+        doc["selected"] = selectedImageSlot();
+        doc["freeBytes"] = LittleFS.totalBytes() - LittleFS.usedBytes();
+        JsonArray list = doc["slots"].to<JsonArray>();
+        for (size_t i = 0; i < count; i++) {
+            char hash[9];
+            snprintf(hash, sizeof(hash), "%08x", (unsigned) slots[i].hash);
+            JsonObject entry = list.add<JsonObject>();
+            entry["name"] = slots[i].name;
+            entry["hash"] = hash;
+            entry["format"] = imageFormatName(slots[i].format);
+            entry["width"] = slots[i].width;
+            entry["height"] = slots[i].height;
+            entry["size"] = slots[i].size;
+            entry["lastShown"] = slots[i].lastShown;
+            entry["etag"] = slots[i].etag;
+        }
+
+        String response;
+        serializeJson(doc, response);
+        request->send(200, "application/json", response);
+    });
+
+    webServer.on("/api/render/jobs", HTTP_GET, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received GET request on '/api/render/jobs'");
+        RenderJob jobs[8];
+        uint8_t count = getRenderJobs(jobs, 8);
+        uint32_t now = millis();
+
+        JsonDocument doc;
+        JsonArray list = doc["jobs"].to<JsonArray>();
+        for (uint8_t i = 0; i < count; i++) {
+            const RenderJob &job = jobs[i];
+            JsonObject entry = list.add<JsonObject>();
+            entry["id"] = job.id;
+            entry["state"] = renderJobStateName(job.state);
+            entry["source"] = renderJobSourceName(job.source);
+            entry["dither"] = ditherModeName(job.dither);
+            entry["force"] = job.force;
+            entry["merged"] = job.merged;
+
+            // Durations in ms; a phase still in progress counts up to now
+            uint32_t started = job.startedAt ? job.startedAt : now;
+            entry["waitMs"] = started - job.queuedAt;
+            if (job.startedAt) {
+                uint32_t renderEnd = job.refreshAt ? job.refreshAt : (job.finishedAt ? job.finishedAt : now);
+                entry["renderMs"] = renderEnd - job.startedAt;
+            }
+            if (job.refreshAt) {
+                entry["refreshMs"] = (job.finishedAt ? job.finishedAt : now) - job.refreshAt;
+            }
+            if (job.finishedAt) {
+                entry["totalMs"] = job.finishedAt - job.queuedAt;
+                for (int s = 0; s < STAGE_COUNT; s++) {
+                    if (job.timing.stages[s].micros == 0) continue;
+                    entry["stages"][stageName((RenderStage) s)] = job.timing.stages[s].micros / 1000.0f;
+                }
+                entry["bandsWritten"] = job.bandsWritten;
+                entry["bandsSkipped"] = job.bandsSkipped;
+                entry["refreshed"] = job.refreshed;
+            }
+        }
+
+        String response;
+        serializeJson(doc, response);
+        request->send(200, "application/json", response);
+    });
+
+    webServer.on("/api/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        request->send(200, "text/plain; version=0.0.4", getPrometheusMetrics());
+    });
+
+    webServer.on("/api/trace", HTTP_GET, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received GET request on '/api/trace'");
+        static TraceEvent events[TRACE_RING_SIZE];
+        size_t count = getTraceEvents(events, TRACE_RING_SIZE);
+
+        JsonDocument doc;
+        doc["cpuMhz"] = getCpuFrequencyMhz();
+        JsonArray list = doc["spans"].to<JsonArray>();
+        for (size_t i = 0; i < count; i++) {
+            JsonObject entry = list.add<JsonObject>();
+            entry["span"] = traceSpanName((TraceSpan) events[i].span);
+            entry["core"] = events[i].core;
+            entry["start"] = events[i].startCycles;
+            entry["us"] = events[i].micros;
+            if (events[i].bytes) entry["bytes"] = events[i].bytes;
+        }
+
+        String response;
+        serializeJson(doc, response);
+        request->send(200, "application/json", response);
+    });
+
+#if PANEL_MOCK
+    // One plane of controller RAM as a PBM image (1 = ink).
+    // Registered before /api/panel, which would also match this path
+    webServer.on("/api/panel/capture", HTTP_GET, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received GET request on '/api/panel/capture'");
+        bool colorPlane = request->hasParam("plane") && request->getParam("plane")->value() == "color";
+        const uint8_t *plane = colorPlane ? display.epd2.colorPlane() : display.epd2.monoPlane();
+        if (!plane) {
+            request->send(503, "text/plain", "Panel RAM not allocated");
+            return;
+        }
+
+        static const String header = "P4\n" + String(MockPanel::WIDTH) + " " + String(MockPanel::HEIGHT) + "\n";
+        size_t length = header.length() + MockPanel::PLANE_SIZE;
+        AsyncWebServerResponse *response = request->beginResponse("image/x-portable-bitmap", length,
+            [plane](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+                size_t n = 0;
+                for (; n < maxLen && index + n < header.length(); n++) {
+                    buffer[n] = header[index + n];
+                }
+                size_t offset = index + n - header.length();
+                for (; n < maxLen && offset < MockPanel::PLANE_SIZE; n++, offset++) {
+                    buffer[n] = ~plane[offset];
+                }
+                return n;
+            });
+        request->send(response);
+    });
+
+    webServer.on("/api/panel", HTTP_GET, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received GET request on '/api/panel'");
+        MockPanel &panel = display.epd2;
+        static MockPanelCall calls[MOCK_PANEL_LOG_SIZE];
+        size_t count = panel.lastCalls(calls, MOCK_PANEL_LOG_SIZE);
+
+        JsonDocument doc;
+        doc["mock"] = true;
+        // CRC-32 of controller RAM, to compare a render against a known good one
+        if (panel.monoPlane() && panel.colorPlane()) {
+            doc["planes"]["mono"] = String(esp_rom_crc32_le(0, panel.monoPlane(), MockPanel::PLANE_SIZE), HEX);
+            doc["planes"]["color"] = String(esp_rom_crc32_le(0, panel.colorPlane(), MockPanel::PLANE_SIZE), HEX);
+        }
+        for (uint8_t op = 0; op < MOCK_OP_COUNT; op++) {
+            JsonObject entry = doc["ops"][mockPanelOpName((MockPanelOp) op)].to<JsonObject>();
+            entry["calls"] = panel.calls((MockPanelOp) op);
+            entry["bytes"] = panel.bytes((MockPanelOp) op);
+        }
+        JsonArray list = doc["calls"].to<JsonArray>();
+        for (size_t i = 0; i < count; i++) {
+            JsonObject entry = list.add<JsonObject>();
+            entry["op"] = mockPanelOpName((MockPanelOp) calls[i].op);
+            entry["x"] = calls[i].x;
+            entry["y"] = calls[i].y;
+            entry["w"] = calls[i].w;
+            entry["h"] = calls[i].h;
+            if (calls[i].bytes) entry["bytes"] = calls[i].bytes;
+        }
+        if (request->hasParam("reset")) panel.resetCounters();
+
+        String response;
+        serializeJson(doc, response);
+        request->send(200, "application/json", response);
+    });
+#endif
+
+    // Registered before /api/bench, which would also match this path
+    webServer.on("/api/bench/result", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint32_t id;
+        String report;
+        bool passed = false;
+        BenchmarkState state = benchmarkResult(id, report, passed);
+        if (state == BENCH_NONE ||
+            (request->hasParam("id") && (uint32_t) request->getParam("id")->value().toInt() != id)) {
+            request->send(404, "text/plain", "No such benchmark");
+            return;
+        }
+        if (state == BENCH_RUNNING) {
+            request->send(202, "application/json", "{\"id\":" + String(id) + ",\"state\":\"running\"}");
+            return;
+        }
+        request->send(passed ? 200 : 500, "application/json", report);
+    });
+
+    webServer.on("/api/bench", HTTP_GET, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received GET request on '/api/bench'");
+        BenchmarkRequest bench = {};
+        String file = request->hasParam("file") ? request->getParam("file")->value() : selectedImagePath();
+        strlcpy(bench.file, file.c_str(), sizeof(bench.file));
+        long iterations = request->hasParam("iterations") ? request->getParam("iterations")->value().toInt() : 3;
+        bench.iterations = constrain(iterations, 1, 10);
+        bench.save = request->hasParam("save");
+        bench.dither = requestDitherMode(request, DITHER_NONE);
+
+        if (request->hasParam("bmp")) {
+            // Batched BMP decoder against the original one, on a test image of every depth
+            bench.kind = BENCH_BMP;
+        } else if (request->hasParam("spi")) {
+            // Bulk panel writes at each SPI clock
+            bench.kind = BENCH_SPI;
+        } else if (request->hasParam("upload")) {
+            // Block-aligned upload writes against one write per chunk
+            long bytes = request->hasParam("bytes") ? request->getParam("bytes")->value().toInt() : 256 * 1024;
+            bench.kind = BENCH_UPLOAD;
+            bench.bytes = constrain(bytes, 4096, 1024 * 1024);
+        } else {
+            bench.kind = BENCH_IMAGE;
+        }
+
+        // Benchmarks take seconds and may wait for the display, so they run in their own task
+        uint32_t id = startBenchmark(bench);
+        if (!id) {
+            request->send(409, "text/plain", "A benchmark is already running");
+            return;
+        }
+        String location = "/api/bench/result?id=" + String(id);
+        AsyncWebServerResponse *response = request->beginResponse(
+            202, "application/json", "{\"id\":" + String(id) + ",\"result\":\"" + location + "\"}");
+        response->addHeader("Location", location);
+        request->send(response);
     });
 
     webServer.on(
         "/api/image/upload",
         HTTP_POST,
         [](AsyncWebServerRequest *request) {
-            debug.println("[WEBSERVER] Upload request completed");
-            if (uploadSuccess) {
-                request->send(200, "text/plain", "Upload complete");
+            LOG_D("[WEBSERVER] Upload request completed");
+            AsyncWebServerResponse *response;
+            if (uploadStatusCode == 304) {
+                response = request->beginResponse(304);
+            } else if (uploadSuccess) {
+                String message = uploadUnchanged ? String("Upload unchanged") : String("Upload complete");
+                response = request->beginResponse(200, "text/plain", message + " (" + String(imageFormatName(uploadImageFormat)) + ")");
             } else {
                 const char* err = uploadErrorMessage ? uploadErrorMessage : "Upload failed";
-                request->send(500, "text/plain", err);
+                response = request->beginResponse(uploadStatusCode, "text/plain", err);
+            }
+            if (uploadEtag.length()) {
+                response->addHeader("ETag", uploadEtag);
+            }
+            if (uploadRenderJob) {
+                response->addHeader("X-Render-Job", String(uploadRenderJob));
+            }
+            request->send(response);
+
+            if (uploadSuccess || uploadStatusCode == 304) {
+                postEvent(EVENT_UPLOAD, "{\"state\":\"%s\",\"status\":%d,\"format\":\"%s\",\"etag\":\"%s\",\"job\":%u}",
+                          uploadStatusCode == 304 || uploadUnchanged ? "unchanged" : "stored",
+                          uploadStatusCode == 304 ? 304 : 200,
+                          imageFormatName(uploadImageFormat), eventString(uploadEtag).c_str(), (unsigned) uploadRenderJob);
+            } else {
+                postEvent(EVENT_ERROR, "{\"source\":\"upload\",\"status\":%d,\"message\":\"%s\"}", uploadStatusCode,
+                          uploadErrorMessage ? uploadErrorMessage : "Upload failed");
             }
         },
         handleImageFileUpload
     );
 
-    webServer.serveStatic("/fs", LittleFS, "/");
+    webServer.on("/api/image/stream", HTTP_POST, handleStreamResponse, handleStreamUpload);
+
+    webServer.on("/api/layout", HTTP_POST, handleLayoutRequest, nullptr, handleLayoutBody);
+
+    // Resumable uploads: open a session, PUT chunks at offsets, finalize once nothing is missing
+    webServer.on("/api/upload/session", HTTP_POST, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received POST request on '/api/upload/session'");
+        if (!request->hasParam("size") || !request->hasParam("crc")) {
+            request->send(400, "text/plain", "Missing size or crc");
+            return;
+        }
+        String slot = request->hasParam("slot") ? request->getParam("slot")->value() : String(IMAGE_STORE_DEFAULT_SLOT);
+        uint32_t size = strtoul(request->getParam("size")->value().c_str(), nullptr, 10);
+        uint32_t crc = strtoul(request->getParam("crc")->value().c_str(), nullptr, 16);
+        DitherMode dither = requestDitherMode(request, DITHER_NONE);
+        String id, message;
+        int status = openUploadSession(slot, size, crc, dither, !request->hasParam("noselect"), id, message);
+        const UploadSession *session = findUploadSession(id);
+        if (status >= 300 || !session) {
+            request->send(status, "text/plain", message);
+            return;
+        }
+        sendUploadSession(request, status, *session);
+    });
+
+    webServer.on("/api/upload/session", HTTP_GET, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received GET request on '/api/upload/session'");
+        const UploadSession *session = findUploadSession(sessionId(request));
+        if (!session) {
+            request->send(404, "text/plain", "No such session");
+            return;
+        }
+        sendUploadSession(request, 200, *session);
+    });
+
+    webServer.on("/api/upload/session", HTTP_DELETE, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received DELETE request on '/api/upload/session'");
+        if (!abortUploadSession(sessionId(request))) {
+            request->send(404, "text/plain", "No such session");
+            return;
+        }
+        request->send(200, "text/plain", "Session removed");
+    });
+
+    webServer.on("/api/upload/chunk", HTTP_PUT, handleUploadChunk, nullptr, handleUploadChunkBody);
+
+    webServer.on("/api/upload/finalize", HTTP_POST, [](AsyncWebServerRequest *request) {
+        LOG_D("[WEBSERVER] Received POST request on '/api/upload/finalize'");
+        String etag, message;
+        uint32_t job = 0;
+        int status = finalizeUploadSession(sessionId(request), etag, job, message);
+        if (status != 200) {
+            request->send(status, "text/plain", message);
+            return;
+        }
+        AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", "Upload complete");
+        response->addHeader("ETag", etag);
+        if (job) response->addHeader("X-Render-Job", String(job));
+        request->send(response);
+        postEvent(EVENT_UPLOAD, "{\"state\":\"stored\",\"status\":200,\"etag\":\"%s\",\"job\":%u}",
+                  eventString(etag).c_str(), (unsigned) job);
+    });
+
+    // Server-Sent Events: upload progress, render jobs and panel phases as they happen
+    initEvents(webServer);
+    debug.println("[WEBSERVER] Event stream enabled on /api/events");
+
+    webServer.on(FS_URL_PREFIX, HTTP_GET, handleStaticFile);
     debug.println("[WEBSERVER] Static file serving enabled");
 
     webServer.onNotFound(notFoundResponse);
@@ -0,0 +1,126 @@
+// Host stand-in for Adafruit GFX: the shape primitives with the library's
+// own algorithms, so shapes land on the same pixels as on the device. There
+// are no font bitmaps on the host (the fonts in Fonts/ have no glyphs), so
+// text measures as empty and draws nothing.
+#ifndef _ADAFRUIT_GFX_H
+#define _ADAFRUIT_GFX_H
+
+#include <Arduino.h>
+
+typedef struct {
+    uint16_t bitmapOffset;
+    uint8_t width;
+    uint8_t height;
+    uint8_t xAdvance;
+    int8_t xOffset;
+    int8_t yOffset;
+} GFXglyph;
+
+typedef struct {
+    uint8_t *bitmap;
+    GFXglyph *glyph;
+    uint16_t first;
+    uint16_t last;
+    uint8_t yAdvance;
+} GFXfont;
+
+class Adafruit_GFX {
+protected:
+    const int16_t WIDTH;
+    const int16_t HEIGHT;
+    int16_t _width;
+    int16_t _height;
+    int16_t cursor_x;
+    int16_t cursor_y;
+    uint16_t textcolor;
+    uint8_t textsize_x;
+    uint8_t textsize_y;
+    bool wrap;
+    const GFXfont *gfxFont;
+
+public:
+    Adafruit_GFX(int16_t w, int16_t h)
+        : WIDTH(w), HEIGHT(h), _width(w), _height(h), cursor_x(0), cursor_y(0), textcolor(0xFFFF),
+          textsize_x(1), textsize_y(1), wrap(true), gfxFont(nullptr) {}
+    virtual ~Adafruit_GFX() {}
+
+    virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+
+    virtual void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
+        writeLine(x, y, x, y + h - 1, color);
+    }
+    virtual void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
+        writeLine(x, y, x + w - 1, y, color);
+    }
+    virtual void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+        for (int16_t i = x; i < x + w; i++) drawFastVLine(i, y, h, color);
+    }
+    virtual void fillScreen(uint16_t color) { fillRect(0, 0, _width, _height, color); }
+
+    virtual void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+        if (x0 == x1) {
+            if (y0 > y1) std::swap(y0, y1);
+            drawFastVLine(x0, y0, y1 - y0 + 1, color);
+        } else if (y0 == y1) {
+            if (x0 > x1) std::swap(x0, x1);
+            drawFastHLine(x0, y0, x1 - x0 + 1, color);
+        } else {
+            writeLine(x0, y0, x1, y1, color);
+        }
+    }
+
+    virtual void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+        drawFastHLine(x, y, w, color);
+        drawFastHLine(x, y + h - 1, w, color);
+        drawFastVLine(x, y, h, color);
+        drawFastVLine(x + w - 1, y, h, color);
+    }
+
+    // Bresenham, as Adafruit_GFX::writeLine
+    void writeLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+        bool steep = abs(y1 - y0) > abs(x1 - x0);
+        if (steep) {
+            std::swap(x0, y0);
+            std::swap(x1, y1);
+        }
+        if (x0 > x1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+        int16_t dx = x1 - x0;
+        int16_t dy = abs(y1 - y0);
+        int16_t err = dx / 2;
+        int16_t ystep = y0 < y1 ? 1 : -1;
+        for (; x0 <= x1; x0++) {
+            if (steep) drawPixel(y0, x0, color);
+            else drawPixel(x0, y0, color);
+            err -= dy;
+            if (err < 0) {
+                y0 += ystep;
+                err += dx;
+            }
+        }
+    }
+
+    void setFont(const GFXfont *f = nullptr) { gfxFont = f; }
+    void setTextSize(uint8_t s) { textsize_x = textsize_y = s > 0 ? s : 1; }
+    void setTextColor(uint16_t c) { textcolor = c; }
+    void setCursor(int16_t x, int16_t y) {
+        cursor_x = x;
+        cursor_y = y;
+    }
+    void setTextWrap(bool w) { wrap = w; }
+
+    void getTextBounds(const char *string, int16_t x, int16_t y, int16_t *x1, int16_t *y1, uint16_t *w,
+                       uint16_t *h) {
+        *x1 = x;
+        *y1 = y;
+        *w = 0;
+        *h = 0;
+    }
+
+    size_t print(const char *s) { return 0; }
+    size_t print(const String &s) { return 0; }
+};
+
+#endif
@@ -0,0 +1,7 @@
+// Host stand-in: debug.h only keeps a pointer to the OLED driver
+#ifndef ADAFRUIT_SSD1306_H
+#define ADAFRUIT_SSD1306_H
+
+class Adafruit_SSD1306;
+
+#endif
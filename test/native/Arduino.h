@@ -0,0 +1,141 @@
+// Host stand-in for the parts of the Arduino core and FreeRTOS that the
+// modules built in [env:native] use. Header only: every test suite is one
+// translation unit plus the sources listed in build_src_filter.
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "freertos/FreeRTOS.h"
+
+using std::min;
+using std::max;
+
+#define DRAM_ATTR
+#define IRAM_ATTR
+#define PROGMEM
+
+#define HIGH 1
+#define LOW 0
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline uint32_t micros() {
+    using namespace std::chrono;
+    static const steady_clock::time_point start = steady_clock::now();
+    return (uint32_t) duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+inline uint32_t millis() {
+    return micros() / 1000;
+}
+
+inline void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline uint32_t getCpuFrequencyMhz() {
+    return 1;
+}
+
+struct HostEsp {
+    // Microseconds stand in for cycles, with getCpuFrequencyMhz() at 1
+    uint32_t getCycleCount() { return micros(); }
+    uint32_t getFreeHeap() { return 0; }
+};
+inline HostEsp ESP;
+
+class String {
+private:
+    std::string value;
+
+public:
+    String(const char *s = "") : value(s ? s : "") {}
+    String(const std::string &s) : value(s) {}
+    String(char c) : value(1, c) {}
+    String(int v) : value(std::to_string(v)) {}
+    String(unsigned v) : value(std::to_string(v)) {}
+    String(long v) : value(std::to_string(v)) {}
+    String(unsigned long v) : value(std::to_string(v)) {}
+    String(long long v) : value(std::to_string(v)) {}
+    String(unsigned long long v) : value(std::to_string(v)) {}
+    String(double v, unsigned decimals = 2) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*f", (int) decimals, v);
+        value = buffer;
+    }
+
+    const char *c_str() const { return value.c_str(); }
+    unsigned length() const { return value.length(); }
+    char operator[](unsigned i) const { return value[i]; }
+
+    String &operator+=(const String &s) {
+        value += s.value;
+        return *this;
+    }
+    friend String operator+(const String &a, const String &b) { return String(a.value + b.value); }
+    friend String operator+(const String &a, const char *b) { return String(a.value + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.value); }
+    bool operator==(const String &s) const { return value == s.value; }
+    bool operator==(const char *s) const { return value == s; }
+    bool operator!=(const String &s) const { return value != s.value; }
+
+    bool startsWith(const String &s) const { return value.compare(0, s.value.size(), s.value) == 0; }
+    bool endsWith(const String &s) const {
+        return value.size() >= s.value.size() &&
+               value.compare(value.size() - s.value.size(), s.value.size(), s.value) == 0;
+    }
+    int indexOf(char c) const {
+        size_t i = value.find(c);
+        return i == std::string::npos ? -1 : (int) i;
+    }
+    int indexOf(const String &s) const {
+        size_t i = value.find(s.value);
+        return i == std::string::npos ? -1 : (int) i;
+    }
+    String substring(unsigned from) const { return from < value.size() ? String(value.substr(from)) : String(); }
+    String substring(unsigned from, unsigned to) const {
+        return from < to && from < value.size() ? String(value.substr(from, to - from)) : String();
+    }
+    void replace(const String &from, const String &to) {
+        if (from.value.empty()) return;
+        for (size_t i = value.find(from.value); i != std::string::npos; i = value.find(from.value, i + to.value.size())) {
+            value.replace(i, from.value.size(), to.value);
+        }
+    }
+    void trim() {
+        size_t first = value.find_first_not_of(" \t\r\n");
+        size_t last = value.find_last_not_of(" \t\r\n");
+        value = first == std::string::npos ? "" : value.substr(first, last - first + 1);
+    }
+    void toLowerCase() {
+        for (char &c : value) c = tolower((unsigned char) c);
+    }
+    long toInt() const { return strtol(value.c_str(), nullptr, 10); }
+};
+
+class HostSerial {
+public:
+    void begin(unsigned long) {}
+    void print(const String &s) { fputs(s.c_str(), stdout); }
+    void println(const String &s = String()) { printf("%s\n", s.c_str()); }
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, format);
+        int n = vfprintf(stdout, format, args);
+        va_end(args);
+        return n;
+    }
+};
+inline HostSerial Serial;
+
+#endif
@@ -0,0 +1,269 @@
+// Host stand-in for the part of ArduinoJson 7 that layout.cpp uses: a
+// document parsed from a buffer, members and elements looked up by key and
+// iteration, and values read with `|` and a default. No serializer.
+#ifndef ARDUINOJSON_H
+#define ARDUINOJSON_H
+
+#include <Arduino.h>
+#include <utility>
+#include <vector>
+
+// Same nesting limit as ArduinoJson's default
+#ifndef ARDUINOJSON_DEFAULT_NESTING_LIMIT
+#define ARDUINOJSON_DEFAULT_NESTING_LIMIT 10
+#endif
+
+struct JsonNode {
+    enum Type : uint8_t {
+        JSON_NULL,
+        JSON_BOOL,
+        JSON_NUMBER,
+        JSON_STRING,
+        JSON_ARRAY,
+        JSON_OBJECT
+    };
+
+    Type type = JSON_NULL;
+    bool boolean = false;
+    double number = 0;
+    std::string text;
+    std::vector<JsonNode> items;
+    std::vector<std::pair<std::string, JsonNode>> members;
+};
+
+class JsonVariant {
+protected:
+    const JsonNode *node;
+
+public:
+    JsonVariant(const JsonNode *n = nullptr) : node(n) {}
+
+    bool isNull() const { return !node || node->type == JsonNode::JSON_NULL; }
+
+    JsonVariant operator[](const char *key) const {
+        if (!node || node->type != JsonNode::JSON_OBJECT) return JsonVariant();
+        for (const auto &member : node->members) {
+            if (member.first == key) return JsonVariant(&member.second);
+        }
+        return JsonVariant();
+    }
+
+    size_t size() const {
+        if (!node) return 0;
+        if (node->type == JsonNode::JSON_ARRAY) return node->items.size();
+        return node->type == JsonNode::JSON_OBJECT ? node->members.size() : 0;
+    }
+
+    const char *operator|(const char *fallback) const {
+        return node && node->type == JsonNode::JSON_STRING ? node->text.c_str() : fallback;
+    }
+    int operator|(int fallback) const {
+        return node && node->type == JsonNode::JSON_NUMBER ? (int) node->number : fallback;
+    }
+    bool operator|(bool fallback) const {
+        return node && node->type == JsonNode::JSON_BOOL ? node->boolean : fallback;
+    }
+};
+
+class JsonObject : public JsonVariant {
+public:
+    JsonObject(const JsonVariant &v = JsonVariant()) : JsonVariant(v) {
+        if (node && node->type != JsonNode::JSON_OBJECT) node = nullptr;
+    }
+};
+
+class JsonArray : public JsonVariant {
+public:
+    JsonArray(const JsonVariant &v = JsonVariant()) : JsonVariant(v) {
+        if (node && node->type != JsonNode::JSON_ARRAY) node = nullptr;
+    }
+
+    class iterator {
+    private:
+        const JsonNode *item;
+
+    public:
+        explicit iterator(const JsonNode *i) : item(i) {}
+        JsonVariant operator*() const { return JsonVariant(item); }
+        iterator &operator++() {
+            item++;
+            return *this;
+        }
+        bool operator!=(const iterator &other) const { return item != other.item; }
+    };
+
+    iterator begin() const { return iterator(node ? node->items.data() : nullptr); }
+    iterator end() const { return iterator(node ? node->items.data() + node->items.size() : nullptr); }
+};
+
+class JsonDocument : public JsonVariant {
+private:
+    JsonNode root;
+
+public:
+    JsonDocument() : JsonVariant(&root) {}
+    JsonDocument(const JsonDocument &) = delete;
+    JsonNode &rootNode() { return root; }
+};
+
+class DeserializationError {
+public:
+    enum Code {
+        Ok,
+        EmptyInput,
+        IncompleteInput,
+        InvalidInput,
+        TooDeep
+    };
+
+    DeserializationError(Code c = Ok) : code(c) {}
+    explicit operator bool() const { return code != Ok; }
+    const char *c_str() const {
+        static const char *names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "TooDeep"};
+        return names[code];
+    }
+
+private:
+    Code code;
+};
+
+class JsonHostParser {
+private:
+    const char *p;
+    const char *end;
+
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    }
+
+    bool literal(const char *word) {
+        size_t len = strlen(word);
+        if ((size_t) (end - p) < len || memcmp(p, word, len)) return false;
+        p += len;
+        return true;
+    }
+
+    static void appendUtf8(std::string &out, uint32_t c) {
+        if (c < 0x80) {
+            out += (char) c;
+        } else if (c < 0x800) {
+            out += (char) (0xC0 | c >> 6);
+            out += (char) (0x80 | (c & 0x3F));
+        } else {
+            out += (char) (0xE0 | c >> 12);
+            out += (char) (0x80 | (c >> 6 & 0x3F));
+            out += (char) (0x80 | (c & 0x3F));
+        }
+    }
+
+    DeserializationError::Code string(std::string &out) {
+        p++;  // opening quote
+        while (p < end && *p != '"') {
+            if (*p != '\\') {
+                out += *p++;
+                continue;
+            }
+            if (++p == end) break;
+            char c = *p++;
+            switch (c) {
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    if (end - p < 4) return DeserializationError::IncompleteInput;
+                    char hex[5] = {p[0], p[1], p[2], p[3], 0};
+                    char *stop;
+                    uint32_t code = strtoul(hex, &stop, 16);
+                    if (stop != hex + 4) return DeserializationError::InvalidInput;
+                    appendUtf8(out, code);
+                    p += 4;
+                    break;
+                }
+                default: out += c; break;
+            }
+        }
+        if (p == end) return DeserializationError::IncompleteInput;
+        p++;  // closing quote
+        return DeserializationError::Ok;
+    }
+
+public:
+    JsonHostParser(const uint8_t *input, size_t len) : p((const char *) input), end((const char *) input + len) {}
+
+    DeserializationError::Code value(JsonNode &node, int depth) {
+        skipSpace();
+        if (p == end) return DeserializationError::IncompleteInput;
+        if (*p == '{' || *p == '[') {
+            if (depth == 0) return DeserializationError::TooDeep;
+            bool object = *p++ == '{';
+            node.type = object ? JsonNode::JSON_OBJECT : JsonNode::JSON_ARRAY;
+            skipSpace();
+            if (p < end && *p == (object ? '}' : ']')) {
+                p++;
+                return DeserializationError::Ok;
+            }
+            while (true) {
+                JsonNode *child;
+                if (object) {
+                    skipSpace();
+                    if (p == end) return DeserializationError::IncompleteInput;
+                    if (*p != '"') return DeserializationError::InvalidInput;
+                    node.members.emplace_back();
+                    DeserializationError::Code err = string(node.members.back().first);
+                    if (err) return err;
+                    skipSpace();
+                    if (p == end) return DeserializationError::IncompleteInput;
+                    if (*p++ != ':') return DeserializationError::InvalidInput;
+                    child = &node.members.back().second;
+                } else {
+                    node.items.emplace_back();
+                    child = &node.items.back();
+                }
+                DeserializationError::Code err = value(*child, depth - 1);
+                if (err) return err;
+                skipSpace();
+                if (p == end) return DeserializationError::IncompleteInput;
+                char c = *p++;
+                if (c == (object ? '}' : ']')) return DeserializationError::Ok;
+                if (c != ',') return DeserializationError::InvalidInput;
+            }
+        }
+        if (*p == '"') {
+            node.type = JsonNode::JSON_STRING;
+            return string(node.text);
+        }
+        bool isTrue = literal("true");
+        if (isTrue || literal("false")) {
+            node.type = JsonNode::JSON_BOOL;
+            node.boolean = isTrue;
+            return DeserializationError::Ok;
+        }
+        if (literal("null")) return DeserializationError::Ok;
+
+        std::string number;
+        while (p < end && strchr("+-.0123456789eE", *p)) number += *p++;
+        char *stop;
+        node.number = strtod(number.c_str(), &stop);
+        if (number.empty() || *stop) return DeserializationError::InvalidInput;
+        node.type = JsonNode::JSON_NUMBER;
+        return DeserializationError::Ok;
+    }
+
+    bool atEnd() {
+        skipSpace();
+        return p == end;
+    }
+};
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const uint8_t *input, size_t len) {
+    doc.rootNode() = JsonNode();
+    JsonHostParser parser(input, len);
+    if (parser.atEnd()) return DeserializationError::EmptyInput;
+    DeserializationError::Code err = parser.value(doc.rootNode(), ARDUINOJSON_DEFAULT_NESTING_LIMIT);
+    if (err) doc.rootNode() = JsonNode();
+    return err;
+}
+
+#endif
@@ -0,0 +1,35 @@
+// Host stand-in for the request parameters display.cpp reads; the server
+// itself only appears in declarations
+#ifndef ESPASYNCWEBSERVER_H
+#define ESPASYNCWEBSERVER_H
+
+#include <Arduino.h>
+#include <map>
+
+class AsyncWebServer;
+
+class AsyncWebParameter {
+private:
+    String _value;
+
+public:
+    explicit AsyncWebParameter(const String &value) : _value(value) {}
+    const String &value() const { return _value; }
+};
+
+class AsyncWebServerRequest {
+private:
+    std::map<std::string, AsyncWebParameter> params;
+
+public:
+    bool hasParam(const char *name, bool post = false) const { return params.count(name) > 0; }
+    const AsyncWebParameter *getParam(const char *name, bool post = false) const {
+        auto it = params.find(name);
+        return it == params.end() ? nullptr : &it->second;
+    }
+
+    // Test hook
+    void addParam(const char *name, const String &value) { params.emplace(name, AsyncWebParameter(value)); }
+};
+
+#endif
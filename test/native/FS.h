@@ -0,0 +1,125 @@
+// Host stand-in for fs::File: a file held in memory. Copies share the same
+// data and position, as copies of an Arduino File share one handle. Every
+// write call is logged with its offset, so tests can replay what the
+// filesystem was handed. fs::FS is a directory of such files by path.
+#ifndef FS_H
+#define FS_H
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+namespace fs {
+
+struct FileWrite {
+    uint32_t offset;
+    uint32_t length;
+};
+
+class File {
+private:
+    struct Data {
+        std::vector<uint8_t> bytes;
+        std::vector<FileWrite> writes;
+        size_t position = 0;
+        // Bytes the next write may still store; negative for no limit
+        long capacity = -1;
+    };
+    std::shared_ptr<Data> data;
+
+public:
+    File() {}
+
+    static File memory(const uint8_t *content = nullptr, size_t size = 0) {
+        File file;
+        file.data = std::make_shared<Data>();
+        if (content) file.data->bytes.assign(content, content + size);
+        return file;
+    }
+
+    explicit operator bool() const { return data != nullptr; }
+
+    size_t size() const { return data ? data->bytes.size() : 0; }
+    size_t position() const { return data ? data->position : 0; }
+    int available() const { return data ? (int) (data->bytes.size() - data->position) : 0; }
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+        if (!data) return false;
+        size_t base = mode == SeekSet ? 0 : (mode == SeekCur ? data->position : data->bytes.size());
+        if (base + pos > data->bytes.size()) return false;
+        data->position = base + pos;
+        return true;
+    }
+
+    size_t read(uint8_t *buffer, size_t len) {
+        if (!data) return 0;
+        size_t n = min(len, data->bytes.size() - data->position);
+        memcpy(buffer, data->bytes.data() + data->position, n);
+        data->position += n;
+        return n;
+    }
+
+    int read() {
+        uint8_t b;
+        return read(&b, 1) == 1 ? b : -1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t len) {
+        if (!data) return 0;
+        size_t n = len;
+        if (data->capacity >= 0) {
+            n = min(n, (size_t) data->capacity);
+            data->capacity -= n;
+        }
+        data->writes.push_back({(uint32_t) data->position, (uint32_t) n});
+        if (data->position + n > data->bytes.size()) data->bytes.resize(data->position + n);
+        memcpy(data->bytes.data() + data->position, buffer, n);
+        data->position += n;
+        return n;
+    }
+
+    void flush() {}
+    void close() {}
+
+    // Test hooks
+    const std::vector<uint8_t> &bytes() const { return data->bytes; }
+    const std::vector<FileWrite> &writes() const { return data->writes; }
+    // Makes writes past `bytes` more bytes come up short, as on a full filesystem
+    void limitWrites(long bytes) { data->capacity = bytes; }
+};
+
+/**
+ * Files by path. Opening for writing creates the file afresh; opening for
+ * reading returns a copy of what was written, positioned at the start.
+ */
+class FS {
+private:
+    std::map<std::string, File> files;
+
+public:
+    File open(const char *path, const char *mode = "r") {
+        if (mode[0] == 'w') return files[path] = File::memory();
+        auto it = files.find(path);
+        if (it == files.end()) return File();
+        return File::memory(it->second.bytes().data(), it->second.size());
+    }
+    File open(const String &path, const char *mode = "r") { return open(path.c_str(), mode); }
+
+    bool exists(const char *path) const { return files.count(path) > 0; }
+    bool exists(const String &path) const { return exists(path.c_str()); }
+    bool remove(const char *path) { return files.erase(path) > 0; }
+    bool remove(const String &path) { return remove(path.c_str()); }
+};
+
+}  // namespace fs
+
+using fs::File;
+
+#endif
@@ -0,0 +1,4 @@
+// Host stand-in: a font without glyphs (see Adafruit_GFX.h)
+#include <Adafruit_GFX.h>
+
+const GFXfont FreeSans18pt7b = {nullptr, nullptr, 0x20, 0x1F, 0};
@@ -0,0 +1,51 @@
+// Host stand-in for GxEPD2_3C, forwarding to the driver as the library does,
+// and for the GxEPD2_750c driver BulkPanel derives from, which is never
+// driven on the host. Paged drawing covers a page of the whole screen and
+// draws only fillScreen(), as clearDisplay() uses it.
+#ifndef GXEPD2_3C_H
+#define GXEPD2_3C_H
+
+#include <GxEPD2_EPD.h>
+
+class GxEPD2_750c : public GxEPD2_EPD {
+public:
+    static const uint16_t WIDTH = 640;
+    static const uint16_t HEIGHT = 384;
+
+    GxEPD2_750c(int16_t cs, int16_t dc, int16_t rst, int16_t busy)
+        : GxEPD2_EPD(cs, dc, rst, busy, LOW, 20000000, WIDTH, HEIGHT, GxEPD2::GDEW075Z09, true, false, false) {}
+
+protected:
+    void _Init_Part() { _using_partial_mode = true; }
+};
+
+template <typename GxEPD2_Type, const uint16_t page_height>
+class GxEPD2_3C {
+private:
+    uint16_t fill;
+
+public:
+    GxEPD2_Type epd2;
+
+    GxEPD2_3C(GxEPD2_Type epd2_instance) : fill(GxEPD_WHITE), epd2(epd2_instance) {}
+
+    void init(uint32_t serial_diag_bitrate = 0) { epd2.init(serial_diag_bitrate); }
+
+    void writeScreenBuffer(uint8_t value = 0xFF) { epd2.writeScreenBuffer(value); }
+    void writeImage(const uint8_t *black, const uint8_t *color, int16_t x, int16_t y, int16_t w, int16_t h,
+                    bool invert = false, bool mirror_y = false, bool pgm = false) {
+        epd2.writeImage(black, color, x, y, w, h, invert, mirror_y, pgm);
+    }
+    void refresh(bool partial_update_mode = false) { epd2.refresh(partial_update_mode); }
+
+    void setFullWindow() {}
+    void firstPage() { fill = GxEPD_WHITE; }
+    void fillScreen(uint16_t color) { fill = color; }
+    bool nextPage() {
+        epd2.writeScreenBuffer(fill == GxEPD_BLACK ? 0x00 : 0xFF, fill == GxEPD_RED ? 0x00 : 0xFF);
+        epd2.refresh(false);
+        return false;
+    }
+};
+
+#endif
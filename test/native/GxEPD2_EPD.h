@@ -0,0 +1,47 @@
+// Host stand-in for the GxEPD2 driver base class MockPanel and BulkPanel
+// derive from, with the colors GxEPD2.h defines
+#ifndef GXEPD2_EPD_H
+#define GXEPD2_EPD_H
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#define GxEPD_BLACK 0x0000
+#define GxEPD_WHITE 0xFFFF
+#define GxEPD_RED 0xF800
+
+namespace GxEPD2 {
+enum Panel {
+    GDEW075Z09
+};
+}
+
+class GxEPD2_EPD {
+public:
+    const uint16_t WIDTH;
+    const uint16_t HEIGHT;
+    const GxEPD2::Panel panel;
+    const bool hasColor;
+    const bool hasPartialUpdate;
+    const bool hasFastPartialUpdate;
+
+    GxEPD2_EPD(int16_t cs, int16_t dc, int16_t rst, int16_t busy, int16_t busy_level, uint32_t busy_timeout,
+               uint16_t w, uint16_t h, GxEPD2::Panel p, bool c, bool pu, bool fpu)
+        : WIDTH(w), HEIGHT(h), panel(p), hasColor(c), hasPartialUpdate(pu), hasFastPartialUpdate(fpu),
+          _pSPIx(nullptr), _initial_write(true), _using_partial_mode(false), _init_display_done(false) {}
+    virtual ~GxEPD2_EPD() {}
+
+protected:
+    SPIClass *_pSPIx;
+    SPISettings _spi_settings;
+    bool _initial_write;
+    bool _using_partial_mode;
+    bool _init_display_done;
+
+    void _writeCommand(uint8_t c) {}
+    void _writeData(uint8_t d) {}
+    void _startTransfer() {}
+    void _endTransfer() {}
+};
+
+#endif
@@ -0,0 +1,10 @@
+// Host stand-in for LittleFS: an in-memory fs::FS (see FS.h), which tests
+// fill with the files a draw path opens
+#ifndef LITTLEFS_H
+#define LITTLEFS_H
+
+#include <FS.h>
+
+inline fs::FS LittleFS;
+
+#endif
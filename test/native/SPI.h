@@ -0,0 +1,24 @@
+// Host stand-in for the SPI bus: the panel driver that clocks data out over
+// it is not driven on the host
+#ifndef SPI_H
+#define SPI_H
+
+#include <Arduino.h>
+
+#define HSPI 2
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+public:
+    SPISettings(uint32_t clock = 1000000, uint8_t bitOrder = MSBFIRST, uint8_t dataMode = SPI_MODE0) {}
+};
+
+class SPIClass {
+public:
+    explicit SPIClass(uint8_t bus = HSPI) {}
+    void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+    void writeBytes(const uint8_t *data, uint32_t size) {}
+};
+
+#endif
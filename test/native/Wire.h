@@ -0,0 +1,4 @@
+// Host stand-in: debug.h includes it for the OLED, which is not used on the host
+#ifndef WIRE_H
+#define WIRE_H
+#endif
@@ -0,0 +1,20 @@
+// Host stand-in for the ROM CRC-32: same result as esp_rom_crc32_le, the
+// zlib CRC-32 continued from `crc`
+#ifndef ESP_ROM_CRC_H
+#define ESP_ROM_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+#endif
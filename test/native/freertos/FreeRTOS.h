@@ -0,0 +1,230 @@
+// Host stand-in for the FreeRTOS calls the modules built in [env:native] make:
+// critical sections, tasks on std::thread with their notifications, counting
+// semaphores and queues. A tick is a millisecond; priorities, cores and the
+// static buffers passed in are ignored. A task may only be deleted once it
+// has parked itself with vTaskSuspend(NULL), which is how the render
+// pipeline retires its workers; the parked thread then returns from the
+// task function.
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFF)
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+// Critical sections are a process-wide recursive mutex
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+inline std::recursive_mutex &hostCriticalSection() {
+    static std::recursive_mutex lock;
+    return lock;
+}
+#define portENTER_CRITICAL(mux) hostCriticalSection().lock()
+#define portEXIT_CRITICAL(mux) hostCriticalSection().unlock()
+inline int xPortGetCoreID() {
+    return 0;
+}
+
+// State guarded by a mutex, with a condition variable for waiters
+struct HostWaitable {
+    std::mutex lock;
+    std::condition_variable changed;
+
+    template <typename Ready>
+    bool wait(std::unique_lock<std::mutex> &held, TickType_t ticks, Ready ready) {
+        if (ticks == portMAX_DELAY) {
+            changed.wait(held, ready);
+            return true;
+        }
+        return changed.wait_for(held, std::chrono::milliseconds(ticks), ready);
+    }
+};
+
+enum eTaskState {
+    eRunning,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted
+};
+
+struct HostTask : HostWaitable {
+    std::thread thread;
+    uint32_t notifications = 0;
+    eTaskState state = eRunning;
+    bool deleting = false;
+};
+
+typedef HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+struct StaticTask_t {};
+
+inline HostTask *&hostCurrentTask() {
+    thread_local HostTask *task = nullptr;
+    return task;
+}
+
+// Threads not started as tasks (main) get a handle on first use, kept for good
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    HostTask *&task = hostCurrentTask();
+    if (!task) task = new HostTask();
+    return task;
+}
+
+inline TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth,
+                                                  void *parameter, UBaseType_t priority, StackType_t *stack,
+                                                  StaticTask_t *buffer, BaseType_t core) {
+    HostTask *task = new HostTask();
+    task->thread = std::thread([task, code, parameter] {
+        hostCurrentTask() = task;
+        code(parameter);
+        std::lock_guard<std::mutex> held(task->lock);
+        task->state = eDeleted;
+        task->changed.notify_all();
+    });
+    return task;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth,
+                                          void *parameter, UBaseType_t priority, TaskHandle_t *created,
+                                          BaseType_t core) {
+    TaskHandle_t task = xTaskCreateStaticPinnedToCore(code, name, stackDepth, parameter, priority, nullptr,
+                                                      nullptr, core);
+    if (created) *created = task;
+    return pdPASS;
+}
+
+// Only a task suspending itself; it stays parked until deleted
+inline void vTaskSuspend(TaskHandle_t task) {
+    HostTask *self = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> held(self->lock);
+    self->state = eSuspended;
+    self->changed.notify_all();
+    self->wait(held, portMAX_DELAY, [self] { return self->deleting; });
+}
+
+inline eTaskState eTaskGetState(TaskHandle_t task) {
+    std::lock_guard<std::mutex> held(task->lock);
+    return task->state;
+}
+
+inline void vTaskDelete(TaskHandle_t task) {
+    {
+        std::lock_guard<std::mutex> held(task->lock);
+        task->deleting = true;
+        task->changed.notify_all();
+    }
+    task->thread.join();
+    delete task;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> held(task->lock);
+    task->notifications++;
+    task->changed.notify_all();
+    return pdPASS;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    HostTask *self = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> held(self->lock);
+    self->wait(held, ticks, [self] { return self->notifications > 0; });
+    uint32_t count = self->notifications;
+    if (count) self->notifications = clearOnExit ? 0 : count - 1;
+    return count;
+}
+
+struct HostSemaphore : HostWaitable {
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+typedef HostSemaphore *SemaphoreHandle_t;
+struct StaticSemaphore_t {};
+
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    HostSemaphore *semaphore = new HostSemaphore();
+    semaphore->count = initial;
+    semaphore->max = max;
+    return semaphore;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t max, UBaseType_t initial,
+                                                        StaticSemaphore_t *buffer) {
+    return xSemaphoreCreateCounting(max, initial);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    std::unique_lock<std::mutex> held(semaphore->lock);
+    if (!semaphore->wait(held, ticks, [semaphore] { return semaphore->count > 0; })) return pdFALSE;
+    semaphore->count--;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> held(semaphore->lock);
+    if (semaphore->count == semaphore->max) return pdFALSE;
+    semaphore->count++;
+    semaphore->changed.notify_all();
+    return pdTRUE;
+}
+
+struct HostQueue : HostWaitable {
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    size_t itemSize;
+};
+
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    HostQueue *queue = new HostQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    std::unique_lock<std::mutex> held(queue->lock);
+    if (!queue->wait(held, ticks, [queue] { return queue->items.size() < queue->length; })) return pdFALSE;
+    const uint8_t *bytes = (const uint8_t *) item;
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    std::unique_lock<std::mutex> held(queue->lock);
+    if (!queue->wait(held, ticks, [queue] { return !queue->items.empty(); })) return pdFALSE;
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+#endif
@@ -0,0 +1,67 @@
+// Definitions the native build needs from modules it does not compile:
+// debug.cpp (OLED and drain task) is replaced by a log straight to stderr,
+// the render timing helpers are those of benchmark.cpp, and the draw paths'
+// calls into the web side (events, ETags, the image store) do nothing.
+// Include from exactly one file of each test suite.
+#ifndef HOST_RUNTIME_H
+#define HOST_RUNTIME_H
+
+#include "debug.h"
+#include "benchmark.h"
+#include "events.h"
+#include "filesystem.h"
+#include "image_store.h"
+
+Debug::Debug()
+    : enqueuePos(0), dequeuePos(0), dropped(0), written(0), display(nullptr), displayReady(false), task(nullptr) {
+    currentMessage[0] = '\0';
+}
+
+void Debug::log(uint8_t level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    written++;
+}
+
+void Debug::write(uint8_t level, const char *message) {
+    fprintf(stderr, "%s\n", message);
+    written++;
+}
+
+void Debug::println(const String &message) {
+    write(LOG_LEVEL_INFO, message.c_str());
+}
+
+void Debug::println(const char *message) {
+    write(LOG_LEVEL_INFO, message);
+}
+
+Debug debug;
+
+PipelineTiming lastRenderTiming = {};
+
+void resetPipelineTiming(PipelineTiming &timing) {
+    memset(&timing, 0, sizeof(timing));
+}
+
+void addStageTime(PipelineTiming &timing, RenderStage stage, uint32_t startMicros, uint32_t bytes) {
+    timing.stages[stage].micros += micros() - startMicros;
+    timing.stages[stage].bytes += bytes;
+}
+
+void printPipelineTiming(const PipelineTiming &timing) {}
+
+void postEvent(DeviceEventType type, const char *format, ...) {}
+
+void setDisplayedImageEtag(const char *etag) {}
+
+String pinSelectedImage(String &etag) {
+    return String();
+}
+
+void unpinImage() {}
+
+#endif
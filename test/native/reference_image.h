@@ -0,0 +1,206 @@
+// The reference image of the native tests and the files made from it: a
+// panel-sized RGB565 frame with gradients, a texture, red bars and a black
+// grid, so every pixel class and every dither path is exercised. Generated
+// rather than committed; it is the same on every run.
+#ifndef REFERENCE_IMAGE_H
+#define REFERENCE_IMAGE_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+#include "panel_format.h"
+
+static const uint16_t REFERENCE_WIDTH = 640;
+static const uint16_t REFERENCE_HEIGHT = 384;
+
+inline void referenceColor(uint16_t x, uint16_t y, uint8_t &r, uint8_t &g, uint8_t &b) {
+    r = x * 255 / (REFERENCE_WIDTH - 1);
+    g = y * 255 / (REFERENCE_HEIGHT - 1);
+    b = (x ^ y) & 0xFF;
+    if ((y / 48) % 4 == 1 && x < REFERENCE_WIDTH / 2) {
+        r = 0xFF;
+        g = b = 0;
+    }
+    if (x % 64 == 0 || y % 64 == 0) {
+        r = g = b = 0;
+    }
+}
+
+// Little-endian RGB565, as uploads store it
+inline std::vector<uint8_t> referenceRgb565() {
+    std::vector<uint8_t> out((size_t) REFERENCE_WIDTH * REFERENCE_HEIGHT * 2);
+    for (uint16_t y = 0; y < REFERENCE_HEIGHT; y++) {
+        for (uint16_t x = 0; x < REFERENCE_WIDTH; x++) {
+            uint8_t r, g, b;
+            referenceColor(x, y, r, g, b);
+            uint16_t p = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+            size_t i = ((size_t) y * REFERENCE_WIDTH + x) * 2;
+            out[i] = p & 0xFF;
+            out[i + 1] = p >> 8;
+        }
+    }
+    return out;
+}
+
+// Color of pixel (x, y) of an image the BMP writer takes
+typedef std::function<void(uint16_t x, uint16_t y, uint8_t &r, uint8_t &g, uint8_t &b)> ImageColor;
+
+// Colors of a little-endian RGB565 frame of the reference size, such as preview.bin
+inline ImageColor rgb565Color(const std::vector<uint8_t> &frame) {
+    return [&frame](uint16_t x, uint16_t y, uint8_t &r, uint8_t &g, uint8_t &b) {
+        size_t i = ((size_t) y * REFERENCE_WIDTH + x) * 2;
+        uint16_t p = frame[i] | (frame[i + 1] << 8);
+        r = (p >> 11) << 3;
+        g = ((p >> 5) & 0x3F) << 2;
+        b = (p & 0x1F) << 3;
+    };
+}
+
+// Palette of an indexed BMP: black, white and red first, so every depth has the panel's colors
+inline std::vector<uint32_t> bmpPalette(uint16_t depth) {
+    std::vector<uint32_t> palette = {0x000000, 0xFFFFFF, 0xFF0000, 0x808080};
+    if (depth == 4) {
+        for (uint32_t c : {0x800000, 0x008000, 0x000080, 0x808000, 0x800080, 0x008080, 0xC0C0C0, 0x00FF00,
+                           0x0000FF, 0xFFFF00, 0xFF00FF, 0x00FFFF}) {
+            palette.push_back(c);
+        }
+    } else if (depth == 8) {
+        // 3-3-2 color cube; it contains black, white and red as well
+        palette.clear();
+        for (uint32_t i = 0; i < 256; i++) {
+            palette.push_back(((i >> 5) * 255 / 7) << 16 | ((i >> 2 & 7) * 255 / 7) << 8 | (i & 3) * 255 / 3);
+        }
+    }
+    palette.resize(1 << depth);
+    return palette;
+}
+
+inline uint8_t nearestPaletteIndex(const std::vector<uint32_t> &palette, uint8_t r, uint8_t g, uint8_t b) {
+    uint8_t best = 0;
+    int bestDistance = INT32_MAX;
+    for (size_t i = 0; i < palette.size(); i++) {
+        int dr = (int) (palette[i] >> 16) - r;
+        int dg = (int) (palette[i] >> 8 & 0xFF) - g;
+        int db = (int) (palette[i] & 0xFF) - b;
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+/**
+ * Bottom-up BMP of the reference size in any depth the decoder supports:
+ * 1, 2, 4 and 8 bit indexed (nearest palette color), 16 bit 555, 16 bit 565
+ * (`bitfields`, with BI_BITFIELDS masks), 24 bit and 32 bit.
+ */
+inline std::vector<uint8_t> referenceBmp(uint16_t depth, bool bitfields = false,
+                                         const ImageColor &color = referenceColor) {
+    const uint32_t rowSize = ((uint32_t) REFERENCE_WIDTH * depth + 31) / 32 * 4;
+    std::vector<uint32_t> palette = depth <= 8 ? bmpPalette(depth) : std::vector<uint32_t>();
+    const uint32_t masksSize = bitfields ? 12 : 0;
+    const uint32_t dataOffset = 54 + masksSize + 4 * palette.size();
+    std::vector<uint8_t> out(dataOffset + rowSize * REFERENCE_HEIGHT);
+    auto put32 = [&](size_t at, uint32_t v) {
+        for (int i = 0; i < 4; i++) out[at + i] = (v >> (8 * i)) & 0xFF;
+    };
+    out[0] = 'B';
+    out[1] = 'M';
+    put32(2, out.size());
+    put32(10, dataOffset);
+    put32(14, 40);
+    put32(18, REFERENCE_WIDTH);
+    put32(22, REFERENCE_HEIGHT);
+    out[26] = 1;
+    out[28] = depth;
+    put32(30, bitfields ? 3 : 0);
+    put32(34, rowSize * REFERENCE_HEIGHT);
+    if (bitfields) {
+        put32(54, 0xF800);
+        put32(58, 0x07E0);
+        put32(62, 0x001F);
+    }
+    for (size_t i = 0; i < palette.size(); i++) put32(54 + masksSize + 4 * i, palette[i]);
+
+    for (uint16_t y = 0; y < REFERENCE_HEIGHT; y++) {
+        uint8_t *row = out.data() + dataOffset + (size_t) (REFERENCE_HEIGHT - 1 - y) * rowSize;
+        for (uint16_t x = 0; x < REFERENCE_WIDTH; x++) {
+            uint8_t r, g, b;
+            color(x, y, r, g, b);
+            if (depth <= 8) {
+                uint8_t index = nearestPaletteIndex(palette, r, g, b);
+                uint32_t bit = (uint32_t) x * depth;
+                row[bit / 8] |= index << (8 - depth - bit % 8);
+            } else if (depth == 16) {
+                uint16_t p = bitfields ? (r >> 3) << 11 | (g >> 2) << 5 | b >> 3 : (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+                row[2 * x] = p & 0xFF;
+                row[2 * x + 1] = p >> 8;
+            } else {
+                uint8_t *p = row + (size_t) x * (depth / 8);
+                p[0] = b;
+                p[1] = g;
+                p[2] = r;
+            }
+        }
+    }
+    return out;
+}
+
+// PackBits as tools/epd3_encode.py writes it
+inline std::vector<uint8_t> packBits(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> out;
+    size_t i = 0;
+    const size_t n = data.size();
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 128 && data[i + run] == data[i]) run++;
+        if (run >= 3) {
+            out.push_back(257 - run);
+            out.push_back(data[i]);
+            i += run;
+            continue;
+        }
+        size_t start = i;
+        while (i < n && i - start < 128) {
+            if (i + 2 < n && data[i] == data[i + 1] && data[i] == data[i + 2]) break;
+            i++;
+        }
+        out.push_back(i - start - 1);
+        out.insert(out.end(), data.begin() + start, data.begin() + i);
+    }
+    return out;
+}
+
+/**
+ * EPD3 file of planes given whole (mono, then color, rows of width / 8
+ * bytes), laid out in bands of `bandRows` as panel_format.h describes, and
+ * run-length compressed for PANEL_ENCODING_RLE.
+ */
+inline std::vector<uint8_t> panelImage(const std::vector<uint8_t> &mono, const std::vector<uint8_t> &color,
+                                       uint16_t width, uint16_t height, uint16_t bandRows, PanelEncoding encoding) {
+    const size_t rowBytes = width / 8;
+    std::vector<uint8_t> bands;
+    for (uint16_t y = 0; y < height; y += bandRows) {
+        size_t start = y * rowBytes;
+        size_t end = min<size_t>(y + bandRows, height) * rowBytes;
+        bands.insert(bands.end(), mono.begin() + start, mono.begin() + end);
+        bands.insert(bands.end(), color.begin() + start, color.begin() + end);
+    }
+    if (encoding == PANEL_ENCODING_RLE) bands = packBits(bands);
+
+    PanelImageHeader header;
+    header.version = PANEL_IMAGE_VERSION;
+    header.encoding = encoding;
+    header.width = width;
+    header.height = height;
+    header.bandRows = bandRows;
+    header.dataSize = bands.size();
+    std::vector<uint8_t> out(PANEL_IMAGE_HEADER_SIZE);
+    writePanelImageHeader(out.data(), header);
+    out.insert(out.end(), bands.begin(), bands.end());
+    return out;
+}
+
+#endif
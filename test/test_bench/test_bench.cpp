@@ -0,0 +1,267 @@
+// Host benchmark of the image pipeline stages over preview.bin, the 640x384
+// RGB565 fixture at the project root, and over BMP versions of it in every
+// depth the decoder supports, checked against the baseline committed next
+// to this file.
+//
+// Absolute times depend on the machine, so each stage is gated on its cost
+// relative to the original per-pixel RGB565 conversion measured in the same
+// run; a stage fails when it costs more than BENCH_REGRESSION_TOLERANCE_PCT
+// over its baseline. After an intended change, rewrite the baseline with
+//   BENCH_SAVE_BASELINE=1 pio test -e native -f test_bench
+#include <unity.h>
+#include "host_runtime.h"
+#include "reference_image.h"
+#include "config.h"
+#include "dither.h"
+#include "image_utils.h"
+#include "pixel_kernel.h"
+#include "plane_rle.h"
+#include "bmp_decoder.h"
+#include <functional>
+#include <map>
+
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "test"
+#endif
+
+#define BENCH_BASELINE_FILE TEST_DATA_DIR "/test_bench/baseline.txt"
+#define BENCH_FIXTURE_FILE TEST_DATA_DIR "/../preview.bin"
+
+// Samples per stage; the cost is their median, the ns/px their fastest
+static const int bench_iterations = 20;
+// Frames per sample, so the short stages are well above the timer resolution
+static const int bench_frames = 4;
+// Rounds a saved baseline is the median of
+static const int bench_baseline_rounds = 3;
+
+static const size_t row_bytes = REFERENCE_WIDTH / 8;
+static const size_t plane_size = row_bytes * REFERENCE_HEIGHT;
+static const uint32_t pixels = (uint32_t) REFERENCE_WIDTH * REFERENCE_HEIGHT;
+static const size_t frame_bytes = (size_t) pixels * 2;
+
+static std::vector<uint8_t> rgb565;
+static std::vector<uint8_t> mono(plane_size);
+static std::vector<uint8_t> color(plane_size);
+// Times one frame of a stage that takes `bytes` bytes of input per frame
+struct BenchStage {
+    const char *name;
+    size_t bytes;
+    std::function<void()> pass;
+};
+
+struct StageResult {
+    std::string name;
+    double nsPerPixel;  // fastest sample
+    double mbPerSecond; // input bytes of the fastest sample
+    double cost;        // median of the samples over the reference sample next to each
+};
+
+static std::vector<BenchStage> stages;
+static std::vector<StageResult> results;
+static double referenceNsPerPixel = 1e9;
+
+static void convertFrameReference();
+
+static uint32_t timeFrames(const std::function<void()> &pass) {
+    uint32_t t0 = micros();
+    for (int frame = 0; frame < bench_frames; frame++) pass();
+    return max<uint32_t>(micros() - t0, 1);
+}
+
+// Times a stage against the reference conversion sample by sample, so a
+// change in clock speed during the run moves both sides of each ratio
+static StageResult measureStage(const BenchStage &stage) {
+    std::vector<double> ratios;
+    uint32_t best = UINT32_MAX;
+    for (int i = 0; i < bench_iterations; i++) {
+        uint32_t reference = timeFrames(convertFrameReference);
+        uint32_t elapsed = timeFrames(stage.pass);
+        referenceNsPerPixel = min(referenceNsPerPixel, reference * 1000.0 / bench_frames / pixels);
+        best = min(best, elapsed);
+        ratios.push_back((double) elapsed / reference);
+    }
+    std::sort(ratios.begin(), ratios.end());
+    return {stage.name, best * 1000.0 / bench_frames / pixels, (double) stage.bytes * bench_frames / best,
+            ratios[ratios.size() / 2]};
+}
+
+// One frame through the RGB565 converter, in render batches
+static void convertFrame(DitherMode dither) {
+    Rgb565Converter converter;
+    TEST_ASSERT_TRUE(converter.begin(REFERENCE_WIDTH, dither));
+    for (uint16_t y = 0; y < REFERENCE_HEIGHT; y += RENDER_BATCH_ROWS) {
+        converter.convertRows(rgb565.data() + (size_t) y * REFERENCE_WIDTH * 2, mono.data() + y * row_bytes,
+                              color.data() + y * row_bytes, RENDER_BATCH_ROWS);
+    }
+}
+
+static void convertFrameReference() {
+    for (uint16_t y = 0; y < REFERENCE_HEIGHT; y += RENDER_BATCH_ROWS) {
+        convertRgb565RowsReference(rgb565.data() + (size_t) y * REFERENCE_WIDTH * 2, mono.data() + y * row_bytes,
+                                   color.data() + y * row_bytes, REFERENCE_WIDTH, RENDER_BATCH_ROWS);
+    }
+}
+
+// Batched decode of a BMP, as drawBitmapFromSpiffs does
+static BenchStage bmpStage(const char *name, uint16_t depth, bool bitfields = false) {
+    auto bmp = std::make_shared<std::vector<uint8_t>>(referenceBmp(depth, bitfields, rgb565Color(rgb565)));
+    auto input = std::make_shared<std::vector<uint8_t>>((size_t) REFERENCE_WIDTH * 4 * RENDER_BATCH_ROWS);
+    return {name, bmp->size(), [bmp, input] {
+        File file = File::memory(bmp->data(), bmp->size());
+        BmpDecoder decoder;
+        TEST_ASSERT_TRUE(decoder.begin(file, REFERENCE_WIDTH, REFERENCE_HEIGHT));
+        for (uint16_t y = 0; y < REFERENCE_HEIGHT; y += RENDER_BATCH_ROWS) {
+            size_t bytesRead;
+            TEST_ASSERT_TRUE(decoder.readRows(y, RENDER_BATCH_ROWS, input->data(), bytesRead));
+            decoder.convertRows(input->data(), y, RENDER_BATCH_ROWS, mono.data() + y * row_bytes,
+                                color.data() + y * row_bytes);
+        }
+    }};
+}
+
+static std::map<std::string, double> loadBaseline() {
+    std::map<std::string, double> baseline;
+    FILE *f = fopen(BENCH_BASELINE_FILE, "r");
+    if (!f) return baseline;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        double cost;
+        if (line[0] != '#' && sscanf(line, "%63s %lf", name, &cost) == 2) baseline[name] = cost;
+    }
+    fclose(f);
+    return baseline;
+}
+
+static void saveBaseline() {
+    FILE *f = fopen(BENCH_BASELINE_FILE, "w");
+    TEST_ASSERT_NOT_NULL_MESSAGE(f, "Cannot write " BENCH_BASELINE_FILE);
+    fprintf(f, "# Cost of each stage relative to the per-pixel reference conversion, median of %d rounds.\n",
+            bench_baseline_rounds);
+    fprintf(f, "# Written by BENCH_SAVE_BASELINE=1 pio test -e native -f test_bench\n");
+    for (auto &result : results) fprintf(f, "%s %.3f\n", result.name.c_str(), result.cost);
+    fclose(f);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_fixture_is_a_panel_frame() {
+    TEST_ASSERT_EQUAL_MESSAGE(frame_bytes, rgb565.size(), "Cannot read " BENCH_FIXTURE_FILE);
+}
+
+void test_convert_matches_reference() {
+    std::vector<uint8_t> refMono(plane_size), refColor(plane_size);
+    convertFrameReference();
+    refMono = mono;
+    refColor = color;
+    convertFrame(DITHER_NONE);
+    TEST_ASSERT_EQUAL_MEMORY(refMono.data(), mono.data(), plane_size);
+    TEST_ASSERT_EQUAL_MEMORY(refColor.data(), color.data(), plane_size);
+}
+
+void test_measure_stages() {
+    static std::vector<uint8_t> rle, band, batch;
+
+    // Read of the stored frame, a render batch at a time, as the pipeline's reader does
+    batch.resize((size_t) REFERENCE_WIDTH * 2 * RENDER_BATCH_ROWS);
+    stages.push_back({"read", frame_bytes, [] {
+        File file = File::memory(rgb565.data(), rgb565.size());
+        for (uint16_t y = 0; y < REFERENCE_HEIGHT; y += RENDER_BATCH_ROWS) {
+            TEST_ASSERT_EQUAL(batch.size(), file.read(batch.data(), batch.size()));
+        }
+    }});
+
+    // Conversion to panel planes, packing included
+    stages.push_back({"convert", frame_bytes, [] { convertFrame(DITHER_NONE); }});
+    stages.push_back({"bayer", frame_bytes, [] { convertFrame(DITHER_BAYER); }});
+    stages.push_back({"floyd-steinberg", frame_bytes, [] { convertFrame(DITHER_FLOYD_STEINBERG); }});
+    stages.push_back({"atkinson", frame_bytes, [] { convertFrame(DITHER_ATKINSON); }});
+
+    // Run-length decode of the fixture's planes, band by band as drawRlePanelImageFromSpiffs does
+    convertFrame(DITHER_NONE);
+    rle = panelImage(mono, color, REFERENCE_WIDTH, REFERENCE_HEIGHT, RENDER_BATCH_ROWS, PANEL_ENCODING_RLE);
+    band.resize(2 * row_bytes * RENDER_BATCH_ROWS);
+    stages.push_back({"rle", rle.size(), [] {
+        File file = File::memory(rle.data(), rle.size());
+        file.seek(PANEL_IMAGE_HEADER_SIZE);
+        PlaneRleReader reader;
+        PipelineTiming timing = {};
+        TEST_ASSERT_TRUE(reader.begin(file, rle.size() - PANEL_IMAGE_HEADER_SIZE));
+        for (uint16_t y = 0; y < REFERENCE_HEIGHT; y += RENDER_BATCH_ROWS) {
+            TEST_ASSERT_TRUE(reader.read(band.data(), band.size(), timing));
+        }
+        TEST_ASSERT_TRUE(reader.finished());
+    }});
+
+    // The fixture as a BMP of each supported depth
+    stages.push_back(bmpStage("bmp1", 1));
+    stages.push_back(bmpStage("bmp2", 2));
+    stages.push_back(bmpStage("bmp4", 4));
+    stages.push_back(bmpStage("bmp8", 8));
+    stages.push_back(bmpStage("bmp555", 16));
+    stages.push_back(bmpStage("bmp565", 16, true));
+    stages.push_back(bmpStage("bmp24", 24));
+    stages.push_back(bmpStage("bmp32", 32));
+
+    for (const BenchStage &stage : stages) results.push_back(measureStage(stage));
+}
+
+void test_no_regression() {
+    TEST_ASSERT_FALSE_MESSAGE(results.empty(), "Stages were not measured");
+    const char *save = getenv("BENCH_SAVE_BASELINE");
+    if (save && strcmp(save, "1") == 0) {
+        for (size_t i = 0; i < stages.size(); i++) {
+            std::vector<double> costs = {results[i].cost};
+            for (int round = 1; round < bench_baseline_rounds; round++) costs.push_back(measureStage(stages[i]).cost);
+            std::sort(costs.begin(), costs.end());
+            results[i].cost = costs[costs.size() / 2];
+        }
+        saveBaseline();
+        TEST_MESSAGE("Baseline saved to " BENCH_BASELINE_FILE);
+        return;
+    }
+
+    std::map<std::string, double> baseline = loadBaseline();
+    TEST_ASSERT_FALSE_MESSAGE(baseline.empty(), "No baseline in " BENCH_BASELINE_FILE);
+
+    char line[160];
+    snprintf(line, sizeof(line), "%-16s %6.2f ns/px", "reference", referenceNsPerPixel);
+    TEST_MESSAGE(line);
+    bool passed = true;
+    for (const StageResult &result : results) {
+        auto entry = baseline.find(result.name);
+        if (entry == baseline.end()) {
+            snprintf(line, sizeof(line), "%s: no baseline, save one with BENCH_SAVE_BASELINE=1", result.name.c_str());
+            TEST_MESSAGE(line);
+            passed = false;
+            continue;
+        }
+        double limit = entry->second * (100 + BENCH_REGRESSION_TOLERANCE_PCT) / 100.0;
+        bool stagePassed = result.cost <= limit;
+        snprintf(line, sizeof(line), "%-16s %6.2f ns/px %8.1f MB/s, %.3f of reference (baseline %.3f, limit %.3f)%s",
+                 result.name.c_str(), result.nsPerPixel, result.mbPerSecond, result.cost, entry->second, limit,
+                 stagePassed ? "" : " REGRESSION");
+        TEST_MESSAGE(line);
+        passed = passed && stagePassed;
+    }
+    TEST_ASSERT_TRUE_MESSAGE(passed, "A stage regressed past its baseline");
+}
+
+int main(int argc, char **argv) {
+    FILE *f = fopen(BENCH_FIXTURE_FILE, "rb");
+    if (f) {
+        rgb565.resize(frame_bytes + 1);
+        rgb565.resize(fread(rgb565.data(), 1, rgb565.size(), f));
+        fclose(f);
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_fixture_is_a_panel_frame);
+    if (rgb565.size() == frame_bytes) {
+        RUN_TEST(test_convert_matches_reference);
+        RUN_TEST(test_measure_stages);
+        RUN_TEST(test_no_regression);
+    }
+    return UNITY_END();
+}
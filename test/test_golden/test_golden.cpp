@@ -0,0 +1,290 @@
+// The reference image through the firmware's draw paths into MockPanel:
+// drawImageFromSpiffs on RGB565 in each dither mode, BMP of every depth and
+// EPD3 files, and renderPendingLayout on a scene, each with the render
+// pipeline, writePanelBand's band cache and the panel frame of display.cpp
+// as on the device. Files come from the in-memory LittleFS of test/native.
+// Both planes of controller RAM are compared with the frames committed under
+// test/golden. The frames are PBM images as /api/panel/capture returns them,
+// so a device capture compares with cmp. After an intended change to a draw
+// path, rewrite them with
+//   UPDATE_GOLDEN=1 pio test -e native -f test_golden
+// and look at the new frames before committing them.
+#include <unity.h>
+#include "host_runtime.h"
+#include "reference_image.h"
+#include "display.h"
+#include "image_utils.h"
+#include "layout.h"
+#include "render_arena.h"
+#include "dither.h"
+#include <LittleFS.h>
+#include <string>
+
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "test"
+#endif
+
+#define GOLDEN_DIR TEST_DATA_DIR "/golden"
+
+static const size_t row_bytes = REFERENCE_WIDTH / 8;
+static const uint16_t panel_bands = (REFERENCE_HEIGHT + RENDER_BATCH_ROWS - 1) / RENDER_BATCH_ROWS;
+
+static std::vector<uint8_t> rgb565;
+static bool updateGolden = false;
+
+// A plane as /api/panel/capture returns it: PBM bits are set for black, panel RAM bits for white
+static std::vector<uint8_t> pbm(const uint8_t *plane) {
+    std::string header = "P4\n" + std::to_string(MockPanel::WIDTH) + " " + std::to_string(MockPanel::HEIGHT) + "\n";
+    std::vector<uint8_t> out(header.begin(), header.end());
+    for (size_t i = 0; i < MockPanel::PLANE_SIZE; i++) out.push_back(~plane[i]);
+    return out;
+}
+
+static std::vector<uint8_t> readFile(const std::string &path) {
+    std::vector<uint8_t> data;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return data;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) data.insert(data.end(), buffer, buffer + n);
+    fclose(f);
+    return data;
+}
+
+static void writeFile(const std::string &path, const std::vector<uint8_t> &data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    TEST_ASSERT_NOT_NULL_MESSAGE(f, ("Cannot write " + path).c_str());
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+// Compares a plane with its frame, or rewrites the frame with UPDATE_GOLDEN=1
+static void checkPlane(const std::string &frame, const char *planeName, const uint8_t *plane) {
+    std::string path = GOLDEN_DIR "/" + frame + "-" + planeName + ".pbm";
+    std::vector<uint8_t> actual = pbm(plane);
+    if (updateGolden) {
+        writeFile(path, actual);
+        TEST_MESSAGE(("Wrote " + path).c_str());
+        return;
+    }
+
+    std::vector<uint8_t> expected = readFile(path);
+    if (expected.empty()) {
+        TEST_FAIL_MESSAGE(("No golden frame " + path + ", write it with UPDATE_GOLDEN=1").c_str());
+    }
+    TEST_ASSERT_EQUAL_MESSAGE(expected.size(), actual.size(), ("Size differs from " + path).c_str());
+    size_t header = actual.size() - MockPanel::PLANE_SIZE;
+    size_t differing = 0;
+    size_t first = 0;
+    for (size_t i = header; i < actual.size(); i++) {
+        if (expected[i] == actual[i]) continue;
+        if (differing++ == 0) first = i - header;
+        differing += __builtin_popcount(expected[i] ^ actual[i]) - 1;
+    }
+    if (differing > 0) {
+        char line[160];
+        snprintf(line, sizeof(line), "%s: %u pixels differ, first in row %u", path.c_str(), (unsigned) differing,
+                 (unsigned) (first / row_bytes));
+        TEST_FAIL_MESSAGE(line);
+    }
+}
+
+// Controller RAM after a frame that was written and refreshed in full
+static void checkFrame(const std::string &frame) {
+    TEST_ASSERT_TRUE(lastPanelFrame.refreshed);
+    TEST_ASSERT_FALSE(lastPanelFrame.cancelled);
+    TEST_ASSERT_NOT_NULL(display.epd2.monoPlane());
+    TEST_ASSERT_NOT_NULL(display.epd2.colorPlane());
+    checkPlane(frame, "mono", display.epd2.monoPlane());
+    checkPlane(frame, "color", display.epd2.colorPlane());
+}
+
+static void storeFile(const char *name, const std::vector<uint8_t> &data) {
+    File file = LittleFS.open(String("/") + name, "w");
+    TEST_ASSERT_EQUAL_UINT32(data.size(), file.write(data.data(), data.size()));
+    file.close();
+}
+
+static void drawFile(const char *name, const std::vector<uint8_t> &data, DitherMode dither = DITHER_NONE) {
+    storeFile(name, data);
+    TEST_ASSERT_TRUE(drawImageFromSpiffs(name, REFERENCE_WIDTH, REFERENCE_HEIGHT, dither));
+}
+
+static void checkConverted(DitherMode dither) {
+    drawFile("reference.bin", rgb565, dither);
+    checkFrame(std::string("rgb565-") + ditherModeName(dither));
+}
+
+static void checkBmp(uint16_t depth, bool bitfields, const char *frame) {
+    drawFile("reference.bmp", referenceBmp(depth, bitfields));
+    checkFrame(frame);
+}
+
+// Planes of the undithered conversion, as an EPD3 file drawn back must reproduce them
+static std::vector<uint8_t> referencePanelImage(uint16_t bandRows, PanelEncoding encoding) {
+    Rgb565Converter converter;
+    TEST_ASSERT_TRUE(converter.begin(REFERENCE_WIDTH, DITHER_NONE));
+    std::vector<uint8_t> mono(row_bytes * REFERENCE_HEIGHT), color(row_bytes * REFERENCE_HEIGHT);
+    for (uint16_t y = 0; y < REFERENCE_HEIGHT; y += RENDER_BATCH_ROWS) {
+        converter.convertRows(rgb565.data() + (size_t) y * REFERENCE_WIDTH * 2, mono.data() + y * row_bytes,
+                              color.data() + y * row_bytes, RENDER_BATCH_ROWS);
+    }
+    return panelImage(mono, color, REFERENCE_WIDTH, REFERENCE_HEIGHT, bandRows, encoding);
+}
+
+// Black ring around a red disc on white, 48 x 40
+static std::vector<uint8_t> iconImage() {
+    const uint16_t width = 48, height = 40;
+    std::vector<uint8_t> mono(width / 8 * height, 0xFF), color(width / 8 * height, 0xFF);
+    for (uint16_t y = 0; y < height; y++) {
+        for (uint16_t x = 0; x < width; x++) {
+            int dx = x - width / 2, dy = y - height / 2;
+            int d2 = dx * dx + dy * dy;
+            uint8_t bit = 0x80 >> (x & 7);
+            size_t i = y * (width / 8) + x / 8;
+            if (d2 < 10 * 10) color[i] &= ~bit;
+            else if (d2 < 18 * 18) mono[i] &= ~bit;
+        }
+    }
+    return panelImage(mono, color, width, height, height, PANEL_ENCODING_PLANES);
+}
+
+// Shapes and icons only: the host has no font bitmaps (see test/native/Adafruit_GFX.h)
+static const char layout_scene[] =
+    "{\"background\": \"white\", \"elements\": ["
+    "{\"type\": \"rect\", \"x\": 0, \"y\": 0, \"w\": 640, \"h\": 40, \"color\": \"black\", \"fill\": true},"
+    "{\"type\": \"rect\", \"x\": 8, \"y\": 8, \"w\": 200, \"h\": 24, \"color\": \"red\", \"fill\": true},"
+    "{\"type\": \"line\", \"x0\": 0, \"y0\": 41, \"x1\": 639, \"y1\": 41, \"color\": \"red\"},"
+    "{\"type\": \"rect\", \"x\": 20, \"y\": 60, \"w\": 300, \"h\": 150, \"color\": \"black\"},"
+    "{\"type\": \"line\", \"x0\": 20, \"y0\": 60, \"x1\": 319, \"y1\": 209, \"color\": \"black\"},"
+    "{\"type\": \"line\", \"x0\": 20, \"y0\": 209, \"x1\": 319, \"y1\": 60, \"color\": \"red\"},"
+    "{\"type\": \"line\", \"x0\": 400, \"y0\": 50, \"x1\": 430, \"y1\": 370, \"color\": \"black\"},"
+    "{\"type\": \"rect\", \"x\": -30, \"y\": 250, \"w\": 100, \"h\": 200, \"color\": \"red\", \"fill\": true},"
+    "{\"type\": \"rect\", \"x\": 600, \"y\": 360, \"w\": 80, \"h\": 60, \"color\": \"black\", \"fill\": true},"
+    "{\"type\": \"icon\", \"x\": 480, \"y\": 70, \"path\": \"/icons/mark.epd3\"},"
+    "{\"type\": \"icon\", \"x\": 500, \"y\": 203, \"path\": \"icons/mark.epd3\"}"
+    "]}";
+
+void setUp() {
+    // Every frame starts from white, as a render with an unknown panel cache does
+    invalidatePanelCache();
+}
+
+void tearDown() {}
+
+void test_rgb565_none() {
+    checkConverted(DITHER_NONE);
+}
+
+void test_rgb565_bayer() {
+    checkConverted(DITHER_BAYER);
+}
+
+void test_rgb565_floyd_steinberg() {
+    checkConverted(DITHER_FLOYD_STEINBERG);
+}
+
+void test_rgb565_atkinson() {
+    checkConverted(DITHER_ATKINSON);
+}
+
+void test_bmp1() {
+    checkBmp(1, false, "bmp1");
+}
+
+void test_bmp2() {
+    checkBmp(2, false, "bmp2");
+}
+
+void test_bmp4() {
+    checkBmp(4, false, "bmp4");
+}
+
+void test_bmp8() {
+    checkBmp(8, false, "bmp8");
+}
+
+void test_bmp555() {
+    checkBmp(16, false, "bmp555");
+}
+
+void test_bmp565() {
+    checkBmp(16, true, "bmp565");
+}
+
+void test_bmp24() {
+    checkBmp(24, false, "bmp24");
+}
+
+void test_bmp32() {
+    checkBmp(32, false, "bmp32");
+}
+
+// Uncompressed planes in bands of the batch size: one read per band
+void test_epd3_planes() {
+    drawFile("reference.epd3", referencePanelImage(RENDER_BATCH_ROWS, PANEL_ENCODING_PLANES));
+    checkFrame("rgb565-none");
+}
+
+// Bands of 24 rows: batches split bands, so planes are read apart and bands written unaligned
+void test_epd3_planes_odd_bands() {
+    drawFile("reference.epd3", referencePanelImage(24, PANEL_ENCODING_PLANES));
+    checkFrame("rgb565-none");
+}
+
+void test_epd3_rle() {
+    drawFile("reference.epd3", referencePanelImage(RENDER_BATCH_ROWS, PANEL_ENCODING_RLE));
+    checkFrame("rgb565-none");
+}
+
+void test_layout_scene() {
+    storeFile("icons/mark.epd3", iconImage());
+    String error = setPendingLayout((const uint8_t *) layout_scene, strlen(layout_scene));
+    TEST_ASSERT_EQUAL_STRING("", error.c_str());
+    TEST_ASSERT_TRUE(renderPendingLayout());
+    TEST_ASSERT_EQUAL(11, lastLayoutStats().elements);
+    checkFrame("layout");
+}
+
+// The same image again: every band matches the cache, nothing is written or refreshed
+void test_unchanged_frame_skips_refresh() {
+    checkConverted(DITHER_NONE);
+    TEST_ASSERT_EQUAL(panel_bands, lastPanelFrame.bandsWritten);
+
+    uint32_t refreshes = display.epd2.calls(MOCK_OP_REFRESH);
+    TEST_ASSERT_TRUE(drawImageFromSpiffs("reference.bin", REFERENCE_WIDTH, REFERENCE_HEIGHT, DITHER_NONE));
+    TEST_ASSERT_EQUAL(0, lastPanelFrame.bandsWritten);
+    TEST_ASSERT_EQUAL(panel_bands, lastPanelFrame.bandsSkipped);
+    TEST_ASSERT_FALSE(lastPanelFrame.refreshed);
+    TEST_ASSERT_EQUAL_UINT32(refreshes, display.epd2.calls(MOCK_OP_REFRESH));
+    checkPlane("rgb565-none", "mono", display.epd2.monoPlane());
+    checkPlane("rgb565-none", "color", display.epd2.colorPlane());
+}
+
+int main(int argc, char **argv) {
+    const char *update = getenv("UPDATE_GOLDEN");
+    updateGolden = update && strcmp(update, "1") == 0;
+    rgb565 = referenceRgb565();
+    if (!initRenderArena()) return 1;
+    initPanel(0);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_rgb565_none);
+    RUN_TEST(test_rgb565_bayer);
+    RUN_TEST(test_rgb565_floyd_steinberg);
+    RUN_TEST(test_rgb565_atkinson);
+    RUN_TEST(test_bmp1);
+    RUN_TEST(test_bmp2);
+    RUN_TEST(test_bmp4);
+    RUN_TEST(test_bmp8);
+    RUN_TEST(test_bmp555);
+    RUN_TEST(test_bmp565);
+    RUN_TEST(test_bmp24);
+    RUN_TEST(test_bmp32);
+    RUN_TEST(test_epd3_planes);
+    RUN_TEST(test_epd3_planes_odd_bands);
+    RUN_TEST(test_epd3_rle);
+    RUN_TEST(test_layout_scene);
+    RUN_TEST(test_unchanged_frame_skips_refresh);
+    return UNITY_END();
+}
@@ -0,0 +1,120 @@
+// The batch index rings of the render pipeline under real threads: batches
+// circulate free -> read -> converted -> free between a reader, a converter
+// and a writer thread as they do between the pipeline's tasks, and every
+// batch must come out once, in order, with what the stage before wrote.
+// Worth running under -fsanitize=thread as well.
+#include <unity.h>
+#include "host_runtime.h"
+#include "batch_ring.h"
+#include "render_pipeline.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+typedef BatchRing<RENDER_PIPELINE_DEPTH + 1> PipelineRing;
+
+// Batches through the pipeline per stress run
+static const uint32_t stress_batches = 200000;
+
+struct StressBatch {
+    uint32_t sequence;  // written by the reader
+    uint32_t input;     // written by the reader
+    uint32_t output;    // written by the converter
+};
+
+static StressBatch batches[RENDER_PIPELINE_DEPTH];
+static PipelineRing freeRing;
+static PipelineRing readRing;
+static PipelineRing convertedRing;
+
+static uint32_t inputFor(uint32_t sequence) {
+    return sequence * 2654435761u;
+}
+
+static uint8_t take(PipelineRing &ring) {
+    uint8_t batch;
+    while (!ring.pop(batch)) std::this_thread::yield();
+    return batch;
+}
+
+void setUp() {
+    freeRing.reset();
+    readRing.reset();
+    convertedRing.reset();
+}
+
+void tearDown() {}
+
+void test_ring_is_fifo_and_reports_empty() {
+    uint8_t batch;
+    TEST_ASSERT_FALSE(freeRing.pop(batch));
+    // Wraps around several times, filled to capacity each time
+    for (int round = 0; round < 5; round++) {
+        for (uint8_t i = 0; i < RENDER_PIPELINE_DEPTH; i++) freeRing.push(round * 10 + i);
+        for (uint8_t i = 0; i < RENDER_PIPELINE_DEPTH; i++) {
+            TEST_ASSERT_TRUE(freeRing.pop(batch));
+            TEST_ASSERT_EQUAL(round * 10 + i, batch);
+        }
+        TEST_ASSERT_FALSE(freeRing.pop(batch));
+    }
+}
+
+void test_batches_circulate_in_order_across_threads() {
+    for (uint8_t i = 0; i < RENDER_PIPELINE_DEPTH; i++) freeRing.push(i);
+
+    std::atomic<uint32_t> errors(0);
+    std::vector<uint32_t> seen(RENDER_PIPELINE_DEPTH, 0);
+
+    std::thread reader([&] {
+        for (uint32_t sequence = 0; sequence < stress_batches; sequence++) {
+            uint8_t i = take(freeRing);
+            batches[i].sequence = sequence;
+            batches[i].input = inputFor(sequence);
+            readRing.push(i);
+        }
+    });
+    std::thread converter([&] {
+        for (uint32_t n = 0; n < stress_batches; n++) {
+            uint8_t i = take(readRing);
+            if (batches[i].input != inputFor(batches[i].sequence)) errors++;
+            batches[i].output = ~batches[i].input;
+            convertedRing.push(i);
+        }
+    });
+
+    // The writer is the calling task in the pipeline
+    for (uint32_t expected = 0; expected < stress_batches; expected++) {
+        uint8_t i = take(convertedRing);
+        if (i >= RENDER_PIPELINE_DEPTH || batches[i].sequence != expected ||
+            batches[i].output != ~inputFor(expected)) {
+            errors++;
+        } else {
+            seen[i]++;
+        }
+        freeRing.push(i);
+    }
+    reader.join();
+    converter.join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, errors.load());
+    // Nothing lost or duplicated: all batches are back in the free ring and the others are empty
+    uint8_t batch;
+    TEST_ASSERT_FALSE(readRing.pop(batch));
+    TEST_ASSERT_FALSE(convertedRing.pop(batch));
+    std::vector<bool> returned(RENDER_PIPELINE_DEPTH, false);
+    for (uint8_t n = 0; n < RENDER_PIPELINE_DEPTH; n++) {
+        TEST_ASSERT_TRUE(freeRing.pop(batch));
+        TEST_ASSERT_TRUE(batch < RENDER_PIPELINE_DEPTH && !returned[batch]);
+        returned[batch] = true;
+    }
+    TEST_ASSERT_FALSE(freeRing.pop(batch));
+    // Every batch did its share of the work
+    for (uint8_t i = 0; i < RENDER_PIPELINE_DEPTH; i++) TEST_ASSERT_TRUE(seen[i] > 0);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_ring_is_fifo_and_reports_empty);
+    RUN_TEST(test_batches_circulate_in_order_across_threads);
+    return UNITY_END();
+}
@@ -0,0 +1,132 @@
+// Upload chunk traces replayed into an in-memory file, once with a write per
+// chunk and once through a BlockWriter, as /api/bench?upload does on LittleFS.
+// The file's write log gives the flash programmed for each path; the block
+// writer must program each byte once, and both files must hold the upload.
+#include <unity.h>
+#include "host_runtime.h"
+#include "block_writer.h"
+#include "esp_rom_crc.h"
+#include <vector>
+
+// Bytes per replay, a whole number of blocks
+static const uint32_t replay_bytes = 256 * 1024;
+
+// The traces of /api/bench?upload: full TCP segments, and a mix of odd sizes
+static const uint16_t segment_chunks[] = {1436};
+static const uint16_t mixed_chunks[] = {1436, 536, 2872, 1072, 5744, 733, 64, 2920};
+
+struct ReplayTrace {
+    const char *name;
+    const uint16_t *sizes;
+    size_t count;
+};
+
+static const ReplayTrace traces[] = {
+    {"segments", segment_chunks, sizeof(segment_chunks) / sizeof(segment_chunks[0])},
+    {"mixed", mixed_chunks, sizeof(mixed_chunks) / sizeof(mixed_chunks[0])},
+};
+
+static std::vector<uint8_t> upload;
+
+// Same synthetic upload as the device benchmark
+static uint8_t uploadByte(uint32_t offset) {
+    return (offset * 31 + (offset >> 8)) & 0xFF;
+}
+
+// Flash programmed for the writes the file was handed
+static uint32_t programmedBytes(const File &file) {
+    uint32_t total = 0;
+    for (const fs::FileWrite &w : file.writes()) total += flashProgramBytes(w.offset, w.length);
+    return total;
+}
+
+// Writes the upload in chunks of `trace` (repeated), directly or through `writer`
+static bool replay(const ReplayTrace &trace, File &file, BlockWriter *writer) {
+    if (writer && !writer->begin(file)) return false;
+    uint32_t offset = 0;
+    for (size_t i = 0; offset < upload.size(); i++) {
+        size_t len = min((size_t) trace.sizes[i % trace.count], upload.size() - offset);
+        bool ok = writer ? writer->write(upload.data() + offset, len)
+                         : file.write(upload.data() + offset, len) == len;
+        if (!ok) return false;
+        offset += len;
+    }
+    return writer ? writer->flush() : true;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_program_bytes_count_whole_units() {
+    TEST_ASSERT_EQUAL_UINT32(0, flashProgramBytes(0, 0));
+    TEST_ASSERT_EQUAL_UINT32(FLASH_PROGRAM_SIZE, flashProgramBytes(0, 1));
+    TEST_ASSERT_EQUAL_UINT32(FLASH_PROGRAM_SIZE, flashProgramBytes(0, FLASH_PROGRAM_SIZE));
+    TEST_ASSERT_EQUAL_UINT32(2 * FLASH_PROGRAM_SIZE, flashProgramBytes(0, FLASH_PROGRAM_SIZE + 1));
+    TEST_ASSERT_EQUAL_UINT32(2 * FLASH_PROGRAM_SIZE, flashProgramBytes(FLASH_PROGRAM_SIZE - 1, 2));
+    TEST_ASSERT_EQUAL_UINT32(FLASH_PROGRAM_SIZE, flashProgramBytes(FLASH_PROGRAM_SIZE, FLASH_PROGRAM_SIZE));
+}
+
+void test_replayed_traces() {
+    uint32_t expectedCrc = esp_rom_crc32_le(0, upload.data(), upload.size());
+    char line[160];
+    for (const ReplayTrace &trace : traces) {
+        File direct = File::memory();
+        File coalesced = File::memory();
+        BlockWriter writer;
+        TEST_ASSERT_TRUE(replay(trace, direct, nullptr));
+        TEST_ASSERT_TRUE(replay(trace, coalesced, &writer));
+
+        // Both files hold the upload, and the writer counted and hashed every byte of it
+        TEST_ASSERT_EQUAL_UINT32(upload.size(), direct.size());
+        TEST_ASSERT_EQUAL_MEMORY(upload.data(), direct.bytes().data(), upload.size());
+        TEST_ASSERT_EQUAL_UINT32(upload.size(), coalesced.size());
+        TEST_ASSERT_EQUAL_MEMORY(upload.data(), coalesced.bytes().data(), upload.size());
+        TEST_ASSERT_EQUAL_UINT32(upload.size(), writer.bytesWritten());
+        TEST_ASSERT_EQUAL_UINT32(expectedCrc, writer.writtenCrc());
+
+        // Block-aligned writes program every byte once; the writer's own count agrees
+        uint32_t directProgrammed = programmedBytes(direct);
+        uint32_t coalescedProgrammed = programmedBytes(coalesced);
+        TEST_ASSERT_EQUAL_UINT32(writer.writeCalls(), coalesced.writes().size());
+        TEST_ASSERT_EQUAL_UINT32(coalescedProgrammed, writer.programmedBytes());
+        TEST_ASSERT_EQUAL_UINT32(upload.size(), coalescedProgrammed);
+        for (const fs::FileWrite &w : coalesced.writes()) {
+            TEST_ASSERT_EQUAL_UINT32(0, w.offset % UPLOAD_WRITE_BLOCK_SIZE);
+        }
+        TEST_ASSERT_GREATER_OR_EQUAL(coalescedProgrammed, directProgrammed);
+
+        snprintf(line, sizeof(line), "%-10s direct %5u writes, amplification %.3f; coalesced %4u writes, %.3f",
+                 trace.name, (unsigned) direct.writes().size(), (double) directProgrammed / upload.size(),
+                 (unsigned) coalesced.writes().size(), (double) coalescedProgrammed / upload.size());
+        TEST_MESSAGE(line);
+    }
+}
+
+void test_mixed_chunks_amplify_direct_writes() {
+    File direct = File::memory();
+    TEST_ASSERT_TRUE(replay(traces[1], direct, nullptr));
+    // Odd chunk sizes split program units between writes
+    TEST_ASSERT_TRUE(programmedBytes(direct) > upload.size());
+}
+
+void test_short_write_fails_with_what_was_stored() {
+    const long stored = UPLOAD_WRITE_BLOCK_SIZE + 904;
+    File file = File::memory();
+    file.limitWrites(stored);
+    BlockWriter writer;
+    TEST_ASSERT_FALSE(replay(traces[0], file, &writer));
+    TEST_ASSERT_FALSE(writer.ok());
+    TEST_ASSERT_EQUAL_UINT32(stored, writer.bytesWritten());
+    TEST_ASSERT_EQUAL_UINT32(esp_rom_crc32_le(0, upload.data(), stored), writer.writtenCrc());
+}
+
+int main(int argc, char **argv) {
+    upload.resize(replay_bytes);
+    for (uint32_t i = 0; i < replay_bytes; i++) upload[i] = uploadByte(i);
+    UNITY_BEGIN();
+    RUN_TEST(test_program_bytes_count_whole_units);
+    RUN_TEST(test_replayed_traces);
+    RUN_TEST(test_mixed_chunks_amplify_direct_writes);
+    RUN_TEST(test_short_write_fails_with_what_was_stored);
+    return UNITY_END();
+}
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Encode an image for the panel as packed EPD3 planes, run-length compressed by default.
+
+Input is a raw little-endian RGB565 file of the panel size (like image.bin), or
+any image Pillow can open, which is resized to the panel. Pixels are mapped to
+white, black and red with the same thresholds as the device (pixel_kernel.h).
+
+    python3 tools/epd3_encode.py weather.png weather.epd3
+    python3 tools/epd3_encode.py image.bin image.epd3 --raw
+    curl -X POST -F "file=@weather.epd3" http://esp32-ip/api/image/upload
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+WIDTH = 640
+HEIGHT = 384
+BAND_ROWS = 16  # RENDER_BATCH_ROWS
+
+WHITE_SUM = 384
+COLOR_LEVEL = 0xF0
+
+ENCODING_PLANES = 0
+ENCODING_RLE = 1
+
+WHITE, BLACK, COLOR = 0, 1, 2
+
+
+def classify565(p, white_sum=WHITE_SUM, color_level=COLOR_LEVEL):
+    r = (p & 0xF800) >> 8
+    g = (p & 0x07E0) >> 3
+    b = (p & 0x001F) << 3
+    if r + g + b > white_sum:
+        return WHITE
+    if r > color_level or (g > color_level and b > color_level):
+        return COLOR
+    return BLACK
+
+
+def load_pixels(path, width, height):
+    """Returns a list of RGB565 values, row by row."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) == width * height * 2:
+        return list(struct.unpack("<%dH" % (width * height), data))
+
+    try:
+        from PIL import Image
+    except ImportError:
+        sys.exit("%s is not a raw RGB565 image of %dx%d, and Pillow is not installed" % (path, width, height))
+    image = Image.open(path).convert("RGB").resize((width, height))
+    return [((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3) for r, g, b in image.getdata()]
+
+
+def to_planes(pixels, width, height):
+    """Mono and color planes as display.writeImage takes them (bit cleared = ink)."""
+    table = [classify565(p) for p in range(65536)]
+    row_bytes = width // 8
+    mono = bytearray(b"\xff" * (row_bytes * height))
+    color = bytearray(b"\xff" * (row_bytes * height))
+    for i, p in enumerate(pixels):
+        c = table[p]
+        if c == BLACK:
+            mono[i >> 3] &= ~(0x80 >> (i & 7))
+        elif c == COLOR:
+            color[i >> 3] &= ~(0x80 >> (i & 7))
+    return mono, color
+
+
+def band_layout(mono, color, width, height, band_rows):
+    """Uncompressed EPD3 data: per band, the mono rows followed by the color rows."""
+    row_bytes = width // 8
+    out = bytearray()
+    for y in range(0, height, band_rows):
+        start = y * row_bytes
+        end = min(y + band_rows, height) * row_bytes
+        out += mono[start:end]
+        out += color[start:end]
+    return bytes(out)
+
+
+def packbits_encode(data):
+    out = bytearray()
+    i = 0
+    n = len(data)
+    while i < n:
+        # Run of at least 3 equal bytes
+        run = 1
+        while i + run < n and run < 128 and data[i + run] == data[i]:
+            run += 1
+        if run >= 3:
+            out.append(257 - run)
+            out.append(data[i])
+            i += run
+            continue
+
+        # Literals up to the next run of 3
+        start = i
+        while i < n and i - start < 128:
+            if i + 2 < n and data[i] == data[i + 1] == data[i + 2]:
+                break
+            i += 1
+        out.append(i - start - 1)
+        out += data[start:i]
+    return bytes(out)
+
+
+def packbits_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        control = data[i]
+        i += 1
+        if control < 128:
+            out += data[i:i + control + 1]
+            i += control + 1
+        elif control > 128:
+            out += bytes([data[i]]) * (257 - control)
+            i += 1
+    return bytes(out)
+
+
+def header(encoding, width, height, band_rows, data_size):
+    return b"EPD3" + struct.pack("<BBHHHI", 1, encoding, width, height, band_rows, data_size)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="raw RGB565 file or any image Pillow can open")
+    parser.add_argument("output", help="EPD3 file to write")
+    parser.add_argument("--raw", action="store_true", help="write uncompressed planes")
+    parser.add_argument("--width", type=int, default=WIDTH)
+    parser.add_argument("--height", type=int, default=HEIGHT)
+    parser.add_argument("--band-rows", type=int, default=BAND_ROWS)
+    args = parser.parse_args()
+
+    if args.width % 8:
+        sys.exit("width must be a multiple of 8")
+
+    pixels = load_pixels(args.input, args.width, args.height)
+    mono, color = to_planes(pixels, args.width, args.height)
+    planes = band_layout(mono, color, args.width, args.height, args.band_rows)
+
+    if args.raw:
+        data = planes
+        encoding = ENCODING_PLANES
+    else:
+        t0 = time.perf_counter()
+        data = packbits_encode(planes)
+        encode_ms = (time.perf_counter() - t0) * 1000
+        if packbits_decode(data) != planes:
+            sys.exit("internal error: run-length round trip failed")
+        encoding = ENCODING_RLE
+        print("encoded in %.1f ms" % encode_ms)
+
+    with open(args.output, "wb") as f:
+        f.write(header(encoding, args.width, args.height, args.band_rows, len(data)))
+        f.write(data)
+
+    rgb565_size = args.width * args.height * 2
+    print("%s: %d bytes (planes %d bytes, %.1fx; RGB565 %d bytes, %.1fx)" % (
+        args.output, len(data) + 16, len(planes), len(planes) / len(data),
+        rgb565_size, rgb565_size / (len(data) + 16)))
+
+
+if __name__ == "__main__":
+    main()
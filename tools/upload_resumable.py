@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Upload an image through a resumable upload session, sending only what is missing.
+
+Opens (or reopens) the session for the file, PUTs every chunk the device does
+not have yet with its CRC-32, retrying failed chunks, and finalizes it. Run it
+again after a dropped connection or a reboot and it picks up where it stopped.
+
+    python3 tools/upload_resumable.py esp32-ip weather.epd3 --slot weather
+"""
+
+import argparse
+import json
+import sys
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+import zlib
+
+
+def request(method, url, data=None, headers=None, timeout=30):
+    req = urllib.request.Request(url, data=data, method=method, headers=headers or {})
+    try:
+        with urllib.request.urlopen(req, timeout=timeout) as resp:
+            return resp.status, resp.read(), dict(resp.headers)
+    except urllib.error.HTTPError as e:
+        return e.code, e.read(), dict(e.headers)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("file")
+    parser.add_argument("--slot", default="default")
+    parser.add_argument("--dither")
+    parser.add_argument("--noselect", action="store_true")
+    parser.add_argument("--retries", type=int, default=5)
+    args = parser.parse_args()
+
+    data = open(args.file, "rb").read()
+    base = "http://%s/api/upload" % args.host
+    params = {"size": len(data), "crc": "%08x" % zlib.crc32(data), "slot": args.slot}
+    if args.dither:
+        params["dither"] = args.dither
+    if args.noselect:
+        params["noselect"] = ""
+
+    status, body, _ = request("POST", base + "/session?" + urllib.parse.urlencode(params))
+    if status not in (200, 201):
+        sys.exit("open failed: %d %s" % (status, body.decode(errors="replace")))
+    session = json.loads(body)
+    sid, chunk = session["id"], session["chunkSize"]
+    missing = [(s, e) for s, e in session["missing"]]
+    todo = sum(e - s for s, e in missing)
+    print("session %s: %s, %d of %d bytes to send" % (sid, "resumed" if status == 200 else "new", todo, len(data)))
+
+    start = time.time()
+    for range_start, range_end in missing:
+        for offset in range(range_start, range_end, chunk):
+            part = data[offset:min(offset + chunk, len(data))]
+            headers = {"X-Chunk-CRC32": "%08x" % zlib.crc32(part), "Content-Type": "application/octet-stream"}
+            url = "%s/chunk?id=%s&offset=%d" % (base, sid, offset)
+            for attempt in range(args.retries):
+                try:
+                    status, body, _ = request("PUT", url, part, headers)
+                except OSError as e:
+                    status, body = 0, str(e).encode()
+                if status == 200:
+                    break
+                print("chunk at %d: %d %s, retrying" % (offset, status, body.decode(errors="replace")))
+                time.sleep(1 + attempt)
+            else:
+                sys.exit("giving up at offset %d; run again to resume" % offset)
+
+    status, body, headers = request("POST", "%s/finalize?id=%s" % (base, sid), timeout=60)
+    if status != 200:
+        sys.exit("finalize failed: %d %s" % (status, body.decode(errors="replace")))
+    print("%s in %.1f s, ETag %s, job %s" % (body.decode(), time.time() - start, headers.get("ETag"),
+                                             headers.get("X-Render-Job", "-")))
+
+
+if __name__ == "__main__":
+    main()